@@ -107,6 +107,7 @@ struct ne_session_s {
     void *notify_ud;
 
     int rdtimeout, cotimeout; /* read, connect timeouts. */
+    size_t rdbufsize; /* socket read buffer size, or zero for default. */
 
     struct hook *create_req_hooks, *pre_send_hooks, *post_send_hooks,
         *post_headers_hooks, *destroy_req_hooks, *destroy_sess_hooks, 
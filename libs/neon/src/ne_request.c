@@ -1474,10 +1474,19 @@ int ne_end_request(ne_request *req)
 int ne_read_response_to_fd(ne_request *req, int fd)
 {
     ssize_t len;
+    char *buffer = req->respbuf;
+    size_t buflen = sizeof req->respbuf;
+
+    /* Read blocks as large as the socket read buffer, so that the
+     * body bypasses the buffer and is read in as few calls as
+     * possible. */
+    if (req->session->rdbufsize > buflen) {
+        buflen = req->session->rdbufsize;
+        buffer = ne_malloc(buflen);
+    }
 
-    while ((len = ne_read_response_block(req, req->respbuf, 
-                                         sizeof req->respbuf)) > 0) {
-        const char *block = req->respbuf;
+    while ((len = ne_read_response_block(req, buffer, buflen)) > 0) {
+        const char *block = buffer;
 
         do {
             ssize_t ret = write(fd, block, len);
@@ -1488,6 +1497,8 @@ int ne_read_response_to_fd(ne_request *req, int fd)
                 ne_strerror(errno, err, sizeof err);
                 ne_set_error(ne_get_session(req), 
                              _("Could not write to file: %s"), err);
+                if (buffer != req->respbuf)
+                    ne_free(buffer);
                 return NE_ERROR;
             } else {
                 len -= ret;
@@ -1495,6 +1506,9 @@ int ne_read_response_to_fd(ne_request *req, int fd)
             }
         } while (len > 0);
     }
+
+    if (buffer != req->respbuf)
+        ne_free(buffer);
     
     return len == 0 ? NE_OK : NE_ERROR;
 }
@@ -1647,6 +1661,9 @@ static int do_connect(ne_session *sess, struct host_info *host)
     if (sess->rdtimeout)
 	ne_sock_read_timeout(sess->socket, sess->rdtimeout);
 
+    if (sess->rdbufsize)
+        ne_sock_read_buffer(sess->socket, sess->rdbufsize);
+
     notify_status(sess, ne_status_connected);
     sess->nexthop = host;
 
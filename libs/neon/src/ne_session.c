@@ -423,6 +423,13 @@ void ne_set_connect_timeout(ne_session *sess, int timeout)
     sess->cotimeout = timeout;
 }
 
+void ne_set_read_buffer_size(ne_session *sess, size_t size)
+{
+    sess->rdbufsize = size;
+    if (sess->connected && size)
+        ne_sock_read_buffer(sess->socket, size);
+}
+
 #define UAHDR "User-Agent: "
 #define AGENT " neon/" NEON_VERSION "\r\n"
 
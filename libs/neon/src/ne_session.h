@@ -309,6 +309,12 @@ void ne_set_read_timeout(ne_session *sess, int timeout);
  * timeout value must be greater than zero. */
 void ne_set_connect_timeout(ne_session *sess, int timeout);
 
+/* Set the size (in bytes) of the read buffer used for connections
+ * made by the session.  Response body reads of at least this size go
+ * directly into the caller's buffer.  A size of zero selects the
+ * default. */
+void ne_set_read_buffer_size(ne_session *sess, size_t size);
+
 /* Sets the user-agent string. neon/VERSION will be appended, to make
  * the full header "User-Agent: product neon/VERSION".
  * If this function is not called, the User-Agent header is not sent.
@@ -215,11 +215,14 @@ struct ne_socket_s {
      * these are consumed and passed back to the caller, bufpos
      * advances through ->buffer.  ->bufavail gives the number of
      * bytes which remain to be consumed in ->buffer (from ->bufpos),
-     * and is hence always <= RDBUFSIZ. */
+     * and is hence always <= ->bufsize.  ->buffer points either at
+     * ->inlinebuf or at a heap buffer set by ne_sock_read_buffer. */
     char *bufpos;
     size_t bufavail;
+    char *buffer;
+    size_t bufsize;
 #define RDBUFSIZ 4096
-    char buffer[RDBUFSIZ];
+    char inlinebuf[RDBUFSIZ];
     /* Error string. */
     char error[192];
 };
@@ -458,12 +461,13 @@ ssize_t ne_sock_read(ne_socket *sock, char *buffer, size_t buflen)
 	sock->bufpos += buflen;
 	sock->bufavail -= buflen;
 	return (ssize_t)buflen;
-    } else if (buflen >= sizeof sock->buffer) {
-	/* No need for read buffer. */
+    } else if (buflen >= sock->bufsize) {
+	/* No need for read buffer: read straight into the caller's
+	 * buffer, saving a copy. */
 	return sock->ops->sread(sock, buffer, buflen);
     } else {
 	/* Fill read buffer. */
-	bytes = sock->ops->sread(sock, sock->buffer, sizeof sock->buffer);
+	bytes = sock->ops->sread(sock, sock->buffer, sock->bufsize);
 	if (bytes <= 0)
 	    return bytes;
 
@@ -485,7 +489,7 @@ ssize_t ne_sock_peek(ne_socket *sock, char *buffer, size_t buflen)
 	bytes = (ssize_t)sock->bufavail;
     } else {
 	/* fill the buffer. */
-	bytes = sock->ops->sread(sock, sock->buffer, sizeof sock->buffer);
+	bytes = sock->ops->sread(sock, sock->buffer, sock->bufsize);
 	if (bytes <= 0)
 	    return bytes;
 
@@ -853,7 +857,7 @@ ssize_t ne_sock_readline(ne_socket *sock, char *buf, size_t buflen)
     size_t len;
     
     if ((lf = memchr(sock->bufpos, '\n', sock->bufavail)) == NULL
-	&& sock->bufavail < RDBUFSIZ) {
+	&& sock->bufavail < sock->bufsize) {
 	/* The buffered data does not contain a complete line: move it
 	 * to the beginning of the buffer. */
 	if (sock->bufavail)
@@ -865,11 +869,11 @@ ssize_t ne_sock_readline(ne_socket *sock, char *buf, size_t buflen)
 	do {
 	    /* Read more data onto end of buffer. */
 	    ssize_t ret = sock->ops->sread(sock, sock->buffer + sock->bufavail,
-                                           RDBUFSIZ - sock->bufavail);
+                                           sock->bufsize - sock->bufavail);
 	    if (ret < 0) return ret;
 	    sock->bufavail += ret;
 	} while ((lf = memchr(sock->buffer, '\n', sock->bufavail)) == NULL
-		 && sock->bufavail < RDBUFSIZ);
+		 && sock->bufavail < sock->bufsize);
     }
 
     if (lf)
@@ -1326,6 +1330,8 @@ ne_socket *ne_sock_create(void)
     ne_socket *sock = ne_calloc(sizeof *sock);
     sock->rdtimeout = SOCKET_READ_TIMEOUT;
     sock->cotimeout = 0;
+    sock->buffer = sock->inlinebuf;
+    sock->bufsize = sizeof sock->inlinebuf;
     sock->bufpos = sock->buffer;
     sock->ops = &iofns_raw;
     sock->fd = -1;
@@ -1645,6 +1651,26 @@ void ne_sock_connect_timeout(ne_socket *sock, int timeout)
     sock->cotimeout = timeout;
 }
 
+void ne_sock_read_buffer(ne_socket *sock, size_t size)
+{
+    char *buffer;
+
+    if (size < sizeof sock->inlinebuf)
+        size = sizeof sock->inlinebuf;
+    /* Never drop data which is already buffered. */
+    if (size < sock->bufavail || size == sock->bufsize)
+        return;
+
+    buffer = size == sizeof sock->inlinebuf ? sock->inlinebuf : ne_malloc(size);
+    if (sock->bufavail)
+        memmove(buffer, sock->bufpos, sock->bufavail);
+    if (sock->buffer != sock->inlinebuf)
+        ne_free(sock->buffer);
+    sock->buffer = buffer;
+    sock->bufsize = size;
+    sock->bufpos = buffer;
+}
+
 #ifdef NE_HAVE_SSL
 
 #ifdef HAVE_GNUTLS
@@ -1966,6 +1992,8 @@ int ne_sock_close(ne_socket *sock)
         ret = 0;
     else
         ret = ne_close(sock->fd);
+    if (sock->buffer != sock->inlinebuf)
+        ne_free(sock->buffer);
     ne_free(sock);
     return ret;
 }
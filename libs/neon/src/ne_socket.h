@@ -250,6 +250,12 @@ void ne_sock_read_timeout(ne_socket *sock, int timeout);
  * connect call will only timeout as dictated by the TCP stack. */
 void ne_sock_connect_timeout(ne_socket *sock, int timeout);
 
+/* Set the size of the read buffer for socket, in bytes.  Reads of at
+ * least 'size' bytes bypass the buffer and go directly into the
+ * caller's buffer.  Any data already buffered is preserved; sizes
+ * smaller than the default of 4096 bytes are rounded up. */
+void ne_sock_read_buffer(ne_socket *sock, size_t size);
+
 /* Negotiate an SSL connection on socket as an SSL server, using given
  * SSL context. */
 int ne_sock_accept_ssl(ne_socket *sock, ne_ssl_context *ctx);
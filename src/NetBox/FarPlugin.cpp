@@ -1929,18 +1929,36 @@ intptr_t TCustomFarFileSystem::GetFindData(
   struct PluginPanelItem **PanelItem, int *ItemsNumber, int OpMode)
 {
   ResetCachedInfo();
-  std::unique_ptr<TObjectList> PanelItems(new TObjectList());
-  bool Result = !FClosed && GetFindDataEx(PanelItems.get(), OpMode);
-  if (Result && PanelItems->GetCount())
+  std::unique_ptr<TFarFindDataArena> Arena(new TFarFindDataArena());
+  PluginPanelItem *Items = nullptr;
+  intptr_t Count = 0;
+  bool Result = false;
+  if (!FClosed)
   {
-    *PanelItem = nb::calloc<PluginPanelItem *>(PanelItems->GetCount(), sizeof(PluginPanelItem));
-    *ItemsNumber = ToInt(PanelItems->GetCount());
-    for (intptr_t Index = 0; Index < PanelItems->GetCount(); ++Index)
+    Result = GetFindDataDirect(Arena.get(), Items, Count, OpMode);
+    if (!Result)
     {
-      PanelItems->GetAs<TCustomFarPanelItem>(Index)->FillPanelItem(
-        &((*PanelItem)[Index]));
+      std::unique_ptr<TObjectList> PanelItems(new TObjectList());
+      Result = GetFindDataEx(PanelItems.get(), OpMode);
+      if (Result && PanelItems->GetCount())
+      {
+        Count = PanelItems->GetCount();
+        Items = Arena->AllocateItems(Count);
+        for (intptr_t Index = 0; Index < Count; ++Index)
+        {
+          PanelItems->GetAs<TCustomFarPanelItem>(Index)->FillPanelItem(
+            &Items[Index], Arena.get());
+        }
+      }
     }
   }
+  if (Result && (Count > 0))
+  {
+    *PanelItem = Items;
+    *ItemsNumber = ToInt(Count);
+    // owned by the items now, until FreeFindData
+    Arena.release();
+  }
   else
   {
     *PanelItem = nullptr;
@@ -1950,6 +1968,12 @@ intptr_t TCustomFarFileSystem::GetFindData(
   return Result;
 }
 
+bool TCustomFarFileSystem::GetFindDataDirect(TFarFindDataArena * /*Arena*/,
+  PluginPanelItem *& /*PanelItem*/, intptr_t & /*ItemsNumber*/, int /*OpMode*/)
+{
+  return false;
+}
+
 void TCustomFarFileSystem::FreeFindData(
   struct PluginPanelItem *PanelItem, intptr_t ItemsNumber)
 {
@@ -1957,18 +1981,9 @@ void TCustomFarFileSystem::FreeFindData(
   if (PanelItem)
   {
     DebugAssert(ItemsNumber > 0);
-    for (intptr_t Index = 0; Index < ItemsNumber; ++Index)
-    {
-      nb_free(PanelItem[Index].FindData.lpwszFileName);
-      nb_free(PanelItem[Index].Description);
-      nb_free(PanelItem[Index].Owner);
-      for (intptr_t CustomIndex = 0; CustomIndex < PanelItem[Index].CustomColumnNumber; ++CustomIndex)
-      {
-        nb_free(PanelItem[Index].CustomColumnData[CustomIndex]);
-      }
-      nb_free(PanelItem[Index].CustomColumnData);
-    }
-    nb_free(PanelItem);
+    // all strings and arrays live in the arena
+    TFarFindDataArena *Arena = TFarFindDataArena::FromItems(PanelItem);
+    delete Arena;
   }
 }
 
@@ -2412,9 +2427,10 @@ UnicodeString TCustomFarPanelItem::GetCustomColumnData(size_t /*Column*/)
   return L"";
 }
 
-void TCustomFarPanelItem::FillPanelItem(struct PluginPanelItem *PanelItem)
+void TCustomFarPanelItem::FillPanelItem(struct PluginPanelItem *PanelItem, TFarFindDataArena *Arena)
 {
   DebugAssert(PanelItem);
+  DebugAssert(Arena);
 
   UnicodeString FileName;
   int64_t Size = 0;
@@ -2435,18 +2451,91 @@ void TCustomFarPanelItem::FillPanelItem(struct PluginPanelItem *PanelItem)
   PanelItem->FindData.ftLastWriteTime = FileTime;
   PanelItem->FindData.nFileSize = Size;
 
-  PanelItem->FindData.lpwszFileName = TCustomFarPlugin::DuplicateStr(FileName);
-  PanelItem->Description = TCustomFarPlugin::DuplicateStr(Description);
-  PanelItem->Owner = TCustomFarPlugin::DuplicateStr(Owner);
-  wchar_t **CustomColumnData = nb::calloc<wchar_t **>(1 + PanelItem->CustomColumnNumber, sizeof(wchar_t *));
+  PanelItem->FindData.lpwszFileName = Arena->DuplicateStr(FileName);
+  PanelItem->Description = Arena->DuplicateStr(Description);
+  PanelItem->Owner = Arena->DuplicateStr(Owner);
+  const size_t ColumnDataSize = (1 + PanelItem->CustomColumnNumber) * sizeof(wchar_t *);
+  wchar_t **CustomColumnData = static_cast<wchar_t **>(Arena->Allocate(ColumnDataSize));
+  memset(CustomColumnData, 0, ColumnDataSize);
   for (intptr_t Index = 0; Index < PanelItem->CustomColumnNumber; ++Index)
   {
     CustomColumnData[Index] =
-      TCustomFarPlugin::DuplicateStr(GetCustomColumnData(Index));
+      Arena->DuplicateStr(GetCustomColumnData(Index));
   }
   PanelItem->CustomColumnData = CustomColumnData;
 }
 
+TFarFindDataArena::TFarFindDataArena() :
+  FChunks(nullptr),
+  FPos(nullptr),
+  FEnd(nullptr)
+{
+}
+
+TFarFindDataArena::~TFarFindDataArena()
+{
+  while (FChunks != nullptr)
+  {
+    TChunk *Chunk = FChunks;
+    FChunks = Chunk->Next;
+    nb_free(Chunk);
+  }
+}
+
+void *TFarFindDataArena::Allocate(size_t Size)
+{
+  Size = (Size + Alignment - 1) & ~static_cast<size_t>(Alignment - 1);
+  if ((FPos == nullptr) || (static_cast<size_t>(FEnd - FPos) < Size))
+  {
+    // header is padded to keep the payload aligned
+    const size_t HeaderSize = (sizeof(TChunk) + Alignment - 1) & ~static_cast<size_t>(Alignment - 1);
+    const size_t DataSize = (Size > ChunkSize) ? Size : ChunkSize;
+    TChunk *Chunk = static_cast<TChunk *>(nb_malloc_uninit(HeaderSize + DataSize));
+    if (Chunk == nullptr)
+    {
+      throw std::bad_alloc();
+    }
+    Chunk->Next = FChunks;
+    FChunks = Chunk;
+    FPos = reinterpret_cast<uint8_t *>(Chunk) + HeaderSize;
+    FEnd = FPos + DataSize;
+  }
+  void *Result = FPos;
+  FPos += Size;
+  return Result;
+}
+
+PluginPanelItem *TFarFindDataArena::AllocateItems(intptr_t Count)
+{
+  DebugAssert(Count > 0);
+  // the arena pointer precedes the array, so FreeFindData can find it
+  const size_t ItemsSize = Count * sizeof(PluginPanelItem);
+  uint8_t *Block = static_cast<uint8_t *>(Allocate(Alignment + ItemsSize));
+  *reinterpret_cast<TFarFindDataArena **>(Block) = this;
+  PluginPanelItem *Result = reinterpret_cast<PluginPanelItem *>(Block + Alignment);
+  memset(Result, 0, ItemsSize);
+  return Result;
+}
+
+TFarFindDataArena *TFarFindDataArena::FromItems(PluginPanelItem *PanelItem)
+{
+  uint8_t *Block = reinterpret_cast<uint8_t *>(PanelItem) - Alignment;
+  return *reinterpret_cast<TFarFindDataArena **>(Block);
+}
+
+wchar_t *TFarFindDataArena::DuplicateStr(UnicodeString Str)
+{
+  // same semantics as TCustomFarPlugin::DuplicateStr
+  if (Str.IsEmpty())
+  {
+    return nullptr;
+  }
+  const size_t sz = Str.Length() + 1;
+  wchar_t *Result = static_cast<wchar_t *>(Allocate(sz * sizeof(wchar_t)));
+  memmove(Result, Str.c_str(), sz * sizeof(wchar_t));
+  return Result;
+}
+
 TFarPanelItem::TFarPanelItem(PluginPanelItem *APanelItem, bool OwnsItem) :
   TCustomFarPanelItem(OBJECT_CLASS_TFarPanelItem),
   FPanelItem(APanelItem),
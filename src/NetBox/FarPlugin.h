@@ -9,6 +9,7 @@
 #include <Common.h>
 
 class TCustomFarFileSystem;
+class TFarFindDataArena;
 class TFarPanelModes;
 class TFarKeyBarTitles;
 class TFarPanelInfo;
@@ -247,6 +248,34 @@ private:
   void CloseFileSystem(TCustomFarFileSystem *FileSystem);
 };
 
+// Bump allocator holding the panel items and all their strings
+// for one GetFindData call, released at once in FreeFindData
+class TFarFindDataArena
+{
+  NB_DISABLE_COPY(TFarFindDataArena)
+public:
+  TFarFindDataArena();
+  ~TFarFindDataArena();
+
+  PluginPanelItem *AllocateItems(intptr_t Count);
+  static TFarFindDataArena *FromItems(PluginPanelItem *PanelItem);
+  void *Allocate(size_t Size);
+  wchar_t *DuplicateStr(UnicodeString Str);
+
+private:
+  struct TChunk
+  {
+    TChunk *Next;
+  };
+
+  TChunk *FChunks;
+  uint8_t *FPos;
+  uint8_t *FEnd;
+
+  enum { ChunkSize = 64 * 1024 };
+  enum { Alignment = 16 };
+};
+
 class TCustomFarFileSystem : public TObject
 {
   friend class TFarPanelInfo;
@@ -291,6 +320,10 @@ protected:
     int &StartSortMode, bool &StartSortOrder, TFarKeyBarTitles *KeyBarTitles,
     UnicodeString &ShortcutData) = 0;
   virtual bool GetFindDataEx(TObjectList *PanelItems, int OpMode) = 0;
+  // Fills panel items directly into the arena, without intermediate
+  // panel item objects; returns false to fall back to GetFindDataEx
+  virtual bool GetFindDataDirect(TFarFindDataArena *Arena,
+    PluginPanelItem *&PanelItem, intptr_t &ItemsNumber, int OpMode);
   virtual bool ProcessHostFileEx(TObjectList *PanelItems, int OpMode);
   virtual bool ProcessKeyEx(intptr_t Key, uintptr_t ControlState);
   virtual bool ProcessEventEx(intptr_t Event, void *Param);
@@ -407,7 +440,7 @@ protected:
     UnicodeString &Owner, void *&UserData, int &CustomColumnNumber) = 0;
   virtual UnicodeString GetCustomColumnData(size_t Column);
 
-  void FillPanelItem(struct PluginPanelItem *PanelItem);
+  void FillPanelItem(struct PluginPanelItem *PanelItem, TFarFindDataArena *Arena);
 };
 
 class TFarPanelItem : public TCustomFarPanelItem
@@ -243,8 +243,17 @@ BOOL WINAPI DllMain(HINSTANCE HInstance, DWORD Reason, LPVOID /*ptr*/ )
       Result = DllProcessAttach(HInstance);
       break;
 
+    case DLL_THREAD_DETACH:
+#ifdef USE_DLMALLOC
+      nb_cache_release_thread();
+#endif
+      break;
+
     case DLL_PROCESS_DETACH:
       Result = DllProcessDetach();
+#ifdef USE_DLMALLOC
+      nb_cache_release_thread();
+#endif
       break;
   }
   return Result;
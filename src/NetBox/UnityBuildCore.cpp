@@ -25,6 +25,8 @@
 #include "../base/Global.cpp"
 #include "../base/System.SyncObjs.cpp"
 #include "../base/FormatUtils.cpp"
+#include "../base/BandwidthScheduler.cpp"
+#include "../base/AsyncFileStream.cpp"
 
 #include "../core/RemoteFiles.cpp"
 #include "../core/Terminal.cpp"
@@ -54,6 +56,10 @@
 
 #include "../core/Http.cpp"
 #include "../core/NeonIntf.cpp"
+#include "../core/ProtocolTrace.cpp"
+#include "../core/SessionStatistics.cpp"
+#include "../core/FileHasher.cpp"
+#include "../core/LocalTreeWalker.cpp"
 #include "../windows/SynchronizeController.cpp"
 #include "../windows/GUITools.cpp"
 #include "../windows/GUIConfiguration.cpp"
@@ -61,5 +67,6 @@
 #include "../windows/ProgParams.cpp"
 #include "../windows/UserInterface.cpp"
 #include "../windows/WinInterface.cpp"
+#include "../windows/DiscMon.cpp"
 
 #include <disable_warnings_in_std_end.hpp>
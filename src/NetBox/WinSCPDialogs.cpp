@@ -468,7 +468,7 @@ bool TWinSCPPlugin::LoggingConfigurationDialog()
   std::unique_ptr<TWinSCPDialog> DialogPtr(new TWinSCPDialog(this));
   TWinSCPDialog *Dialog = DialogPtr.get();
 
-  Dialog->SetSize(TPoint(65, 15));
+  Dialog->SetSize(TPoint(65, 17));
   Dialog->SetCaption(FORMAT("%s - %s",
       GetMsg(NB_PLUGIN_TITLE), ::StripHotkey(GetMsg(NB_CONFIG_LOGGING))));
 
@@ -523,6 +523,35 @@ bool TWinSCPPlugin::LoggingConfigurationDialog()
   LogFileOverwriteButton->SetCaption(GetMsg(NB_LOGGING_LOG_FILE_OVERWRITE));
   LogFileOverwriteButton->SetEnabledDependency(LogToFileCheck);
 
+  Dialog->SetNextItemPosition(ipNewLine);
+
+  TFarCheckBox *LogProtocolTraceCheck = new TFarCheckBox(Dialog);
+  LogProtocolTraceCheck->SetCaption(GetMsg(NB_LOGGING_LOG_PROTOCOL_TRACE));
+  LogProtocolTraceCheck->SetEnabledDependency(LogToFileCheck);
+
+  Text = new TFarText(Dialog);
+  Text->SetCaption(GetMsg(NB_LOGGING_DOWNLOAD_CHECKSUM));
+  Text->SetEnabledDependency(LoggingCheck);
+
+  Dialog->SetNextItemPosition(ipRight);
+
+  TFarComboBox *DownloadChecksumCombo = new TFarComboBox(Dialog);
+  DownloadChecksumCombo->SetDropDownList(true);
+  DownloadChecksumCombo->SetWidth(10);
+  DownloadChecksumCombo->GetItems()->Add(GetMsg(NB_LOGGING_DOWNLOAD_CHECKSUM_OFF));
+  const UnicodeString DownloadChecksumAlgs[] =
+  {
+    Md5ChecksumAlg, Sha1ChecksumAlg, Sha256ChecksumAlg, Sha512ChecksumAlg,
+    Crc32ChecksumAlg, Xxh64ChecksumAlg,
+  };
+  for (intptr_t Index = 0; Index < static_cast<intptr_t>(_countof(DownloadChecksumAlgs)); ++Index)
+  {
+    DownloadChecksumCombo->GetItems()->Add(DownloadChecksumAlgs[Index]);
+  }
+  DownloadChecksumCombo->SetEnabledDependency(LoggingCheck);
+
+  Dialog->SetNextItemPosition(ipNewLine);
+
   Dialog->AddStandardButtons();
 
   LoggingCheck->SetChecked(GetConfiguration()->GetLogging());
@@ -534,6 +563,15 @@ bool TWinSCPPlugin::LoggingConfigurationDialog()
     GetConfiguration()->GetLogFileName());
   LogFileAppendButton->SetChecked(GetConfiguration()->GetLogFileAppend());
   LogFileOverwriteButton->SetChecked(!GetConfiguration()->GetLogFileAppend());
+  LogProtocolTraceCheck->SetChecked(GetConfiguration()->GetLogProtocolTrace());
+  DownloadChecksumCombo->SetItemIndex(0);
+  for (intptr_t Index = 0; Index < static_cast<intptr_t>(_countof(DownloadChecksumAlgs)); ++Index)
+  {
+    if (::SameText(DownloadChecksumAlgs[Index], GetConfiguration()->GetDownloadChecksumAlg()))
+    {
+      DownloadChecksumCombo->SetItemIndex(Index + 1);
+    }
+  }
 
   bool Result = (Dialog->ShowModal() == brOK);
 
@@ -552,6 +590,10 @@ bool TWinSCPPlugin::LoggingConfigurationDialog()
       GetConfiguration()->SetLogFileName(LogFileNameEdit->GetText());
     }
     GetConfiguration()->SetLogFileAppend(LogFileAppendButton->GetChecked());
+    GetConfiguration()->SetLogProtocolTrace(LogProtocolTraceCheck->GetChecked());
+    intptr_t ChecksumIndex = DownloadChecksumCombo->GetItemIndex();
+    GetConfiguration()->SetDownloadChecksumAlg(
+      (ChecksumIndex > 0) ? DownloadChecksumAlgs[ChecksumIndex - 1] : UnicodeString());
   }
   return Result;
 }
@@ -699,12 +741,18 @@ bool TWinSCPPlugin::EnduranceConfigurationDialog()
   return Result;
 }
 
+static intptr_t BandwidthLimitFromKB(intptr_t KB)
+{
+  // the bandwidth schedulers count in LONG
+  return static_cast<intptr_t>(std::min<int64_t>(static_cast<int64_t>(KB) * 1024, MAXLONG));
+}
+
 bool TWinSCPPlugin::QueueConfigurationDialog()
 {
   std::unique_ptr<TWinSCPDialog> DialogPtr(new TWinSCPDialog(this));
   TWinSCPDialog *Dialog = DialogPtr.get();
 
-  Dialog->SetSize(TPoint(76, 11));
+  Dialog->SetSize(TPoint(76, 14));
   Dialog->SetCaption(FORMAT("%s - %s",
       GetMsg(NB_PLUGIN_TITLE), ::StripHotkey(GetMsg(NB_CONFIG_BACKGROUND))));
 
@@ -732,6 +780,33 @@ bool TWinSCPPlugin::QueueConfigurationDialog()
   TFarCheckBox *QueueBeepCheck = new TFarCheckBox(Dialog);
   QueueBeepCheck->SetCaption(GetMsg(NB_TRANSFER_QUEUE_BEEP));
 
+  TFarSeparator *Separator = new TFarSeparator(Dialog);
+  Separator->SetCaption(GetMsg(NB_TRANSFER_BANDWIDTH_GROUP));
+
+  Text = new TFarText(Dialog);
+  Text->SetCaption(GetMsg(NB_TRANSFER_BANDWIDTH_DOWNLOAD));
+
+  Dialog->SetNextItemPosition(ipRight);
+
+  TFarEdit *DownloadBandwidthLimitEdit = new TFarEdit(Dialog);
+  DownloadBandwidthLimitEdit->SetFixed(true);
+  DownloadBandwidthLimitEdit->SetMask(L"9999999");
+  DownloadBandwidthLimitEdit->SetWidth(9);
+
+  Dialog->SetNextItemPosition(ipNewLine);
+
+  Text = new TFarText(Dialog);
+  Text->SetCaption(GetMsg(NB_TRANSFER_BANDWIDTH_UPLOAD));
+
+  Dialog->SetNextItemPosition(ipRight);
+
+  TFarEdit *UploadBandwidthLimitEdit = new TFarEdit(Dialog);
+  UploadBandwidthLimitEdit->SetFixed(true);
+  UploadBandwidthLimitEdit->SetMask(L"9999999");
+  UploadBandwidthLimitEdit->SetWidth(9);
+
+  Dialog->SetNextItemPosition(ipNewLine);
+
   Dialog->AddStandardButtons();
 
   TFarConfiguration *FarConfiguration = GetFarConfiguration();
@@ -740,6 +815,8 @@ bool TWinSCPPlugin::QueueConfigurationDialog()
   QueueAutoPopupCheck->SetChecked(FarConfiguration->GetQueueAutoPopup());
   RememberPasswordCheck->SetChecked(GetGUIConfiguration()->GetSessionRememberPassword());
   QueueBeepCheck->SetChecked(FarConfiguration->GetQueueBeep());
+  DownloadBandwidthLimitEdit->SetAsInteger(GetConfiguration()->GetDownloadBandwidthLimit() / 1024);
+  UploadBandwidthLimitEdit->SetAsInteger(GetConfiguration()->GetUploadBandwidthLimit() / 1024);
 
   bool Result = (Dialog->ShowModal() == brOK);
 
@@ -757,6 +834,8 @@ bool TWinSCPPlugin::QueueConfigurationDialog()
     FarConfiguration->SetQueueAutoPopup(QueueAutoPopupCheck->GetChecked());
     GetGUIConfiguration()->SetSessionRememberPassword(RememberPasswordCheck->GetChecked());
     FarConfiguration->SetQueueBeep(QueueBeepCheck->GetChecked());
+    GetConfiguration()->SetDownloadBandwidthLimit(BandwidthLimitFromKB(DownloadBandwidthLimitEdit->GetAsInteger()));
+    GetConfiguration()->SetUploadBandwidthLimit(BandwidthLimitFromKB(UploadBandwidthLimitEdit->GetAsInteger()));
 
     GetGUIConfiguration()->SetDefaultCopyParam(CopyParam);
   }
@@ -6717,6 +6796,7 @@ private:
   TFarCheckBox *SynchronizePreviewChangesCheck;
   TFarCheckBox *SynchronizeByTimeCheck;
   TFarCheckBox *SynchronizeBySizeCheck;
+  TFarCheckBox *SynchronizeByChecksumCheck;
   TFarCheckBox *SaveSettingsCheck;
   TFarLister *CopyParamLister;
 
@@ -6822,6 +6902,11 @@ TFullSynchronizeDialog::TFullSynchronizeDialog(
   SynchronizeBySizeCheck->SetCaption(GetMsg(NB_SYNCHRONIZE_BY_SIZE));
   SynchronizeBySizeCheck->SetEnabledDependencyNegative(SynchronizeBothButton);
 
+  SetNextItemPosition(ipRight);
+
+  SynchronizeByChecksumCheck = new TFarCheckBox(this);
+  SynchronizeByChecksumCheck->SetCaption(GetMsg(NB_SYNCHRONIZE_BY_CHECKSUM));
+
   SetNextItemPosition(ipNewLine);
 
   new TFarSeparator(this);
@@ -6926,6 +7011,10 @@ void TFullSynchronizeDialog::Change()
       SynchronizeDeleteCheck->SetChecked(false);
       SynchronizeByTimeCheck->SetChecked(true);
     }
+    if (SynchronizeTimestampsButton->GetChecked() || SynchronizeBothButton->GetChecked())
+    {
+      SynchronizeByChecksumCheck->SetChecked(false);
+    }
     if (SynchronizeBothButton->GetChecked())
     {
       SynchronizeBySizeCheck->SetChecked(false);
@@ -6945,6 +7034,8 @@ void TFullSynchronizeDialog::Change()
       !SynchronizeTimestampsButton->GetChecked() && !MirrorFilesButton->GetChecked());
     SynchronizeBySizeCheck->SetCaption(SynchronizeTimestampsButton->GetChecked() ?
       GetMsg(NB_SYNCHRONIZE_SAME_SIZE) : GetMsg(NB_SYNCHRONIZE_BY_SIZE));
+    SynchronizeByChecksumCheck->SetEnabled(!SynchronizeBothButton->GetChecked() &&
+      !SynchronizeTimestampsButton->GetChecked());
 
     if (!SynchronizeBySizeCheck->GetChecked() && !SynchronizeByTimeCheck->GetChecked())
     {
@@ -7059,6 +7150,7 @@ bool TFullSynchronizeDialog::Execute(TTerminal::TSynchronizeMode &Mode,
   }
   SynchronizeByTimeCheck->SetChecked(FLAGCLEAR(Params, TTerminal::spNotByTime));
   SynchronizeBySizeCheck->SetChecked(FLAGSET(Params, TTerminal::spBySize));
+  SynchronizeByChecksumCheck->SetChecked(FLAGSET(Params, TTerminal::spByChecksum));
   SaveSettingsCheck->SetChecked(SaveSettings);
   FSaveMode = SaveMode;
   FOrigMode = Mode;
@@ -7076,7 +7168,7 @@ bool TFullSynchronizeDialog::Execute(TTerminal::TSynchronizeMode &Mode,
     Params &= ~(TTerminal::spDelete | TTerminal::spNoConfirmation |
         TTerminal::spExistingOnly | TTerminal::spPreviewChanges |
         TTerminal::spTimestamp | TTerminal::spNotByTime | TTerminal::spBySize |
-        spSelectedOnly | TTerminal::spMirror);
+        spSelectedOnly | TTerminal::spMirror | TTerminal::spByChecksum);
     Params |=
       FLAGMASK(SynchronizeDeleteCheck->GetChecked(), TTerminal::spDelete) |
       FLAGMASK(SynchronizeExistingOnlyCheck->GetChecked(), TTerminal::spExistingOnly) |
@@ -7086,7 +7178,8 @@ bool TFullSynchronizeDialog::Execute(TTerminal::TSynchronizeMode &Mode,
         TTerminal::spTimestamp) |
       FLAGMASK(MirrorFilesButton->GetChecked(), TTerminal::spMirror) |
       FLAGMASK(!SynchronizeByTimeCheck->GetChecked(), TTerminal::spNotByTime) |
-      FLAGMASK(SynchronizeBySizeCheck->GetChecked(), TTerminal::spBySize);
+      FLAGMASK(SynchronizeBySizeCheck->GetChecked(), TTerminal::spBySize) |
+      FLAGMASK(SynchronizeByChecksumCheck->GetChecked(), TTerminal::spByChecksum);
 
     SaveSettings = SaveSettingsCheck->GetChecked();
     SaveMode = FSaveMode;
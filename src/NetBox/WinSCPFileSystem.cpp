@@ -108,6 +108,14 @@ void TRemoteFilePanelItem::GetData(
   CustomColumnNumber = 4;
 }
 
+void TRemoteFilePanelItem::FillFileItem(TRemoteFile *ARemoteFile,
+  PluginPanelItem *PanelItem, TFarFindDataArena *Arena)
+{
+  // no heap allocation, the item only adapts the file for FillPanelItem
+  TRemoteFilePanelItem Item(ARemoteFile);
+  Item.FillPanelItem(PanelItem, Arena);
+}
+
 UnicodeString TRemoteFilePanelItem::GetCustomColumnData(size_t Column)
 {
   switch (Column)
@@ -454,107 +462,115 @@ void TWinSCPFileSystem::GetOpenPluginInfoEx(DWORD &Flags,
   }
 }
 
-bool TWinSCPFileSystem::GetFindDataEx(TObjectList *PanelItems, int OpMode)
+void TWinSCPFileSystem::ReadFileList(int OpMode)
 {
-  bool Result = false;
-  if (Connected())
+  DebugAssert(!FNoProgress);
+  // OPM_FIND is used also for calculation of directory size (F3, quick view).
+  // However directory is usually read from SetDirectory, so FNoProgress
+  // seems to have no effect here.
+  // Do not know if OPM_SILENT is even used.
+  FNoProgress = FLAGSET(OpMode, OPM_FIND) || FLAGSET(OpMode, OPM_SILENT);
+  SCOPE_EXIT
   {
-    DebugAssert(!FNoProgress);
-    // OPM_FIND is used also for calculation of directory size (F3, quick view).
-    // However directory is usually read from SetDirectory, so FNoProgress
-    // seems to have no effect here.
-    // Do not know if OPM_SILENT is even used.
-    FNoProgress = FLAGSET(OpMode, OPM_FIND) || FLAGSET(OpMode, OPM_SILENT);
+    FNoProgress = false;
+  };
+  if (FReloadDirectory && FTerminal->GetActive())
+  {
+    FReloadDirectory = false;
+    FTerminal->ReloadDirectory();
+  }
+
+  TCustomFileSystem *FileSystem = GetTerminal()->GetFileSystem();
+  bool ResolveSymlinks = GetSessionData()->GetResolveSymlinks();
+  for (intptr_t Index = 0; ResolveSymlinks && (Index < GetTerminal()->GetFiles()->GetCount()); ++Index)
+  {
+    TRemoteFile *File = GetTerminal()->GetFiles()->GetFile(Index);
+    DebugAssert(File);
+    if (File->GetIsSymLink())
     {
-      SCOPE_EXIT
+      if (FarPlugin->CheckForEsc())
       {
-        FNoProgress = false;
+        ResolveSymlinks = false;
+        continue;
       };
-      if (FReloadDirectory && FTerminal->GetActive())
-      {
-        FReloadDirectory = false;
-        FTerminal->ReloadDirectory();
-      }
-
-      TCustomFileSystem *FileSystem = GetTerminal()->GetFileSystem();
-      bool ResolveSymlinks = GetSessionData()->GetResolveSymlinks();
-      for (intptr_t Index = 0; Index < GetTerminal()->GetFiles()->GetCount(); ++Index)
+      // Check what kind of symlink this is
+      const UnicodeString LinkFileName = File->GetLinkTo();
+      if (!LinkFileName.IsEmpty())
       {
-        TRemoteFile *File = GetTerminal()->GetFiles()->GetFile(Index);
-        DebugAssert(File);
-        if (ResolveSymlinks && File->GetIsSymLink())
+        TRemoteFile *LinkFile = nullptr;
+        try
         {
-          if (FarPlugin->CheckForEsc())
-          {
-            ResolveSymlinks = false;
-            continue;
-          };
-          // Check what kind of symlink this is
-          const UnicodeString LinkFileName = File->GetLinkTo();
-          if (!LinkFileName.IsEmpty())
+          FileSystem->ReadFile(LinkFileName, LinkFile);
+        }
+        catch (const Exception & /*E*/)
+        {
+          LinkFile = nullptr;
+        }
+        if ((LinkFile != nullptr) && LinkFile->GetIsDirectory())
+        {
+          File->SetType(FILETYPE_DIRECTORY);
+          File->SetIsSymLink(true);
+          if (const auto LinkedFile = File->GetLinkedFile())
           {
-            TRemoteFile *LinkFile = nullptr;
-            try
-            {
-              FileSystem->ReadFile(LinkFileName, LinkFile);
-            }
-            catch (const Exception & /*E*/)
-            {
-              LinkFile = nullptr;
-            }
-            if ((LinkFile != nullptr) && LinkFile->GetIsDirectory())
-            {
-              File->SetType(FILETYPE_DIRECTORY);
-              File->SetIsSymLink(true);
-              if (const auto LinkedFile = File->GetLinkedFile())
-              {
-                LinkedFile->SetType(FILETYPE_DIRECTORY);
-              }
-            }
-            SAFE_DESTROY(LinkFile);
+            LinkedFile->SetType(FILETYPE_DIRECTORY);
           }
         }
-        PanelItems->Add(new TRemoteFilePanelItem(File));
+        SAFE_DESTROY(LinkFile);
       }
     }
+  }
+}
+
+bool TWinSCPFileSystem::GetFindDataDirect(TFarFindDataArena *Arena,
+  PluginPanelItem *&PanelItem, intptr_t &ItemsNumber, int OpMode)
+{
+  bool Result = false;
+  // Remote directory is filled straight from the file list,
+  // session list goes through GetFindDataEx
+  if (Connected())
+  {
+    ReadFileList(OpMode);
+    TRemoteDirectory *Files = GetTerminal()->GetFiles();
+    ItemsNumber = Files->GetCount();
+    PanelItem = (ItemsNumber > 0) ? Arena->AllocateItems(ItemsNumber) : nullptr;
+    for (intptr_t Index = 0; Index < ItemsNumber; ++Index)
+    {
+      TRemoteFilePanelItem::FillFileItem(Files->GetFile(Index), &PanelItem[Index], Arena);
+    }
+    Result = true;
+  }
+  return Result;
+}
+
+bool TWinSCPFileSystem::GetFindDataEx(TObjectList *PanelItems, int OpMode)
+{
+  bool Result = false;
+  if (Connected())
+  {
+    ReadFileList(OpMode);
+    for (intptr_t Index = 0; Index < GetTerminal()->GetFiles()->GetCount(); ++Index)
+    {
+      PanelItems->Add(new TRemoteFilePanelItem(GetTerminal()->GetFiles()->GetFile(Index)));
+    }
     Result = true;
   }
   else if (IsSessionList())
   {
     Result = true;
     DebugAssert(StoredSessions);
-    StoredSessions->Load();
-    UnicodeString Folder = FSessionsFolder;
-    if (!FSessionsFolder.IsEmpty())
-    {
-      Folder = base::UnixIncludeTrailingBackslash(FSessionsFolder);
-    }
+    StoredSessions->Reload();
 
     std::unique_ptr<TStringList> ChildPaths(new TStringList());
-    ChildPaths->SetCaseSensitive(false);
-    for (intptr_t Index = 0; Index < StoredSessions->GetCount(); ++Index)
+    std::unique_ptr<TList> ChildSessions(new TList());
+    StoredSessions->GetFolderIndex()->GetChildren(
+      FSessionsFolder, ChildPaths.get(), ChildSessions.get());
+    for (intptr_t Index = 0; Index < ChildPaths->GetCount(); ++Index)
     {
-      const TSessionData *Data = StoredSessions->GetSession(Index);
-      UnicodeString SessionName = Data->GetName();
-      if (SessionName.SubString(1, Folder.Length()) == Folder)
-      {
-        UnicodeString Name = SessionName.SubString(
-            Folder.Length() + 1, SessionName.Length() - Folder.Length());
-        intptr_t Slash = Name.Pos(L'/');
-        if (Slash > 0)
-        {
-          Name.SetLength(Slash - 1);
-          if (ChildPaths->IndexOf(Name) < 0)
-          {
-            PanelItems->Add(new TSessionFolderPanelItem(Name));
-            ChildPaths->Add(Name);
-          }
-        }
-        else
-        {
-          PanelItems->Add(new TSessionPanelItem(Data));
-        }
-      }
+      PanelItems->Add(new TSessionFolderPanelItem(ChildPaths->GetString(Index)));
+    }
+    for (intptr_t Index = 0; Index < ChildSessions->GetCount(); ++Index)
+    {
+      PanelItems->Add(new TSessionPanelItem(ChildSessions->GetAs<TSessionData>(Index)));
     }
 
     if (!FNewSessionsFolder.IsEmpty())
@@ -1428,7 +1444,7 @@ void TWinSCPFileSystem::Synchronize(UnicodeString LocalDirectory,
       {
         Checklist = FTerminal->SynchronizeCollect(LocalDirectory, RemoteDirectory,
           Mode, &CopyParam, Params | TTerminal::spNoConfirmation,
-          nb::bind(&TWinSCPFileSystem::TerminalSynchronizeDirectory, this), Options);
+          nb::bind(&TWinSCPFileSystem::TerminalSynchronizeDirectory, this), Options, nullptr);
       }
     }
 
@@ -1513,6 +1529,21 @@ void TWinSCPFileSystem::FullSynchronize(bool Source)
       }
     }
 
+    // Without preview, the transfers run in the background queue
+    // while the comparison still continues
+    std::unique_ptr<TSynchronizeQueueFeeder> Feeder;
+    TSynchronizeCollectedEvent OnSynchronizeCollected = nullptr;
+    if (CopyParam.GetQueue() &&
+        FLAGCLEAR(Params, TTerminal::spPreviewChanges) &&
+        FLAGCLEAR(Params, TTerminal::spTimestamp))
+    {
+      GetFarConfiguration()->CacheFarSettings();
+      Feeder.reset(new TSynchronizeQueueFeeder(GetQueue(), FTerminal, &CopyParam,
+        Params | TTerminal::spNoConfirmation));
+      Feeder->SetOnWait(nb::bind(&TWinSCPFileSystem::SynchronizeQueueWait, this));
+      OnSynchronizeCollected = nb::bind(&TSynchronizeQueueFeeder::Collected, Feeder.get());
+    }
+
     std::unique_ptr<TSynchronizeChecklist> Checklist;
     {
       SCOPE_EXIT
@@ -1534,13 +1565,18 @@ void TWinSCPFileSystem::FullSynchronize(bool Source)
         };
         Checklist.reset(FTerminal->SynchronizeCollect(LocalDirectory, RemoteDirectory,
             Mode, &CopyParam, Params | TTerminal::spNoConfirmation,
-            nb::bind(&TWinSCPFileSystem::TerminalSynchronizeDirectory, this), &SynchronizeOptions));
+            nb::bind(&TWinSCPFileSystem::TerminalSynchronizeDirectory, this), &SynchronizeOptions,
+            OnSynchronizeCollected));
       }
 
-      if (Checklist.get() && Checklist->GetCount() == 0)
+      if (Checklist.get() && (Checklist->GetCount() == 0))
       {
-        MoreMessageDialog(GetMsg(NB_COMPARE_NO_DIFFERENCES), nullptr,
-          qtInformation, qaOK);
+        // without the queued differences
+        if ((Feeder.get() == nullptr) || (Feeder->GetQueuedFiles() == 0))
+        {
+          MoreMessageDialog(GetMsg(NB_COMPARE_NO_DIFFERENCES), nullptr,
+            qtInformation, qaOK);
+        }
       }
       else if (FLAGCLEAR(Params, TTerminal::spPreviewChanges) ||
         SynchronizeChecklistDialog(Checklist.get(), Mode, Params,
@@ -1617,6 +1653,18 @@ void TWinSCPFileSystem::TerminalSynchronizeDirectory(
   }
 }
 
+void TWinSCPFileSystem::SynchronizeQueueWait(TObject * /*Sender*/)
+{
+  // the queue is full, let its items ask their questions meanwhile
+  ProcessQueue(true);
+  if (GetWinSCPPlugin()->CheckForEsc() &&
+    (MoreMessageDialog(GetMsg(NB_CANCEL_OPERATION), nullptr,
+        qtConfirmation, qaOK | qaCancel) == qaOK))
+  {
+    Abort();
+  }
+}
+
 void TWinSCPFileSystem::Synchronize()
 {
   TFarPanelInfo **AnotherPanel = GetAnotherPanelInfo();
@@ -1627,7 +1675,7 @@ void TWinSCPFileSystem::Synchronize()
   Params.RemoteDirectory = FTerminal->RemoteGetCurrentDirectory();
   intptr_t UnusedParams = (GetGUIConfiguration()->GetSynchronizeParams() &
       (TTerminal::spPreviewChanges | TTerminal::spTimestamp |
-        TTerminal::spNotByTime | TTerminal::spBySize));
+        TTerminal::spNotByTime | TTerminal::spBySize | TTerminal::spByChecksum));
   Params.Params = GetGUIConfiguration()->GetSynchronizeParams() & ~UnusedParams;
   Params.Options = GetGUIConfiguration()->GetSynchronizeOptions();
   TSynchronizeController Controller(
@@ -2035,6 +2083,10 @@ void TWinSCPFileSystem::ShowInformation()
 {
   const TSessionInfo &SessionInfo = GetTerminal()->GetSessionInfo();
   TFileSystemInfo FileSystemInfo = GetTerminal()->GetFileSystemInfo();
+  if ((SessionInfo.Statistics != nullptr) && !SessionInfo.Statistics->GetEmpty())
+  {
+    FileSystemInfo.AdditionalInfo += SessionInfo.Statistics->GetReport();
+  }
   TGetSpaceAvailableEvent OnGetSpaceAvailable;
   if (GetTerminal()->GetIsCapable(fcCheckingSpaceAvailable))
   {
@@ -3569,11 +3621,15 @@ TTerminalQueueStatus *TWinSCPFileSystem::ProcessQueue(bool Hidden)
 
     FQueueItemInvalidated = false;
 
-    for (intptr_t Index = 0; Index < FQueueStatus->GetActiveCount(); ++Index)
+    // only the items reported by QueueItemUpdate since the last time are refreshed,
+    // the pending items cannot change without the list being updated
+    intptr_t ActiveEnd = FQueueStatus->GetDoneAndActiveCount();
+    for (intptr_t Index = FQueueStatus->GetDoneCount(); Index < ActiveEnd; ++Index)
     {
       TQueueItemProxy *QueueItem = FQueueStatus->GetItem(Index);
       if (QueueItem->GetUserData() != nullptr)
       {
+        QueueItem->SetUserData(nullptr);
         QueueItem->Update();
         Result = FQueueStatus;
       }
@@ -4177,6 +4233,34 @@ void TWinSCPFileSystem::ShowLog()
   GetWinSCPPlugin()->Viewer(Log->GetLogFileName(), Log->GetLogFileName(), VF_NONMODAL);
 }
 
+bool TWinSCPFileSystem::IsTracing() const
+{
+  return Connected() && !FTerminal->GetLog()->GetTraceFileName().IsEmpty();
+}
+
+void TWinSCPFileSystem::ShowProtocolTrace()
+{
+  DebugAssert(IsTracing());
+  UnicodeString TraceFileName = FTerminal->GetLog()->GetTraceFileName();
+  std::unique_ptr<TStrings> Lines(new TStringList());
+  DecodeProtocolTrace(TraceFileName, ptfText, Lines.get());
+
+  UnicodeString TempDir = GetWinSCPPlugin()->GetTemporaryDir();
+  if (TempDir.IsEmpty() || !::ForceDirectories(ApiPath(TempDir)))
+  {
+    throw Exception(FMTLOAD(NB_CREATE_TEMP_DIR_ERROR, TempDir));
+  }
+  UnicodeString FileName = ::IncludeTrailingBackslash(TempDir) + base::ExtractFileName(TraceFileName, false) + L".txt";
+  UTF8String Content(UnicodeString(L"\xFEFF") + Lines->GetText());
+  DWORD Error = CNBFile::SaveFile(ApiPath(FileName).c_str(), Content.c_str());
+  if (Error != ERROR_SUCCESS)
+  {
+    ::RaiseLastOSError(Error);
+  }
+  // the decoded copy is a snapshot, it is removed with its temporary directory
+  GetWinSCPPlugin()->Viewer(FileName, TraceFileName, VF_NONMODAL | VF_DELETEONCLOSE);
+}
+
 UnicodeString TWinSCPFileSystem::GetFileNameHash(UnicodeString AFileName) const
 {
   RawByteString Result;
@@ -106,6 +106,8 @@ protected:
     int &StartSortMode, bool &StartSortOrder, TFarKeyBarTitles *KeyBarTitles,
     UnicodeString &ShortcutData) override;
   virtual bool GetFindDataEx(TObjectList *PanelItems, int OpMode) override;
+  virtual bool GetFindDataDirect(TFarFindDataArena *Arena,
+    PluginPanelItem *&PanelItem, intptr_t &ItemsNumber, int OpMode) override;
   virtual bool ProcessKeyEx(intptr_t Key, uintptr_t ControlState) override;
   virtual bool SetDirectoryEx(UnicodeString Dir, int OpMode) override;
   virtual intptr_t MakeDirectoryEx(UnicodeString &Name, int OpMode) override;
@@ -132,6 +134,7 @@ protected:
     bool Duplicate);
   void FocusSession(const TSessionData *Data);
   void DeleteSession(TSessionData *Data, void *AParam);
+  void ReadFileList(int OpMode);
   void ProcessSessions(TObjectList *PanelItems,
     TProcessSessionEvent ProcessSession, void *AParam);
   void ExportSession(TSessionData *Data, void *AParam);
@@ -235,7 +238,9 @@ protected:
   void EditHistory();
   UnicodeString ProgressBar(intptr_t Percentage, intptr_t Width);
   bool IsLogging() const;
+  bool IsTracing() const;
   void ShowLog();
+  void ShowProtocolTrace();
 
   TTerminal *GetTerminal() const { return FTerminal; }
   TSessionData *GetSessionData() const { return FTerminal ? FTerminal->GetSessionData() : nullptr; }
@@ -298,6 +303,7 @@ private:
   void GetSpaceAvailable(UnicodeString APath,
     TSpaceAvailable &ASpaceAvailable, bool &Close);
   void QueueAddItem(TQueueItem *Item);
+  void SynchronizeQueueWait(TObject *Sender);
   UnicodeString GetFileNameHash(UnicodeString AFileName) const;
   intptr_t GetFilesRemote(TObjectList *PanelItems, bool Move,
     UnicodeString &DestPath, int OpMode);
@@ -397,6 +403,8 @@ class TRemoteFilePanelItem : public TCustomFarPanelItem
   NB_DISABLE_COPY(TRemoteFilePanelItem)
 public:
   explicit TRemoteFilePanelItem(TRemoteFile *ARemoteFile);
+  static void FillFileItem(TRemoteFile *ARemoteFile,
+    PluginPanelItem *PanelItem, TFarFindDataArena *Arena);
   static void SetPanelModes(TFarPanelModes *PanelModes);
   static void SetKeyBarTitles(TFarKeyBarTitles *KeyBarTitles);
 
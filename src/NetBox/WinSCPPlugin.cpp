@@ -371,6 +371,7 @@ void TWinSCPPlugin::CommandsMenu(bool FromFileSystem)
   intptr_t MQueue = MenuItems->Add(GetMsg(NB_MENU_COMMANDS_QUEUE), FSVisible);
   intptr_t MInformation = MenuItems->Add(GetMsg(NB_MENU_COMMANDS_INFORMATION), FSVisible);
   intptr_t MLog = MenuItems->Add(GetMsg(NB_MENU_COMMANDS_LOG), FSVisible);
+  intptr_t MProtocolTrace = MenuItems->Add(GetMsg(NB_MENU_COMMANDS_PROTOCOL_TRACE), FSVisible);
   intptr_t MClearCaches = MenuItems->Add(GetMsg(NB_MENU_COMMANDS_CLEAR_CACHES), FSVisible);
   intptr_t MPutty = MenuItems->Add(GetMsg(NB_MENU_COMMANDS_PUTTY), FSVisible);
   intptr_t MEditHistory = MenuItems->Add(GetMsg(NB_MENU_COMMANDS_EDIT_HISTORY), FSConnected);
@@ -387,6 +388,7 @@ void TWinSCPPlugin::CommandsMenu(bool FromFileSystem)
   intptr_t MAbout = MenuItems->Add(GetMsg(NB_CONFIG_ABOUT));
 
   MenuItems->SetDisabled(MLog, !FSVisible || (FileSystem && !FileSystem->IsLogging()));
+  MenuItems->SetDisabled(MProtocolTrace, !FSVisible || (FileSystem && !FileSystem->IsTracing()));
   MenuItems->SetDisabled(MClearCaches, !FSVisible || (FileSystem && FileSystem->AreCachesEmpty()));
   MenuItems->SetDisabled(MPutty, !FSVisible || !::FileExists(::ExpandEnvVars(ExtractProgram(GetFarConfiguration()->GetPuttyPath()))));
   MenuItems->SetDisabled(MEditHistory, !FSConnected || (FileSystem && FileSystem->IsEditHistoryEmpty()));
@@ -403,6 +405,11 @@ void TWinSCPPlugin::CommandsMenu(bool FromFileSystem)
       DebugAssert(FileSystem);
       FileSystem->ShowLog();
     }
+    else if ((Result == MProtocolTrace) && FileSystem)
+    {
+      DebugAssert(FileSystem);
+      FileSystem->ShowProtocolTrace();
+    }
     else if ((Result == MAttributes) && FileSystem)
     {
       DebugAssert(FileSystem);
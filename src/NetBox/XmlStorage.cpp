@@ -17,7 +17,9 @@ TXmlStorage::TXmlStorage(UnicodeString AStorage,
   FCurrentElement(nullptr),
   FStoredSessionsSubKey(StoredSessionsSubKey),
   FFailed(0),
-  FStoredSessionsOpened(false)
+  FStoredSessionsOpened(false),
+  FModified(false),
+  FIndexedElement(nullptr)
 {
 }
 
@@ -29,11 +31,20 @@ void TXmlStorage::Init()
 
 TXmlStorage::~TXmlStorage()
 {
-  if (GetAccessMode() == smReadWrite)
+  Flush();
+  SAFE_DESTROY_EX(tinyxml2::XMLDocument, FXmlDoc);
+}
+
+void TXmlStorage::Flush()
+{
+  // All changes are kept in the document and written at once
+  if ((GetAccessMode() == smReadWrite) && FModified)
   {
-    WriteXml();
+    if (WriteXml())
+    {
+      FModified = false;
+    }
   }
-  SAFE_DESTROY_EX(tinyxml2::XMLDocument, FXmlDoc);
 }
 
 bool TXmlStorage::ReadXml()
@@ -44,7 +55,8 @@ bool TXmlStorage::ReadXml()
     return false;
   }
   size_t buffSize = static_cast<size_t>(xmlFile.GetFileSize() + 1);
-  if (buffSize > 1000000)
+  // sanity limit only, thousands of sessions take several megabytes
+  if (buffSize > 256 * 1024 * 1024)
   {
     return false;
   }
@@ -122,6 +134,7 @@ void TXmlStorage::SetAccessMode(TStorageAccessMode Value)
     FCurrentElement = FXmlDoc->NewElement(CONST_ROOT_NODE);
     FCurrentElement->SetAttribute(CONST_VERSION_ATTR, CONST_XML_VERSION21);
     FXmlDoc->LinkEndChild(FCurrentElement);
+    FModified = true;
     break;
   }
 }
@@ -151,6 +164,8 @@ bool TXmlStorage::DoOpenSubKey(UnicodeString MungedSubKey, bool CanCreate)
       Element = FXmlDoc->NewElement(SubKey.c_str());
     }
     FCurrentElement->LinkEndChild(Element);
+    IndexElement(Element);
+    FModified = true;
   }
   else
   {
@@ -160,6 +175,7 @@ bool TXmlStorage::DoOpenSubKey(UnicodeString MungedSubKey, bool CanCreate)
   if (Result)
   {
     FSubElements.push_back(OldCurrentElement);
+    FSubStoredSessionsOpened.push_back(FStoredSessionsOpened);
     FCurrentElement = Element;
     FStoredSessionsOpened = (MungedSubKey == FStoredSessionsSubKey);
   }
@@ -173,10 +189,14 @@ void TXmlStorage::CloseSubKey()
   {
     FCurrentElement = FSubElements.back();
     FSubElements.pop_back();
+    // the next session of the stored sessions is looked up by its name attribute again
+    FStoredSessionsOpened = FSubStoredSessionsOpened.back();
+    FSubStoredSessionsOpened.pop_back();
   }
   else
   {
     FCurrentElement = nullptr;
+    FStoredSessionsOpened = false;
   }
 }
 
@@ -186,7 +206,7 @@ bool TXmlStorage::DeleteSubKey(UnicodeString SubKey)
   tinyxml2::XMLElement *Element = FindElement(SubKey);
   if (Element != nullptr)
   {
-    FCurrentElement->DeleteChild(Element);
+    RemoveElement(Element);
     Result = true;
   }
   return Result;
@@ -214,7 +234,7 @@ bool TXmlStorage::DeleteValue(UnicodeString Name)
   tinyxml2::XMLElement *Element = FindElement(Name);
   if (Element != nullptr)
   {
-    FCurrentElement->DeleteChild(Element);
+    RemoveElement(Element);
     Result = true;
   }
   return Result;
@@ -225,10 +245,17 @@ void TXmlStorage::RemoveIfExists(UnicodeString Name)
   tinyxml2::XMLElement *Element = FindElement(Name);
   if (Element != nullptr)
   {
-    FCurrentElement->DeleteChild(Element);
+    RemoveElement(Element);
   }
 }
 
+void TXmlStorage::RemoveElement(tinyxml2::XMLElement *Element)
+{
+  UnindexElement(Element);
+  FCurrentElement->DeleteChild(Element);
+  FModified = true;
+}
+
 void TXmlStorage::AddNewElement(UnicodeString Name, UnicodeString Value)
 {
   AnsiString StrName(Name);
@@ -236,6 +263,118 @@ void TXmlStorage::AddNewElement(UnicodeString Name, UnicodeString Value)
   tinyxml2::XMLElement *Element = FXmlDoc->NewElement(StrName.c_str());
   Element->LinkEndChild(FXmlDoc->NewText(StrValue.c_str()));
   FCurrentElement->LinkEndChild(Element);
+  IndexElement(Element);
+  FModified = true;
+}
+
+rde::hash_value_t TXmlStorage::HashKey(TIndexKey Kind, const char *Key)
+{
+  // FNV-1a, seeded by kind, so that session names do not clash with value names
+  rde::hash_value_t Result = 2166136261u ^ static_cast<rde::hash_value_t>(Kind);
+  for (const char *P = Key; *P != '\0'; P++)
+  {
+    Result = (Result ^ static_cast<uint8_t>(*P)) * 16777619u;
+  }
+  return Result;
+}
+
+const char *TXmlStorage::GetElementKey(TIndexKey Kind, const tinyxml2::XMLElement *Element)
+{
+  const char *Result;
+  if (Kind == ikName)
+  {
+    Result = Element->Name();
+  }
+  else if (strcmp(Element->Name(), CONST_SESSION_NODE) == 0)
+  {
+    Result = Element->Attribute(CONST_NAME_ATTR);
+  }
+  else
+  {
+    Result = nullptr;
+  }
+  return Result;
+}
+
+void TXmlStorage::IndexElement(tinyxml2::XMLElement *Element) const
+{
+  if (FIndexedElement == FCurrentElement)
+  {
+    for (intptr_t Kind = ikName; Kind <= ikSessionName; Kind++)
+    {
+      const char *Key = GetElementKey(static_cast<TIndexKey>(Kind), Element);
+      if (Key != nullptr)
+      {
+        // keeps the first element on duplicates or collisions, as a linear search would find it
+        FIndex.insert(TElementIndex::value_type(HashKey(static_cast<TIndexKey>(Kind), Key), Element));
+      }
+    }
+  }
+}
+
+void TXmlStorage::UnindexElement(tinyxml2::XMLElement *Element)
+{
+  if (FIndexedElement == FCurrentElement)
+  {
+    for (intptr_t Kind = ikName; Kind <= ikSessionName; Kind++)
+    {
+      const char *Key = GetElementKey(static_cast<TIndexKey>(Kind), Element);
+      if (Key != nullptr)
+      {
+        TElementIndex::iterator Iterator = FIndex.find(HashKey(static_cast<TIndexKey>(Kind), Key));
+        if ((Iterator != FIndex.end()) && (Iterator->second == Element))
+        {
+          // another element with the same key may exist, index again on next lookup
+          FIndex.clear();
+          FIndexedElement = nullptr;
+          break;
+        }
+      }
+    }
+  }
+}
+
+tinyxml2::XMLElement *TXmlStorage::LookupElement(TIndexKey Kind, const char *Key) const
+{
+  tinyxml2::XMLElement *Result = nullptr;
+  if (FCurrentElement != nullptr)
+  {
+    if (FIndexedElement != FCurrentElement)
+    {
+      // single pass over the children of newly opened key
+      FIndex.clear();
+      FIndexedElement = FCurrentElement;
+      for (tinyxml2::XMLElement *Element = FCurrentElement->FirstChildElement();
+        Element != nullptr; Element = Element->NextSiblingElement())
+      {
+        IndexElement(Element);
+      }
+    }
+
+    TElementIndex::const_iterator Iterator = FIndex.find(HashKey(Kind, Key));
+    if (Iterator != FIndex.end())
+    {
+      const char *ElementKey = GetElementKey(Kind, Iterator->second);
+      if ((ElementKey != nullptr) && (strcmp(ElementKey, Key) == 0))
+      {
+        Result = Iterator->second;
+      }
+      else
+      {
+        // hash collision
+        for (tinyxml2::XMLElement *Element = FCurrentElement->FirstChildElement();
+          (Result == nullptr) && (Element != nullptr); Element = Element->NextSiblingElement())
+        {
+          ElementKey = GetElementKey(Kind, Element);
+          if ((ElementKey != nullptr) && (strcmp(ElementKey, Key) == 0))
+          {
+            Result = Element;
+          }
+        }
+      }
+    }
+  }
+  return Result;
 }
 
 UnicodeString TXmlStorage::GetSubKeyText(UnicodeString Name) const
@@ -254,16 +393,9 @@ UnicodeString TXmlStorage::GetSubKeyText(UnicodeString Name) const
 
 tinyxml2::XMLElement *TXmlStorage::FindElement(UnicodeString Name) const
 {
-  for (const tinyxml2::XMLElement *Element = FCurrentElement->FirstChildElement();
-    Element != nullptr; Element = Element->NextSiblingElement())
-  {
-    UnicodeString ElementName = ToUnicodeString(Element->Name());
-    if (ElementName == Name)
-    {
-      return const_cast<tinyxml2::XMLElement *>(Element);
-    }
-  }
-  return nullptr;
+  // Convert the name once, instead of every sibling name
+  AnsiString StrName(Name);
+  return LookupElement(ikName, StrName.c_str());
 }
 
 tinyxml2::XMLElement *TXmlStorage::FindChildElement(AnsiString SubKey) const
@@ -272,15 +404,11 @@ tinyxml2::XMLElement *TXmlStorage::FindChildElement(AnsiString SubKey) const
   // DebugAssert(FCurrentElement);
   if (FStoredSessionsOpened)
   {
-    tinyxml2::XMLElement *Element = FCurrentElement->FirstChildElement(CONST_SESSION_NODE);
-    if (Element && !strcmp(Element->Attribute(CONST_NAME_ATTR), SubKey.c_str()))
-    {
-      Result = Element;
-    }
+    Result = LookupElement(ikSessionName, SubKey.c_str());
   }
   else if (FCurrentElement)
   {
-    Result = FCurrentElement->FirstChildElement(SubKey.c_str());
+    Result = LookupElement(ikName, SubKey.c_str());
   }
   return Result;
 }
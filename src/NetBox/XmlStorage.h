@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vcl.h>
+#include <rdestl/hash_map.h>
 #include "HierarchicalStorage.h"
 #include "tinyxml2.h"
 
@@ -39,6 +40,7 @@ public:
   virtual void WriteBinaryData(UnicodeString Name, const void *Buffer, size_t Size);
 
   virtual void GetValueNames(TStrings *Strings) const;
+  virtual void Flush();
 
   virtual void SetAccessMode(TStorageAccessMode Value);
   virtual bool DoKeyExists(UnicodeString SubKey, bool ForceAnsi);
@@ -61,11 +63,27 @@ private:
   bool ReadXml();
   bool WriteXml();
 
+  // Children of the current element, hashed by element name
+  // and, for sessions, by the name attribute
+  typedef rde::hash_map<rde::hash_value_t, tinyxml2::XMLElement *> TElementIndex;
+  enum TIndexKey { ikName = 0, ikSessionName = 1 };
+  static rde::hash_value_t HashKey(TIndexKey Kind, const char *Key);
+  static const char *GetElementKey(TIndexKey Kind, const tinyxml2::XMLElement *Element);
+  tinyxml2::XMLElement *LookupElement(TIndexKey Kind, const char *Key) const;
+  void IndexElement(tinyxml2::XMLElement *Element) const;
+  void UnindexElement(tinyxml2::XMLElement *Element);
+  void RemoveElement(tinyxml2::XMLElement *Element);
+
 private:
   tinyxml2::XMLDocument *FXmlDoc;
   rde::vector<tinyxml2::XMLElement *> FSubElements;
+  // FStoredSessionsOpened of the elements in FSubElements
+  rde::vector<bool> FSubStoredSessionsOpened;
   tinyxml2::XMLElement *FCurrentElement;
   UnicodeString FStoredSessionsSubKey;
   intptr_t FFailed;
   bool FStoredSessionsOpened;
+  bool FModified;
+  mutable TElementIndex FIndex;
+  mutable const tinyxml2::XMLElement *FIndexedElement;
 };
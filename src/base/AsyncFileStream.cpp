@@ -0,0 +1,490 @@
+#include <vcl.h>
+#pragma hdrstop
+
+#include <Common.h>
+#include <Sysutils.hpp>
+#include <rtlconsts.h>
+#include <AsyncFileStream.h>
+
+TFileBufferRing::TFileBufferRing(intptr_t BufferCount, intptr_t BufferSize) :
+  FCount(BufferCount),
+  FBufferSize(BufferSize),
+  FBuffers(BufferCount),
+  FFree(nullptr),
+  FFilled(nullptr)
+{
+  for (intptr_t Index = 0; Index < FCount; Index++)
+  {
+    FBuffers[Index].Data = static_cast<char *>(nb_malloc_uninit(static_cast<size_t>(FBufferSize)));
+    FBuffers[Index].Length = 0;
+    FBuffers[Index].Offset = 0;
+    if (FBuffers[Index].Data == nullptr)
+    {
+      throw Exception(FMTLOAD(SMemoryStreamError));
+    }
+  }
+  Reset();
+}
+
+TFileBufferRing::~TFileBufferRing()
+{
+  for (intptr_t Index = 0; Index < FCount; Index++)
+  {
+    nb_free(FBuffers[Index].Data);
+  }
+  ::CloseHandle(FFree);
+  ::CloseHandle(FFilled);
+}
+
+void TFileBufferRing::Reset()
+{
+  if (FFree != nullptr)
+  {
+    ::CloseHandle(FFree);
+  }
+  if (FFilled != nullptr)
+  {
+    ::CloseHandle(FFilled);
+  }
+  FFree = ::CreateSemaphore(nullptr, static_cast<LONG>(FCount), static_cast<LONG>(FCount), nullptr);
+  FFilled = ::CreateSemaphore(nullptr, 0, static_cast<LONG>(FCount), nullptr);
+  if ((FFree == nullptr) || (FFilled == nullptr))
+  {
+    ::RaiseLastOSError();
+  }
+}
+
+TWriteBehindStream::TWriteBehindStream(HANDLE AHandle,
+  intptr_t BufferCount, intptr_t BufferSize) :
+  FHandle(AHandle),
+  FRing(BufferCount, BufferSize),
+  FThread(nullptr),
+  FErrorEvent(nullptr),
+  FRetryEvent(nullptr),
+  FError(0),
+  FErrorRaised(false),
+  FTerminated(false),
+  FSubmitIndex(0),
+  FWriteIndex(0),
+  FFilling(false),
+  FPosition(::FileSeek(AHandle, 0, FILE_CURRENT))
+{
+  FErrorEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  FRetryEvent = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+  DWORD ThreadId;
+  FThread = ::CreateThread(nullptr, 0, &TWriteBehindStream::WriterThreadProc, this, 0, &ThreadId);
+  if ((FErrorEvent == nullptr) || (FRetryEvent == nullptr) || (FThread == nullptr))
+  {
+    DWORD Error = ::GetLastError();
+    if (FErrorEvent != nullptr)
+    {
+      ::CloseHandle(FErrorEvent);
+    }
+    if (FRetryEvent != nullptr)
+    {
+      ::CloseHandle(FRetryEvent);
+    }
+    ::SetLastError(Error);
+    ::RaiseLastOSError();
+  }
+}
+
+TWriteBehindStream::~TWriteBehindStream()
+{
+  try
+  {
+    Flush();
+  }
+  catch (...)
+  {
+    // the owner was told about the error already, or does not care
+    // as it is abandoning the file
+  }
+  FTerminated = true;
+  ::ReleaseSemaphore(FRing.GetFilledSemaphore(), 1, nullptr);
+  ::SetEvent(FRetryEvent);
+  ::WaitForSingleObject(FThread, INFINITE);
+  ::CloseHandle(FThread);
+  ::CloseHandle(FErrorEvent);
+  ::CloseHandle(FRetryEvent);
+}
+
+DWORD WINAPI TWriteBehindStream::WriterThreadProc(void *Parameter)
+{
+  static_cast<TWriteBehindStream *>(Parameter)->ProcessWrites();
+  return 0;
+}
+
+void TWriteBehindStream::ProcessWrites()
+{
+  while (true)
+  {
+    ::WaitForSingleObject(FRing.GetFilledSemaphore(), INFINITE);
+    if (FTerminated)
+    {
+      break;
+    }
+    TFileBufferRing::TBuffer &Buffer = FRing.GetBuffer(FWriteIndex);
+    // buffers are written where they belong, as the owner may have
+    // rolled back and resubmitted a range that was queued already
+    ::FileSeek(FHandle, Buffer.Offset, FILE_BEGIN);
+    DWORD Written = 0;
+    while (Written < Buffer.Length)
+    {
+      DWORD Chunk = 0;
+      if (!::WriteFile(FHandle, Buffer.Data + Written, Buffer.Length - Written, &Chunk, nullptr) ||
+          (Chunk == 0))
+      {
+        DWORD Error = ::GetLastError();
+        ::InterlockedExchange(&FError, static_cast<LONG>((Error != ERROR_SUCCESS) ? Error : ERROR_WRITE_FAULT));
+        ::SetEvent(FErrorEvent);
+        // park until the owner retries (or gives up)
+        ::WaitForSingleObject(FRetryEvent, INFINITE);
+        if (FTerminated)
+        {
+          return;
+        }
+        // the failed write might have been partial
+        ::FileSeek(FHandle, Buffer.Offset, FILE_BEGIN);
+        Written = 0;
+      }
+      else
+      {
+        Written += Chunk;
+      }
+    }
+    FWriteIndex++;
+    ::ReleaseSemaphore(FRing.GetFreeSemaphore(), 1, nullptr);
+  }
+}
+
+void TWriteBehindStream::CheckError()
+{
+  if (FError != 0)
+  {
+    if (!FErrorRaised)
+    {
+      FErrorRaised = true;
+      ::SetLastError(static_cast<DWORD>(FError));
+      ::RaiseLastOSError();
+    }
+    // called again after the error was raised, retry
+    FErrorRaised = false;
+    ::ResetEvent(FErrorEvent);
+    ::InterlockedExchange(&FError, 0);
+    ::SetEvent(FRetryEvent);
+  }
+}
+
+void TWriteBehindStream::AcquireBuffer()
+{
+  HANDLE Handles[2] = { FRing.GetFreeSemaphore(), FErrorEvent };
+  while (::WaitForMultipleObjects(2, Handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+  {
+    CheckError();
+  }
+  TFileBufferRing::TBuffer &Buffer = FRing.GetBuffer(FSubmitIndex);
+  Buffer.Length = 0;
+  Buffer.Offset = FPosition;
+  FFilling = true;
+}
+
+void TWriteBehindStream::SubmitBuffer()
+{
+  DebugAssert(FFilling);
+  FFilling = false;
+  if (FRing.GetBuffer(FSubmitIndex).Length == 0)
+  {
+    ::ReleaseSemaphore(FRing.GetFreeSemaphore(), 1, nullptr);
+  }
+  else
+  {
+    FSubmitIndex++;
+    ::ReleaseSemaphore(FRing.GetFilledSemaphore(), 1, nullptr);
+  }
+}
+
+int64_t TWriteBehindStream::Write(const void *Buffer, int64_t Count)
+{
+  CheckError();
+  const char *Ptr = static_cast<const char *>(Buffer);
+  const int64_t StartPosition = FPosition;
+  int64_t Result = 0;
+  while (Result < Count)
+  {
+    if (!FFilling)
+    {
+      try
+      {
+        AcquireBuffer();
+      }
+      catch (...)
+      {
+        // The write fails as a whole, so that the owner can retry it
+        // with the same data. Buffers submitted by this call are written
+        // at their offsets and then overwritten with the same data.
+        FPosition = StartPosition;
+        throw;
+      }
+    }
+    TFileBufferRing::TBuffer &Target = FRing.GetBuffer(FSubmitIndex);
+    int64_t Chunk = FRing.GetBufferSize() - Target.Length;
+    if (Chunk > Count - Result)
+    {
+      Chunk = Count - Result;
+    }
+    memmove(Target.Data + Target.Length, Ptr + Result, static_cast<size_t>(Chunk));
+    Target.Length += static_cast<DWORD>(Chunk);
+    Result += Chunk;
+    FPosition += Chunk;
+    if (Target.Length == static_cast<DWORD>(FRing.GetBufferSize()))
+    {
+      SubmitBuffer();
+    }
+  }
+  return Result;
+}
+
+void TWriteBehindStream::Flush()
+{
+  CheckError();
+  if (FFilling)
+  {
+    SubmitBuffer();
+  }
+  // all buffers are free once everything is written
+  HANDLE Handles[2] = { FRing.GetFreeSemaphore(), FErrorEvent };
+  intptr_t Acquired = 0;
+  while (Acquired < FRing.GetCount())
+  {
+    if (::WaitForMultipleObjects(2, Handles, FALSE, INFINITE) == WAIT_OBJECT_0)
+    {
+      Acquired++;
+    }
+    else
+    {
+      if (Acquired > 0)
+      {
+        ::ReleaseSemaphore(FRing.GetFreeSemaphore(), static_cast<LONG>(Acquired), nullptr);
+        Acquired = 0;
+      }
+      CheckError();
+    }
+  }
+  ::ReleaseSemaphore(FRing.GetFreeSemaphore(), static_cast<LONG>(Acquired), nullptr);
+}
+
+int64_t TWriteBehindStream::Read(void *Buffer, int64_t Count)
+{
+  Flush();
+  // the handle is where the writer stopped, which is not always the position
+  ::FileSeek(FHandle, FPosition, FILE_BEGIN);
+  int64_t Result = ::FileRead(FHandle, Buffer, Count);
+  if (Result > 0)
+  {
+    FPosition += Result;
+  }
+  return Result;
+}
+
+int64_t TWriteBehindStream::Seek(int64_t Offset, int Origin)
+{
+  if ((Origin == FILE_CURRENT) && (Offset == 0))
+  {
+    return FPosition;
+  }
+  Flush();
+  if (Origin == FILE_CURRENT)
+  {
+    FPosition = ::FileSeek(FHandle, FPosition + Offset, FILE_BEGIN);
+  }
+  else
+  {
+    FPosition = ::FileSeek(FHandle, Offset, ToDWord(Origin));
+  }
+  return FPosition;
+}
+
+int64_t TWriteBehindStream::Seek(const int64_t Offset, TSeekOrigin Origin)
+{
+  return Seek(Offset, static_cast<int>(Origin));
+}
+
+void TWriteBehindStream::SetSize(const int64_t NewSize)
+{
+  Seek(NewSize, soFromBeginning);
+  ::Win32Check(::SetEndOfFile(FHandle) > 0);
+}
+
+TReadAheadStream::TReadAheadStream(HANDLE AHandle,
+  intptr_t BufferCount, intptr_t BufferSize) :
+  FHandle(AHandle),
+  FRing(BufferCount, BufferSize),
+  FThread(nullptr),
+  FTerminated(false),
+  FError(ERROR_SUCCESS),
+  FEof(false),
+  FReadIndex(0),
+  FConsumeIndex(0),
+  FConsumed(NPOS),
+  FPosition(::FileSeek(AHandle, 0, FILE_CURRENT))
+{
+  Start();
+}
+
+TReadAheadStream::~TReadAheadStream()
+{
+  Stop();
+  // leave the handle where the reading ended, not where the read-ahead got to
+  ::FileSeek(FHandle, FPosition, FILE_BEGIN);
+}
+
+void TReadAheadStream::Start()
+{
+  FTerminated = false;
+  FError = ERROR_SUCCESS;
+  FEof = false;
+  FReadIndex = 0;
+  FConsumeIndex = 0;
+  FConsumed = NPOS;
+  DWORD ThreadId;
+  FThread = ::CreateThread(nullptr, 0, &TReadAheadStream::ReaderThreadProc, this, 0, &ThreadId);
+  if (FThread == nullptr)
+  {
+    ::RaiseLastOSError();
+  }
+}
+
+void TReadAheadStream::Stop()
+{
+  if (FThread != nullptr)
+  {
+    FTerminated = true;
+    ::ReleaseSemaphore(FRing.GetFreeSemaphore(), 1, nullptr);
+    ::WaitForSingleObject(FThread, INFINITE);
+    ::CloseHandle(FThread);
+    FThread = nullptr;
+    FRing.Reset();
+  }
+}
+
+DWORD WINAPI TReadAheadStream::ReaderThreadProc(void *Parameter)
+{
+  static_cast<TReadAheadStream *>(Parameter)->ProcessReads();
+  return 0;
+}
+
+void TReadAheadStream::ProcessReads()
+{
+  while (true)
+  {
+    ::WaitForSingleObject(FRing.GetFreeSemaphore(), INFINITE);
+    if (FTerminated)
+    {
+      break;
+    }
+    TFileBufferRing::TBuffer &Buffer = FRing.GetBuffer(FReadIndex);
+    DWORD Read = 0;
+    if (!::ReadFile(FHandle, Buffer.Data, static_cast<DWORD>(FRing.GetBufferSize()), &Read, nullptr))
+    {
+      FError = ::GetLastError();
+      Read = 0;
+    }
+    Buffer.Length = Read;
+    FReadIndex++;
+    ::ReleaseSemaphore(FRing.GetFilledSemaphore(), 1, nullptr);
+    // an empty buffer marks the end of file or an error
+    if (Read == 0)
+    {
+      break;
+    }
+  }
+}
+
+int64_t TReadAheadStream::Read(void *Buffer, int64_t Count)
+{
+  char *Ptr = static_cast<char *>(Buffer);
+  int64_t Result = 0;
+  while ((Result < Count) && !FEof)
+  {
+    if (FConsumed == NPOS)
+    {
+      ::WaitForSingleObject(FRing.GetFilledSemaphore(), INFINITE);
+      FConsumed = 0;
+    }
+    TFileBufferRing::TBuffer &Source = FRing.GetBuffer(FConsumeIndex);
+    if (Source.Length == 0)
+    {
+      if (FError != ERROR_SUCCESS)
+      {
+        DWORD Error = FError;
+        // read again from where we are, if the owner retries
+        Stop();
+        ::FileSeek(FHandle, FPosition, FILE_BEGIN);
+        Start();
+        if (Result == 0)
+        {
+          ::SetLastError(Error);
+          ::RaiseLastOSError();
+        }
+      }
+      else
+      {
+        FEof = true;
+      }
+      break;
+    }
+    int64_t Chunk = static_cast<int64_t>(Source.Length) - FConsumed;
+    if (Chunk > Count - Result)
+    {
+      Chunk = Count - Result;
+    }
+    memmove(Ptr + Result, Source.Data + FConsumed, static_cast<size_t>(Chunk));
+    FConsumed += static_cast<intptr_t>(Chunk);
+    Result += Chunk;
+    FPosition += Chunk;
+    if (FConsumed == static_cast<intptr_t>(Source.Length))
+    {
+      FConsumeIndex++;
+      FConsumed = NPOS;
+      ::ReleaseSemaphore(FRing.GetFreeSemaphore(), 1, nullptr);
+    }
+  }
+  return Result;
+}
+
+int64_t TReadAheadStream::Write(const void * /*Buffer*/, int64_t /*Count*/)
+{
+  ThrowNotImplemented(1210);
+  return 0;
+}
+
+int64_t TReadAheadStream::Seek(int64_t Offset, int Origin)
+{
+  if ((Origin == FILE_CURRENT) && (Offset == 0))
+  {
+    return FPosition;
+  }
+  Stop();
+  if (Origin == FILE_CURRENT)
+  {
+    // the handle is ahead of what was consumed
+    FPosition = ::FileSeek(FHandle, FPosition + Offset, FILE_BEGIN);
+  }
+  else
+  {
+    FPosition = ::FileSeek(FHandle, Offset, ToDWord(Origin));
+  }
+  Start();
+  return FPosition;
+}
+
+int64_t TReadAheadStream::Seek(const int64_t Offset, TSeekOrigin Origin)
+{
+  return Seek(Offset, static_cast<int>(Origin));
+}
+
+void TReadAheadStream::SetSize(const int64_t /*NewSize*/)
+{
+  ThrowNotImplemented(1211);
+}
@@ -0,0 +1,125 @@
+
+#pragma once
+
+#include <Classes.hpp>
+
+// Ring of equally sized buffers shared by a producer and a consumer
+// thread. Free and filled buffers are counted by semaphores,
+// so each side blocks only when the other one falls behind.
+class NB_CORE_EXPORT TFileBufferRing : public TObject
+{
+NB_DISABLE_COPY(TFileBufferRing)
+public:
+  TFileBufferRing(intptr_t BufferCount, intptr_t BufferSize);
+  virtual ~TFileBufferRing();
+
+  struct TBuffer
+  {
+    char *Data;
+    DWORD Length;
+    int64_t Offset;
+  };
+
+  intptr_t GetCount() const { return FCount; }
+  intptr_t GetBufferSize() const { return FBufferSize; }
+  TBuffer &GetBuffer(intptr_t Index) { return FBuffers[Index % FCount]; }
+  HANDLE GetFreeSemaphore() const { return FFree; }
+  HANDLE GetFilledSemaphore() const { return FFilled; }
+  void Reset();
+
+private:
+  intptr_t FCount;
+  intptr_t FBufferSize;
+  rde::vector<TBuffer> FBuffers;
+  HANDLE FFree;
+  HANDLE FFilled;
+};
+
+// Writes to a file handle on a worker thread (write-behind), so that
+// a slow disk does not stall the thread servicing the network.
+// Write only copies the data to a buffer and blocks only when all
+// buffers are waiting to be written. A failed background write is raised
+// from the next Write or Flush; calling either again retries the write
+// of all the data that were not written yet. A Write that raises has not
+// moved the position, so it can be repeated with the same data.
+// The handle is not owned, but must stay open until the stream is destroyed.
+class NB_CORE_EXPORT TWriteBehindStream : public TStream
+{
+NB_DISABLE_COPY(TWriteBehindStream)
+public:
+  explicit TWriteBehindStream(HANDLE AHandle,
+    intptr_t BufferCount = DefaultBufferCount, intptr_t BufferSize = DefaultBufferSize);
+  virtual ~TWriteBehindStream();
+
+  virtual int64_t Read(void *Buffer, int64_t Count) override;
+  virtual int64_t Write(const void *Buffer, int64_t Count) override;
+  virtual int64_t Seek(int64_t Offset, int Origin) override;
+  virtual int64_t Seek(const int64_t Offset, TSeekOrigin Origin) override;
+  virtual void SetSize(const int64_t NewSize) override;
+
+  // Waits until all data are written to the file
+  void Flush();
+
+  static const intptr_t DefaultBufferCount = 8;
+  static const intptr_t DefaultBufferSize = 256 * 1024;
+
+private:
+  HANDLE FHandle;
+  TFileBufferRing FRing;
+  HANDLE FThread;
+  HANDLE FErrorEvent;
+  HANDLE FRetryEvent;
+  volatile LONG FError;
+  bool FErrorRaised;
+  volatile bool FTerminated;
+  intptr_t FSubmitIndex;
+  intptr_t FWriteIndex;
+  bool FFilling;
+  int64_t FPosition;
+
+  void CheckError();
+  void AcquireBuffer();
+  void SubmitBuffer();
+  void ProcessWrites();
+  static DWORD WINAPI WriterThreadProc(void *Parameter);
+};
+
+// Reads a file handle ahead on a worker thread (read-ahead), sequentially
+// from its current position. Seeking restarts the read-ahead.
+// The handle is not owned, but must stay open until the stream is destroyed.
+class NB_CORE_EXPORT TReadAheadStream : public TStream
+{
+NB_DISABLE_COPY(TReadAheadStream)
+public:
+  explicit TReadAheadStream(HANDLE AHandle,
+    intptr_t BufferCount = DefaultBufferCount, intptr_t BufferSize = DefaultBufferSize);
+  virtual ~TReadAheadStream();
+
+  virtual int64_t Read(void *Buffer, int64_t Count) override;
+  virtual int64_t Write(const void *Buffer, int64_t Count) override;
+  virtual int64_t Seek(int64_t Offset, int Origin) override;
+  virtual int64_t Seek(const int64_t Offset, TSeekOrigin Origin) override;
+  virtual void SetSize(const int64_t NewSize) override;
+
+  static const intptr_t DefaultBufferCount = 8;
+  static const intptr_t DefaultBufferSize = 256 * 1024;
+
+private:
+  HANDLE FHandle;
+  TFileBufferRing FRing;
+  HANDLE FThread;
+  volatile bool FTerminated;
+  // set by the worker, with the semaphore releases ordering the accesses
+  DWORD FError;
+  bool FEof;
+  intptr_t FReadIndex;
+  intptr_t FConsumeIndex;
+  // position within the buffer being consumed, NPOS if none
+  intptr_t FConsumed;
+  int64_t FPosition;
+
+  void Start();
+  void Stop();
+  void ProcessReads();
+  static DWORD WINAPI ReaderThreadProc(void *Parameter);
+};
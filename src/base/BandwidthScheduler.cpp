@@ -0,0 +1,249 @@
+
+#include <vcl.h>
+#pragma hdrstop
+
+#include <Common.h>
+#include <BandwidthScheduler.h>
+
+static const LONG DefaultBandwidthBurst = 1000;
+// Transfers that have not asked for bandwidth during the last window
+// no longer count as competing for the global cap
+static const DWORD BandwidthWindow = 500;
+// How long to wait when nothing is available
+static const uintptr_t BandwidthWaitTime = 50;
+
+static TBandwidthScheduler BandwidthSchedulers[2];
+
+TBandwidthScheduler *GetBandwidthScheduler(TBandwidthDirection Direction)
+{
+  return &BandwidthSchedulers[Direction];
+}
+
+// Negative limits mean no limit, the limits beyond LONG are capped
+static LONG ClampLimit(intptr_t Value)
+{
+  return static_cast<LONG>(std::min<int64_t>(std::max<int64_t>(Value, 0), MAXLONG));
+}
+
+// Adds Count tokens to Tokens, never exceeding Capacity.
+// Tokens may be negative, when more was transferred than was available.
+static void AddTokens(volatile LONG &Tokens, LONG Count, LONG Capacity)
+{
+  LONG Old, New;
+  do
+  {
+    Old = Tokens;
+    New = (Old > Capacity - Count) ? Capacity : Old + Count;
+  }
+  while (::InterlockedCompareExchange(&Tokens, New, Old) != Old);
+}
+
+// Claims the time elapsed since LastRefill, returning the number of tokens
+// it is worth at Rate bytes per second. Only one of concurrent callers
+// wins the time slice, others get zero.
+static LONG ClaimElapsed(volatile LONG &LastRefill, LONG Rate)
+{
+  LONG Result = 0;
+  LONG Last = LastRefill;
+  DWORD Now = ::GetTickCount();
+  DWORD Elapsed = Now - static_cast<DWORD>(Last);
+  if (Elapsed > 0)
+  {
+    int64_t Count = static_cast<int64_t>(Rate) * Elapsed / MSecsPerSec;
+    // Do not claim the time slice until it is worth at least one byte,
+    // otherwise low limits would never refill
+    if ((Count > 0) &&
+        (::InterlockedCompareExchange(&LastRefill, static_cast<LONG>(Now), Last) == Last))
+    {
+      Result = static_cast<LONG>(std::min(Count, static_cast<int64_t>(MAXLONG)));
+    }
+  }
+  return Result;
+}
+
+TBandwidthScheduler::TBandwidthScheduler() :
+  FLimit(0),
+  FBurst(DefaultBandwidthBurst),
+  FTokens(0),
+  FLastRefill(static_cast<LONG>(::GetTickCount())),
+  FWindow(0),
+  FWindowWeight(0),
+  FLastWindowWeight(0)
+{
+}
+
+void TBandwidthScheduler::SetLimit(intptr_t Value)
+{
+  LONG Limit = ClampLimit(Value);
+  if (::InterlockedExchange(&FLimit, Limit) != Limit)
+  {
+    // Start with an empty bucket, so that the new limit is not exceeded
+    // by a burst accumulated under the previous one
+    ::InterlockedExchange(&FTokens, 0);
+    ::InterlockedExchange(&FLastRefill, static_cast<LONG>(::GetTickCount()));
+  }
+}
+
+void TBandwidthScheduler::SetBurst(uintptr_t MSecs)
+{
+  ::InterlockedExchange(&FBurst, static_cast<LONG>(std::max<uintptr_t>(MSecs, 1)));
+}
+
+LONG TBandwidthScheduler::GetCapacity(intptr_t Rate) const
+{
+  int64_t Result = static_cast<int64_t>(Rate) * FBurst / MSecsPerSec;
+  return static_cast<LONG>(std::max<int64_t>(std::min<int64_t>(Result, MAXLONG), 1));
+}
+
+void TBandwidthScheduler::Refill()
+{
+  LONG Count = ClaimElapsed(FLastRefill, FLimit);
+  if (Count > 0)
+  {
+    AddTokens(FTokens, Count, GetCapacity(FLimit));
+  }
+}
+
+intptr_t TBandwidthScheduler::Available(intptr_t Size)
+{
+  intptr_t Result = Size;
+  if (FLimit > 0)
+  {
+    Refill();
+    Result = std::max<intptr_t>(std::min<intptr_t>(Result, FTokens), 0);
+  }
+  return Result;
+}
+
+intptr_t TBandwidthScheduler::GetShare(LONG &Window, intptr_t Weight)
+{
+  LONG Current = static_cast<LONG>(::GetTickCount() / BandwidthWindow);
+  LONG Last = FWindow;
+  if ((Last != Current) &&
+      (::InterlockedCompareExchange(&FWindow, Current, Last) == Last))
+  {
+    // Only the winner of the window switch moves the weights,
+    // the weight of an idle period is not carried over
+    LONG WindowWeight = ::InterlockedExchange(&FWindowWeight, 0);
+    ::InterlockedExchange(&FLastWindowWeight, (Current == Last + 1) ? WindowWeight : 0);
+  }
+  if (Window != Current)
+  {
+    Window = Current;
+    ::InterlockedExchangeAdd(&FWindowWeight, static_cast<LONG>(Weight));
+  }
+  // The current window may not have seen all the transfers yet,
+  // the last one may still count transfers that have finished since
+  LONG CurrentWeight = FWindowWeight;
+  LONG LastWeight = FLastWindowWeight;
+  int64_t TotalWeight = std::max<int64_t>(std::max(CurrentWeight, LastWeight), Weight);
+  int64_t Result = static_cast<int64_t>(FLimit) * Weight / TotalWeight;
+  return static_cast<intptr_t>(std::max<int64_t>(Result, 1));
+}
+
+void TBandwidthScheduler::Consume(intptr_t Size)
+{
+  if ((FLimit > 0) && (Size > 0))
+  {
+    ::InterlockedExchangeAdd(&FTokens, -static_cast<LONG>(Size));
+  }
+}
+
+TBandwidthBucket::TBandwidthBucket(TBandwidthDirection Direction, intptr_t Weight) :
+  FDirection(Direction),
+  FWeight((Weight > 0) ? Weight : 1),
+  FLimit(0),
+  FTokens(0),
+  FLastRefill(static_cast<LONG>(::GetTickCount())),
+  FShareTokens(0),
+  FShareLastRefill(static_cast<LONG>(::GetTickCount())),
+  FShareWindow(-1)
+{
+}
+
+void TBandwidthBucket::SetLimit(intptr_t Value)
+{
+  LONG Limit = ClampLimit(Value);
+  if (::InterlockedExchange(&FLimit, Limit) != Limit)
+  {
+    // Allow the first second worth of data right away,
+    // as the previous per-second limiter did
+    ::InterlockedExchange(&FTokens, Limit);
+    ::InterlockedExchange(&FLastRefill, static_cast<LONG>(::GetTickCount()));
+  }
+}
+
+void TBandwidthBucket::Refill()
+{
+  LONG Count = ClaimElapsed(FLastRefill, FLimit);
+  if (Count > 0)
+  {
+    // per-transfer burst is one second worth of data
+    AddTokens(FTokens, Count, FLimit);
+  }
+}
+
+intptr_t TBandwidthBucket::AvailableShare(intptr_t Size)
+{
+  // The share is refilled over the elapsed time, at the rate given by
+  // the weights, so it does not depend on how often the transfer asks
+  TBandwidthScheduler *Scheduler = GetBandwidthScheduler(FDirection);
+  intptr_t Rate = Scheduler->GetShare(FShareWindow, FWeight);
+  LONG Count = ClaimElapsed(FShareLastRefill, static_cast<LONG>(Rate));
+  if (Count > 0)
+  {
+    AddTokens(FShareTokens, Count, Scheduler->GetCapacity(Rate));
+  }
+  intptr_t Result = std::max<intptr_t>(std::min<intptr_t>(Size, FShareTokens), 0);
+  if (Result > 0)
+  {
+    // the shares are computed from the recent windows only,
+    // the global bucket keeps the sum of them within the cap
+    Result = Scheduler->Available(Result);
+  }
+  return Result;
+}
+
+intptr_t TBandwidthBucket::Available(intptr_t Size)
+{
+  intptr_t Result = Size;
+  if (FLimit > 0)
+  {
+    Refill();
+    Result = std::max<intptr_t>(std::min<intptr_t>(Result, FTokens), 0);
+  }
+  if ((Result > 0) && (GetBandwidthScheduler(FDirection)->GetLimit() > 0))
+  {
+    Result = AvailableShare(Result);
+  }
+  return Result;
+}
+
+void TBandwidthBucket::Consume(intptr_t Size)
+{
+  if (Size > 0)
+  {
+    if (FLimit > 0)
+    {
+      ::InterlockedExchangeAdd(&FTokens, -static_cast<LONG>(Size));
+    }
+    TBandwidthScheduler *Scheduler = GetBandwidthScheduler(FDirection);
+    if (Scheduler->GetLimit() > 0)
+    {
+      ::InterlockedExchangeAdd(&FShareTokens, -static_cast<LONG>(Size));
+      Scheduler->Consume(Size);
+    }
+  }
+}
+
+intptr_t TBandwidthBucket::Acquire(intptr_t Size)
+{
+  intptr_t Result = Available(Size);
+  Consume(Result);
+  return Result;
+}
+
+uintptr_t TBandwidthBucket::GetWaitTime() const
+{
+  return BandwidthWaitTime;
+}
@@ -0,0 +1,97 @@
+
+#pragma once
+
+#include <Classes.hpp>
+
+enum TBandwidthDirection
+{
+  bdDownload = 0,
+  bdUpload = 1,
+};
+
+// Transfers the user waits for get a larger share of the global cap
+// than the background queue transfers
+const intptr_t ForegroundBandwidthWeight = 2;
+const intptr_t BackgroundBandwidthWeight = 1;
+
+// Token bucket shared by all transfers going in one direction,
+// regardless of protocol. It enforces the global cap only;
+// per-transfer limits are kept in TBandwidthBucket.
+// It also sums the weights of the transfers active in the recent
+// time window, so that each transfer can refill its own share
+// of the cap at the rate given by its weight.
+// All members are updated with interlocked operations,
+// so the data path never blocks on a lock.
+class NB_CORE_EXPORT TBandwidthScheduler : public TObject
+{
+NB_DISABLE_COPY(TBandwidthScheduler)
+public:
+  TBandwidthScheduler();
+
+  // Bytes per second, 0 = unlimited
+  void SetLimit(intptr_t Value);
+  intptr_t GetLimit() const { return FLimit; }
+  // How long an idle direction may accumulate unused bandwidth
+  void SetBurst(uintptr_t MSecs);
+  uintptr_t GetBurst() const { return FBurst; }
+
+  intptr_t Available(intptr_t Size);
+  void Consume(intptr_t Size);
+  // Bytes per second due to a transfer with Weight,
+  // Window is the last time window the transfer was counted in
+  intptr_t GetShare(LONG &Window, intptr_t Weight);
+  LONG GetCapacity(intptr_t Rate) const;
+
+private:
+  volatile LONG FLimit;
+  volatile LONG FBurst;
+  volatile LONG FTokens;
+  volatile LONG FLastRefill;
+  volatile LONG FWindow;
+  volatile LONG FWindowWeight;
+  volatile LONG FLastWindowWeight;
+
+  void Refill();
+};
+
+// Per-transfer token bucket. It is owned by a single transfer,
+// so it can be freely copied along with its owner.
+class NB_CORE_EXPORT TBandwidthBucket
+{
+public:
+  explicit TBandwidthBucket(TBandwidthDirection Direction = bdDownload, intptr_t Weight = 1);
+
+  void SetDirection(TBandwidthDirection Value) { FDirection = Value; }
+  TBandwidthDirection GetDirection() const { return FDirection; }
+  // Relative share of the global cap when transfers compete for it
+  void SetWeight(intptr_t Value) { FWeight = (Value > 0) ? Value : 1; }
+  intptr_t GetWeight() const { return FWeight; }
+  // Bytes per second of this transfer, 0 = unlimited
+  void SetLimit(intptr_t Value);
+  intptr_t GetLimit() const { return FLimit; }
+
+  // How much of Size may be transferred now, without consuming it
+  intptr_t Available(intptr_t Size);
+  // Accounts actually transferred bytes
+  void Consume(intptr_t Size);
+  // Available + Consume
+  intptr_t Acquire(intptr_t Size);
+  // Suggested time to wait when nothing is available
+  uintptr_t GetWaitTime() const;
+
+private:
+  TBandwidthDirection FDirection;
+  intptr_t FWeight;
+  volatile LONG FLimit;
+  volatile LONG FTokens;
+  volatile LONG FLastRefill;
+  // this transfer's share of the global cap
+  volatile LONG FShareTokens;
+  volatile LONG FShareLastRefill;
+  LONG FShareWindow;
+
+  void Refill();
+  intptr_t AvailableShare(intptr_t Size);
+};
+
+NB_CORE_EXPORT TBandwidthScheduler *GetBandwidthScheduler(TBandwidthDirection Direction);
@@ -8,6 +8,8 @@
 #include <Sysutils.hpp>
 #include <rtlconsts.h>
 #include <FileBuffer.h>
+#include <rdestl/sort.h>
+#include <rdestl/radix_sorter.h>
 
 static TGlobals *GlobalFunctions = nullptr;
 
@@ -332,6 +334,9 @@ const intptr_t MSecsPerDay = SecsPerDay * MSecsPerSec;
 const intptr_t DateDelta = 693594;
 const intptr_t UnixDateDelta = 25569;
 static const int MemoryDelta = 0x2000;
+// Clear keeps buffers up to this size for reuse
+static const int64_t MemoryKeepCapacity = 0x40000;
+static const int64_t MemoryVirtualThreshold = 0x1000000;
 
 TStrings::TStrings() :
   TObjectList(OBJECT_CLASS_TStrings),
@@ -470,7 +475,7 @@ void TStrings::SetDelimitedText(UnicodeString Value)
   }
 }
 
-intptr_t TStrings::CompareStrings(UnicodeString S1, UnicodeString S2) const
+intptr_t TStrings::CompareStrings(const UnicodeString &S1, const UnicodeString &S2) const
 {
   return static_cast<intptr_t>(::AnsiCompareText(S1, S2));
 }
@@ -752,7 +757,9 @@ intptr_t StringListCompareStrings(TStringList *List, intptr_t Index1, intptr_t I
 TStringList::TStringList(TObjectClassId Kind) :
   TStrings(Kind),
   FSorted(false),
-  FCaseSensitive(false)
+  FCaseSensitive(false),
+  FHashed(false),
+  FIndexValid(false)
 {
   SetOwnsObjects(false);
 }
@@ -840,7 +847,8 @@ intptr_t TStringList::IndexOf(UnicodeString S) const
   intptr_t Result = NPOS;
   if (!GetSorted())
   {
-    Result = TStrings::IndexOf(S);
+    // sorted lists bisect, the index would only slow down their inserts
+    Result = FHashed ? HashedIndexOf(S) : TStrings::IndexOf(S);
   }
   else
   {
@@ -866,6 +874,7 @@ void TStringList::SetString(intptr_t Index, UnicodeString S)
   if (Index < static_cast<intptr_t>(FStrings.size()))
   {
     FStrings[Index] = S;
+    InvalidateIndex();
   }
   else
   {
@@ -881,11 +890,19 @@ void TStringList::Delete(intptr_t Index)
     Error(SListIndexError, Index);
   }
   Changing();
+  ItemDeleted(Index);
   FStrings.erase(FStrings.begin() + Index);
   TObjectList::Delete(Index);
   Changed();
 }
 
+void TStringList::Clear()
+{
+  // no point maintaining the index item by item
+  InvalidateIndex();
+  TObjectList::Clear();
+}
+
 void TStringList::InsertObject(intptr_t Index, UnicodeString Key, TObject *AObject)
 {
   if (GetSorted())
@@ -917,6 +934,7 @@ void TStringList::InsertItem(intptr_t Index, UnicodeString S, TObject *AObject)
 
     TObjectList::Insert(Index, AObject);
   }
+  ItemInserted(Index);
   Changed();
 }
 
@@ -948,6 +966,7 @@ void TStringList::SetCaseSensitive(bool Value)
   if (Value != FCaseSensitive)
   {
     FCaseSensitive = Value;
+    InvalidateIndex();
     if (GetSorted())
     {
       Sort();
@@ -964,6 +983,7 @@ void TStringList::SetSorted(bool Value)
       Sort();
     }
     FSorted = Value;
+    InvalidateIndex();
   }
 }
 
@@ -1038,79 +1058,326 @@ void TStringList::CustomSort(TStringListSortCompare ACompareFunc)
   if (!GetSorted() && (GetCount() > 1))
   {
     Changing();
-    QuickSort(0, GetCount() - 1, ACompareFunc);
+    // items stay in place while their order is computed,
+    // so the compare function sees the original indexes
+    rde::vector<rde::uint32> Order(GetCount());
+    for (intptr_t Index = 0; Index < GetCount(); ++Index)
+    {
+      Order[Index] = static_cast<rde::uint32>(Index);
+    }
+    SortOrder(Order, ACompareFunc);
+    ApplyOrder(Order);
+    InvalidateIndex();
     Changed();
   }
 }
 
-void TStringList::QuickSort(intptr_t L, intptr_t R, TStringListSortCompare SCompare)
+namespace {
+
+const intptr_t IntroSortThreshold = 16;
+const intptr_t SortKeyThreshold = 256;
+
+template<typename T, class TPredicate>
+void MoveMedianToFirst(T *Result, T *A, T *B, T *C, TPredicate Pred)
 {
-  intptr_t Index;
-  do
+  if (Pred(*A, *B))
   {
-    Index = L;
-    intptr_t J = R;
-    intptr_t P = (L + R) >> 1;
-    do
+    if (Pred(*B, *C))
+      rde::swap(*Result, *B);
+    else if (Pred(*A, *C))
+      rde::swap(*Result, *C);
+    else
+      rde::swap(*Result, *A);
+  }
+  else if (Pred(*A, *C))
+    rde::swap(*Result, *A);
+  else if (Pred(*B, *C))
+    rde::swap(*Result, *C);
+  else
+    rde::swap(*Result, *B);
+}
+
+template<typename T, class TPredicate>
+T *UnguardedPartition(T *First, T *Last, T *Pivot, TPredicate Pred)
+{
+  while (true)
+  {
+    while (Pred(*First, *Pivot))
+      ++First;
+    --Last;
+    while (Pred(*Pivot, *Last))
+      --Last;
+    if (!(First < Last))
+      return First;
+    rde::swap(*First, *Last);
+    ++First;
+  }
+}
+
+// Quick sort falling back to heap sort on degenerate input
+// and finishing small partitions with insertion sort
+template<typename T, class TPredicate>
+void IntroSort(T *Begin, T *End, intptr_t DepthLimit, TPredicate Pred)
+{
+  while (End - Begin > IntroSortThreshold)
+  {
+    if (DepthLimit == 0)
     {
-      while (SCompare(this, Index, P) < 0)
+      rde::heap_sort(Begin, End, Pred);
+      return;
+    }
+    --DepthLimit;
+    T *Mid = Begin + (End - Begin) / 2;
+    MoveMedianToFirst(Begin, Begin + 1, Mid, End - 1, Pred);
+    T *Cut = UnguardedPartition(Begin + 1, End, Begin, Pred);
+    IntroSort(Cut, End, DepthLimit, Pred);
+    End = Cut;
+  }
+  rde::insertion_sort(Begin, End, Pred);
+}
+
+template<typename T, class TPredicate>
+void IntroSort(T *Begin, T *End, TPredicate Pred)
+{
+  intptr_t DepthLimit = 0;
+  for (intptr_t Count = End - Begin; Count > 1; Count >>= 1)
+  {
+    DepthLimit += 2;
+  }
+  IntroSort(Begin, End, DepthLimit, Pred);
+}
+
+struct TIndexLess
+{
+  TStringList *List;
+  TStringListSortCompare *Compare;
+  bool operator()(rde::uint32 Index1, rde::uint32 Index2) const
+  {
+    return Compare(List, Index1, Index2) < 0;
+  }
+};
+
+// Binary sort keys order the same way as CompareString with the same flags
+void GetSortKey(const UnicodeString &S, bool CaseSensitive, RawByteString &Key)
+{
+  const DWORD Flags = LCMAP_SORTKEY | SORT_STRINGSORT | (CaseSensitive ? 0 : NORM_IGNORECASE);
+  int Size = ::LCMapString(0, Flags, S.c_str(), -1, nullptr, 0);
+  if (Size <= 0)
+  {
+    Key.Clear();
+    return;
+  }
+  char *Buffer = Key.SetLength(Size);
+  ::LCMapString(0, Flags, S.c_str(), -1, reinterpret_cast<wchar_t *>(Buffer), Size);
+}
+
+struct TSortKeyLess
+{
+  const rde::vector<RawByteString> *Keys;
+  bool operator()(rde::uint32 Index1, rde::uint32 Index2) const
+  {
+    const RawByteString &Key1 = (*Keys)[Index1];
+    const RawByteString &Key2 = (*Keys)[Index2];
+    intptr_t Length = (Key1.Length() < Key2.Length()) ? Key1.Length() : Key2.Length();
+    int C = memcmp(Key1.c_str(), Key2.c_str(), Length);
+    return (C < 0) || ((C == 0) && (Key1.Length() < Key2.Length()));
+  }
+};
+
+struct TSortKeyPrefix
+{
+  const rde::vector<RawByteString> *Keys;
+  rde::uint32 operator()(rde::uint32 Index) const
+  {
+    // first four bytes, big endian, so that the numeric order is the key order
+    const RawByteString &Key = (*Keys)[Index];
+    rde::uint32 Result = 0;
+    for (intptr_t I = 0; I < 4; ++I)
+    {
+      Result = (Result << 8) | ((I < Key.Length()) ? static_cast<uint8_t>(Key.c_str()[I]) : 0);
+    }
+    return Result;
+  }
+};
+
+} // namespace
+
+void TStringList::SortOrder(rde::vector<rde::uint32> &Order, TStringListSortCompare SCompare)
+{
+  rde::uint32 *Begin = Order.begin();
+  intptr_t Count = static_cast<intptr_t>(Order.size());
+  if ((SCompare == StringListCompareStrings) && (Count >= SortKeyThreshold))
+  {
+    // Large lists: compare binary sort keys instead of calling CompareString
+    // for every pair, and bucket them by the key prefix with a radix pass first
+    rde::vector<RawByteString> Keys(Count);
+    for (intptr_t Index = 0; Index < Count; ++Index)
+    {
+      GetSortKey(FStrings[Index], GetCaseSensitive(), Keys[Index]);
+    }
+    TSortKeyPrefix Prefix = { &Keys };
+    rde::radix_sorter<rde::uint32> Sorter;
+    Sorter.sort<rde::radix_sorter<rde::uint32>::data_unsigned>(Begin, static_cast<int>(Count), Prefix);
+
+    TSortKeyLess Less = { &Keys };
+    intptr_t Start = 0;
+    while (Start < Count)
+    {
+      rde::uint32 StartPrefix = Prefix(Begin[Start]);
+      intptr_t Stop = Start + 1;
+      while ((Stop < Count) && (Prefix(Begin[Stop]) == StartPrefix))
       {
-        Index++;
+        ++Stop;
       }
-      while (SCompare(this, J, P) > 0)
+      if (Stop - Start > 1)
       {
-        J--;
+        IntroSort(Begin + Start, Begin + Stop, Less);
       }
-      if (Index <= J)
+      Start = Stop;
+    }
+  }
+  else
+  {
+    TIndexLess Less = { this, SCompare };
+    IntroSort(Begin, Begin + Count, Less);
+  }
+}
+
+void TStringList::ApplyOrder(rde::vector<rde::uint32> &Order)
+{
+  // Follow the permutation cycles, moving each string once
+  intptr_t Count = static_cast<intptr_t>(Order.size());
+  for (intptr_t Index = 0; Index < Count; ++Index)
+  {
+    if (static_cast<intptr_t>(Order[Index]) == Index)
+    {
+      continue;
+    }
+    UnicodeString S(std::move(FStrings[Index]));
+    TObject *Obj = TObjectList::GetObj(Index);
+    intptr_t J = Index;
+    while (true)
+    {
+      intptr_t K = static_cast<intptr_t>(Order[J]);
+      Order[J] = static_cast<rde::uint32>(J);
+      if (K == Index)
       {
-        ExchangeItems(Index, J);
-        if (P == Index)
-        {
-          P = J;
-        }
-        else if (P == J)
+        FStrings[J] = std::move(S);
+        TObjectList::SetItem(J, Obj);
+        break;
+      }
+      FStrings[J] = std::move(FStrings[K]);
+      TObjectList::SetItem(J, TObjectList::GetObj(K));
+      J = K;
+    }
+  }
+}
+
+void TStringList::SetHashed(bool Value)
+{
+  if (Value != FHashed)
+  {
+    FHashed = Value;
+    InvalidateIndex();
+  }
+}
+
+rde::hash_value_t TStringList::HashString(const UnicodeString &S) const
+{
+  // Hash of the sort key, so that strings equal for CompareStrings
+  // (case-insensitively or linguistically) hash the same
+  RawByteString Key;
+  GetSortKey(S, GetCaseSensitive(), Key);
+  rde::hash_value_t Result = 2166136261u;
+  for (intptr_t Index = 0; Index < Key.Length(); ++Index)
+  {
+    Result = (Result ^ static_cast<uint8_t>(Key.c_str()[Index])) * 16777619u;
+  }
+  return Result;
+}
+
+intptr_t TStringList::HashedIndexOf(const UnicodeString &S) const
+{
+  if (!FIndexValid)
+  {
+    FIndex.clear();
+    for (intptr_t Index = 0; Index < GetCount(); ++Index)
+    {
+      // keeps the first index of equal hashes
+      FIndex.insert(TStringIndex::value_type(HashString(FStrings[Index]), Index));
+    }
+    FIndexValid = true;
+  }
+  intptr_t Result = NPOS;
+  TStringIndex::const_iterator It = FIndex.find(HashString(S));
+  if (It != FIndex.end())
+  {
+    if (CompareStrings(FStrings[It->second], S) == 0)
+    {
+      Result = It->second;
+    }
+    else
+    {
+      // hash collision, an equal string can only follow
+      for (intptr_t Index = It->second + 1; Index < GetCount(); ++Index)
+      {
+        if (CompareStrings(FStrings[Index], S) == 0)
         {
-          P = Index;
+          Result = Index;
+          break;
         }
-        Index++;
-        J--;
       }
     }
-    while (Index <= J);
-    if (L < J)
+  }
+  return Result;
+}
+
+void TStringList::ItemInserted(intptr_t Index)
+{
+  if (FIndexValid)
+  {
+    if (Index < GetCount() - 1)
     {
-      QuickSort(L, J, SCompare);
+      // shifting all following indexes would make the insert O(n),
+      // rebuild on the next lookup instead (rare for unsorted lists)
+      InvalidateIndex();
+    }
+    else
+    {
+      // appended, any earlier equal hash keeps its lower index
+      FIndex.insert(TStringIndex::value_type(HashString(FStrings[Index]), Index));
     }
-    L = Index;
   }
-  while (Index < R);
 }
 
-void TStringList::ExchangeItems(intptr_t Index1, intptr_t Index2)
+void TStringList::ItemDeleted(intptr_t Index)
 {
-  bool Owns = GetOwnsObjects();
-  SetOwnsObjects(false);
+  if (FIndexValid)
   {
-    SCOPE_EXIT
+    if (Index < GetCount() - 1)
     {
-      SetOwnsObjects(Owns);
-    };
-    UnicodeString SItem1 = FStrings[Index1];
-    TObject *OItem1 = TObjectList::GetObj(Index1);
-    FStrings[Index1] = FStrings[Index2];
-    TObjectList::SetItem(Index1, TObjectList::GetObj(Index2));
-    FStrings[Index2] = SItem1;
-    TObjectList::SetItem(Index2, OItem1);
+      InvalidateIndex();
+    }
+    else
+    {
+      rde::hash_value_t Hash = HashString(FStrings[Index]);
+      TStringIndex::iterator Found = FIndex.find(Hash);
+      if ((Found != FIndex.end()) && (Found->second == Index))
+      {
+        FIndex.erase(Hash);
+      }
+    }
   }
 }
 
-intptr_t TStringList::CompareStrings(UnicodeString S1, UnicodeString S2) const
+intptr_t TStringList::CompareStrings(const UnicodeString &S1, const UnicodeString &S2) const
 {
+  // same as AnsiCompareStr/AnsiCompareText, without copying the strings
   if (GetCaseSensitive())
   {
-    return AnsiCompareStr(S1, S2);
+    return ::StringCmp(S1.c_str(), S2.c_str());
   }
-  return AnsiCompareText(S1, S2);
+  return ::StringCmpI(S1.c_str(), S2.c_str());
 }
 
 TDateTime::TDateTime(uint16_t Hour,
@@ -1418,13 +1685,15 @@ TMemoryStream::TMemoryStream() :
   FMemory(nullptr),
   FSize(0),
   FPosition(0),
-  FCapacity(0)
+  FCapacity(0),
+  FVirtualThreshold(MemoryVirtualThreshold),
+  FVirtual(false)
 {
 }
 
 TMemoryStream::~TMemoryStream()
 {
-  Clear();
+  SetCapacity(0);
 }
 
 int64_t TMemoryStream::Read(void *Buffer, int64_t Count)
@@ -1488,15 +1757,26 @@ void TMemoryStream::SaveToFile(UnicodeString /*AFileName*/)
 
 void TMemoryStream::Clear()
 {
-  SetCapacity(0);
   FSize = 0;
   FPosition = 0;
+  // streams cleared and refilled block by block keep their buffer
+  if (FCapacity > MemoryKeepCapacity)
+  {
+    SetCapacity(0);
+  }
 }
 
 void TMemoryStream::SetSize(const int64_t NewSize)
 {
   int64_t OldPosition = FPosition;
-  SetCapacity(NewSize);
+  if (NewSize > FCapacity)
+  {
+    Grow(NewSize);
+  }
+  else if ((NewSize < FCapacity / 4) && (FCapacity > MemoryKeepCapacity))
+  {
+    SetCapacity(NewSize);
+  }
   FSize = NewSize;
   if (OldPosition > NewSize)
   {
@@ -1510,6 +1790,40 @@ void TMemoryStream::SetCapacity(int64_t NewCapacity)
   FCapacity = NewCapacity;
 }
 
+void TMemoryStream::Grow(int64_t MinCapacity)
+{
+  // geometric growth, so that buffers built piece by piece
+  // are not copied over and over
+  int64_t NewCapacity = FCapacity + FCapacity / 2;
+  if (NewCapacity < MinCapacity)
+  {
+    NewCapacity = MinCapacity;
+  }
+  SetCapacity(NewCapacity);
+}
+
+void TMemoryStream::Reserve(int64_t Capacity)
+{
+  if (Capacity > FCapacity)
+  {
+    SetCapacity(Capacity);
+  }
+}
+
+void TMemoryStream::FreeMemory()
+{
+  if (FVirtual)
+  {
+    ::VirtualFree(FMemory, 0, MEM_RELEASE);
+  }
+  else
+  {
+    nb_free(FMemory);
+  }
+  FMemory = nullptr;
+  FVirtual = false;
+}
+
 void *TMemoryStream::Realloc(int64_t &NewCapacity)
 {
   if ((NewCapacity > 0) && (NewCapacity != FSize))
@@ -1519,17 +1833,19 @@ void *TMemoryStream::Realloc(int64_t &NewCapacity)
   void *Result = FMemory;
   if (NewCapacity != FCapacity)
   {
+    bool Virtual = (FVirtualThreshold > 0) && (NewCapacity >= FVirtualThreshold);
     if (NewCapacity == 0)
     {
-      nb_free(FMemory);
-      FMemory = nullptr;
+      FreeMemory();
       Result = nullptr;
     }
-    else
+    else if (!Virtual && !FVirtual)
     {
+      // contents beyond the size are always written before being read,
+      // no need to zero them
       if (FCapacity == 0)
       {
-        Result = nb::calloc<void *>(1, static_cast<::size_t>(NewCapacity));
+        Result = nb_malloc_uninit(static_cast<::size_t>(NewCapacity));
       }
       else
       {
@@ -1540,6 +1856,29 @@ void *TMemoryStream::Realloc(int64_t &NewCapacity)
         throw EStreamError(FMTLOAD(SMemoryStreamError));
       }
     }
+    else
+    {
+      // very large buffers are mapped directly, so that their memory
+      // goes back to the system as soon as they are released
+      if (Virtual)
+      {
+        Result = ::VirtualAlloc(nullptr, static_cast<::size_t>(NewCapacity), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+      }
+      else
+      {
+        Result = nb_malloc_uninit(static_cast<::size_t>(NewCapacity));
+      }
+      if (Result == nullptr)
+      {
+        throw EStreamError(FMTLOAD(SMemoryStreamError));
+      }
+      if (FMemory != nullptr)
+      {
+        memmove(Result, FMemory, static_cast<::size_t>(FSize < NewCapacity ? FSize : NewCapacity));
+        FreeMemory();
+      }
+      FVirtual = Virtual;
+    }
   }
   return Result;
 }
@@ -1562,7 +1901,7 @@ int64_t TMemoryStream::Write(const void *Buffer, int64_t Count)
       {
         if (Pos > FCapacity)
         {
-          SetCapacity(Pos);
+          Grow(Pos);
         }
         FSize = Pos;
       }
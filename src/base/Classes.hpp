@@ -8,6 +8,7 @@
 #include <math.h>
 #include <rdestl/vector.h>
 #include <rdestl/pair.h>
+#include <rdestl/hash_map.h>
 
 #include <FastDelegate.h>
 #include <FastDelegateBind.h>
@@ -269,7 +270,7 @@ public:
   void SetQuoteChar(wchar_t Value) { FQuoteChar = Value; }
   UnicodeString GetDelimitedText() const;
   void SetDelimitedText(UnicodeString Value);
-  virtual intptr_t CompareStrings(UnicodeString S1, UnicodeString S2) const;
+  virtual intptr_t CompareStrings(const UnicodeString &S1, const UnicodeString &S2) const;
   intptr_t GetUpdateCount() const { return FUpdateCount; }
   virtual void Assign(const TPersistent *Source) override;
   virtual intptr_t GetCount() const = 0;
@@ -323,12 +324,12 @@ public:
   TNotifyEvent GetOnChanging() const { return FOnChanging; }
   void SetOnChanging(TNotifyEvent OnChanging) { FOnChanging = OnChanging; }
   void InsertItem(intptr_t Index, UnicodeString S, TObject *AObject);
-  void QuickSort(intptr_t L, intptr_t R, TStringListSortCompare SCompare);
 
   virtual void Assign(const TPersistent *Source) override;
   virtual bool Find(UnicodeString S, intptr_t &Index) const;
   virtual intptr_t IndexOf(UnicodeString S) const override;
   virtual void Delete(intptr_t Index) override;
+  virtual void Clear() override;
   virtual void InsertObject(intptr_t Index, UnicodeString Key, TObject *AObject) override;
   virtual void Sort() override;
   virtual void CustomSort(TStringListSortCompare ACompareFunc);
@@ -337,8 +338,12 @@ public:
   virtual void Changing();
   virtual void Changed() override;
   virtual void Insert(intptr_t Index, UnicodeString S, TObject *AObject = nullptr) override;
-  virtual intptr_t CompareStrings(UnicodeString S1, UnicodeString S2) const override;
+  virtual intptr_t CompareStrings(const UnicodeString &S1, const UnicodeString &S2) const override;
   virtual intptr_t GetCount() const override;
+  // Keeps a hash index of the strings for O(1) IndexOf of unsorted lists,
+  // that are appended to and searched repeatedly; sorted lists ignore it
+  bool GetHashed() const { return FHashed; }
+  void SetHashed(bool Value);
 
 public:
   virtual void SetObj(intptr_t Index, TObject *AObject) override;
@@ -357,9 +362,20 @@ private:
   rde::vector<UnicodeString> FStrings;
   bool FSorted;
   bool FCaseSensitive;
+  bool FHashed;
+  // hash of sort key -> first index with that hash
+  typedef rde::hash_map<rde::hash_value_t, intptr_t> TStringIndex;
+  mutable TStringIndex FIndex;
+  mutable bool FIndexValid;
 
 private:
-  void ExchangeItems(intptr_t Index1, intptr_t Index2);
+  rde::hash_value_t HashString(const UnicodeString &S) const;
+  intptr_t HashedIndexOf(const UnicodeString &S) const;
+  void ItemInserted(intptr_t Index);
+  void ItemDeleted(intptr_t Index);
+  void InvalidateIndex() { FIndex.clear(); FIndexValid = false; }
+  void SortOrder(rde::vector<rde::uint32> &Order, TStringListSortCompare SCompare);
+  void ApplyOrder(rde::vector<rde::uint32> &Order);
 
 private:
   TStringList(const TStringList &);
@@ -583,6 +599,10 @@ public:
   virtual int64_t Write(const void *Buffer, int64_t Count) override;
 
   void *GetMemory() const { return FMemory; }
+  void Reserve(int64_t Capacity);
+  // Capacity from which the memory is allocated directly from the system (0 = never)
+  int64_t GetVirtualThreshold() const { return FVirtualThreshold; }
+  void SetVirtualThreshold(int64_t Value) { FVirtualThreshold = Value; }
 
 protected:
   void SetPointer(void *Ptr, int64_t Size);
@@ -591,12 +611,16 @@ protected:
 
 private:
   void SetCapacity(int64_t NewCapacity);
+  void Grow(int64_t MinCapacity);
+  void FreeMemory();
 
 private:
   void *FMemory;
   int64_t FSize;
   int64_t FPosition;
   int64_t FCapacity;
+  int64_t FVirtualThreshold;
+  bool FVirtual;
 };
 
 struct TRegKeyInfo
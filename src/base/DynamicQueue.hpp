@@ -139,7 +139,7 @@ void DynamicQueue<TX>::ReAllocate(int num) {
    if (OldBuffer) nb_free(OldBuffer);            // Should not occur in single-threaded applications
 
    TX * Buffer2 = 0;                             // New buffer
-   Buffer2 = static_cast<TX *>(nb_malloc(sizeof(TX) * num));                        // Allocate new buffer
+   Buffer2 = static_cast<TX *>(nb_malloc_uninit(sizeof(TX) * num));                        // Allocate new buffer
    if (Buffer2 == 0) {Error(3,num); return;}     // Error can't allocate
    if (Buffer) {
       // A smaller buffer is previously allocated
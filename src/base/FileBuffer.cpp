@@ -41,6 +41,11 @@ void TFileBuffer::SetSize(int64_t Value)
   }
 }
 
+void TFileBuffer::Reserve(int64_t Value)
+{
+  FMemory->Reserve(Value);
+}
+
 void TFileBuffer::SetPosition(int64_t Value)
 {
   FMemory->SetPosition(Value);
@@ -127,6 +132,21 @@ void TFileBuffer::Convert(char * Source, char * Dest, intptr_t Params,
   // one character source EOL
   if (!Source[1])
   {
+    if (Dest[1])
+    {
+      // make room for the expanded EOLs at once
+      int64_t Count = 0;
+      for (int64_t Index = 0; Index < GetSize(); ++Index)
+      {
+        if (Ptr[Index] == Source[0])
+        {
+          ++Count;
+        }
+      }
+      Reserve(GetSize() + Count + 1);
+      Ptr = GetData();
+    }
+
     bool PrevToken = Token;
     Token = false;
 
@@ -42,6 +42,7 @@ public:
   char * GetData() const { return static_cast<char *>(FMemory->GetMemory()); }
   int64_t GetSize() const { return FMemory->GetSize(); }
   void SetSize(int64_t Value);
+  void Reserve(int64_t Value);
   void SetPosition(int64_t Value);
   int64_t GetPosition() const;
 
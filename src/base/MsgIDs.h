@@ -476,6 +476,9 @@ enum MsgIDs {
     NB_LOGGING_LOG_TO_FILE,
     NB_LOGGING_LOG_FILE_APPEND,
     NB_LOGGING_LOG_FILE_OVERWRITE,
+    NB_LOGGING_LOG_PROTOCOL_TRACE,
+    NB_LOGGING_DOWNLOAD_CHECKSUM,
+    NB_LOGGING_DOWNLOAD_CHECKSUM_OFF,
     NB_LOGGING_LOG_VIEW_GROUP,
     NB_LOGGING_LOG_VIEW_COMPLETE,
     NB_LOGGING_LOG_VIEW_LINES,
@@ -515,9 +518,13 @@ enum MsgIDs {
     NB_TRANSFER_AUTO_POPUP,
     NB_TRANSFER_QUEUE_BEEP,
     NB_TRANSFER_REMEMBER_PASSWORD,
+    NB_TRANSFER_BANDWIDTH_GROUP,
+    NB_TRANSFER_BANDWIDTH_DOWNLOAD,
+    NB_TRANSFER_BANDWIDTH_UPLOAD,
 
     NB_MENU_COMMANDS,
     NB_MENU_COMMANDS_LOG,
+    NB_MENU_COMMANDS_PROTOCOL_TRACE,
     NB_MENU_COMMANDS_ATTRIBUTES,
     NB_MENU_COMMANDS_LINK,
     NB_MENU_COMMANDS_CONFIGURE,
@@ -630,6 +637,7 @@ enum MsgIDs {
     NB_SYNCHRONIZE_BY_SIZE,
     NB_SYNCHRONIZE_SELECTED_ONLY,
     NB_SYNCHRONIZE_SAME_SIZE,
+    NB_SYNCHRONIZE_BY_CHECKSUM,
 
     NB_SYNCHRONIZE_TITLE,
     NB_SYNCHRONIZE_SYCHRONIZING,
@@ -170,6 +170,12 @@ AnsiString &AnsiString::operator=(const AnsiString &StrCopy)
   return *this;
 }
 
+AnsiString &AnsiString::operator=(AnsiString &&StrCopy)
+{
+  Data = std::move(StrCopy.Data);
+  return *this;
+}
+
 AnsiString &AnsiString::operator=(const UTF8String &StrCopy)
 {
   Init(StrCopy.c_str(), StrCopy.Length());
@@ -340,6 +346,12 @@ RawByteString &RawByteString::operator=(const RawByteString &StrCopy)
   return *this;
 }
 
+RawByteString &RawByteString::operator=(RawByteString &&StrCopy)
+{
+  Data = std::move(StrCopy.Data);
+  return *this;
+}
+
 RawByteString &RawByteString::operator=(const AnsiString &StrCopy)
 {
   Init(StrCopy.c_str(), StrCopy.Length());
@@ -485,6 +497,12 @@ UTF8String &UTF8String::operator=(const UTF8String &StrCopy)
   return *this;
 }
 
+UTF8String &UTF8String::operator=(UTF8String &&StrCopy)
+{
+  Data = std::move(StrCopy.Data);
+  return *this;
+}
+
 UTF8String &UTF8String::operator=(const RawByteString &StrCopy)
 {
   Init(StrCopy.c_str(), StrCopy.Length());
@@ -781,7 +799,8 @@ void UnicodeString::Unique()
 
 UnicodeString &UnicodeString::operator=(UnicodeString StrCopy)
 {
-  Init(StrCopy.c_str(), StrCopy.GetLength());
+  // StrCopy is already a private copy (or a moved temporary), take it over
+  Data = std::move(StrCopy.Data);
   return *this;
 }
 
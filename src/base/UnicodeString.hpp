@@ -12,6 +12,7 @@ class NB_CORE_EXPORT UTF8String
 public:
   UTF8String() {}
   UTF8String(const UTF8String &rhs);
+  UTF8String(UTF8String &&rhs) : Data(std::move(rhs.Data)) {}
   explicit UTF8String(UnicodeString Str);
   UTF8String(const wchar_t *Str);
   explicit UTF8String(const wchar_t *Str, intptr_t Length);
@@ -41,6 +42,7 @@ public:
 public:
   UTF8String &operator=(UnicodeString StrCopy);
   UTF8String &operator=(const UTF8String &StrCopy);
+  UTF8String &operator=(UTF8String &&StrCopy);
   UTF8String &operator=(const RawByteString &StrCopy);
   UTF8String &operator=(const char *lpszData);
   UTF8String &operator=(const wchar_t *lpwszData);
@@ -79,6 +81,7 @@ public:
   UnicodeString(intptr_t Length, wchar_t Ch) : Data(Ch, (int)Length) {}
 
   UnicodeString(const UnicodeString &Str);
+  UnicodeString(UnicodeString &&Str) : Data(std::move(Str.Data)) {}
   explicit UnicodeString(const UTF8String &Str);
   explicit UnicodeString(const AnsiString &Str);
 
@@ -205,6 +208,7 @@ class NB_CORE_EXPORT AnsiString
 public:
   AnsiString() {}
   AnsiString(const AnsiString &rhs);
+  AnsiString(AnsiString &&rhs) : Data(std::move(rhs.Data)) {}
   AnsiString(intptr_t Length, char Ch) : Data(Ch, (int)Length) {}
   explicit AnsiString(const wchar_t *Str);
   explicit AnsiString(const wchar_t *Str, intptr_t Length);
@@ -246,6 +250,7 @@ public:
   AnsiString &operator=(UnicodeString StrCopy);
   AnsiString &operator=(const RawByteString &StrCopy);
   AnsiString &operator=(const AnsiString &StrCopy);
+  AnsiString &operator=(AnsiString &&StrCopy);
   AnsiString &operator=(const UTF8String &StrCopy);
   AnsiString &operator=(const char *Str);
   AnsiString &operator=(const wchar_t *Str);
@@ -295,6 +300,7 @@ public:
   explicit RawByteString(const unsigned char *Str, intptr_t Length);
   RawByteString(UnicodeString Str);
   RawByteString(const RawByteString &Str);
+  RawByteString(RawByteString &&Str) : Data(std::move(Str.Data)) {}
   RawByteString(const AnsiString &Str);
   RawByteString(const UTF8String &Str);
   ~RawByteString() {}
@@ -322,6 +328,7 @@ public:
 public:
   RawByteString &operator=(UnicodeString StrCopy);
   RawByteString &operator=(const RawByteString &StrCopy);
+  RawByteString &operator=(RawByteString &&StrCopy);
   RawByteString &operator=(const AnsiString &StrCopy);
   RawByteString &operator=(const UTF8String &StrCopy);
   RawByteString &operator=(const char *lpszData);
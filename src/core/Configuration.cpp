@@ -7,11 +7,13 @@
 #include <Common.h>
 #include <Exceptions.h>
 #include "Configuration.h"
+#include <BandwidthScheduler.h>
 #include "PuttyIntf.h"
 #include "TextsCore.h"
 #include "Interface.h"
 #include "CoreMain.h"
 #include "WinSCPSecurity.h"
+#include "FileHasher.h"
 #include <System.ShlObj.hpp>
 #include <System.IOUtils.hpp>
 #include <System.StrUtils.hpp>
@@ -28,6 +30,8 @@ const UnicodeString Sha512ChecksumAlg(L"sha-512");
 const UnicodeString Md5ChecksumAlg(L"md5");
 // Not defined by IANA
 const UnicodeString Crc32ChecksumAlg(L"crc32");
+// Local only, no server calculates it
+const UnicodeString Xxh64ChecksumAlg(L"xxh64");
 
 const UnicodeString SshFingerprintType(L"ssh");
 const UnicodeString TlsFingerprintType(L"tls");
@@ -42,6 +46,8 @@ TConfiguration::TConfiguration(TObjectClassId Kind) :
   FPermanentLogging(false),
   FLogWindowLines(0),
   FLogFileAppend(false),
+  FLogProtocolTrace(false),
+  FDownloadChecksumAlg(),
   FLogSensitive(false),
   FPermanentLogSensitive(false),
   FLogMaxSize(0),
@@ -68,8 +74,11 @@ TConfiguration::TConfiguration(TObjectClassId Kind) :
   FShowFtpWelcomeMessage(false),
   FTryFtpWhenSshFails(false),
   FParallelDurationThreshold(0),
+  FDownloadBandwidthLimit(0),
+  FUploadBandwidthLimit(0),
   FScripting(false),
   FSessionReopenAutoMaximumNumberOfRetries(0),
+  FLocalHashCacheMaxEntries(0),
   FDisablePasswordStoring(false),
   FForceBanners(false),
   FDisableAcceptingHostKeys(false),
@@ -144,14 +153,19 @@ void TConfiguration::Default()
   FExternalIpAddress.Clear();
   FTryFtpWhenSshFails = true;
   FParallelDurationThreshold = 10;
+  SetDownloadBandwidthLimit(0);
+  SetUploadBandwidthLimit(0);
   SetCollectUsage(FDefaultCollectUsage);
   FSessionReopenAutoMaximumNumberOfRetries = CONST_DEFAULT_NUMBER_OF_RETRIES;
+  FLocalHashCacheMaxEntries = TLocalHashCache::DefaultMaxEntries;
 
   FLogging = false;
   FPermanentLogging = false;
   FLogFileName = GetDefaultLogFileName();
   FPermanentLogFileName = FLogFileName;
   FLogFileAppend = true;
+  FLogProtocolTrace = false;
+  FDownloadChecksumAlg.Clear();
   FLogSensitive = false;
   FPermanentLogSensitive = FLogSensitive;
   FLogMaxSize = 0;
@@ -285,13 +299,18 @@ UnicodeString TConfiguration::PropertyToKey(UnicodeString Property)
     KEY(String,   ExternalIpAddress); \
     KEY(Bool,     TryFtpWhenSshFails); \
     KEY(Integer,  ParallelDurationThreshold); \
+    KEY(Integer,  DownloadBandwidthLimit); \
+    KEY(Integer,  UploadBandwidthLimit); \
     KEY(Bool,     CollectUsage); \
     KEY(Integer,  SessionReopenAutoMaximumNumberOfRetries); \
+    KEY(Integer,  LocalHashCacheMaxEntries); \
   ); \
   BLOCK(L"Logging", CANCREATE, \
     KEYEX(Bool,  PermanentLogging, Logging); \
     KEYEX(String,PermanentLogFileName, LogFileName); \
     KEY(Bool,    LogFileAppend); \
+    KEY(Bool,    LogProtocolTrace); \
+    KEY(String,  DownloadChecksumAlg); \
     KEYEX(Bool,  PermanentLogSensitive, LogSensitive); \
     KEYEX(Int64, PermanentLogMaxSize, LogMaxSize); \
     KEYEX(Integer, PermanentLogMaxCount, LogMaxCount); \
@@ -841,6 +860,19 @@ void TConfiguration::CleanupHostKeys()
   }
 }
 
+TLocalHashCache *TConfiguration::GetLocalHashCache()
+{
+  TGuard Guard(FCriticalSection);
+  if (FLocalHashCache.get() == nullptr)
+  {
+    UnicodeString FileName =
+      ::IncludeTrailingBackslash(::ExtractFilePath(GetRandomSeedFileName())) + L"netbox.hashes";
+    FLocalHashCache.reset(new TLocalHashCache(FileName));
+  }
+  FLocalHashCache->SetMaxEntries(GetLocalHashCacheMaxEntries());
+  return FLocalHashCache.get();
+}
+
 void TConfiguration::CleanupRandomSeedFile()
 {
   try
@@ -1580,6 +1612,18 @@ void TConfiguration::SetParallelDurationThreshold(intptr_t Value)
   SET_CONFIG_PROPERTY(ParallelDurationThreshold);
 }
 
+void TConfiguration::SetDownloadBandwidthLimit(intptr_t Value)
+{
+  SET_CONFIG_PROPERTY_EX(DownloadBandwidthLimit,
+    GetBandwidthScheduler(bdDownload)->SetLimit(Value));
+}
+
+void TConfiguration::SetUploadBandwidthLimit(intptr_t Value)
+{
+  SET_CONFIG_PROPERTY_EX(UploadBandwidthLimit,
+    GetBandwidthScheduler(bdUpload)->SetLimit(Value));
+}
+
 void TConfiguration::SetPuttyRegistryStorageKey(UnicodeString Value)
 {
   SET_CONFIG_PROPERTY(PuttyRegistryStorageKey);
@@ -1744,6 +1788,16 @@ void TConfiguration::SetLogFileAppend(bool Value)
   SET_CONFIG_PROPERTY(LogFileAppend);
 }
 
+void TConfiguration::SetLogProtocolTrace(bool Value)
+{
+  SET_CONFIG_PROPERTY(LogProtocolTrace);
+}
+
+void TConfiguration::SetDownloadChecksumAlg(UnicodeString Value)
+{
+  SET_CONFIG_PROPERTY(DownloadChecksumAlg);
+}
+
 void TConfiguration::SetLogSensitive(bool Value)
 {
   if (GetLogSensitive() != Value)
@@ -1898,6 +1952,11 @@ void TConfiguration::SetSessionReopenAutoMaximumNumberOfRetries(intptr_t Value)
   SET_CONFIG_PROPERTY(SessionReopenAutoMaximumNumberOfRetries);
 }
 
+void TConfiguration::SetLocalHashCacheMaxEntries(intptr_t Value)
+{
+  SET_CONFIG_PROPERTY(LocalHashCacheMaxEntries);
+}
+
 
 void TShortCuts::Add(const TShortCut &ShortCut)
 {
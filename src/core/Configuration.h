@@ -25,6 +25,7 @@ enum TFtpEncryptionSwitch_219
 };
 
 class TStoredSessionList;
+class TLocalHashCache;
 
 class NB_CORE_EXPORT TConfiguration : public TObject
 {
@@ -46,6 +47,8 @@ private:
   UnicodeString FPermanentLogFileName;
   intptr_t FLogWindowLines;
   bool FLogFileAppend;
+  bool FLogProtocolTrace;
+  UnicodeString FDownloadChecksumAlg;
   bool FLogSensitive;
   bool FPermanentLogSensitive;
   int64_t FLogMaxSize;
@@ -82,13 +85,17 @@ private:
   UnicodeString FExternalIpAddress;
   bool FTryFtpWhenSshFails;
   intptr_t FParallelDurationThreshold;
+  intptr_t FDownloadBandwidthLimit;
+  intptr_t FUploadBandwidthLimit;
   bool FScripting;
   intptr_t FSessionReopenAutoMaximumNumberOfRetries;
+  intptr_t FLocalHashCacheMaxEntries;
 
   bool FDisablePasswordStoring;
   bool FForceBanners;
   bool FDisableAcceptingHostKeys;
   bool FDefaultCollectUsage;
+  std::unique_ptr<TLocalHashCache> FLocalHashCache;
 
 public:
   TVSFixedFileInfo *GetFixedApplicationInfo() const;
@@ -103,6 +110,9 @@ public:
   UnicodeString GetPuttySessionsKey() const;
   void SetRandomSeedFile(UnicodeString Value);
   UnicodeString GetRandomSeedFileName() const;
+  // Checksums of local files for synchronization by checksum,
+  // stored next to the random seed file
+  TLocalHashCache *GetLocalHashCache();
   void SetPuttyRegistryStorageKey(UnicodeString Value);
   UnicodeString GetSshHostKeysSubKey() const;
   UnicodeString GetRootKeyStr() const;
@@ -114,6 +124,8 @@ public:
   UnicodeString GetLogFileName() const;
   bool GetLogToFile() const;
   void SetLogFileAppend(bool Value);
+  void SetLogProtocolTrace(bool Value);
+  void SetDownloadChecksumAlg(UnicodeString Value);
   void SetLogSensitive(bool Value);
   void SetLogMaxSize(int64_t Value);
   int64_t GetLogMaxSize() const;
@@ -151,6 +163,8 @@ public:
   void SetExternalIpAddress(UnicodeString Value);
   void SetTryFtpWhenSshFails(bool Value);
   void SetParallelDurationThreshold(intptr_t Value);
+  void SetDownloadBandwidthLimit(intptr_t Value);
+  void SetUploadBandwidthLimit(intptr_t Value);
   bool GetCollectUsage() const;
   void SetCollectUsage(bool Value);
   bool GetIsUnofficial() const;
@@ -317,6 +331,9 @@ public:
   __property UnicodeString ExternalIpAddress = { read = FExternalIpAddress, write = SetExternalIpAddress };
   __property bool TryFtpWhenSshFails = { read = FTryFtpWhenSshFails, write = SetTryFtpWhenSshFails };
   __property intptr_t ParallelDurationThreshold = { read = FParallelDurationThreshold, write = SetParallelDurationThreshold };
+  // Global caps (bytes per second) shared by all transfers of all sessions
+  __property intptr_t DownloadBandwidthLimit = { read = FDownloadBandwidthLimit, write = SetDownloadBandwidthLimit };
+  __property intptr_t UploadBandwidthLimit = { read = FUploadBandwidthLimit, write = SetUploadBandwidthLimit };
 
   __property UnicodeString TimeFormat = { read = GetTimeFormat };
   __property TStorage Storage  = { read=GetStorage };
@@ -339,6 +356,8 @@ public:
   UnicodeString GetPuttyRegistryStorageKey() const { return FPuttyRegistryStorageKey; }
   UnicodeString GetRandomSeedFile() const { return FRandomSeedFile; }
   bool GetLogFileAppend() const { return FLogFileAppend; }
+  bool GetLogProtocolTrace() const { return FLogProtocolTrace; }
+  UnicodeString GetDownloadChecksumAlg() const { return FDownloadChecksumAlg; }
   bool GetLogSensitive() const { return FLogSensitive; }
   intptr_t GetLogProtocol() const { return FLogProtocol; }
   intptr_t GetActualLogProtocol() const { return FActualLogProtocol; }
@@ -357,11 +376,15 @@ public:
   UnicodeString GetExternalIpAddress() const { return FExternalIpAddress; }
   bool GetTryFtpWhenSshFails() const { return FTryFtpWhenSshFails; }
   intptr_t GetParallelDurationThreshold() const { return FParallelDurationThreshold; }
+  intptr_t GetDownloadBandwidthLimit() const { return FDownloadBandwidthLimit; }
+  intptr_t GetUploadBandwidthLimit() const { return FUploadBandwidthLimit; }
   bool GetDisablePasswordStoring() const { return FDisablePasswordStoring; }
   bool GetForceBanners() const { return FForceBanners; }
   bool GetDisableAcceptingHostKeys() const { return FDisableAcceptingHostKeys; }
   intptr_t GetSessionReopenAutoMaximumNumberOfRetries() const { return FSessionReopenAutoMaximumNumberOfRetries; }
   void SetSessionReopenAutoMaximumNumberOfRetries(intptr_t Value);
+  intptr_t GetLocalHashCacheMaxEntries() const { return FLocalHashCacheMaxEntries; }
+  void SetLocalHashCacheMaxEntries(intptr_t Value);
 };
 
 class NB_CORE_EXPORT TShortCuts : public TObject
@@ -386,6 +409,7 @@ NB_CORE_EXPORT extern const UnicodeString Sha384ChecksumAlg;
 NB_CORE_EXPORT extern const UnicodeString Sha512ChecksumAlg;
 NB_CORE_EXPORT extern const UnicodeString Md5ChecksumAlg;
 NB_CORE_EXPORT extern const UnicodeString Crc32ChecksumAlg;
+NB_CORE_EXPORT extern const UnicodeString Xxh64ChecksumAlg;
 
 NB_CORE_EXPORT extern const UnicodeString SshFingerprintType;
 NB_CORE_EXPORT extern const UnicodeString TlsFingerprintType;
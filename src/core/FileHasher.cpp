@@ -0,0 +1,963 @@
+#include <vcl.h>
+#pragma hdrstop
+
+#include <Common.h>
+#include <Exceptions.h>
+#include <algorithm>
+#include <memory>
+#include <openssl/evp.h>
+#include <zlib.h>
+
+#include "FileHasher.h"
+#include "Configuration.h"
+#include "TextsCore.h"
+
+// OpenSSL picks the SHA-NI, AVX2 or SSSE3 code path at run time
+// when built with its assembler modules
+class TEvpHash : public TLocalHash
+{
+public:
+  explicit TEvpHash(const EVP_MD *Md) :
+    FContext(EVP_MD_CTX_create())
+  {
+    EVP_DigestInit_ex(FContext, Md, nullptr);
+  }
+
+  virtual ~TEvpHash()
+  {
+    EVP_MD_CTX_destroy(FContext);
+  }
+
+  virtual void Update(const void *Data, size_t Length) override
+  {
+    EVP_DigestUpdate(FContext, Data, Length);
+  }
+
+  virtual UnicodeString Final() override
+  {
+    uint8_t Digest[EVP_MAX_MD_SIZE];
+    unsigned int Length = 0;
+    EVP_DigestFinal_ex(FContext, Digest, &Length);
+    return BytesToHex(Digest, Length, false);
+  }
+
+private:
+  EVP_MD_CTX *FContext;
+};
+
+class TCrc32Hash : public TLocalHash
+{
+public:
+  TCrc32Hash() :
+    FCrc(crc32(0, nullptr, 0))
+  {
+  }
+
+  virtual void Update(const void *Data, size_t Length) override
+  {
+    const Bytef *Ptr = static_cast<const Bytef *>(Data);
+    while (Length > 0)
+    {
+      uInt Chunk = static_cast<uInt>((Length > 0x40000000) ? 0x40000000 : Length);
+      FCrc = crc32(FCrc, Ptr, Chunk);
+      Ptr += Chunk;
+      Length -= Chunk;
+    }
+  }
+
+  virtual UnicodeString Final() override
+  {
+    uint8_t Digest[4];
+    for (intptr_t Index = 0; Index < 4; Index++)
+    {
+      Digest[Index] = static_cast<uint8_t>(FCrc >> (24 - Index * 8));
+    }
+    return BytesToHex(Digest, sizeof(Digest), false);
+  }
+
+private:
+  uLong FCrc;
+};
+
+// XXH64 with seed 0, formatted big endian (canonical form)
+class TXxh64Hash : public TLocalHash
+{
+public:
+  TXxh64Hash() :
+    FTotalLength(0),
+    FBufferSize(0)
+  {
+    FAcc[0] = Prime1 + Prime2;
+    FAcc[1] = Prime2;
+    FAcc[2] = 0;
+    FAcc[3] = 0 - Prime1;
+  }
+
+  virtual void Update(const void *Data, size_t Length) override
+  {
+    const uint8_t *Ptr = static_cast<const uint8_t *>(Data);
+    const uint8_t *End = Ptr + Length;
+    FTotalLength += Length;
+
+    if (FBufferSize + Length < StripeSize)
+    {
+      memmove(FBuffer + FBufferSize, Ptr, Length);
+      FBufferSize += Length;
+      return;
+    }
+
+    if (FBufferSize > 0)
+    {
+      size_t Fill = StripeSize - FBufferSize;
+      memmove(FBuffer + FBufferSize, Ptr, Fill);
+      ProcessStripe(FBuffer);
+      Ptr += Fill;
+      FBufferSize = 0;
+    }
+
+    while (Ptr + StripeSize <= End)
+    {
+      ProcessStripe(Ptr);
+      Ptr += StripeSize;
+    }
+
+    FBufferSize = End - Ptr;
+    memmove(FBuffer, Ptr, FBufferSize);
+  }
+
+  virtual UnicodeString Final() override
+  {
+    uint64_t H;
+    if (FTotalLength >= StripeSize)
+    {
+      H = Rotl(FAcc[0], 1) + Rotl(FAcc[1], 7) + Rotl(FAcc[2], 12) + Rotl(FAcc[3], 18);
+      for (intptr_t Index = 0; Index < 4; Index++)
+      {
+        H = (H ^ Round(0, FAcc[Index])) * Prime1 + Prime4;
+      }
+    }
+    else
+    {
+      H = Prime5;
+    }
+    H += FTotalLength;
+
+    const uint8_t *Ptr = FBuffer;
+    const uint8_t *End = FBuffer + FBufferSize;
+    while (Ptr + 8 <= End)
+    {
+      H ^= Round(0, Read64(Ptr));
+      H = Rotl(H, 27) * Prime1 + Prime4;
+      Ptr += 8;
+    }
+    if (Ptr + 4 <= End)
+    {
+      H ^= static_cast<uint64_t>(Read32(Ptr)) * Prime1;
+      H = Rotl(H, 23) * Prime2 + Prime3;
+      Ptr += 4;
+    }
+    while (Ptr < End)
+    {
+      H ^= (*Ptr) * Prime5;
+      H = Rotl(H, 11) * Prime1;
+      Ptr++;
+    }
+
+    H ^= H >> 33;
+    H *= Prime2;
+    H ^= H >> 29;
+    H *= Prime3;
+    H ^= H >> 32;
+
+    uint8_t Digest[8];
+    for (intptr_t Index = 0; Index < 8; Index++)
+    {
+      Digest[Index] = static_cast<uint8_t>(H >> (56 - Index * 8));
+    }
+    return BytesToHex(Digest, sizeof(Digest), false);
+  }
+
+private:
+  static const uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+  static const uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+  static const uint64_t Prime3 = 0x165667B19E3779F9ULL;
+  static const uint64_t Prime4 = 0x85EBCA77C2B2AE63ULL;
+  static const uint64_t Prime5 = 0x27D4EB2F165667C5ULL;
+  static const size_t StripeSize = 32;
+
+  uint64_t FAcc[4];
+  uint64_t FTotalLength;
+  uint8_t FBuffer[StripeSize];
+  size_t FBufferSize;
+
+  static uint64_t Rotl(uint64_t Value, int Bits)
+  {
+    return (Value << Bits) | (Value >> (64 - Bits));
+  }
+
+  static uint64_t Read64(const uint8_t *Ptr)
+  {
+    uint64_t Result;
+    memmove(&Result, Ptr, sizeof(Result));
+    return Result;
+  }
+
+  static uint32_t Read32(const uint8_t *Ptr)
+  {
+    uint32_t Result;
+    memmove(&Result, Ptr, sizeof(Result));
+    return Result;
+  }
+
+  static uint64_t Round(uint64_t Acc, uint64_t Input)
+  {
+    Acc += Input * Prime2;
+    Acc = Rotl(Acc, 31);
+    return Acc * Prime1;
+  }
+
+  void ProcessStripe(const uint8_t *Ptr)
+  {
+    for (intptr_t Index = 0; Index < 4; Index++)
+    {
+      FAcc[Index] = Round(FAcc[Index], Read64(Ptr + Index * 8));
+    }
+  }
+};
+
+TLocalHash *CreateLocalHash(UnicodeString Alg)
+{
+  const EVP_MD *Md = nullptr;
+  if (SameText(Alg, Sha1ChecksumAlg))
+  {
+    Md = EVP_sha1();
+  }
+  else if (SameText(Alg, Sha224ChecksumAlg))
+  {
+    Md = EVP_sha224();
+  }
+  else if (SameText(Alg, Sha256ChecksumAlg))
+  {
+    Md = EVP_sha256();
+  }
+  else if (SameText(Alg, Sha384ChecksumAlg))
+  {
+    Md = EVP_sha384();
+  }
+  else if (SameText(Alg, Sha512ChecksumAlg))
+  {
+    Md = EVP_sha512();
+  }
+  else if (SameText(Alg, Md5ChecksumAlg))
+  {
+    Md = EVP_md5();
+  }
+  else if (SameText(Alg, Crc32ChecksumAlg))
+  {
+    return new TCrc32Hash();
+  }
+  else if (SameText(Alg, Xxh64ChecksumAlg))
+  {
+    return new TXxh64Hash();
+  }
+  return (Md != nullptr) ? new TEvpHash(Md) : nullptr;
+}
+
+bool IsLocalChecksumAlgSupported(UnicodeString Alg)
+{
+  std::unique_ptr<TLocalHash> Hash(CreateLocalHash(Alg));
+  return (Hash.get() != nullptr);
+}
+
+static const DWORD HashBufferSize = 256 * 1024;
+
+UnicodeString CalculateLocalFileChecksum(UnicodeString Alg, UnicodeString FileName)
+{
+  std::unique_ptr<TLocalHash> Hash(CreateLocalHash(Alg));
+  if (Hash.get() == nullptr)
+  {
+    throw Exception(FMTLOAD(UNKNOWN_CHECKSUM, Alg));
+  }
+
+  HANDLE File = ::CreateFile(ApiPath(FileName).c_str(), GENERIC_READ,
+    FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (File == INVALID_HANDLE_VALUE)
+  {
+    ::RaiseLastOSError();
+  }
+  SCOPE_EXIT
+  {
+    ::CloseHandle(File);
+  };
+
+  rde::vector<uint8_t> Buffer(HashBufferSize);
+  DWORD Read = 0;
+  do
+  {
+    if (!::ReadFile(File, &Buffer[0], HashBufferSize, &Read, nullptr))
+    {
+      ::RaiseLastOSError();
+    }
+    Hash->Update(&Buffer[0], Read);
+  }
+  while (Read > 0);
+  return Hash->Final();
+}
+
+THashThreadPool::THashThreadPool(intptr_t ThreadCount, intptr_t MinThreadCount) :
+  FThreadCount(ThreadCount),
+  FNextJob(0),
+  FJobSemaphore(nullptr)
+{
+  if (FThreadCount <= 0)
+  {
+    SYSTEM_INFO SystemInfo;
+    ::GetSystemInfo(&SystemInfo);
+    FThreadCount = SystemInfo.dwNumberOfProcessors;
+  }
+  if (FThreadCount > MaxThreads)
+  {
+    FThreadCount = MaxThreads;
+  }
+  if (FThreadCount < MinThreadCount)
+  {
+    FThreadCount = MinThreadCount;
+  }
+  FJobSemaphore = ::CreateSemaphore(nullptr, 0, MAXLONG, nullptr);
+  if (FJobSemaphore == nullptr)
+  {
+    ::RaiseLastOSError();
+  }
+}
+
+THashThreadPool::~THashThreadPool()
+{
+  Cancel();
+  ::CloseHandle(FJobSemaphore);
+}
+
+void THashThreadPool::Add(TJob *Job)
+{
+  {
+    TGuard Guard(FSection);
+    FJobs.push_back(Job);
+  }
+  // start the workers as the jobs come, there may be few of them
+  if (static_cast<intptr_t>(FThreads.size()) < FThreadCount)
+  {
+    DWORD ThreadId;
+    HANDLE Thread = ::CreateThread(nullptr, 0, &THashThreadPool::WorkerThreadProc, this, 0, &ThreadId);
+    if (Thread != nullptr)
+    {
+      FThreads.push_back(Thread);
+    }
+  }
+  ::ReleaseSemaphore(FJobSemaphore, 1, nullptr);
+}
+
+bool THashThreadPool::NextJob(TJob *&Job)
+{
+  TGuard Guard(FSection);
+  bool Result = (FNextJob < static_cast<intptr_t>(FJobs.size()));
+  if (Result)
+  {
+    Job = FJobs[FNextJob];
+    FNextJob++;
+  }
+  return Result;
+}
+
+void THashThreadPool::ProcessJobs()
+{
+  // each job and each wake-up by Join release the semaphore once
+  while (::WaitForSingleObject(FJobSemaphore, INFINITE) == WAIT_OBJECT_0)
+  {
+    TJob *Job = nullptr;
+    if (!NextJob(Job))
+    {
+      break;
+    }
+    Job->Execute();
+  }
+}
+
+DWORD WINAPI THashThreadPool::WorkerThreadProc(void *Parameter)
+{
+  static_cast<THashThreadPool *>(Parameter)->ProcessJobs();
+  return 0;
+}
+
+void THashThreadPool::Join()
+{
+  if (!FThreads.empty())
+  {
+    // wake up the workers waiting for jobs that will not come
+    ::ReleaseSemaphore(FJobSemaphore, static_cast<LONG>(FThreads.size()), nullptr);
+    ::WaitForMultipleObjects(static_cast<DWORD>(FThreads.size()), &FThreads[0], TRUE, INFINITE);
+    for (size_t Index = 0; Index < FThreads.size(); Index++)
+    {
+      ::CloseHandle(FThreads[Index]);
+    }
+    FThreads.clear();
+  }
+  // drop the wake-ups nobody took, so that the pool can be used again
+  while (::WaitForSingleObject(FJobSemaphore, 0) == WAIT_OBJECT_0)
+  {
+  }
+  TGuard Guard(FSection);
+  FJobs.clear();
+  FNextJob = 0;
+}
+
+void THashThreadPool::Wait()
+{
+  // no thread could be started or there are more jobs than threads,
+  // help on this one
+  TJob *Job = nullptr;
+  while (NextJob(Job))
+  {
+    Job->Execute();
+  }
+  Join();
+}
+
+void THashThreadPool::Cancel()
+{
+  {
+    TGuard Guard(FSection);
+    FNextJob = static_cast<intptr_t>(FJobs.size());
+  }
+  Join();
+}
+
+// enough for the thread pool to balance, few enough not to thrash the disk
+static const int64_t BlockHashJobSize = 16 * 1024 * 1024;
+
+TLocalBlockHasher::TLocalBlockHasher(intptr_t ThreadCount) :
+  FSize(0),
+  FBlockSize(0),
+  FTerminated(false),
+  // one thread hashes the whole file, at least one the blocks
+  FPool(ThreadCount, 2)
+{
+}
+
+TLocalBlockHasher::~TLocalBlockHasher()
+{
+  // stop the workers, when leaving on exception
+  FTerminated = true;
+  FPool.Cancel();
+}
+
+static intptr_t BlocksPerJob(int64_t BlockSize)
+{
+  int64_t Result = BlockHashJobSize / BlockSize;
+  return (Result > 0) ? static_cast<intptr_t>(Result) : 1;
+}
+
+void TLocalBlockHasher::Start(UnicodeString Alg, UnicodeString FileName, int64_t Size, int64_t BlockSize)
+{
+  DebugAssert(FJobs.empty() && (BlockSize > 0));
+  {
+    std::unique_ptr<TLocalHash> Hash(CreateLocalHash(Alg));
+    if (Hash.get() == nullptr)
+    {
+      throw Exception(FMTLOAD(UNKNOWN_CHECKSUM, Alg));
+    }
+  }
+
+  FAlg = Alg;
+  FFileName = FileName;
+  FSize = Size;
+  FBlockSize = BlockSize;
+  intptr_t BlockCount = static_cast<intptr_t>((Size + BlockSize - 1) / BlockSize);
+  FBlockChecksums.clear();
+  FBlockChecksums.resize(BlockCount);
+  FFileChecksum = L"";
+  FError = L"";
+  FTerminated = false;
+  intptr_t PerJob = BlocksPerJob(BlockSize);
+  // the jobs are not moved once added to the pool
+  FJobs.resize(1 + (BlockCount + PerJob - 1) / PerJob);
+  for (intptr_t Index = 0; Index < static_cast<intptr_t>(FJobs.size()); Index++)
+  {
+    FJobs[Index].Owner = this;
+    FJobs[Index].Index = Index;
+    FPool.Add(&FJobs[Index]);
+  }
+}
+
+void TLocalBlockHasher::Wait()
+{
+  FPool.Wait();
+  FJobs.clear();
+  if (!FError.IsEmpty())
+  {
+    throw ExtException(FMTLOAD(CHECKSUM_ERROR, FFileName), FError);
+  }
+}
+
+void TLocalBlockHasher::HashRange(HANDLE File, int64_t Offset, int64_t Length,
+  TLocalHash *Hash, rde::vector<uint8_t> &Buffer)
+{
+  LARGE_INTEGER Position;
+  Position.QuadPart = Offset;
+  if (!::SetFilePointerEx(File, Position, nullptr, FILE_BEGIN))
+  {
+    ::RaiseLastOSError();
+  }
+  while ((Length > 0) && !FTerminated)
+  {
+    DWORD ToRead = static_cast<DWORD>((Length < HashBufferSize) ? Length : HashBufferSize);
+    DWORD Read = 0;
+    if (!::ReadFile(File, &Buffer[0], ToRead, &Read, nullptr))
+    {
+      ::RaiseLastOSError();
+    }
+    if (Read == 0)
+    {
+      // file was truncated meanwhile
+      break;
+    }
+    Hash->Update(&Buffer[0], Read);
+    Length -= Read;
+  }
+}
+
+void TLocalBlockHasher::ProcessJob(intptr_t Index)
+{
+  if (FTerminated)
+  {
+    return;
+  }
+  try
+  {
+    HANDLE File = ::CreateFile(ApiPath(FFileName).c_str(), GENERIC_READ,
+      FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+      (Index == 0) ? FILE_FLAG_SEQUENTIAL_SCAN : 0, nullptr);
+    if (File == INVALID_HANDLE_VALUE)
+    {
+      ::RaiseLastOSError();
+    }
+    SCOPE_EXIT
+    {
+      ::CloseHandle(File);
+    };
+
+    rde::vector<uint8_t> Buffer(HashBufferSize);
+    if (Index == 0)
+    {
+      std::unique_ptr<TLocalHash> Hash(CreateLocalHash(FAlg));
+      HashRange(File, 0, FSize, Hash.get(), Buffer);
+      FFileChecksum = Hash->Final();
+    }
+    else
+    {
+      intptr_t PerJob = BlocksPerJob(FBlockSize);
+      intptr_t BlockCount = GetBlockCount();
+      intptr_t Block = (Index - 1) * PerJob;
+      intptr_t EndBlock = ((Block + PerJob) < BlockCount) ? (Block + PerJob) : BlockCount;
+      for (; Block < EndBlock; Block++)
+      {
+        int64_t Offset = Block * FBlockSize;
+        int64_t Length = ((Offset + FBlockSize) < FSize) ? FBlockSize : (FSize - Offset);
+        std::unique_ptr<TLocalHash> Hash(CreateLocalHash(FAlg));
+        HashRange(File, Offset, Length, Hash.get(), Buffer);
+        FBlockChecksums[Block] = Hash->Final();
+      }
+    }
+  }
+  catch (Exception &E)
+  {
+    TGuard Guard(FErrorSection);
+    if (FError.IsEmpty())
+    {
+      FError = E.Message;
+    }
+    // no point hashing the rest
+    FTerminated = true;
+  }
+}
+
+void TBackgroundFileHasher::TFileJob::Execute()
+{
+  try
+  {
+    Checksum = CalculateLocalFileChecksum(Alg, FileName);
+  }
+  catch (Exception &E)
+  {
+    Error = E.Message;
+  }
+}
+
+TBackgroundFileHasher::TBackgroundFileHasher(UnicodeString Alg, intptr_t ThreadCount) :
+  FAlg(Alg),
+  FPool(ThreadCount)
+{
+}
+
+TBackgroundFileHasher::~TBackgroundFileHasher()
+{
+  // stop the workers, when leaving on exception
+  FPool.Cancel();
+  for (size_t Index = 0; Index < FJobs.size(); Index++)
+  {
+    delete FJobs[Index];
+  }
+}
+
+intptr_t TBackgroundFileHasher::Add(UnicodeString FileName)
+{
+  std::unique_ptr<TFileJob> Job(new TFileJob());
+  Job->Alg = FAlg;
+  Job->FileName = FileName;
+  FJobs.push_back(Job.get());
+  FPool.Add(Job.release());
+  return static_cast<intptr_t>(FJobs.size()) - 1;
+}
+
+void TBackgroundFileHasher::Wait()
+{
+  FPool.Wait();
+}
+
+// "NBHC" and format version
+static const uint32_t LocalHashCacheMagic = 0x4348424E;
+static const uint32_t LocalHashCacheVersion = 2;
+
+static uint64_t FileTimeToUInt64(const FILETIME &Time)
+{
+  return (static_cast<uint64_t>(Time.dwHighDateTime) << 32) | Time.dwLowDateTime;
+}
+
+static void PutCacheData(rde::vector<uint8_t> &Buffer, const void *Data, size_t Length)
+{
+  size_t Size = Buffer.size();
+  Buffer.resize(Size + Length);
+  memmove(&Buffer[Size], Data, Length);
+}
+
+static void PutCacheString(rde::vector<uint8_t> &Buffer, const UnicodeString &Str)
+{
+  uint32_t Length = static_cast<uint32_t>(Str.Length());
+  PutCacheData(Buffer, &Length, sizeof(Length));
+  PutCacheData(Buffer, Str.c_str(), Length * sizeof(wchar_t));
+}
+
+static bool GetCacheData(const uint8_t *&Ptr, const uint8_t *End, void *Data, size_t Length)
+{
+  bool Result = (static_cast<size_t>(End - Ptr) >= Length);
+  if (Result)
+  {
+    memmove(Data, Ptr, Length);
+    Ptr += Length;
+  }
+  return Result;
+}
+
+static bool GetCacheString(const uint8_t *&Ptr, const uint8_t *End, UnicodeString &Str)
+{
+  uint32_t Length = 0;
+  bool Result =
+    GetCacheData(Ptr, End, &Length, sizeof(Length)) &&
+    (static_cast<size_t>(End - Ptr) / sizeof(wchar_t) >= Length);
+  if (Result)
+  {
+    Str = UnicodeString(reinterpret_cast<const wchar_t *>(Ptr), Length);
+    Ptr += Length * sizeof(wchar_t);
+  }
+  return Result;
+}
+
+TLocalHashCache::TLocalHashCache(UnicodeString FileName) :
+  FFileName(FileName),
+  FMaxEntries(DefaultMaxEntries),
+  FUseCounter(0),
+  FSessionStart(0),
+  FLoaded(false),
+  FModified(false)
+{
+}
+
+TLocalHashCache::~TLocalHashCache()
+{
+}
+
+void TLocalHashCache::NeedLoaded()
+{
+  if (!FLoaded)
+  {
+    FLoaded = true;
+    try
+    {
+      Load();
+    }
+    catch (Exception &)
+    {
+      // start over with empty cache
+      FEntries.clear();
+      FUseCounter = 0;
+    }
+    FSessionStart = FUseCounter;
+  }
+}
+
+void TLocalHashCache::SetMaxEntries(intptr_t Value)
+{
+  TGuard Guard(FSection);
+  FMaxEntries = Value;
+}
+
+void TLocalHashCache::Load()
+{
+  HANDLE File = ::CreateFile(ApiPath(FFileName).c_str(), GENERIC_READ, FILE_SHARE_READ,
+    nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (File == INVALID_HANDLE_VALUE)
+  {
+    // not created yet
+    return;
+  }
+  SCOPE_EXIT
+  {
+    ::CloseHandle(File);
+  };
+
+  LARGE_INTEGER FileSize;
+  THROWOSIFFALSE(::GetFileSizeEx(File, &FileSize));
+  if ((FileSize.QuadPart <= 0) || (FileSize.QuadPart > 512 * 1024 * 1024))
+  {
+    return;
+  }
+  rde::vector<uint8_t> Buffer(static_cast<size_t>(FileSize.QuadPart));
+  DWORD Read = 0;
+  THROWOSIFFALSE(::ReadFile(File, &Buffer[0], static_cast<DWORD>(Buffer.size()), &Read, nullptr));
+
+  const uint8_t *Ptr = &Buffer[0];
+  const uint8_t *End = Ptr + Read;
+  uint32_t Magic = 0;
+  uint32_t Version = 0;
+  uint32_t Count = 0;
+  if (GetCacheData(Ptr, End, &Magic, sizeof(Magic)) && (Magic == LocalHashCacheMagic) &&
+      GetCacheData(Ptr, End, &Version, sizeof(Version)) && (Version == LocalHashCacheVersion) &&
+      GetCacheData(Ptr, End, &Count, sizeof(Count)))
+  {
+    for (uint32_t Index = 0; Index < Count; Index++)
+    {
+      UnicodeString Key;
+      TEntry Entry;
+      if (!GetCacheString(Ptr, End, Key) ||
+          !GetCacheData(Ptr, End, &Entry.Used, sizeof(Entry.Used)) ||
+          !GetCacheData(Ptr, End, &Entry.Size, sizeof(Entry.Size)) ||
+          !GetCacheData(Ptr, End, &Entry.LastWriteTime, sizeof(Entry.LastWriteTime)) ||
+          !GetCacheData(Ptr, End, &Entry.CreationTime, sizeof(Entry.CreationTime)) ||
+          !GetCacheString(Ptr, End, Entry.Alg) ||
+          !GetCacheString(Ptr, End, Entry.Checksum))
+      {
+        // truncated, keep what was read
+        break;
+      }
+      FEntries[Key] = Entry;
+      if (Entry.Used > FUseCounter)
+      {
+        FUseCounter = Entry.Used;
+      }
+    }
+  }
+}
+
+bool TLocalHashCache::Find(UnicodeString Alg, UnicodeString FileName, int64_t Size,
+  const FILETIME &LastWriteTime, const FILETIME &CreationTime, UnicodeString &Checksum)
+{
+  TGuard Guard(FSection);
+  NeedLoaded();
+  TEntries::iterator Iter = FEntries.find(LowerCase(FileName));
+  bool Result =
+    (Iter != FEntries.end()) &&
+    (Iter->second.Size == Size) &&
+    (Iter->second.LastWriteTime == FileTimeToUInt64(LastWriteTime)) &&
+    (Iter->second.CreationTime == FileTimeToUInt64(CreationTime)) &&
+    SameText(Iter->second.Alg, Alg);
+  if (Result)
+  {
+    Iter->second.Used = ++FUseCounter;
+    Checksum = Iter->second.Checksum;
+  }
+  return Result;
+}
+
+void TLocalHashCache::Store(UnicodeString Alg, UnicodeString FileName, int64_t Size,
+  const FILETIME &LastWriteTime, const FILETIME &CreationTime, UnicodeString Checksum)
+{
+  TGuard Guard(FSection);
+  NeedLoaded();
+  TEntry &Entry = FEntries[LowerCase(FileName)];
+  Entry.Size = Size;
+  Entry.LastWriteTime = FileTimeToUInt64(LastWriteTime);
+  Entry.CreationTime = FileTimeToUInt64(CreationTime);
+  Entry.Used = ++FUseCounter;
+  Entry.Alg = Alg;
+  Entry.Checksum = Checksum;
+  FModified = true;
+}
+
+void TLocalHashCache::Trim()
+{
+  if (static_cast<intptr_t>(FEntries.size()) > FMaxEntries)
+  {
+    rde::vector<uint64_t> Used;
+    Used.reserve(FEntries.size());
+    for (TEntries::const_iterator Iter = FEntries.begin(); Iter != FEntries.end(); ++Iter)
+    {
+      if (Iter->second.Used <= FSessionStart)
+      {
+        Used.push_back(Iter->second.Used);
+      }
+    }
+    size_t Drop = FEntries.size() - FMaxEntries;
+    if (Drop > Used.size())
+    {
+      Drop = Used.size();
+    }
+    if (Drop == 0)
+    {
+      return;
+    }
+    std::nth_element(Used.begin(), Used.begin() + (Drop - 1), Used.end());
+    uint64_t Threshold = Used[Drop - 1];
+    TEntries::iterator Iter = FEntries.begin();
+    while ((Iter != FEntries.end()) && (Drop > 0))
+    {
+      if (Iter->second.Used <= Threshold)
+      {
+        Iter = FEntries.erase(Iter);
+        Drop--;
+      }
+      else
+      {
+        ++Iter;
+      }
+    }
+  }
+}
+
+bool TLocalHashCache::Save()
+{
+  TGuard Guard(FSection);
+  bool Result = !FModified;
+  if (!Result)
+  {
+    Trim();
+
+    rde::vector<uint8_t> Buffer;
+    uint32_t Count = static_cast<uint32_t>(FEntries.size());
+    PutCacheData(Buffer, &LocalHashCacheMagic, sizeof(LocalHashCacheMagic));
+    PutCacheData(Buffer, &LocalHashCacheVersion, sizeof(LocalHashCacheVersion));
+    PutCacheData(Buffer, &Count, sizeof(Count));
+    for (TEntries::const_iterator Iter = FEntries.begin(); Iter != FEntries.end(); ++Iter)
+    {
+      const TEntry &Entry = Iter->second;
+      PutCacheString(Buffer, Iter->first);
+      PutCacheData(Buffer, &Entry.Used, sizeof(Entry.Used));
+      PutCacheData(Buffer, &Entry.Size, sizeof(Entry.Size));
+      PutCacheData(Buffer, &Entry.LastWriteTime, sizeof(Entry.LastWriteTime));
+      PutCacheData(Buffer, &Entry.CreationTime, sizeof(Entry.CreationTime));
+      PutCacheString(Buffer, Entry.Alg);
+      PutCacheString(Buffer, Entry.Checksum);
+    }
+
+    // write aside and replace, so that a crash does not leave the cache half written
+    UnicodeString TempFileName = FFileName + L".tmp";
+    HANDLE File = ::CreateFile(ApiPath(TempFileName).c_str(), GENERIC_WRITE, 0,
+      nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (File != INVALID_HANDLE_VALUE)
+    {
+      DWORD Written = 0;
+      bool Complete =
+        ::WriteFile(File, &Buffer[0], static_cast<DWORD>(Buffer.size()), &Written, nullptr) &&
+        (Written == Buffer.size());
+      ::CloseHandle(File);
+      Result =
+        Complete &&
+        ::MoveFileEx(ApiPath(TempFileName).c_str(), ApiPath(FFileName).c_str(), MOVEFILE_REPLACE_EXISTING);
+      if (!Result)
+      {
+        ::DeleteFile(ApiPath(TempFileName).c_str());
+      }
+    }
+    FModified = !Result;
+  }
+  return Result;
+}
+
+THashingStream::THashingStream(TStream *Stream, TLocalHash *Hash) :
+  FStream(Stream),
+  FHash(Hash),
+  FPosition(Stream->GetPosition()),
+  FHashedSize(0),
+  FValid(FPosition == 0)
+{
+}
+
+THashingStream::~THashingStream()
+{
+}
+
+void THashingStream::Hash(const void *Buffer, int64_t Count)
+{
+  if (FValid && (Count > 0))
+  {
+    if (FPosition > FHashedSize)
+    {
+      // skipped over data that was not hashed
+      FValid = false;
+    }
+    else if (FPosition + Count > FHashedSize)
+    {
+      int64_t Skip = FHashedSize - FPosition;
+      FHash->Update(static_cast<const uint8_t *>(Buffer) + Skip, static_cast<size_t>(Count - Skip));
+      FHashedSize = FPosition + Count;
+    }
+  }
+  FPosition += Count;
+}
+
+int64_t THashingStream::Read(void *Buffer, int64_t Count)
+{
+  int64_t Result = FStream->Read(Buffer, Count);
+  if (Result > 0)
+  {
+    Hash(Buffer, Result);
+  }
+  return Result;
+}
+
+int64_t THashingStream::Write(const void *Buffer, int64_t Count)
+{
+  int64_t Result = FStream->Write(Buffer, Count);
+  if (Result > 0)
+  {
+    Hash(Buffer, Result);
+  }
+  return Result;
+}
+
+int64_t THashingStream::Seek(int64_t Offset, int Origin)
+{
+  return Seek(Offset, static_cast<TSeekOrigin>(Origin));
+}
+
+int64_t THashingStream::Seek(const int64_t Offset, TSeekOrigin Origin)
+{
+  FPosition = FStream->Seek(Offset, Origin);
+  return FPosition;
+}
+
+void THashingStream::SetSize(const int64_t NewSize)
+{
+  FStream->SetSize(NewSize);
+  if (NewSize < FHashedSize)
+  {
+    FValid = false;
+  }
+}
@@ -0,0 +1,242 @@
+
+#pragma once
+
+#include <Classes.hpp>
+#include <map>
+#include "SessionInfo.h"
+
+// Incremental digest of one of the checksum algorithms
+// (Sha*ChecksumAlg, Md5ChecksumAlg, Crc32ChecksumAlg, Xxh64ChecksumAlg)
+// calculated locally. Final returns lowercase hex, as do the checksums
+// calculated by the servers, so the two can be compared directly.
+class NB_CORE_EXPORT TLocalHash : public TObject
+{
+  NB_DISABLE_COPY(TLocalHash)
+public:
+  TLocalHash() {}
+  virtual ~TLocalHash() {}
+
+  virtual void Update(const void *Data, size_t Length) = 0;
+  virtual UnicodeString Final() = 0;
+};
+
+// Returns nullptr for algorithms that cannot be calculated locally
+NB_CORE_EXPORT TLocalHash *CreateLocalHash(UnicodeString Alg);
+NB_CORE_EXPORT bool IsLocalChecksumAlgSupported(UnicodeString Alg);
+
+// Returns lowercase hex checksum of the whole file
+NB_CORE_EXPORT UnicodeString CalculateLocalFileChecksum(UnicodeString Alg, UnicodeString FileName);
+
+// Worker threads shared by the local hashers. Jobs run in the order they
+// are added, the threads are started as the jobs come. Wait runs
+// the remaining jobs on the calling thread too, so they get done
+// even if no thread could be started.
+class NB_CORE_EXPORT THashThreadPool : public TObject
+{
+  NB_DISABLE_COPY(THashThreadPool)
+public:
+  class TJob
+  {
+  public:
+    virtual ~TJob() {}
+    // Must not throw
+    virtual void Execute() = 0;
+  };
+
+  // 0 = one thread per processor, up to MaxThreads
+  explicit THashThreadPool(intptr_t ThreadCount = 0, intptr_t MinThreadCount = 1);
+  virtual ~THashThreadPool();
+
+  // The job is not owned and must exist until Wait or Cancel returns
+  void Add(TJob *Job);
+  // Waits until all jobs are done
+  void Wait();
+  // Drops the jobs that have not started yet and waits for the others
+  void Cancel();
+
+  // hashing is mostly bound by the disk beyond a few threads
+  static const intptr_t MaxThreads = 4;
+
+private:
+  intptr_t FThreadCount;
+  TCriticalSection FSection;
+  rde::vector<TJob *> FJobs;
+  intptr_t FNextJob;
+  HANDLE FJobSemaphore;
+  rde::vector<HANDLE> FThreads;
+
+  bool NextJob(TJob *&Job);
+  void ProcessJobs();
+  void Join();
+  static DWORD WINAPI WorkerThreadProc(void *Parameter);
+};
+
+// Hashes a file in blocks of fixed size on a pool of worker threads,
+// and the whole file along with them. Hashing runs in the background
+// between Start and Wait, so the caller can wait for the server meanwhile.
+class NB_CORE_EXPORT TLocalBlockHasher : public TObject
+{
+  NB_DISABLE_COPY(TLocalBlockHasher)
+public:
+  // 0 = one thread per processor, up to THashThreadPool::MaxThreads
+  explicit TLocalBlockHasher(intptr_t ThreadCount = 0);
+  virtual ~TLocalBlockHasher();
+
+  void Start(UnicodeString Alg, UnicodeString FileName, int64_t Size, int64_t BlockSize);
+  // Raises the first failure
+  void Wait();
+
+  intptr_t GetBlockCount() const { return static_cast<intptr_t>(FBlockChecksums.size()); }
+  UnicodeString GetBlockChecksum(intptr_t Index) const { return FBlockChecksums[Index]; }
+  UnicodeString GetFileChecksum() const { return FFileChecksum; }
+
+private:
+  class TBlockJob : public THashThreadPool::TJob
+  {
+  public:
+    TLocalBlockHasher *Owner;
+    intptr_t Index;
+
+    virtual void Execute() override { Owner->ProcessJob(Index); }
+  };
+
+  UnicodeString FAlg;
+  UnicodeString FFileName;
+  int64_t FSize;
+  int64_t FBlockSize;
+  volatile bool FTerminated;
+  rde::vector<UnicodeString> FBlockChecksums;
+  UnicodeString FFileChecksum;
+  TCriticalSection FErrorSection;
+  UnicodeString FError;
+  // job 0 is the whole file, then runs of BlocksPerJob blocks
+  rde::vector<TBlockJob> FJobs;
+  THashThreadPool FPool;
+
+  void ProcessJob(intptr_t Index);
+  void HashRange(HANDLE File, int64_t Offset, int64_t Length, TLocalHash *Hash, rde::vector<uint8_t> &Buffer);
+};
+
+// Hashes files on a pool of worker threads as they are added,
+// while the caller goes on with other work (e.g. reading the remote
+// directories). Checksums can be collected once Wait returns.
+class NB_CORE_EXPORT TBackgroundFileHasher : public TObject
+{
+  NB_DISABLE_COPY(TBackgroundFileHasher)
+public:
+  // 0 = one thread per processor, up to THashThreadPool::MaxThreads
+  explicit TBackgroundFileHasher(UnicodeString Alg, intptr_t ThreadCount = 0);
+  virtual ~TBackgroundFileHasher();
+
+  // Returns index of the job
+  intptr_t Add(UnicodeString FileName);
+  void Wait();
+
+  intptr_t GetCount() const { return static_cast<intptr_t>(FJobs.size()); }
+  // Empty, when the file could not be hashed
+  UnicodeString GetChecksum(intptr_t Index) const { return FJobs[Index]->Checksum; }
+  UnicodeString GetError(intptr_t Index) const { return FJobs[Index]->Error; }
+
+private:
+  class TFileJob : public THashThreadPool::TJob
+  {
+  public:
+    UnicodeString Alg;
+    UnicodeString FileName;
+    UnicodeString Checksum;
+    UnicodeString Error;
+
+    virtual void Execute() override;
+  };
+
+  UnicodeString FAlg;
+  // jobs are not moved, as the workers hash them outside of the lock
+  rde::vector<TFileJob *> FJobs;
+  THashThreadPool FPool;
+};
+
+// Checksums of local files calculated before, persisted between sessions.
+// An entry is used only while the file keeps its size, last write time
+// and creation time. The creation time stands for the file identity
+// (inode), which the find data do not carry. Entries used in this session
+// are always kept, so a tree larger than the limit is not hashed again
+// on the next run; the least recently used of the others are dropped
+// beyond the limit. Thread-safe.
+class NB_CORE_EXPORT TLocalHashCache : public TObject
+{
+  NB_DISABLE_COPY(TLocalHashCache)
+public:
+  explicit TLocalHashCache(UnicodeString FileName);
+  virtual ~TLocalHashCache();
+
+  bool Find(UnicodeString Alg, UnicodeString FileName, int64_t Size,
+    const FILETIME &LastWriteTime, const FILETIME &CreationTime, UnicodeString &Checksum);
+  void Store(UnicodeString Alg, UnicodeString FileName, int64_t Size,
+    const FILETIME &LastWriteTime, const FILETIME &CreationTime, UnicodeString Checksum);
+  // Writes the cache, if it has changed. The cache is only an optimization,
+  // so the failure is not raised.
+  bool Save();
+
+  UnicodeString GetFileName() const { return FFileName; }
+  void SetMaxEntries(intptr_t Value);
+
+  static const intptr_t DefaultMaxEntries = 1000000;
+
+private:
+  struct TEntry
+  {
+    int64_t Size;
+    uint64_t LastWriteTime;
+    uint64_t CreationTime;
+    uint64_t Used;
+    UnicodeString Alg;
+    UnicodeString Checksum;
+  };
+  typedef std::map<UnicodeString, TEntry> TEntries;
+
+  UnicodeString FFileName;
+  TCriticalSection FSection;
+  TEntries FEntries;
+  intptr_t FMaxEntries;
+  uint64_t FUseCounter;
+  // entries with Used above were used in this session
+  uint64_t FSessionStart;
+  bool FLoaded;
+  bool FModified;
+
+  void NeedLoaded();
+  void Load();
+  void Trim();
+};
+
+// Passes the data through to another stream and hashes it on the way,
+// so that a downloaded file does not need to be read again to be verified.
+// The hash is valid only if the data were written (or read) sequentially
+// from the start; bytes written again at the same position (retries)
+// are hashed once.
+class NB_CORE_EXPORT THashingStream : public TStream
+{
+  NB_DISABLE_COPY(THashingStream)
+public:
+  // Takes ownership of neither stream nor hash
+  THashingStream(TStream *Stream, TLocalHash *Hash);
+  virtual ~THashingStream();
+
+  virtual int64_t Read(void *Buffer, int64_t Count) override;
+  virtual int64_t Write(const void *Buffer, int64_t Count) override;
+  virtual int64_t Seek(int64_t Offset, int Origin) override;
+  virtual int64_t Seek(const int64_t Offset, TSeekOrigin Origin) override;
+  virtual void SetSize(const int64_t NewSize) override;
+
+  bool GetValid() const { return FValid; }
+  int64_t GetHashedSize() const { return FHashedSize; }
+
+private:
+  TStream *FStream;
+  TLocalHash *FHash;
+  int64_t FPosition;
+  int64_t FHashedSize;
+  bool FValid;
+
+  void Hash(const void *Buffer, int64_t Count);
+};
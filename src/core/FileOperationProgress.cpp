@@ -87,8 +87,7 @@ void TFileOperationProgressType::Clear()
   FFileStartTime = 0.0;
   FFilesFinished = 0;
   FReset = false;
-  FLastSecond = 0;
-  FRemainingCPS = 0;
+  FBandwidthBucket = TBandwidthBucket();
   FTicks.clear();
   FTotalTransferredThen.clear();
   FCounterSet = false;
@@ -134,7 +133,6 @@ void TFileOperationProgressType::ClearTransfer()
   FSkippedSize = 0;
   FTransferredSize = 0;
   FTransferringFile = false;
-  FLastSecond = 0;
 }
 
 void TFileOperationProgressType::Start(TFileOperation AOperation,
@@ -370,41 +368,29 @@ intptr_t TFileOperationProgressType::AdjustToCPSLimit(
 {
   SetSpeedCounters();
 
-  // CPSLimit reader is guarded, we cannot block whole method as it can last long.
-  if (FCPSLimit > 0)
+  // The bucket enforces both our CPSLimit and the global bandwidth cap
+  // shared with all other transfers in the same direction.
+  FBandwidthBucket.SetDirection((FSide == osLocal) ? bdUpload : bdDownload);
+  intptr_t Result = 0;
+  if (Size > 0)
   {
-    // we must not return 0, hence, if we reach zero,
-    // we wait until the next second
+    // we must not return 0, hence, if nothing is available,
+    // we wait until the buckets refill
     do
     {
-      uintptr_t Second = (::GetTickCount() / MSecsPerSec);
-
-      if (Second != FLastSecond)
-      {
-        FRemainingCPS = FCPSLimit;
-        FLastSecond = Second;
-      }
-
-      if (FRemainingCPS == 0)
+      // CPSLimit reader is guarded, we cannot block whole method as it can last long.
+      // CPSLimit may also have been changed in DoProgress
+      FBandwidthBucket.SetLimit(FCPSLimit);
+      Result = FBandwidthBucket.Acquire(Size);
+      if (Result == 0)
       {
-        SleepEx(100, true);
+        SleepEx(static_cast<DWORD>(FBandwidthBucket.GetWaitTime()), true);
         DoProgress();
       }
     }
-    while ((FCPSLimit > 0) && (FRemainingCPS == 0));
-
-    // CPSLimit may have been dropped in DoProgress
-    if (FCPSLimit > 0)
-    {
-      if (FRemainingCPS < Size)
-      {
-        Size = FRemainingCPS;
-      }
-
-      FRemainingCPS -= Size;
-    }
+    while (Result == 0);
   }
-  return Size;
+  return Result;
 }
 
 // Use in SCP protocol only
@@ -534,6 +520,12 @@ intptr_t TFileOperationProgressType::GetCPSLimit() const
   return Result;
 }
 
+void TFileOperationProgressType::SetBandwidthWeight(intptr_t AWeight)
+{
+  TGuard Guard(*FSection);
+  FBandwidthBucket.SetWeight(AWeight);
+}
+
 void TFileOperationProgressType::SetCPSLimit(intptr_t ACPSLimit)
 {
   if (FParent != nullptr)
@@ -3,6 +3,7 @@
 
 #include <Common.h>
 #include <Exceptions.h>
+#include <BandwidthScheduler.h>
 
 #include "Configuration.h"
 #include "CopyParam.h"
@@ -100,8 +101,7 @@ private:
   TFileOperationProgressEvent FOnProgress;
   TFileOperationFinishedEvent FOnFinished;
   bool FReset;
-  uintptr_t FLastSecond;
-  intptr_t FRemainingCPS;
+  TBandwidthBucket FBandwidthBucket;
   bool FCounterSet;
   rde::vector<intptr_t> FTicks;
   rde::vector<int64_t> FTotalTransferredThen;
@@ -254,6 +254,8 @@ public:
   void SetCancelAtLeast(TCancelStatus ACancel);
   bool ClearCancelFile();
   void SetCPSLimit(intptr_t ACPSLimit);
+  // share of the global bandwidth cap, relative to other transfers
+  void SetBandwidthWeight(intptr_t AWeight);
   void SetBatchOverwrite(TBatchOverwrite ABatchOverwrite);
   void SetSkipToAll();
   UnicodeString GetLogStr(bool Done) const;
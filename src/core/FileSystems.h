@@ -204,6 +204,11 @@ public:
   virtual void LookupUsersGroups() = 0;
   virtual void ReadCurrentDirectory() = 0;
   virtual void ReadDirectory(TRemoteFileList *FileList) = 0;
+  // Reads several listings at once, where the protocol allows pipelining.
+  // The listings that were not read, also when cancelled, are left empty.
+  virtual void ReadDirectories(TList *FileLists) = 0;
+  // the listings that ReadDirectories opens at once
+  static const intptr_t MaxPipelinedListings = 16;
   virtual void ReadFile(UnicodeString AFileName,
     TRemoteFile *&File) = 0;
   virtual void ReadSymlink(TRemoteFile *SymLinkFile,
@@ -9,6 +9,7 @@
 #define MPEXT
 #endif
 #include "FtpFileSystem.h"
+#include "ProtocolTrace.h"
 #include "FileZillaIntf.h"
 
 #include <Common.h>
@@ -41,6 +42,7 @@ public:
 
 protected:
   virtual bool DoPostMessage(TMessageType Type, WPARAM wParam, LPARAM lParam) override;
+  virtual bool DoPostTransferStatus(int64_t TransferSize, int64_t Bytes, bool FileTransfer) override;
 
   virtual bool HandleStatus(const wchar_t *Status, int Type) override;
   virtual bool HandleAsynchRequestOverwrite(
@@ -91,6 +93,11 @@ bool TFileZillaImpl::DoPostMessage(TMessageType Type, WPARAM wParam, LPARAM lPar
   return FFileSystem->FTPPostMessage(Type, wParam, lParam);
 }
 
+bool TFileZillaImpl::DoPostTransferStatus(int64_t TransferSize, int64_t Bytes, bool FileTransfer)
+{
+  return FFileSystem->FTPPostTransferStatus(TransferSize, Bytes, FileTransfer);
+}
+
 bool TFileZillaImpl::HandleStatus(const wchar_t *Status, int Type)
 {
   return FFileSystem->HandleStatus(Status, Type);
@@ -168,28 +175,201 @@ std::wstring TFileZillaImpl::GetClientString() const
   return std::wstring(GetSshVersionString().c_str());
 }
 
+// Latest transfer status, updated in place until consumed
+struct TTransferStatusSlot
+{
+  CUSTOM_MEM_ALLOCATION_IMPL
+
+  int64_t TransferSize;
+  int64_t Bytes;
+  bool FileTransfer;
+  bool Queued;
+  bool Owned;
+};
+
 struct message_t
 {
   CUSTOM_MEM_ALLOCATION_IMPL
 
   message_t() : wparam(0),
-    lparam(0)
+    lparam(0),
+    status(nullptr)
   {
   }
 
   message_t(WPARAM w, LPARAM l) : wparam(w),
-    lparam(l)
+    lparam(l),
+    status(nullptr)
   {
   }
 
   WPARAM wparam;
   LPARAM lparam;
+  // transfer status marker, if not null
+  TTransferStatusSlot *status;
 };
 
-class TMessageQueue : public TObject, public rde::list<message_t>
-{
+// Bounded single-consumer ring of messages from the FileZilla thread.
+// Producers are serialized by the queue lock of the file system,
+// the consumer pops without locking as long as the ring did not overflow.
+// Messages that do not fit go to an overflow list, and keep going there
+// until the consumer empties it, so the order is preserved.
+// Transfer status updates are coalesced: a marker is queued for the first
+// update only, and the following updates overwrite its slot, until another
+// message is queued after it.
+class TMessageQueue : public TObject
+{
+  NB_DISABLE_COPY(TMessageQueue)
 public:
   typedef message_t value_type;
+
+  TMessageQueue() :
+    FHead(0),
+    FTail(0),
+    FOverflowCount(0),
+    FOpenStatusSlot(nullptr)
+  {
+    for (intptr_t Index = 0; Index < StatusSlotCount; Index++)
+    {
+      FStatusSlots[Index].Queued = false;
+      FStatusSlots[Index].Owned = false;
+    }
+  }
+
+  virtual ~TMessageQueue()
+  {
+    value_type Message;
+    while (PopRing(Message) || PopOverflow(Message))
+    {
+      if ((Message.status != nullptr) && Message.status->Owned)
+      {
+        delete Message.status;
+      }
+    }
+  }
+
+  // Producer side, under the queue lock
+  void Push(const value_type &Message)
+  {
+    FOpenStatusSlot = nullptr;
+    DoPush(Message);
+  }
+
+  // Producer side, under the queue lock;
+  // returns false when the update was merged into a queued one
+  bool PushTransferStatus(int64_t TransferSize, int64_t Bytes, bool FileTransfer)
+  {
+    bool Result = (FOpenStatusSlot == nullptr);
+    if (Result)
+    {
+      for (intptr_t Index = 0; (FOpenStatusSlot == nullptr) && (Index < StatusSlotCount); Index++)
+      {
+        if (!FStatusSlots[Index].Queued)
+        {
+          FOpenStatusSlot = &FStatusSlots[Index];
+        }
+      }
+      if (FOpenStatusSlot == nullptr)
+      {
+        // all slots are waiting behind other messages
+        FOpenStatusSlot = new TTransferStatusSlot();
+        FOpenStatusSlot->Owned = true;
+      }
+      FOpenStatusSlot->Queued = true;
+    }
+    FOpenStatusSlot->TransferSize = TransferSize;
+    FOpenStatusSlot->Bytes = Bytes;
+    FOpenStatusSlot->FileTransfer = FileTransfer;
+    if (Result)
+    {
+      value_type Message;
+      Message.status = FOpenStatusSlot;
+      DoPush(Message);
+    }
+    return Result;
+  }
+
+  // Consumer side, the lock is taken when the ring is empty
+  // and the overflow list is not, and to consume a status slot
+  bool Pop(value_type &Message, TCriticalSection &Lock)
+  {
+    bool Result = PopRing(Message);
+    if (!Result && (FOverflowCount > 0))
+    {
+      TGuard Guard(Lock);
+      Result = PopOverflow(Message);
+    }
+    return Result;
+  }
+
+  // Consumer side, under the queue lock
+  void ConsumeStatus(TTransferStatusSlot *Slot, TTransferStatusSlot &Status)
+  {
+    Status = *Slot;
+    Slot->Queued = false;
+    if (FOpenStatusSlot == Slot)
+    {
+      FOpenStatusSlot = nullptr;
+    }
+  }
+
+  bool Empty() const
+  {
+    return (FHead == FTail) && (FOverflowCount == 0);
+  }
+
+private:
+  static const LONG Capacity = 1024;
+  static const intptr_t StatusSlotCount = 2;
+
+  value_type FRing[Capacity];
+  volatile LONG FHead;
+  volatile LONG FTail;
+  rde::list<value_type> FOverflow;
+  volatile LONG FOverflowCount;
+  TTransferStatusSlot FStatusSlots[StatusSlotCount];
+  TTransferStatusSlot *FOpenStatusSlot;
+
+  void DoPush(const value_type &Message)
+  {
+    LONG Tail = FTail;
+    if ((FOverflowCount == 0) && (Tail - FHead < Capacity))
+    {
+      FRing[Tail % Capacity] = Message;
+      // publishes the message to the consumer
+      ::InterlockedExchange(&FTail, Tail + 1);
+    }
+    else
+    {
+      FOverflow.push_back(Message);
+      ::InterlockedIncrement(&FOverflowCount);
+    }
+  }
+
+  bool PopRing(value_type &Message)
+  {
+    LONG Head = FHead;
+    bool Result = (Head != FTail);
+    if (Result)
+    {
+      Message = FRing[Head % Capacity];
+      // frees the entry for the producer
+      ::InterlockedExchange(&FHead, Head + 1);
+    }
+    return Result;
+  }
+
+  bool PopOverflow(value_type &Message)
+  {
+    bool Result = !FOverflow.empty();
+    if (Result)
+    {
+      Message = FOverflow.front();
+      FOverflow.pop_front();
+      ::InterlockedDecrement(&FOverflowCount);
+    }
+    return Result;
+  }
 };
 
 #if 0
@@ -268,7 +448,8 @@ TFTPFileSystem::TFTPFileSystem(TTerminal *ATerminal) :
   TCustomFileSystem(OBJECT_CLASS_TFTPFileSystem, ATerminal),
   FFileZillaIntf(nullptr),
   FQueue(new TMessageQueue),
-  FQueueEvent(::CreateEvent(nullptr, true, false, nullptr)),
+  FQueueEvent(::CreateEvent(nullptr, false, false, nullptr)),
+  FQueueWaiting(0),
   FFileSystemInfoValid(false),
   FReply(0),
   FCommandReply(0),
@@ -3091,6 +3272,11 @@ void TFTPFileSystem::ReadFile(UnicodeString AFileName,
   AFile = Own ? File : File->Duplicate();
 }
 
+void TFTPFileSystem::ReadDirectories(TList * /*FileLists*/)
+{
+  // noop, the control connection serves one listing at a time
+}
+
 void TFTPFileSystem::ReadSymlink(TRemoteFile *SymlinkFile,
   TRemoteFile *&AFile)
 {
@@ -3460,6 +3646,27 @@ intptr_t TFTPFileSystem::GetOptionVal(intptr_t OptionID) const
     Result = FFileTransferNoList ? TRUE : FALSE;
     break;
 
+  case OPTION_MPEXT_BANDWIDTH_WEIGHT:
+    Result = FTerminal->GetBandwidthWeight();
+    break;
+
+  case OPTION_MPEXT_PIPELINING:
+    switch (Data->GetFtpPipelining())
+    {
+    case asOn:
+      Result = 1;
+      break;
+
+    case asOff:
+      Result = 0;
+      break;
+
+    default:
+      Result = 2;
+      break;
+    }
+    break;
+
   default:
     DebugFail();
     Result = FALSE;
@@ -3480,41 +3687,71 @@ bool TFTPFileSystem::FTPPostMessage(uintptr_t Type, WPARAM wParam, LPARAM lParam
     TGuard Guard(FTransferStatusCriticalSection);
   }
 
-  TGuard Guard(FQueueCriticalSection);
+  {
+    TGuard Guard(FQueueCriticalSection);
+    FQueue->Push(TMessageQueue::value_type(wParam, lParam));
+  }
+  WakeMessageConsumer();
 
-  FQueue->push_back(TMessageQueue::value_type(wParam, lParam));
-  ::SetEvent(FQueueEvent);
+  return true;
+}
+
+bool TFTPFileSystem::FTPPostTransferStatus(int64_t TransferSize, int64_t Bytes, bool FileTransfer)
+{
+  // See FTPPostMessage
+  {
+    TGuard Guard(FTransferStatusCriticalSection);
+  }
+
+  bool Queued;
+  {
+    TGuard Guard(FQueueCriticalSection);
+    Queued = FQueue->PushTransferStatus(TransferSize, Bytes, FileTransfer);
+  }
+  if (Queued)
+  {
+    WakeMessageConsumer();
+  }
 
   return true;
 }
 
+void TFTPFileSystem::WakeMessageConsumer()
+{
+  // signal only when the consumer waits (or is about to),
+  // not for every message
+  if (::InterlockedExchange(&FQueueWaiting, 0) != 0)
+  {
+    ::SetEvent(FQueueEvent);
+  }
+}
+
 bool TFTPFileSystem::ProcessMessage()
 {
-  bool Result;
   TMessageQueue::value_type Message;
+  bool Result = FQueue->Pop(Message, FQueueCriticalSection);
 
+  if (Result)
   {
-    TGuard Guard(FQueueCriticalSection);
-
-    Result = !FQueue->empty();
-    if (Result)
+    if (Message.status != nullptr)
     {
-      Message = FQueue->front();
-      FQueue->erase(FQueue->begin());
+      TTransferStatusSlot Status;
+      {
+        TGuard Guard(FQueueCriticalSection);
+        FQueue->ConsumeStatus(Message.status, Status);
+      }
+      if (Status.Owned)
+      {
+        delete Message.status;
+      }
+      HandleTransferStatus(true, Status.TransferSize, Status.Bytes, Status.FileTransfer);
     }
     else
     {
-      // now we are perfectly sure that the queue is empty as it is locked,
-      // so reset the event
-      ::ResetEvent(FQueueEvent);
+      FFileZillaIntf->HandleMessage(Message.wparam, Message.lparam);
     }
   }
 
-  if (Result)
-  {
-    FFileZillaIntf->HandleMessage(Message.wparam, Message.lparam);
-  }
-
   return Result;
 }
 
@@ -3528,7 +3765,19 @@ void TFTPFileSystem::WaitForMessages()
   DWORD Result;
   do
   {
-    Result = ::WaitForSingleObject(FQueueEvent, GUIUpdateInterval);
+    // announce the wait before checking the queue,
+    // so that a message posted in between signals the event
+    ::InterlockedExchange(&FQueueWaiting, 1);
+    if (!FQueue->Empty())
+    {
+      Result = WAIT_OBJECT_0;
+    }
+    else
+    {
+      // the timeout is for the GUI only, messages wake us up
+      Result = ::WaitForSingleObject(FQueueEvent, GUIUpdateInterval);
+    }
+    ::InterlockedExchange(&FQueueWaiting, 0);
     FTerminal->ProcessGUI();
   }
   while (Result == WAIT_TIMEOUT);
@@ -4217,6 +4466,7 @@ bool TFTPFileSystem::HandleStatus(const wchar_t *AStatus, int Type)
       FLastCommand = CMD_UNKNOWN;
     }
     LogType = llInput;
+    FTerminal->GetLog()->RecordTrace(tpFTP, tdSend, 0, 0, Status.Length());
   }
   break;
 
@@ -4257,6 +4507,11 @@ bool TFTPFileSystem::HandleStatus(const wchar_t *AStatus, int Type)
   case TFileZillaIntf::LOG_REPLY:
     HandleReplyStatus(AStatus);
     LogType = llOutput;
+    {
+      int64_t Code = 0;
+      ::TryStrToInt64(Status.SubString(1, 3), Code);
+      FTerminal->GetLog()->RecordTrace(tpFTP, tdReceive, static_cast<uintptr_t>(Code), 0, Status.Length());
+    }
     break;
 
   case TFileZillaIntf::LOG_INFO:
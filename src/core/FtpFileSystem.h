@@ -70,6 +70,7 @@ public:
   virtual void LookupUsersGroups() override;
   virtual void ReadCurrentDirectory() override;
   virtual void ReadDirectory(TRemoteFileList *FileList) override;
+  virtual void ReadDirectories(TList *FileLists) override;
   virtual void ReadFile(UnicodeString AFileName,
     TRemoteFile *&AFile) override;
   virtual void ReadSymlink(TRemoteFile *SymlinkFile,
@@ -111,6 +112,8 @@ protected:
   };
 
   bool FTPPostMessage(uintptr_t Type, WPARAM wParam, LPARAM lParam);
+  bool FTPPostTransferStatus(int64_t TransferSize, int64_t Bytes, bool FileTransfer);
+  void WakeMessageConsumer();
   bool ProcessMessage();
   void DiscardMessages();
   void WaitForMessages();
@@ -246,6 +249,7 @@ private:
   TCriticalSection FTransferStatusCriticalSection;
   TMessageQueue *FQueue;
   HANDLE FQueueEvent;
+  volatile LONG FQueueWaiting;
   TSessionInfo FSessionInfo;
   TFileSystemInfo FFileSystemInfo;
   bool FFileSystemInfoValid;
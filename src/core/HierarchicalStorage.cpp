@@ -11,7 +11,7 @@
 #include "HierarchicalStorage.h"
 
 #define READ_REGISTRY(Method) \
-  if (FRegistry->ValueExists(Name)) \
+  if (HasValue(Name)) \
   try { return FRegistry->Method(Name); } catch (...) { FFailed++; return Default; } \
   else return Default;
 #define WRITE_REGISTRY(Method) \
@@ -422,6 +422,11 @@ bool THierarchicalStorage::GetTemporary() const
   return false;
 }
 
+HKEY THierarchicalStorage::WatchChanges(HANDLE /*Event*/) const
+{
+  return nullptr;
+}
+
 TRegistryStorage::TRegistryStorage(UnicodeString AStorage) :
   THierarchicalStorage(IncludeTrailingBackslash(AStorage)),
   FRegistry(nullptr)
@@ -441,15 +446,47 @@ TRegistryStorage::TRegistryStorage(UnicodeString AStorage, HKEY ARootKey) :
 void TRegistryStorage::Init()
 {
   FFailed = 0;
+  FValueNames = nullptr;
   FRegistry = new TRegistry();
   FRegistry->SetAccess(KEY_READ);
 }
 
 TRegistryStorage::~TRegistryStorage()
 {
+  SAFE_DESTROY(FValueNames);
   SAFE_DESTROY(FRegistry);
 }
 
+bool TRegistryStorage::HasValue(UnicodeString Name) const
+{
+  bool Result;
+  // Stored sessions keep only values that differ from defaults,
+  // so most reads are for values that do not exist.
+  // Enumerate the key once instead of querying every value.
+  if (GetAccessMode() == smRead)
+  {
+    if (FValueNames == nullptr)
+    {
+      FValueNames = new TStringList();
+      FValueNames->SetCaseSensitive(false);
+      FRegistry->GetValueNames(FValueNames);
+      FValueNames->SetSorted(true);
+    }
+    intptr_t Index;
+    Result = FValueNames->Find(Name, Index);
+  }
+  else
+  {
+    Result = FRegistry->ValueExists(Name);
+  }
+  return Result;
+}
+
+void TRegistryStorage::InvalidateValueNames()
+{
+  SAFE_DESTROY(FValueNames);
+}
+
 bool TRegistryStorage::Copy(TRegistryStorage *Storage)
 {
   TRegistry *Registry = Storage->FRegistry;
@@ -509,6 +546,7 @@ UnicodeString TRegistryStorage::GetSource()
 
 void TRegistryStorage::SetAccessMode(TStorageAccessMode Value)
 {
+  InvalidateValueNames();
   THierarchicalStorage::SetAccessMode(Value);
   if (FRegistry)
   {
@@ -528,6 +566,7 @@ void TRegistryStorage::SetAccessMode(TStorageAccessMode Value)
 
 bool TRegistryStorage::DoOpenSubKey(UnicodeString SubKey, bool CanCreate)
 {
+  InvalidateValueNames();
   if (FKeyHistory->GetCount() > 0)
   {
     FRegistry->CloseKey();
@@ -538,6 +577,7 @@ bool TRegistryStorage::DoOpenSubKey(UnicodeString SubKey, bool CanCreate)
 
 void TRegistryStorage::CloseSubKey()
 {
+  InvalidateValueNames();
   FRegistry->CloseKey();
   THierarchicalStorage::CloseSubKey();
   if (FKeyHistory->GetCount())
@@ -571,6 +611,23 @@ void TRegistryStorage::GetValueNames(TStrings *Strings) const
   FRegistry->GetValueNames(Strings);
 }
 
+HKEY TRegistryStorage::WatchChanges(HANDLE Event) const
+{
+  // Own handle, as the notification ends when the handle is closed
+  HKEY Result = nullptr;
+  if ((FRegistry->GetCurrentKey() != nullptr) &&
+      (::RegOpenKeyEx(FRegistry->GetCurrentKey(), nullptr, 0, KEY_NOTIFY, &Result) == ERROR_SUCCESS))
+  {
+    if (::RegNotifyChangeKeyValue(Result, TRUE,
+          REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET, Event, TRUE) != ERROR_SUCCESS)
+    {
+      ::RegCloseKey(Result);
+      Result = nullptr;
+    }
+  }
+  return Result;
+}
+
 bool TRegistryStorage::DeleteValue(UnicodeString Name)
 {
   return FRegistry->DeleteValue(Name);
@@ -585,7 +642,7 @@ bool TRegistryStorage::DoKeyExists(UnicodeString SubKey, bool AForceAnsi)
 
 bool TRegistryStorage::ValueExists(UnicodeString Value) const
 {
-  bool Result = FRegistry->ValueExists(Value);
+  bool Result = HasValue(Value);
   return Result;
 }
 
@@ -618,7 +675,7 @@ intptr_t TRegistryStorage::ReadInteger(UnicodeString Name, intptr_t Default) con
 int64_t TRegistryStorage::ReadInt64(UnicodeString Name, int64_t Default) const
 {
   int64_t Result = Default;
-  if (FRegistry->ValueExists(Name))
+  if (HasValue(Name))
   {
     try
     {
@@ -641,7 +698,7 @@ size_t TRegistryStorage::ReadBinaryData(UnicodeString Name,
   void *Buffer, size_t Size) const
 {
   size_t Result;
-  if (FRegistry->ValueExists(Name))
+  if (HasValue(Name))
   {
     try
     {
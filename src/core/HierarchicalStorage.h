@@ -71,6 +71,11 @@ public:
   virtual void WriteBinaryDataAsString(UnicodeString Name, RawByteString Value);
 
   virtual void Flush();
+  // Starts watching the current key (with all its subkeys) for changes,
+  // signalling the Event on first change. Returns the watched key,
+  // which needs to be kept open while watching and closed with RegCloseKey,
+  // or nullptr when the storage cannot be watched.
+  virtual HKEY WatchChanges(HANDLE Event) const;
 
 #if 0
   __property UnicodeString Storage  = { read=FStorage };
@@ -151,6 +156,7 @@ public:
   void WriteBinaryData(UnicodeString Name, const void *Buffer, size_t Size);
 
   virtual void GetValueNames(TStrings *Strings) const;
+  virtual HKEY WatchChanges(HANDLE Event) const;
 
 protected:
   virtual bool DoKeyExists(UnicodeString SubKey, bool AForceAnsi);
@@ -169,6 +175,14 @@ public:
 private:
   TRegistry *FRegistry;
   mutable intptr_t FFailed;
+  // Names of values of the current key, collected on first read,
+  // so that reading absent (default) values does not query registry.
+  // This saves registry queries only, every loaded session still holds
+  // its own copy of all values (UnicodeString copies are deep).
+  mutable TStringList *FValueNames;
+
+  bool HasValue(UnicodeString Name) const;
+  void InvalidateValueNames();
 };
 
 #if 0
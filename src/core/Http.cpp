@@ -76,6 +76,7 @@ void THttp::SendRequest(const char *Method, UnicodeString Request)
 
       TProxyMethod ProxyMethod = GetProxyHost().IsEmpty() ? ::pmNone : pmHTTP;
       InitNeonSession(NeonSession, ProxyMethod, GetProxyHost(), GetProxyPort(), UnicodeString(), UnicodeString());
+      SetNeonReadBufferSize(NeonSession, 0);
 
       if (IsTls)
       {
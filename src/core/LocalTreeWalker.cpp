@@ -0,0 +1,309 @@
+#include <vcl.h>
+#pragma hdrstop
+
+#include <Common.h>
+#include <Exceptions.h>
+#include <memory>
+
+#include "LocalTreeWalker.h"
+#include "Terminal.h"
+#include "CopyParam.h"
+
+// FindExInfoBasic and FIND_FIRST_EX_LARGE_FETCH of Windows 7 SDK
+static const FINDEX_INFO_LEVELS FindExInfoBasicLevel = static_cast<FINDEX_INFO_LEVELS>(1);
+static const DWORD FindFirstExLargeFetch = 2;
+
+TLocalTreeWalker::TLocalTreeWalker(const TTerminal *ATerminal, const TCopyParamType *ACopyParam,
+  intptr_t AParams, intptr_t ThreadCount) :
+  FTerminal(ATerminal),
+  FCopyParam(ACopyParam),
+  FHasMask(false),
+  FParams(AParams),
+  FThreadCount(ThreadCount),
+  FReadyEntries(0),
+  FTerminated(false),
+  FWorkEvent(nullptr),
+  FReadyEvent(nullptr)
+{
+  FHasMask = (FCopyParam != nullptr) && !FCopyParam->GetIncludeFileMask().GetMasks().IsEmpty();
+  if (FThreadCount <= 0)
+  {
+    SYSTEM_INFO SystemInfo;
+    ::GetSystemInfo(&SystemInfo);
+    // the workers mostly wait for the disk
+    FThreadCount = SystemInfo.dwNumberOfProcessors * 2;
+  }
+  if (FThreadCount > MaxThreads)
+  {
+    FThreadCount = MaxThreads;
+  }
+  FWorkEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  FReadyEvent = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+  if ((FWorkEvent == nullptr) || (FReadyEvent == nullptr))
+  {
+    DWORD LastError = ::GetLastError();
+    SAFE_CLOSE_HANDLE(FWorkEvent);
+    SAFE_CLOSE_HANDLE(FReadyEvent);
+    ::RaiseLastOSError(LastError);
+  }
+}
+
+TLocalTreeWalker::~TLocalTreeWalker()
+{
+  {
+    TGuard Guard(FSection);
+    FTerminated = true;
+    ::SetEvent(FWorkEvent);
+  }
+  if (!FThreads.empty())
+  {
+    ::WaitForMultipleObjects(static_cast<DWORD>(FThreads.size()), &FThreads[0], TRUE, INFINITE);
+    for (size_t Index = 0; Index < FThreads.size(); Index++)
+    {
+      ::CloseHandle(FThreads[Index]);
+    }
+  }
+  for (TListings::iterator Iter = FReady.begin(); Iter != FReady.end(); ++Iter)
+  {
+    delete Iter->second;
+  }
+  ::CloseHandle(FWorkEvent);
+  ::CloseHandle(FReadyEvent);
+}
+
+UnicodeString TLocalTreeWalker::Key(UnicodeString Directory)
+{
+  return LowerCase(::IncludeTrailingBackslash(Directory));
+}
+
+void TLocalTreeWalker::StartThreads()
+{
+  // started on first use, the walker may be not needed at all
+  while (static_cast<intptr_t>(FThreads.size()) < FThreadCount)
+  {
+    DWORD ThreadId;
+    HANDLE Thread = ::CreateThread(nullptr, 0, &TLocalTreeWalker::WorkerThreadProc, this, 0, &ThreadId);
+    if (Thread == nullptr)
+    {
+      break;
+    }
+    FThreads.push_back(Thread);
+  }
+}
+
+void TLocalTreeWalker::UpdateWorkEvent()
+{
+  // called with FSection locked
+  bool Work =
+    FTerminated ||
+    !FDemanded.empty() ||
+    (!FQueue.empty() && (FReadyEntries < MaxReadyEntries));
+  if (Work)
+  {
+    ::SetEvent(FWorkEvent);
+  }
+  else
+  {
+    ::ResetEvent(FWorkEvent);
+  }
+}
+
+void TLocalTreeWalker::Add(UnicodeString Directory)
+{
+  TGuard Guard(FSection);
+  UnicodeString DirectoryKey = Key(Directory);
+  if ((FStates.find(DirectoryKey) == FStates.end()) && (FReady.find(DirectoryKey) == FReady.end()))
+  {
+    FStates[DirectoryKey] = lsQueued;
+    FQueue.push_back(::IncludeTrailingBackslash(Directory));
+    StartThreads();
+    UpdateWorkEvent();
+  }
+}
+
+bool TLocalTreeWalker::NextDirectory(UnicodeString &Directory)
+{
+  // called with FSection locked
+  bool Result = false;
+  while (!Result && !FTerminated &&
+    (!FDemanded.empty() || (!FQueue.empty() && (FReadyEntries < MaxReadyEntries))))
+  {
+    rde::vector<UnicodeString> &Source = !FDemanded.empty() ? FDemanded : FQueue;
+    Directory = Source.back();
+    Source.pop_back();
+    // a directory asked for by the caller stays in the queue too
+    TStates::iterator Iter = FStates.find(Key(Directory));
+    if ((Iter != FStates.end()) && (Iter->second == lsQueued))
+    {
+      Iter->second = lsListing;
+      Result = true;
+    }
+  }
+  UpdateWorkEvent();
+  return Result;
+}
+
+TLocalDirectoryListing *TLocalTreeWalker::ListDirectory(UnicodeString Directory)
+{
+  std::unique_ptr<TLocalDirectoryListing> Listing(new TLocalDirectoryListing());
+  Listing->Directory = Directory;
+
+  WIN32_FIND_DATA FindData;
+  UnicodeString Path = ApiPath(Directory + L"*.*");
+  // short names are not needed and bigger buffers save round trips to network shares
+  HANDLE Find = ::FindFirstFileEx(Path.c_str(), FindExInfoBasicLevel, &FindData,
+    FindExSearchNameMatch, nullptr, FindFirstExLargeFetch);
+  if ((Find == INVALID_HANDLE_VALUE) && (::GetLastError() == ERROR_INVALID_PARAMETER))
+  {
+    // before Windows 7
+    Find = ::FindFirstFile(Path.c_str(), &FindData);
+  }
+  if (Find == INVALID_HANDLE_VALUE)
+  {
+    Listing->Error = ::GetLastError();
+  }
+  else
+  {
+    bool KeepExcluded = FLAGSET(FParams, lwKeepExcluded);
+    do
+    {
+      UnicodeString FileName = FindData.cFileName;
+      if ((FileName != THISDIRECTORY) && (FileName != PARENTDIRECTORY))
+      {
+        TLocalTreeEntry Entry;
+        Entry.FileName = FileName;
+        Entry.Attrs = FindData.dwFileAttributes;
+        Entry.Size = (static_cast<int64_t>(FindData.nFileSizeHigh) << 32) + FindData.nFileSizeLow;
+        Entry.Modification = ::FileTimeToDateTime(FindData.ftLastWriteTime);
+        Entry.LastWriteTime = FindData.ftLastWriteTime;
+        Entry.CreationTime = FindData.ftCreationTime;
+        Entry.Included = true;
+        if (FHasMask)
+        {
+          TFileMasks::TParams MaskParams;
+          MaskParams.Size = Entry.Size;
+          MaskParams.Modification = Entry.Modification;
+          UnicodeString BaseFileName = FTerminal->GetBaseFileName(Directory + FileName);
+          Entry.Included =
+            FCopyParam->AllowTransfer(BaseFileName, osLocal, Entry.GetIsDirectory(), MaskParams);
+        }
+        if (Entry.Included || KeepExcluded)
+        {
+          Listing->Entries.push_back(Entry);
+        }
+      }
+    }
+    while (::FindNextFile(Find, &FindData));
+    DWORD LastError = ::GetLastError();
+    if (LastError != ERROR_NO_MORE_FILES)
+    {
+      Listing->Error = LastError;
+    }
+    ::FindClose(Find);
+  }
+  return Listing.release();
+}
+
+void TLocalTreeWalker::Listed(TLocalDirectoryListing *Listing)
+{
+  // called with FSection locked
+  UnicodeString DirectoryKey = Key(Listing->Directory);
+  FStates.erase(DirectoryKey);
+  FReady[DirectoryKey] = Listing;
+  FReadyEntries += static_cast<intptr_t>(Listing->Entries.size());
+  ::SetEvent(FReadyEvent);
+}
+
+void TLocalTreeWalker::ProcessDirectories()
+{
+  bool Terminated = false;
+  while (!Terminated)
+  {
+    UnicodeString Directory;
+    bool Found;
+    {
+      TGuard Guard(FSection);
+      Terminated = FTerminated;
+      Found = !Terminated && NextDirectory(Directory);
+    }
+
+    if (Found)
+    {
+      TLocalDirectoryListing *Listing = nullptr;
+      try
+      {
+        Listing = ListDirectory(Directory);
+      }
+      catch (Exception &)
+      {
+        // out of memory or alike, the caller retries
+        Listing = new TLocalDirectoryListing();
+        Listing->Directory = Directory;
+        Listing->Error = ERROR_NOT_ENOUGH_MEMORY;
+      }
+      TGuard Guard(FSection);
+      Listed(Listing);
+      UpdateWorkEvent();
+    }
+    else if (!Terminated)
+    {
+      ::WaitForSingleObject(FWorkEvent, INFINITE);
+    }
+  }
+}
+
+DWORD WINAPI TLocalTreeWalker::WorkerThreadProc(void *Parameter)
+{
+  static_cast<TLocalTreeWalker *>(Parameter)->ProcessDirectories();
+  return 0;
+}
+
+TLocalDirectoryListing *TLocalTreeWalker::GetListing(UnicodeString Directory)
+{
+  UnicodeString DirectoryKey = Key(Directory);
+  std::unique_ptr<TLocalDirectoryListing> Result;
+  {
+    TGuard Guard(FSection);
+    StartThreads();
+    bool Demanded = false;
+    while (Result.get() == nullptr)
+    {
+      TListings::iterator Iter = FReady.find(DirectoryKey);
+      if (Iter != FReady.end())
+      {
+        Result.reset(Iter->second);
+        FReady.erase(Iter);
+        FReadyEntries -= static_cast<intptr_t>(Result->Entries.size());
+        UpdateWorkEvent();
+      }
+      else if (FThreads.empty())
+      {
+        // no thread could be started, list on this one
+        TUnguard Unguard(FSection);
+        Result.reset(ListDirectory(::IncludeTrailingBackslash(Directory)));
+      }
+      else
+      {
+        if (!Demanded)
+        {
+          TStates::iterator StateIter = FStates.find(DirectoryKey);
+          if (StateIter == FStates.end())
+          {
+            FStates[DirectoryKey] = lsQueued;
+            FDemanded.push_back(::IncludeTrailingBackslash(Directory));
+          }
+          else if (StateIter->second == lsQueued)
+          {
+            FDemanded.push_back(::IncludeTrailingBackslash(Directory));
+          }
+          Demanded = true;
+          UpdateWorkEvent();
+        }
+        TUnguard Unguard(FSection);
+        ::WaitForSingleObject(FReadyEvent, INFINITE);
+      }
+    }
+  }
+  FindCheck(Result->Error, Result->Directory + L"*.*");
+  return Result.release();
+}
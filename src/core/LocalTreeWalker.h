@@ -0,0 +1,102 @@
+#pragma once
+
+#include <Classes.hpp>
+#include <map>
+
+class TTerminal;
+class TCopyParamType;
+
+// One entry of a local directory, as found by TLocalTreeWalker
+struct NB_CORE_EXPORT TLocalTreeEntry
+{
+  UnicodeString FileName;
+  DWORD Attrs;
+  int64_t Size;
+  TDateTime Modification;
+  FILETIME LastWriteTime;
+  FILETIME CreationTime;
+  // matches the include mask; the excluded entries are kept only with lwKeepExcluded
+  bool Included;
+
+  bool GetIsDirectory() const { return FLAGSET(Attrs, FILE_ATTRIBUTE_DIRECTORY); }
+};
+
+class NB_CORE_EXPORT TLocalDirectoryListing : public TObject
+{
+  NB_DISABLE_COPY(TLocalDirectoryListing)
+public:
+  TLocalDirectoryListing() : Error(ERROR_SUCCESS) {}
+
+  // with trailing backslash
+  UnicodeString Directory;
+  // without "." and ".."
+  rde::vector<TLocalTreeEntry> Entries;
+  // of FindFirstFile or FindNextFile, ERROR_SUCCESS when listed completely
+  DWORD Error;
+};
+
+// Lists local directories on a pool of worker threads, ahead of the caller.
+// Only the directories passed to Add are listed ahead, so the caller adds
+// just the subdirectories it is going to visit. The most recently added
+// directory is listed first, so adding the subdirectories backwards
+// follows the depth-first order, in which the callers usually ask.
+// The entries are matched against the include mask on the workers.
+class NB_CORE_EXPORT TLocalTreeWalker : public TObject
+{
+  NB_DISABLE_COPY(TLocalTreeWalker)
+public:
+  static const intptr_t lwKeepExcluded = 0x01;
+
+  // CopyParam can be nullptr to include all entries.
+  // 0 = two threads per processor, up to MaxThreads
+  TLocalTreeWalker(const TTerminal *ATerminal, const TCopyParamType *ACopyParam,
+    intptr_t AParams, intptr_t ThreadCount = 0);
+  virtual ~TLocalTreeWalker();
+
+  // Starts listing the directory ahead, the caller must take it with GetListing
+  void Add(UnicodeString Directory);
+  // Waits for the directory to be listed (listing it first, if it was not
+  // asked for yet) and passes the ownership of the listing to the caller.
+  // Raises the failure the way FindFirstChecked does.
+  TLocalDirectoryListing *GetListing(UnicodeString Directory);
+
+  // listing is mostly bound by the disk or network latency
+  static const intptr_t MaxThreads = 8;
+  // the workers do not list ahead beyond this many entries not taken yet,
+  // the listings asked for by GetListing are made regardless
+  static const intptr_t MaxReadyEntries = 256 * 1024;
+
+private:
+  enum TState { lsQueued, lsListing };
+  typedef std::map<UnicodeString, TState> TStates;
+  typedef std::map<UnicodeString, TLocalDirectoryListing *> TListings;
+
+  const TTerminal *FTerminal;
+  const TCopyParamType *FCopyParam;
+  bool FHasMask;
+  intptr_t FParams;
+  intptr_t FThreadCount;
+  TCriticalSection FSection;
+  // listed ahead, from the back
+  rde::vector<UnicodeString> FQueue;
+  // asked for by the caller, listed before the rest
+  rde::vector<UnicodeString> FDemanded;
+  TStates FStates;
+  TListings FReady;
+  intptr_t FReadyEntries;
+  bool FTerminated;
+  // set while there is work for the workers
+  HANDLE FWorkEvent;
+  // signaled whenever a listing is done
+  HANDLE FReadyEvent;
+  rde::vector<HANDLE> FThreads;
+
+  static UnicodeString Key(UnicodeString Directory);
+  void StartThreads();
+  bool NextDirectory(UnicodeString &Directory);
+  void UpdateWorkEvent();
+  TLocalDirectoryListing *ListDirectory(UnicodeString Directory);
+  void Listed(TLocalDirectoryListing *Listing);
+  void ProcessDirectories();
+  static DWORD WINAPI WorkerThreadProc(void *Parameter);
+};
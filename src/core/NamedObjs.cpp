@@ -12,6 +12,8 @@ static intptr_t NamedObjectSortProc(const void *Item1, const void *Item2)
 }
 
 //--- TNamedObject ----------------------------------------------------------
+volatile LONG TNamedObject::FRenameCount = 0;
+
 TNamedObject::TNamedObject(TObjectClassId Kind, UnicodeString AName) :
   TPersistent(Kind),
   FHidden(false)
@@ -21,6 +23,10 @@ TNamedObject::TNamedObject(TObjectClassId Kind, UnicodeString AName) :
 
 void TNamedObject::SetName(UnicodeString Value)
 {
+  if (FName != Value)
+  {
+    ::InterlockedIncrement(&FRenameCount);
+  }
   FHidden = (Value.SubString(1, TNamedObjectList::HiddenPrefix.Length()) == TNamedObjectList::HiddenPrefix);
   FName = Value;
 }
@@ -84,7 +90,8 @@ TNamedObjectList::TNamedObjectList(TObjectClassId Kind) :
   TObjectList(Kind),
   FHiddenCount(0),
   FAutoSort(true),
-  FControlledAdd(false)
+  FControlledAdd(false),
+  FVersion(0)
 {
 }
 
@@ -112,6 +119,7 @@ void TNamedObjectList::AlphaSort()
 {
   Sort(NamedObjectSortProc);
   Recount();
+  FVersion++;
 }
 
 intptr_t TNamedObjectList::Add(TObject *AObject)
@@ -136,6 +144,7 @@ intptr_t TNamedObjectList::Add(TObject *AObject)
 
 void TNamedObjectList::Notify(void *Ptr, TListNotification Action)
 {
+  FVersion++;
   if (Action == lnDeleted)
   {
     TNamedObject *NamedObject = static_cast<TNamedObject *>(Ptr);
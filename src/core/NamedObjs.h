@@ -29,9 +29,12 @@ public:
   bool IsSameName(UnicodeString AName) const;
   virtual intptr_t Compare(const TNamedObject *Other) const;
   void MakeUniqueIn(TNamedObjectList *List);
+  // Number of renames of any named object, items do not know their list
+  static intptr_t GetRenameCount() { return FRenameCount; }
 private:
   UnicodeString FName;
   bool FHidden;
+  static volatile LONG FRenameCount;
 };
 
 class NB_CORE_EXPORT TNamedObjectList : public TObjectList
@@ -48,12 +51,15 @@ protected:
   intptr_t FHiddenCount;
   bool FAutoSort;
   bool FControlledAdd;
+  intptr_t FVersion;
   void Recount();
 public:
   static const UnicodeString HiddenPrefix;
 
   bool GetAutoSort() const { return FAutoSort; }
   void SetAutoSort(bool Value) { FAutoSort = Value; }
+  // Changes whenever items are added, removed, sorted or renamed
+  intptr_t GetVersion() const { return FVersion + TNamedObject::GetRenameCount(); }
 
   explicit TNamedObjectList(TObjectClassId Kind = OBJECT_CLASS_TNamedObjectList);
   void AlphaSort();
@@ -117,6 +117,21 @@ void DestroyNeonSession(ne_session *Session)
   ne_session_destroy(Session);
 }
 
+void SetNeonReadBufferSize(ne_session *Session, intptr_t Size)
+{
+  const intptr_t MinReadBufferSize = 64 * 1024;
+  const intptr_t MaxReadBufferSize = 1024 * 1024;
+  if (Size < MinReadBufferSize)
+  {
+    Size = MinReadBufferSize;
+  }
+  else if (Size > MaxReadBufferSize)
+  {
+    Size = MaxReadBufferSize;
+  }
+  ne_set_read_buffer_size(Session, static_cast<size_t>(Size));
+}
+
 UnicodeString GetNeonError(ne_session *Session)
 {
   return StrFromNeon(ne_get_error(Session));
@@ -14,6 +14,7 @@ ne_session *CreateNeonSession(const ne_uri &uri);
 void InitNeonSession(ne_session *Session, TProxyMethod ProxyMethod, UnicodeString ProxyHost,
   intptr_t ProxyPort, UnicodeString ProxyUsername, UnicodeString ProxyPassword);
 void DestroyNeonSession(ne_session *Session);
+void SetNeonReadBufferSize(ne_session *Session, intptr_t Size);
 UnicodeString GetNeonError(ne_session *Session);
 void CheckNeonStatus(ne_session *Session, intptr_t NeonStatus,
   UnicodeString AHostName, UnicodeString CustomError = L"");
@@ -0,0 +1,364 @@
+#include <vcl.h>
+#pragma hdrstop
+
+#include <Common.h>
+#include <Exceptions.h>
+
+#include "ProtocolTrace.h"
+#include "SftpFileSystem.h"
+
+static const char ProtocolTraceMagic[8] = { 'N', 'B', 'T', 'R', 'A', 'C', 'E', '\0' };
+static const uint32_t ProtocolTraceVersion = 1;
+// Records that fit into smallest trace
+static const int64_t ProtocolTraceMinSize = 1024 * 1024;
+
+TProtocolTrace::TProtocolTrace(UnicodeString AFileName, int64_t AMaxSize) :
+  FFileName(AFileName),
+  FMaxSize(std::max(AMaxSize, ProtocolTraceMinSize)),
+  FFile(INVALID_HANDLE_VALUE),
+  FMapping(nullptr),
+  FHeader(nullptr),
+  FRecords(nullptr),
+  FCapacity(0),
+  FFrequency(0)
+{
+  LARGE_INTEGER Frequency;
+  ::QueryPerformanceFrequency(&Frequency);
+  FFrequency = Frequency.QuadPart;
+  memset(FPending, 0, sizeof(FPending));
+  // the view must be addressable as a whole
+  FMaxSize = std::min(FMaxSize, static_cast<int64_t>(512 * 1024 * 1024));
+  Open();
+}
+
+TProtocolTrace::~TProtocolTrace()
+{
+  Close();
+}
+
+void TProtocolTrace::Open()
+{
+  DebugAssert(FFile == INVALID_HANDLE_VALUE);
+  FFile = ::CreateFile(FFileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+    nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  THROWOSIFFALSE(FFile != INVALID_HANDLE_VALUE);
+
+  LARGE_INTEGER Size;
+  Size.QuadPart = FMaxSize;
+  FMapping = ::CreateFileMapping(FFile, nullptr, PAGE_READWRITE, Size.HighPart, Size.LowPart, nullptr);
+  if (FMapping != nullptr)
+  {
+    FHeader = static_cast<TProtocolTraceHeader *>(::MapViewOfFile(FMapping, FILE_MAP_WRITE, 0, 0, 0));
+  }
+  if (FHeader == nullptr)
+  {
+    DWORD LastError = ::GetLastError();
+    Close();
+    ::RaiseLastOSError(LastError);
+  }
+
+  FRecords = reinterpret_cast<TProtocolTraceRecord *>(FHeader + 1);
+  FCapacity = static_cast<uint32_t>((FMaxSize - sizeof(TProtocolTraceHeader)) / sizeof(TProtocolTraceRecord));
+
+  memmove(FHeader->Magic, ProtocolTraceMagic, sizeof(FHeader->Magic));
+  FHeader->Version = ProtocolTraceVersion;
+  FHeader->RecordSize = sizeof(TProtocolTraceRecord);
+  FHeader->Frequency = FFrequency;
+  LARGE_INTEGER Ticks;
+  ::QueryPerformanceCounter(&Ticks);
+  FHeader->StartTicks = Ticks.QuadPart;
+  FILETIME Now;
+  ::GetSystemTimeAsFileTime(&Now);
+  FHeader->StartTime = (static_cast<uint64_t>(Now.dwHighDateTime) << 32) | Now.dwLowDateTime;
+  FHeader->Count = 0;
+  FHeader->Reserved = 0;
+}
+
+void TProtocolTrace::Close()
+{
+  if (FHeader != nullptr)
+  {
+    // Trim the file to what was actually recorded
+    LARGE_INTEGER Size;
+    Size.QuadPart = sizeof(TProtocolTraceHeader) + static_cast<int64_t>(FHeader->Count) * sizeof(TProtocolTraceRecord);
+    ::UnmapViewOfFile(FHeader);
+    FHeader = nullptr;
+    FRecords = nullptr;
+    ::CloseHandle(FMapping);
+    FMapping = nullptr;
+    if (::SetFilePointerEx(FFile, Size, nullptr, FILE_BEGIN))
+    {
+      ::SetEndOfFile(FFile);
+    }
+  }
+  else if (FMapping != nullptr)
+  {
+    ::CloseHandle(FMapping);
+    FMapping = nullptr;
+  }
+  if (FFile != INVALID_HANDLE_VALUE)
+  {
+    ::CloseHandle(FFile);
+    FFile = INVALID_HANDLE_VALUE;
+  }
+}
+
+void TProtocolTrace::Rotate()
+{
+  Close();
+  UnicodeString PreviousFileName = FFileName + L".1";
+  if (::FileExists(PreviousFileName))
+  {
+    ::DeleteFileChecked(PreviousFileName);
+  }
+  THROWOSIFFALSE(::RenameFile(FFileName, PreviousFileName));
+  Open();
+}
+
+void TProtocolTrace::Record(TTraceProtocol Protocol, TTraceDirection Direction,
+  uintptr_t Type, uintptr_t MessageNumber, uintptr_t Length)
+{
+  LARGE_INTEGER Ticks;
+  ::QueryPerformanceCounter(&Ticks);
+
+  TGuard Guard(FCriticalSection);
+  try
+  {
+    if ((FHeader != nullptr) && (FHeader->Count >= FCapacity))
+    {
+      Rotate();
+    }
+  }
+  catch (...)
+  {
+    // Stop tracing rather than failing the session
+    Close();
+  }
+
+  if (FHeader != nullptr)
+  {
+    uint32_t Latency = 0;
+    // SSH records are raw reads and writes, not messages,
+    // there is no request to match the response with
+    if (Protocol != tpSSH)
+    {
+      // Key is offset by one, so that zeroed slot never matches
+      uint32_t Key = static_cast<uint32_t>(MessageNumber) + 1;
+      TPendingRequest &Pending = FPending[(Protocol * PendingSlots) + (MessageNumber % PendingSlots)];
+      if (Direction == tdSend)
+      {
+        Pending.Key = Key;
+        Pending.Ticks = Ticks.QuadPart;
+      }
+      else if (Pending.Key == Key)
+      {
+        Latency = static_cast<uint32_t>(((Ticks.QuadPart - Pending.Ticks) * 1000000) / FFrequency);
+        Pending.Key = 0;
+      }
+    }
+
+    TProtocolTraceRecord &Rec = FRecords[FHeader->Count];
+    Rec.Ticks = Ticks.QuadPart;
+    Rec.MessageNumber = static_cast<uint32_t>(MessageNumber);
+    Rec.Length = static_cast<uint32_t>(Length);
+    Rec.Latency = Latency;
+    Rec.Type = static_cast<uint16_t>(Type);
+    Rec.Protocol = static_cast<uint8_t>(Protocol);
+    Rec.Direction = static_cast<uint8_t>(Direction);
+    // publish the record only once it is complete
+    ::MemoryBarrier();
+    FHeader->Count++;
+  }
+}
+
+static const wchar_t *TraceProtocolName(uint8_t Protocol)
+{
+  switch (Protocol)
+  {
+  case tpSSH:
+    return L"SSH";
+  case tpSFTP:
+    return L"SFTP";
+  case tpFTP:
+    return L"FTP";
+  default:
+    return L"?";
+  }
+}
+
+static UnicodeString TraceRecordName(const TProtocolTraceRecord &Rec)
+{
+  UnicodeString Result;
+  switch (Rec.Protocol)
+  {
+  case tpSFTP:
+    Result = SFTPPacketTypeName(Rec.Type);
+    break;
+
+  case tpFTP:
+    Result = (Rec.Direction == tdSend) ? UnicodeString(L"Command") : FORMAT(L"Reply %d", ToInt(Rec.Type));
+    break;
+
+  default:
+    Result = (Rec.Direction == tdSend) ? L"Sent" : L"Read";
+    break;
+  }
+  return Result;
+}
+
+static int64_t TraceMicroseconds(const TProtocolTraceHeader *Header, int64_t Ticks)
+{
+  int64_t Elapsed = Ticks - Header->StartTicks;
+  return ((Elapsed / Header->Frequency) * 1000000) +
+    (((Elapsed % Header->Frequency) * 1000000) / Header->Frequency);
+}
+
+static UnicodeString TraceTimestamp(const TProtocolTraceHeader *Header, int64_t Ticks)
+{
+  // FILETIME is in 100ns units
+  uint64_t Time = Header->StartTime + (TraceMicroseconds(Header, Ticks) * 10);
+  FILETIME UtcTime;
+  UtcTime.dwLowDateTime = static_cast<DWORD>(Time & 0xFFFFFFFF);
+  UtcTime.dwHighDateTime = static_cast<DWORD>(Time >> 32);
+  FILETIME LocalTime;
+  SYSTEMTIME SystemTime;
+  ::FileTimeToLocalFileTime(&UtcTime, &LocalTime);
+  ::FileTimeToSystemTime(&LocalTime, &SystemTime);
+  return FORMAT(L"%04d-%02d-%02d %02d:%02d:%02d.%03d",
+    SystemTime.wYear, SystemTime.wMonth, SystemTime.wDay,
+    SystemTime.wHour, SystemTime.wMinute, SystemTime.wSecond, SystemTime.wMilliseconds);
+}
+
+void DecodeProtocolTrace(UnicodeString TraceFileName,
+  TProtocolTraceFormat Format, TStrings *Output)
+{
+  HANDLE File = ::CreateFile(TraceFileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+    nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  THROWOSIFFALSE(File != INVALID_HANDLE_VALUE);
+  HANDLE Mapping = nullptr;
+  const TProtocolTraceHeader *Header = nullptr;
+  try__finally
+  {
+    SCOPE_EXIT
+    {
+      if (Header != nullptr)
+      {
+        ::UnmapViewOfFile(Header);
+      }
+      if (Mapping != nullptr)
+      {
+        ::CloseHandle(Mapping);
+      }
+      ::CloseHandle(File);
+    };
+
+    LARGE_INTEGER Size;
+    THROWOSIFFALSE(::GetFileSizeEx(File, &Size));
+    if (Size.QuadPart < static_cast<int64_t>(sizeof(TProtocolTraceHeader)))
+    {
+      throw Exception(FORMAT(L"\"%s\" is not a protocol trace.", TraceFileName));
+    }
+    Mapping = ::CreateFileMapping(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    THROWOSIFFALSE(Mapping != nullptr);
+    Header = static_cast<const TProtocolTraceHeader *>(::MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0));
+    THROWOSIFFALSE(Header != nullptr);
+
+    if ((memcmp(Header->Magic, ProtocolTraceMagic, sizeof(Header->Magic)) != 0) ||
+        (Header->Version != ProtocolTraceVersion) ||
+        (Header->RecordSize != sizeof(TProtocolTraceRecord)) ||
+        (Header->Frequency <= 0))
+    {
+      throw Exception(FORMAT(L"\"%s\" is not a protocol trace.", TraceFileName));
+    }
+
+    // the trace may still be open by a running session
+    int64_t Available = (Size.QuadPart - sizeof(TProtocolTraceHeader)) / sizeof(TProtocolTraceRecord);
+    uint32_t Count = static_cast<uint32_t>(std::min(static_cast<int64_t>(Header->Count), Available));
+    const TProtocolTraceRecord *Records = reinterpret_cast<const TProtocolTraceRecord *>(Header + 1);
+
+    Output->BeginUpdate();
+    try__finally
+    {
+      SCOPE_EXIT
+      {
+        Output->EndUpdate();
+      };
+      if (Format == ptfCsv)
+      {
+        Output->Add(L"Time,Microseconds,Protocol,Direction,Type,Name,Number,Size,Latency");
+      }
+      else if (Format == ptfChromeTrace)
+      {
+        Output->Add(L"{\"traceEvents\":[");
+      }
+
+      for (uint32_t Index = 0; Index < Count; Index++)
+      {
+        const TProtocolTraceRecord &Rec = Records[Index];
+        int64_t Microseconds = TraceMicroseconds(Header, Rec.Ticks);
+        UnicodeString Name = TraceRecordName(Rec);
+        UnicodeString Line;
+        switch (Format)
+        {
+        case ptfText:
+          // Mimics the text session log
+          Line = FORMAT(L"%s %s %s: %s, Size: %d, Number: %d",
+            (Rec.Direction == tdSend) ? L">" : L"<", TraceTimestamp(Header, Rec.Ticks),
+            TraceProtocolName(Rec.Protocol), Name, ToInt(Rec.Length), ToInt(Rec.MessageNumber));
+          if (Rec.Latency > 0)
+          {
+            Line += FORMAT(L", Latency: %d.%03d ms", ToInt(Rec.Latency / 1000), ToInt(Rec.Latency % 1000));
+          }
+          break;
+
+        case ptfCsv:
+          Line = FORMAT(L"%s,%lld,%s,%s,%d,%s,%u,%u,%u",
+            TraceTimestamp(Header, Rec.Ticks), Microseconds, TraceProtocolName(Rec.Protocol),
+            (Rec.Direction == tdSend) ? L"send" : L"receive", ToInt(Rec.Type), Name,
+            Rec.MessageNumber, Rec.Length, Rec.Latency);
+          break;
+
+        case ptfChromeTrace:
+          // Responses with known latency become spans covering the whole request
+          if (Rec.Latency > 0)
+          {
+            Line = FORMAT(L"{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%u,\"pid\":1,\"tid\":%d,\"args\":{\"number\":%u,\"size\":%u}}",
+              Name, TraceProtocolName(Rec.Protocol), Microseconds - Rec.Latency, Rec.Latency,
+              ToInt(Rec.Protocol), Rec.MessageNumber, Rec.Length);
+          }
+          else
+          {
+            Line = FORMAT(L"{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":1,\"tid\":%d,\"args\":{\"number\":%u,\"size\":%u,\"direction\":\"%s\"}}",
+              Name, TraceProtocolName(Rec.Protocol), Microseconds, ToInt(Rec.Protocol),
+              Rec.MessageNumber, Rec.Length, (Rec.Direction == tdSend) ? L"send" : L"receive");
+          }
+          if (Index + 1 < Count)
+          {
+            Line += L",";
+          }
+          break;
+        }
+        Output->Add(Line);
+      }
+
+      if (Format == ptfChromeTrace)
+      {
+        Output->Add(L"]}");
+      }
+    }
+    __finally
+    {
+#if 0
+      Output->EndUpdate();
+#endif // #if 0
+    };
+  }
+  __finally
+  {
+#if 0
+    ::UnmapViewOfFile(Header);
+    ::CloseHandle(Mapping);
+    ::CloseHandle(File);
+#endif // #if 0
+  };
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Classes.hpp>
+
+enum TTraceProtocol
+{
+  tpSSH = 0,
+  tpSFTP = 1,
+  tpFTP = 2,
+};
+
+enum TTraceDirection
+{
+  tdSend = 0,
+  tdReceive = 1,
+};
+
+enum TProtocolTraceFormat
+{
+  ptfText,
+  ptfCsv,
+  ptfChromeTrace,
+};
+
+#pragma pack(push, 1)
+struct TProtocolTraceHeader
+{
+  char Magic[8];
+  uint32_t Version;
+  uint32_t RecordSize;
+  // QueryPerformanceFrequency of the recording machine
+  int64_t Frequency;
+  // Performance counter and wall clock time (UTC FILETIME) when the trace was started
+  int64_t StartTicks;
+  uint64_t StartTime;
+  // Number of records written, updated after each record
+  uint32_t Count;
+  uint32_t Reserved;
+};
+
+struct TProtocolTraceRecord
+{
+  // Performance counter value, monotonic
+  int64_t Ticks;
+  uint32_t MessageNumber;
+  uint32_t Length;
+  // Microseconds from the matching request, 0 when not known (always for SSH)
+  uint32_t Latency;
+  // SFTP packet type or FTP reply code
+  uint16_t Type;
+  uint8_t Protocol;
+  uint8_t Direction;
+};
+#pragma pack(pop)
+
+// Compact binary alternative to dumping packets into the text session log.
+// Fixed-size records go to a memory-mapped file, which is rotated
+// (the previous one is kept with ".1" suffix) when full.
+class NB_CORE_EXPORT TProtocolTrace : public TObject
+{
+  NB_DISABLE_COPY(TProtocolTrace)
+public:
+  explicit TProtocolTrace(UnicodeString AFileName, int64_t AMaxSize);
+  virtual ~TProtocolTrace();
+
+  void Record(TTraceProtocol Protocol, TTraceDirection Direction,
+    uintptr_t Type, uintptr_t MessageNumber, uintptr_t Length);
+
+  UnicodeString GetFileName() const { return FFileName; }
+
+private:
+  // Requests waiting for response, indexed by protocol and low bits of message number
+  struct TPendingRequest
+  {
+    uint32_t Key;
+    int64_t Ticks;
+  };
+  static const intptr_t PendingSlots = 256;
+
+  TCriticalSection FCriticalSection;
+  UnicodeString FFileName;
+  int64_t FMaxSize;
+  HANDLE FFile;
+  HANDLE FMapping;
+  TProtocolTraceHeader *FHeader;
+  TProtocolTraceRecord *FRecords;
+  uint32_t FCapacity;
+  int64_t FFrequency;
+  TPendingRequest FPending[3 * PendingSlots];
+
+  void Open();
+  void Close();
+  void Rotate();
+};
+
+NB_CORE_EXPORT void DecodeProtocolTrace(UnicodeString TraceFileName,
+  TProtocolTraceFormat Format, TStrings *Output);
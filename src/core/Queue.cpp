@@ -499,6 +499,7 @@ TTerminalQueue::TTerminalQueue(TTerminal *ATerminal,
   FItems(new TList()),
   FDoneItems(new TList()),
   FItemsInProcess(0),
+  FListVersion(0),
   FFreeTerminals(0),
   FTerminals(new TList()),
   FForcedItems(new TList()),
@@ -652,6 +653,7 @@ void TTerminalQueue::AddItem(TQueueItem *Item)
 
     FItems->Add(Item);
     Item->FQueue = this;
+    ++FListVersion;
   }
 
   DoListUpdate();
@@ -671,6 +673,7 @@ void TTerminalQueue::RetryItem(TQueueItem *Item)
       DebugUsedParam(Index);
       FItemsInProcess--;
       FItems->Add(Item);
+      ++FListVersion;
     }
 
     DoListUpdate();
@@ -696,12 +699,21 @@ void TTerminalQueue::DeleteItem(TQueueItem *Item, bool CanKeep)
       DebugUsedParam(Index);
       FItemsInProcess--;
       FForcedItems->Remove(Item);
+      ++FListVersion;
       // =0  do not keep
       // <0  infinity
       if ((FKeepDoneItemsFor != 0) && CanKeep && Item->Complete())
       {
         DebugAssert(Item->GetStatus() == TQueueItem::qsDone);
-        FDoneItems->Add(Item);
+        // FDoneAt is set before the item gets here, so the items completed
+        // about the same time may come in a different order,
+        // keep the list sorted by it for the expiry sweep
+        intptr_t DoneIndex = FDoneItems->GetCount();
+        while ((DoneIndex > 0) && (GetItem(FDoneItems, DoneIndex - 1)->FDoneAt > Item->FDoneAt))
+        {
+          --DoneIndex;
+        }
+        FDoneItems->Insert(DoneIndex, Item);
       }
       else
       {
@@ -758,7 +770,8 @@ void TTerminalQueue::UpdateStatusForList(
     {
       Current->Delete(ItemProxy);
       Status->Add(ItemProxy);
-      ItemProxy->Update();
+      // the item is known to be in the list, no need to look it up in ItemGetData
+      Item->GetData(ItemProxy);
     }
     else
     {
@@ -769,6 +782,29 @@ void TTerminalQueue::UpdateStatusForList(
 
 TTerminalQueueStatus *TTerminalQueue::CreateStatus(TTerminalQueueStatus *Current)
 {
+  if (Current != nullptr)
+  {
+    TGuard Guard(FItemsSection);
+
+    // No item was added, removed or moved since the Current was created,
+    // only the items in process can have changed
+    if (Current->FListVersion == FListVersion)
+    {
+      for (intptr_t Index = 0; Index < FItemsInProcess; ++Index)
+      {
+        TQueueItem *Item = GetItem(Index);
+        TQueueItemProxy *ItemProxy = Current->FindByQueueItem(Item);
+        DebugAssert(ItemProxy != nullptr);
+        if (ItemProxy != nullptr)
+        {
+          Item->GetData(ItemProxy);
+        }
+      }
+      Current->ResetStats();
+      return Current;
+    }
+  }
+
   std::unique_ptr<TTerminalQueueStatus> Status(new TTerminalQueueStatus());
   try__catch
   {
@@ -787,6 +823,7 @@ TTerminalQueueStatus *TTerminalQueue::CreateStatus(TTerminalQueueStatus *Current
       UpdateStatusForList(Status.get(), FDoneItems, Current);
       Status->SetDoneCount(Status->GetCount());
       UpdateStatusForList(Status.get(), FItems, Current);
+      Status->FListVersion = FListVersion;
     }
     __finally
     {
@@ -872,6 +909,7 @@ bool TTerminalQueue::ItemMove(TQueueItem *Item, TQueueItem *BeforeItem)
       if (Result)
       {
         FItems->Move(Index, IndexDest);
+        ++FListVersion;
       }
     }
 
@@ -903,6 +941,7 @@ bool TTerminalQueue::ItemExecuteNow(TQueueItem *Item)
         if (Index > FItemsInProcess)
         {
           FItems->Move(Index, FItemsInProcess);
+          ++FListVersion;
         }
 
         if ((FTransfersLimit >= 0) && (FTerminals->GetCount() >= FTransfersLimit) &&
@@ -947,6 +986,7 @@ bool TTerminalQueue::ItemDelete(TQueueItem *Item)
           FItems->Delete(Index);
           FForcedItems->Remove(Item);
           SAFE_DESTROY(Item);
+          ++FListVersion;
           UpdateList = true;
         }
         else
@@ -961,6 +1001,7 @@ bool TTerminalQueue::ItemDelete(TQueueItem *Item)
         if (Result)
         {
           FDoneItems->Delete(Index);
+          ++FListVersion;
           UpdateList = true;
         }
       }
@@ -1092,6 +1133,7 @@ void TTerminalQueue::ProcessEvent()
   {
     TerminalItem = nullptr;
     TQueueItem *Item1 = nullptr;
+    bool DoneItemsExpired = false;
 
     {
       TGuard Guard(FItemsSection);
@@ -1105,16 +1147,26 @@ void TTerminalQueue::ProcessEvent()
         {
           RemoveDoneItemsBefore = ::IncSecond(RemoveDoneItemsBefore, -FKeepDoneItemsFor);
         }
-        for (intptr_t Index = 0; Index < FDoneItems->GetCount(); ++Index)
+        // the done items are sorted by the time they completed, so the expired
+        // ones are at the front and the sweep can stop at the first one kept
+        intptr_t Expired = 0;
+        while ((Expired < FDoneItems->GetCount()) &&
+          (GetItem(FDoneItems, Expired)->FDoneAt <= RemoveDoneItemsBefore))
+        {
+          TQueueItem *Item2 = GetItem(FDoneItems, Expired);
+          SAFE_DESTROY(Item2);
+          ++Expired;
+        }
+        if (Expired > 0)
         {
-          TQueueItem *Item2 = GetItem(FDoneItems, Index);
-          if (Item2->FDoneAt <= RemoveDoneItemsBefore)
+          intptr_t Count = FDoneItems->GetCount();
+          for (intptr_t Index = Expired; Index < Count; ++Index)
           {
-            FDoneItems->Delete(Index);
-            SAFE_DESTROY(Item2);
-            Index--;
-            DoListUpdate();
+            FDoneItems->SetItem(Index - Expired, FDoneItems->GetItem(Index));
           }
+          FDoneItems->SetCount(Count - Expired);
+          ++FListVersion;
+          DoneItemsExpired = true;
         }
       }
 
@@ -1148,11 +1200,17 @@ void TTerminalQueue::ProcessEvent()
               FForcedItems->Delete(ForcedIndex);
             }
             FItemsInProcess++;
+            ++FListVersion;
           }
         }
       }
     }
 
+    if (DoneItemsExpired)
+    {
+      DoListUpdate();
+    }
+
     if (TerminalItem != nullptr)
     {
       TerminalItem->Process(Item1);
@@ -1239,6 +1297,23 @@ bool TTerminalQueue::GetIsEmpty() const
   return (FItems->GetCount() == 0);
 }
 
+intptr_t TTerminalQueue::GetPendingCount() const
+{
+  TGuard Guard(FItemsSection);
+  return (FItems->GetCount() - FItemsInProcess);
+}
+
+bool TTerminalQueue::GetIsWaitingForUser() const
+{
+  TGuard Guard(FItemsSection);
+  bool Result = (FItemsInProcess > 0);
+  for (intptr_t Index = 0; Result && (Index < FItemsInProcess); ++Index)
+  {
+    Result = TQueueItem::IsUserActionStatus(GetItem(Index)->GetStatus());
+  }
+  return Result;
+}
+
 bool TTerminalQueue::TryAddParallelOperation(TQueueItem *Item, bool Force)
 {
   TGuard Guard(FItemsSection);
@@ -1281,6 +1356,7 @@ public:
   void Init(
     TSessionData *SessionData, TConfiguration *Configuration,
     TTerminalItem *Item, UnicodeString Name);
+  virtual intptr_t GetBandwidthWeight() const override { return BackgroundBandwidthWeight; }
 
 protected:
   virtual bool DoQueryReopen(Exception *E) override;
@@ -2028,6 +2104,7 @@ intptr_t TQueueItemProxy::GetIndex() const
 
 TTerminalQueueStatus::TTerminalQueueStatus() :
   FList(new TList()),
+  FListVersion(-1),
   FDoneCount(0),
   FActiveCount(0),
   FActivePrimaryCount(0),
@@ -2133,12 +2210,14 @@ void TTerminalQueueStatus::Add(TQueueItemProxy *ItemProxy)
   }
 
   FList->Insert(Index, ItemProxy);
+  FProxies[ItemProxy->FQueueItem] = ItemProxy;
   ResetStats();
 }
 
 void TTerminalQueueStatus::Delete(TQueueItemProxy *ItemProxy)
 {
   FList->Extract(ItemProxy);
+  FProxies.erase(ItemProxy->FQueueItem);
   ItemProxy->FQueueStatus = nullptr;
   ResetStats();
 }
@@ -2161,16 +2240,8 @@ TQueueItemProxy *TTerminalQueueStatus::GetItem(intptr_t Index)
 TQueueItemProxy *TTerminalQueueStatus::FindByQueueItem(
   TQueueItem *QueueItem)
 {
-  for (intptr_t Index = 0; Index < FList->GetCount(); ++Index)
-  {
-    TQueueItemProxy *Item = GetItem(Index);
-    DebugAssert(Item);
-    if (Item->FQueueItem == QueueItem)
-    {
-      return Item;
-    }
-  }
-  return nullptr;
+  TProxies::const_iterator It = FProxies.find(QueueItem);
+  return (It != FProxies.end()) ? It->second : nullptr;
 }
 
 // TLocatedQueueItem
@@ -2505,6 +2576,126 @@ void TDownloadQueueItem::DoTransferExecute(TTerminal *Terminal, TParallelOperati
   Terminal->CopyToLocal(FFilesToCopy, FTargetDir, FCopyParam, FParams, ParallelOperation);
 }
 
+// TSynchronizeQueueFeeder
+
+static bool IsQueuedChecklistItem(const TChecklistItem *ChecklistItem)
+{
+  return
+    ChecklistItem->Checked &&
+    ((ChecklistItem->Action == saUploadNew) || (ChecklistItem->Action == saUploadUpdate) ||
+     (ChecklistItem->Action == saDownloadNew) || (ChecklistItem->Action == saDownloadUpdate));
+}
+
+TSynchronizeQueueFeeder::TSynchronizeQueueFeeder(TTerminalQueue *Queue, TTerminal *Terminal,
+  const TCopyParamType *CopyParam, intptr_t Params) :
+  FQueue(Queue),
+  FTerminal(Terminal),
+  FCopyParam(*CopyParam),
+  FCopyParams(0),
+  FQueuedFiles(0),
+  FOnWait(nullptr)
+{
+  // the same as in TTerminal::SynchronizeApply
+  DebugAssert(FLAGCLEAR(Params, TTerminal::spTimestamp));
+  FCopyParams = FLAGMASK(FLAGSET(Params, TTerminal::spNoConfirmation), cpNoConfirmation);
+  if (FLAGCLEAR(Params, TTerminal::spNotByTime))
+  {
+    FCopyParam.SetPreserveTime(true);
+  }
+}
+
+void TSynchronizeQueueFeeder::Collected(TSynchronizeChecklist *Checklist,
+  intptr_t Index, intptr_t Count)
+{
+  std::unique_ptr<TStringList> UploadList(new TStringList());
+  std::unique_ptr<TStringList> DownloadList(new TStringList());
+  UnicodeString UploadTargetDir;
+  UnicodeString DownloadTargetDir;
+  for (intptr_t ItemIndex = Index; ItemIndex < Index + Count; ++ItemIndex)
+  {
+    const TChecklistItem *ChecklistItem = Checklist->GetItem(ItemIndex);
+    if (IsQueuedChecklistItem(ChecklistItem))
+    {
+      if ((ChecklistItem->Action == saUploadNew) || (ChecklistItem->Action == saUploadUpdate))
+      {
+        UnicodeString TargetDir = base::UnixIncludeTrailingBackslash(ChecklistItem->Remote.Directory);
+        if ((TargetDir != UploadTargetDir) || (UploadList->GetCount() >= MaxFilesPerItem))
+        {
+          AddItem(UploadList.get(), UploadTargetDir, true);
+          UploadTargetDir = TargetDir;
+        }
+        UploadList->Add(
+          ::IncludeTrailingBackslash(ChecklistItem->Local.Directory) +
+          ChecklistItem->Local.FileName);
+      }
+      else
+      {
+        UnicodeString TargetDir = ::IncludeTrailingBackslash(ChecklistItem->Local.Directory);
+        if ((TargetDir != DownloadTargetDir) || (DownloadList->GetCount() >= MaxFilesPerItem))
+        {
+          AddItem(DownloadList.get(), DownloadTargetDir, false);
+          DownloadTargetDir = TargetDir;
+        }
+        DownloadList->AddObject(
+          base::UnixIncludeTrailingBackslash(ChecklistItem->Remote.Directory) +
+          ChecklistItem->Remote.FileName,
+          ChecklistItem->RemoteFile);
+      }
+    }
+  }
+  AddItem(UploadList.get(), UploadTargetDir, true);
+  AddItem(DownloadList.get(), DownloadTargetDir, false);
+
+  // the queue items have their own copies of the remote files,
+  // the checklist keeps only what is left for SynchronizeApply
+  for (intptr_t ItemIndex = Index + Count - 1; ItemIndex >= Index; --ItemIndex)
+  {
+    if (IsQueuedChecklistItem(Checklist->GetItem(ItemIndex)))
+    {
+      Checklist->Delete(ItemIndex);
+    }
+  }
+}
+
+void TSynchronizeQueueFeeder::AddItem(TStrings *Files, UnicodeString TargetDir, bool Upload)
+{
+  if (Files->GetCount() > 0)
+  {
+    WaitForQueue();
+
+    TQueueItem *Item;
+    if (Upload)
+    {
+      Item = new TUploadQueueItem(FTerminal, Files, TargetDir, &FCopyParam, FCopyParams, false, false);
+    }
+    else
+    {
+      Item = new TDownloadQueueItem(FTerminal, Files, TargetDir, &FCopyParam, FCopyParams, false, false);
+    }
+    FTerminal->LogEvent(FORMAT("Queuing %d files to %s for synchronization.", ToInt(Files->GetCount()), TargetDir));
+    FQueue->AddItem(Item);
+    FQueuedFiles += Files->GetCount();
+    Files->Clear();
+  }
+}
+
+void TSynchronizeQueueFeeder::WaitForQueue()
+{
+  // Back-pressure: the comparison stops, until the queue catches up,
+  // so neither the queue nor the checklist grow without limit.
+  // The queue cannot catch up, while its items wait for the user,
+  // who may not be asked until the comparison finishes (without the queue auto popup).
+  while (FQueue->GetEnabled() && (FQueue->GetPendingCount() >= MaxPendingItems) &&
+    !FQueue->GetIsWaitingForUser())
+  {
+    if (FOnWait)
+    {
+      FOnWait(this);
+    }
+    ::Sleep(50);
+  }
+}
+
 // TTerminalThread
 
 TTerminalThread::TTerminalThread(TTerminal *Terminal) :
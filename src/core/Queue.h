@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <map>
 #include "Terminal.h"
 #include "FileOperationProgress.h"
 
@@ -160,8 +161,12 @@ protected:
   TConfiguration *FConfiguration;
   TSessionData *FSessionData;
   TList *FItems;
+  // ordered by completion time
   TList *FDoneItems;
   intptr_t FItemsInProcess;
+  // changes with every change of the lists, so that the unchanged status
+  // does not need to be rebuilt, guarded by FItemsSection
+  intptr_t FListVersion;
   TCriticalSection FItemsSection;
   intptr_t FFreeTerminals;
   TList *FTerminals;
@@ -206,6 +211,10 @@ public:
   void SetKeepDoneItemsFor(intptr_t Value);
   void SetEnabled(bool Value);
   bool GetIsEmpty() const;
+  // the items not started yet
+  intptr_t GetPendingCount() const;
+  // all the items in process wait for a prompt, query or error to be answered
+  bool GetIsWaitingForUser() const;
 
   bool TryAddParallelOperation(TQueueItem *Item, bool Force);
   bool ContinueParallelOperation() const;
@@ -380,7 +389,11 @@ protected:
   void NeedStats() const;
 
 private:
+  typedef std::map<const TQueueItem *, TQueueItemProxy *> TProxies;
+
   TList *FList;
+  TProxies FProxies;
+  intptr_t FListVersion;
   intptr_t FDoneCount;
   mutable intptr_t FActiveCount;
   mutable intptr_t FActivePrimaryCount;
@@ -484,6 +497,42 @@ protected:
   virtual void DoTransferExecute(TTerminal *Terminal, TParallelOperation *ParallelOperation) override;
 };
 
+// Adds the transfers of synchronization checklist items to the queue as soon as
+// TTerminal::SynchronizeCollect reports them (Collected is its OnSynchronizeCollected),
+// so the queue terminals transfer while the comparison continues.
+// The queued items are removed from the checklist, the rest is left
+// for TTerminal::SynchronizeApply.
+class NB_CORE_EXPORT TSynchronizeQueueFeeder : public TObject
+{
+  NB_DISABLE_COPY(TSynchronizeQueueFeeder)
+public:
+  explicit TSynchronizeQueueFeeder(TTerminalQueue *Queue, TTerminal *Terminal,
+    const TCopyParamType *CopyParam, intptr_t Params);
+  virtual ~TSynchronizeQueueFeeder()
+  {
+  }
+
+  void Collected(TSynchronizeChecklist *Checklist, intptr_t Index, intptr_t Count);
+
+  intptr_t GetQueuedFiles() const { return FQueuedFiles; }
+  // called repeatedly, while the comparison waits for the queue to catch up
+  void SetOnWait(TNotifyEvent Value) { FOnWait = Value; }
+
+  static const intptr_t MaxFilesPerItem = 256;
+  static const intptr_t MaxPendingItems = 16;
+
+private:
+  TTerminalQueue *FQueue;
+  TTerminal *FTerminal;
+  TCopyParamType FCopyParam;
+  intptr_t FCopyParams;
+  intptr_t FQueuedFiles;
+  TNotifyEvent FOnWait;
+
+  void AddItem(TStrings *Files, UnicodeString TargetDir, bool Upload);
+  void WaitForQueue();
+};
+
 class TUserAction;
 class NB_CORE_EXPORT TTerminalThread : public TSignalThread
 {
@@ -1205,6 +1205,11 @@ void TSCPFileSystem::ReadDirectory(TRemoteFileList *FileList)
   while (Again);
 }
 
+void TSCPFileSystem::ReadDirectories(TList * /*FileLists*/)
+{
+  // noop, the shell runs one command at a time
+}
+
 void TSCPFileSystem::ReadSymlink(TRemoteFile *SymlinkFile,
   TRemoteFile *&File)
 {
@@ -59,6 +59,7 @@ public:
   virtual void LookupUsersGroups() override;
   virtual void ReadCurrentDirectory() override;
   virtual void ReadDirectory(TRemoteFileList *FileList) override;
+  virtual void ReadDirectories(TList *FileLists) override;
   virtual void ReadFile(UnicodeString AFileName,
     TRemoteFile *&File) override;
   virtual void ReadSymlink(TRemoteFile *SymlinkFile,
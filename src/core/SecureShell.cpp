@@ -9,6 +9,7 @@
 #include "PuttyIntf.h"
 #include "Interface.h"
 #include "SecureShell.h"
+#include "ProtocolTrace.h"
 #include "TextsCore.h"
 #include "HelpCore.h"
 #include "CoreMain.h"
@@ -41,6 +42,7 @@ TSecureShell::TSecureShell(TSessionUI *UI,
   FUI = UI;
   FSessionData = SessionData;
   FLog = Log;
+  FStatistics = nullptr;
   FConfiguration = Configuration;
   FAuthenticating = false;
   FAuthenticated = false;
@@ -1221,6 +1223,7 @@ intptr_t TSecureShell::Receive(uint8_t *Buf, intptr_t Length)
     LogEvent(FORMAT("Read %d bytes (%d pending)",
         ToInt(Length), ToInt(PendLen)));
   }
+  FLog->RecordTrace(tpSSH, tdReceive, 0, 0, Length);
   return Length;
 }
 
@@ -1403,12 +1406,17 @@ void TSecureShell::DispatchSendBuffer(intptr_t BufSize)
 void TSecureShell::Send(const uint8_t *Buf, intptr_t Length)
 {
   CheckConnection();
-  int BufSize = FBackend->send(FBackendHandle, const_cast<char *>(reinterpret_cast<const char *>(Buf)), ToInt(Length));
+  int BufSize;
+  {
+    TStatisticsTimer Timer(FStatistics, scSshLayerTime);
+    BufSize = FBackend->send(FBackendHandle, const_cast<char *>(reinterpret_cast<const char *>(Buf)), ToInt(Length));
+  }
   if (GetConfiguration()->GetActualLogProtocol() >= 1)
   {
     LogEvent(FORMAT("Sent %d bytes", ToInt(Length)));
     LogEvent(FORMAT("There are %u bytes remaining in the send buffer", BufSize));
   }
+  FLog->RecordTrace(tpSSH, tdSend, 0, 0, Length);
   FLastDataSent = Now();
   // among other forces receive of pending data to free the servers's send buffer
   EventSelectLoop(0, false, nullptr);
@@ -1983,7 +1991,11 @@ void TSecureShell::HandleNetworkEvents(SOCKET Socket, WSANETWORKEVENTS &Events)
             EventTypes[Event].Desc, int(Socket), Err));
       }
       LPARAM SelectEvent = WSAMAKESELECTREPLY(EventTypes[Event].Mask, Err);
-      select_result(static_cast<WPARAM>(Socket), SelectEvent);
+      {
+        // incoming data are decrypted and verified while handling the event
+        TStatisticsTimer Timer(FStatistics, scSshLayerTime);
+        select_result(static_cast<WPARAM>(Socket), SelectEvent);
+      }
       CheckConnection();
     }
   }
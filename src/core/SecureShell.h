@@ -6,6 +6,7 @@
 #include "Configuration.h"
 #include "SessionData.h"
 #include "SessionInfo.h"
+#include "SessionStatistics.h"
 
 #ifndef PuttyIntfH
 struct Backend;
@@ -71,6 +72,7 @@ private:
   uint8_t *OutPtr;
   uint8_t *Pending;
   TSessionLog *FLog;
+  TSessionStatistics *FStatistics;
   TConfiguration *FConfiguration;
   bool FAuthenticating;
   bool FAuthenticated;
@@ -148,6 +150,7 @@ public:
   void SendNull();
 
   const TSessionInfo &GetSessionInfo() const;
+  void SetStatistics(TSessionStatistics *Value) { FStatistics = Value; }
   UnicodeString GetHostKeyFingerprint() const;
   bool SshFallbackCmd() const;
   uint32_t MinPacketSize() const;
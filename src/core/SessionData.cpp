@@ -39,6 +39,7 @@ const intptr_t HTTPPortNumber = 80;
 const intptr_t HTTPSPortNumber = 443;
 const intptr_t TelnetPortNumber = 23;
 const intptr_t DefaultSendBuf = 256 * 1024;
+const intptr_t DefaultReadBuf = 256 * 1024;
 const intptr_t ProxyPortNumber = 80;
 
 const UnicodeString AnonymousUserName(L"anonymous");
@@ -156,6 +157,7 @@ void TSessionData::Default()
   SetPuttyProtocol(L"");
   SetTcpNoDelay(true);
   SetSendBuf(DefaultSendBuf);
+  SetReadBuf(DefaultReadBuf);
   SetSshSimple(true);
   FNotUtf = asAuto;
   FIsWorkspace = false;
@@ -233,6 +235,8 @@ void TSessionData::Default()
   SetSFTPMaxVersion(::SFTPMaxVersion);
   SetSFTPMaxPacketSize(0);
   SetSFTPMinPacketSize(0);
+  SetSFTPDeltaUpload(false);
+  SetSFTPDeltaBlockSize(0);
 
   for (intptr_t Index = 0; Index < static_cast<intptr_t>(_countof(FSFTPBugs)); ++Index)
   {
@@ -262,6 +266,8 @@ void TSessionData::Default()
   SetMaxTlsVersion(tls12);
   SetFtpListAll(asAuto);
   SetFtpHost(asAuto);
+  // some servers lose commands that arrive before the previous reply
+  SetFtpPipelining(asOff);
   SetFtpDupFF(false);
   SetFtpUndupFF(false);
   SetFtpDeleteFromCwd(asAuto);
@@ -364,6 +370,7 @@ void TSessionData::NonPersistant()
   PROPERTY(TimeDifferenceAuto); \
   PROPERTY(TcpNoDelay); \
   PROPERTY(SendBuf); \
+  PROPERTY(ReadBuf); \
   PROPERTY(SshSimple); \
   PROPERTY(AuthKI); \
   PROPERTY(AuthKIPassword); \
@@ -391,6 +398,8 @@ void TSessionData::NonPersistant()
   PROPERTY(SFTPListingQueue); \
   PROPERTY(SFTPMaxVersion); \
   PROPERTY(SFTPMaxPacketSize); \
+  PROPERTY(SFTPDeltaUpload); \
+  PROPERTY(SFTPDeltaBlockSize); \
   \
   PROPERTY(Tunnel); \
   PROPERTY(TunnelHostName); \
@@ -411,6 +420,7 @@ void TSessionData::NonPersistant()
   PROPERTY(FtpTransferActiveImmediately); \
   PROPERTY(FtpListAll); \
   PROPERTY(FtpHost); \
+  PROPERTY(FtpPipelining); \
   PROPERTY(FtpDupFF); \
   PROPERTY(FtpUndupFF); \
   PROPERTY(FtpDeleteFromCwd); \
@@ -691,6 +701,7 @@ void TSessionData::DoLoad(THierarchicalStorage *Storage, bool PuttyImport, bool
     SetTcpNoDelay(Storage->ReadBool("TcpNoDelay", GetTcpNoDelay()));
   }
   SetSendBuf(Storage->ReadInteger("SendBuf", Storage->ReadInteger("SshSendBuf", GetSendBuf())));
+  SetReadBuf(Storage->ReadInteger("ReadBuf", GetReadBuf()));
   SetSshSimple(Storage->ReadBool("SshSimple", GetSshSimple()));
 
   SetProxyMethod(static_cast<TProxyMethod>(Storage->ReadInteger("ProxyMethod", ::pmNone)));
@@ -758,6 +769,8 @@ void TSessionData::DoLoad(THierarchicalStorage *Storage, bool PuttyImport, bool
   SetSFTPDownloadQueue(Storage->ReadInteger("SFTPDownloadQueue", GetSFTPDownloadQueue()));
   SetSFTPUploadQueue(Storage->ReadInteger("SFTPUploadQueue", GetSFTPUploadQueue()));
   SetSFTPListingQueue(Storage->ReadInteger("SFTPListingQueue", GetSFTPListingQueue()));
+  SetSFTPDeltaUpload(Storage->ReadBool("SFTPDeltaUpload", GetSFTPDeltaUpload()));
+  SetSFTPDeltaBlockSize(Storage->ReadInteger("SFTPDeltaBlockSize", GetSFTPDeltaBlockSize()));
 
   SetColor(Storage->ReadInteger("Color", GetColor()));
 
@@ -802,6 +815,7 @@ void TSessionData::DoLoad(THierarchicalStorage *Storage, bool PuttyImport, bool
   SetFtpUndupFF(Storage->ReadBool("FtpUndupFF", GetFtpUndupFF()));
   SetFtpDeleteFromCwd(static_cast<TAutoSwitch>(Storage->ReadInteger("FtpDeleteFromCwd", GetFtpDeleteFromCwd())));
   SetFtpHost(static_cast<TAutoSwitch>(Storage->ReadInteger("FtpHost", GetFtpHost())));
+  SetFtpPipelining(static_cast<TAutoSwitch>(Storage->ReadInteger("FtpPipelining", GetFtpPipelining())));
   SetSslSessionReuse(Storage->ReadBool("SslSessionReuse", GetSslSessionReuse()));
   SetTlsCertificateFile(Storage->ReadString("TlsCertificateFile", GetTlsCertificateFile()));
 
@@ -1050,6 +1064,7 @@ void TSessionData::DoSave(THierarchicalStorage *Storage,
     Storage->DeleteValue("SFTPUtfBug");
     WRITE_DATA_EX(Integer, "Utf", GetNotUtf(), );
     WRITE_DATA(Integer, SendBuf);
+    WRITE_DATA(Integer, ReadBuf);
     WRITE_DATA(Bool, SshSimple);
   }
 
@@ -1115,6 +1130,8 @@ void TSessionData::DoSave(THierarchicalStorage *Storage,
     WRITE_DATA(Integer, SFTPDownloadQueue);
     WRITE_DATA(Integer, SFTPUploadQueue);
     WRITE_DATA(Integer, SFTPListingQueue);
+    WRITE_DATA(Bool, SFTPDeltaUpload);
+    WRITE_DATA(Integer, SFTPDeltaBlockSize);
 
     WRITE_DATA(Integer, Color);
 
@@ -1135,6 +1152,7 @@ void TSessionData::DoSave(THierarchicalStorage *Storage,
     WRITE_DATA(Integer, Ftps);
     WRITE_DATA(Integer, FtpListAll);
     WRITE_DATA(Integer, FtpHost);
+    WRITE_DATA(Integer, FtpPipelining);
     WRITE_DATA(Bool, FtpDupFF);
     WRITE_DATA(Bool, FtpUndupFF);
     WRITE_DATA(Integer, FtpDeleteFromCwd);
@@ -3690,6 +3708,11 @@ void TSessionData::SetSendBuf(intptr_t Value)
   SET_SESSION_PROPERTY(SendBuf);
 }
 
+void TSessionData::SetReadBuf(intptr_t Value)
+{
+  SET_SESSION_PROPERTY(ReadBuf);
+}
+
 void TSessionData::SetSshSimple(bool Value)
 {
   SET_SESSION_PROPERTY(SshSimple);
@@ -3982,6 +4005,16 @@ void TSessionData::SetSFTPUploadQueue(intptr_t Value)
   SET_SESSION_PROPERTY(SFTPUploadQueue);
 }
 
+void TSessionData::SetSFTPDeltaUpload(bool Value)
+{
+  SET_SESSION_PROPERTY(SFTPDeltaUpload);
+}
+
+void TSessionData::SetSFTPDeltaBlockSize(intptr_t Value)
+{
+  SET_SESSION_PROPERTY(SFTPDeltaBlockSize);
+}
+
 void TSessionData::SetSFTPListingQueue(intptr_t Value)
 {
   SET_SESSION_PROPERTY(SFTPListingQueue);
@@ -4175,6 +4208,11 @@ void TSessionData::SetFtpHost(TAutoSwitch Value)
   SET_SESSION_PROPERTY(FtpHost);
 }
 
+void TSessionData::SetFtpPipelining(TAutoSwitch Value)
+{
+  SET_SESSION_PROPERTY(FtpPipelining);
+}
+
 void TSessionData::SetFtpDeleteFromCwd(TAutoSwitch Value)
 {
   SET_SESSION_PROPERTY(FtpDeleteFromCwd);
@@ -4454,7 +4492,11 @@ TFtps TSessionData::TranslateFtpEncryptionNumber(intptr_t FtpEncryption) const
 TStoredSessionList::TStoredSessionList(bool AReadOnly) :
   TNamedObjectList(OBJECT_CLASS_TStoredSessionList),
   FDefaultSettings(new TSessionData(DefaultName)),
-  FReadOnly(AReadOnly)
+  FReadOnly(AReadOnly),
+  FChangeEvent(nullptr),
+  FWatchedKey(nullptr),
+  FFolderIndex(nullptr),
+  FFolderIndexVersion(-1)
 {
   DebugAssert(GetConfiguration());
   SetOwnsObjects(true);
@@ -4462,6 +4504,12 @@ TStoredSessionList::TStoredSessionList(bool AReadOnly) :
 
 TStoredSessionList::~TStoredSessionList()
 {
+  StopWatching();
+  if (FChangeEvent != nullptr)
+  {
+    ::CloseHandle(FChangeEvent);
+  }
+  SAFE_DESTROY(FFolderIndex);
   SAFE_DESTROY(FDefaultSettings);
   for (intptr_t Index = 0; Index < GetCount(); ++Index)
   {
@@ -4572,10 +4620,22 @@ void TStoredSessionList::Load()
   std::unique_ptr<THierarchicalStorage> Storage(GetConfiguration()->CreateStorage(SessionList));
   try__finally
   {
+    StopWatching();
     if (Storage->OpenSubKey(GetConfiguration()->GetStoredSessionsSubKey(), False))
     {
+      // Start watching before loading, not to miss changes made meanwhile
+      if (FChangeEvent == nullptr)
+      {
+        FChangeEvent = ::CreateEvent(nullptr, true, false, nullptr);
+      }
+      if (FChangeEvent != nullptr)
+      {
+        ::ResetEvent(FChangeEvent);
+        FWatchedKey = Storage->WatchChanges(FChangeEvent);
+      }
       Load(Storage.get());
     }
+    FFolderIndexVersion = -1;
   }
   __finally
   {
@@ -4585,6 +4645,134 @@ void TStoredSessionList::Load()
   };
 }
 
+void TStoredSessionList::StopWatching()
+{
+  if (FWatchedKey != nullptr)
+  {
+    ::RegCloseKey(FWatchedKey);
+    FWatchedKey = nullptr;
+  }
+}
+
+bool TStoredSessionList::Reload()
+{
+  // Without a watch (storage not supporting it, or not loaded yet)
+  // we cannot tell, so load always
+  bool Result =
+    (FWatchedKey == nullptr) ||
+    (::WaitForSingleObject(FChangeEvent, 0) == WAIT_OBJECT_0);
+  if (Result)
+  {
+    Load();
+  }
+  return Result;
+}
+
+const TSessionFolderIndex *TStoredSessionList::GetFolderIndex()
+{
+  // Sessions can be added, removed or renamed in memory too, without storage change
+  if ((FFolderIndex == nullptr) || (FFolderIndexVersion != GetVersion()))
+  {
+    if (FFolderIndex == nullptr)
+    {
+      FFolderIndex = new TSessionFolderIndex();
+    }
+    FFolderIndex->Build(this);
+    FFolderIndexVersion = GetVersion();
+  }
+  return FFolderIndex;
+}
+
+TSessionFolderIndex::TNode::TNode() :
+  Folders(new TStringList()),
+  Sessions(new TList())
+{
+  Folders->SetCaseSensitive(false);
+  Folders->SetSorted(true);
+}
+
+TSessionFolderIndex::TNode::~TNode()
+{
+  for (intptr_t Index = 0; Index < Folders->GetCount(); ++Index)
+  {
+    delete Folders->GetObj(Index);
+  }
+  SAFE_DESTROY(Folders);
+  SAFE_DESTROY(Sessions);
+}
+
+TSessionFolderIndex::TNode *TSessionFolderIndex::TNode::GetFolder(UnicodeString Name, bool CanCreate)
+{
+  TNode *Result = nullptr;
+  intptr_t Index;
+  if (Folders->Find(Name, Index))
+  {
+    Result = static_cast<TNode *>(Folders->GetObj(Index));
+  }
+  else if (CanCreate)
+  {
+    Result = new TNode();
+    Folders->AddObject(Name, Result);
+  }
+  return Result;
+}
+
+TSessionFolderIndex::TSessionFolderIndex() :
+  FRoot(new TNode())
+{
+}
+
+TSessionFolderIndex::~TSessionFolderIndex()
+{
+  SAFE_DESTROY(FRoot);
+}
+
+void TSessionFolderIndex::Clear()
+{
+  SAFE_DESTROY(FRoot);
+  FRoot = new TNode();
+}
+
+void TSessionFolderIndex::Build(const TStoredSessionList *Sessions)
+{
+  Clear();
+  for (intptr_t Index = 0; Index < Sessions->GetCount(); ++Index)
+  {
+    const TSessionData *Data = Sessions->GetSession(Index);
+    UnicodeString Name = Data->GetName();
+    TNode *Node = FRoot;
+    intptr_t Slash;
+    while ((Slash = Name.Pos(L'/')) > 0)
+    {
+      Node = Node->GetFolder(Name.SubString(1, Slash - 1), true);
+      Name.Delete(1, Slash);
+    }
+    Node->Sessions->Add(const_cast<TSessionData *>(Data));
+  }
+}
+
+void TSessionFolderIndex::GetChildren(UnicodeString Folder, TStrings *Folders, TList *Sessions) const
+{
+  TNode *Node = FRoot;
+  UnicodeString Path = Folder;
+  while ((Node != nullptr) && !Path.IsEmpty())
+  {
+    Node = Node->GetFolder(CutToChar(Path, L'/', false), false);
+  }
+
+  if (Node != nullptr)
+  {
+    for (intptr_t Index = 0; Index < Node->Folders->GetCount(); ++Index)
+    {
+      Folders->Add(Node->Folders->GetString(Index));
+    }
+    for (intptr_t Index = 0; Index < Node->Sessions->GetCount(); ++Index)
+    {
+      Sessions->Add(Node->Sessions->GetItem(Index));
+    }
+  }
+}
+
 void TStoredSessionList::DoSave(THierarchicalStorage *Storage,
   TSessionData *Data, bool All, bool RecryptPasswordOnly,
   TSessionData *FactoryDefaults)
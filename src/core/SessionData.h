@@ -126,6 +126,7 @@ NB_CORE_EXPORT extern const TKex DefaultKexList[KEX_COUNT];
 NB_CORE_EXPORT extern const TGssLib DefaultGssLibList[GSSLIB_COUNT];
 NB_CORE_EXPORT extern const wchar_t FSProtocolNames[FSPROTOCOL_COUNT][16];
 NB_CORE_EXPORT extern const intptr_t DefaultSendBuf;
+NB_CORE_EXPORT extern const intptr_t DefaultReadBuf;
 NB_CORE_EXPORT extern const UnicodeString AnonymousUserName;
 NB_CORE_EXPORT extern const UnicodeString AnonymousPassword;
 NB_CORE_EXPORT extern const intptr_t SshPortNumber;
@@ -236,6 +237,7 @@ private:
   bool FIgnoreLsWarnings;
   bool FTcpNoDelay;
   intptr_t FSendBuf;
+  intptr_t FReadBuf;
   bool FSshSimple;
   TProxyMethod FProxyMethod;
   UnicodeString FProxyHost;
@@ -257,6 +259,8 @@ private:
   intptr_t FSFTPDownloadQueue;
   intptr_t FSFTPUploadQueue;
   intptr_t FSFTPListingQueue;
+  bool FSFTPDeltaUpload;
+  intptr_t FSFTPDeltaBlockSize;
   intptr_t FSFTPMaxVersion;
   intptr_t FSFTPMaxPacketSize;
   TDSTMode FDSTMode;
@@ -268,6 +272,7 @@ private:
   TAutoSwitch FSCPLsFullTime;
   TAutoSwitch FFtpListAll;
   TAutoSwitch FFtpHost;
+  TAutoSwitch FFtpPipelining;
   TAutoSwitch FFtpDeleteFromCwd;
   bool FSslSessionReuse;
   UnicodeString FTlsCertificateFile;
@@ -381,6 +386,7 @@ public:
   void SetIgnoreLsWarnings(bool Value);
   void SetTcpNoDelay(bool Value);
   void SetSendBuf(intptr_t Value);
+  void SetReadBuf(intptr_t Value);
   void SetSshSimple(bool Value);
   UnicodeString GetSshProtStr() const;
   bool GetUsesSsh() const;
@@ -411,6 +417,8 @@ public:
   void SetSFTPDownloadQueue(intptr_t Value);
   void SetSFTPUploadQueue(intptr_t Value);
   void SetSFTPListingQueue(intptr_t Value);
+  void SetSFTPDeltaUpload(bool Value);
+  void SetSFTPDeltaBlockSize(intptr_t Value);
   void SetSFTPMaxVersion(intptr_t Value);
   void SetSFTPMaxPacketSize(intptr_t Value);
   void SetSFTPBug(TSftpBug Bug, TAutoSwitch Value);
@@ -418,6 +426,7 @@ public:
   void SetSCPLsFullTime(TAutoSwitch Value);
   void SetFtpListAll(TAutoSwitch Value);
   void SetFtpHost(TAutoSwitch Value);
+  void SetFtpPipelining(TAutoSwitch Value);
   void SetFtpDeleteFromCwd(TAutoSwitch Value);
   void SetSslSessionReuse(bool Value);
   void SetTlsCertificateFile(UnicodeString Value);
@@ -661,6 +670,7 @@ public:
   __property bool IgnoreLsWarnings  = { read=FIgnoreLsWarnings, write=SetIgnoreLsWarnings };
   __property bool TcpNoDelay  = { read=FTcpNoDelay, write=SetTcpNoDelay };
   __property intptr_t SendBuf  = { read=FSendBuf, write=SetSendBuf };
+  __property intptr_t ReadBuf  = { read=FReadBuf, write=SetReadBuf };
   __property bool SshSimple  = { read=FSshSimple, write=SetSshSimple };
   __property UnicodeString SshProtStr  = { read=GetSshProtStr };
   __property UnicodeString CipherList  = { read=GetCipherList, write=SetCipherList };
@@ -685,12 +695,15 @@ public:
   __property intptr_t SFTPDownloadQueue = { read = FSFTPDownloadQueue, write = SetSFTPDownloadQueue };
   __property intptr_t SFTPUploadQueue = { read = FSFTPUploadQueue, write = SetSFTPUploadQueue };
   __property intptr_t SFTPListingQueue = { read = FSFTPListingQueue, write = SetSFTPListingQueue };
+  __property bool SFTPDeltaUpload = { read = FSFTPDeltaUpload, write = SetSFTPDeltaUpload };
+  __property intptr_t SFTPDeltaBlockSize = { read = FSFTPDeltaBlockSize, write = SetSFTPDeltaBlockSize };
   __property intptr_t SFTPMaxVersion = { read = FSFTPMaxVersion, write = SetSFTPMaxVersion };
   __property uintptr_t SFTPMaxPacketSize = { read = FSFTPMaxPacketSize, write = SetSFTPMaxPacketSize };
   __property TAutoSwitch SFTPBug[TSftpBug Bug]  = { read=GetSFTPBug, write=SetSFTPBug };
   __property TAutoSwitch SCPLsFullTime = { read = FSCPLsFullTime, write = SetSCPLsFullTime };
   __property TAutoSwitch FtpListAll = { read = FFtpListAll, write = SetFtpListAll };
   __property TAutoSwitch FtpHost = { read = FFtpHost, write = SetFtpHost };
+  __property TAutoSwitch FtpPipelining = { read = FFtpPipelining, write = SetFtpPipelining };
   __property TAutoSwitch FtpDeleteFromCwd = { read = FFtpDeleteFromCwd, write = SetFtpDeleteFromCwd };
   __property bool SslSessionReuse = { read = FSslSessionReuse, write = SetSslSessionReuse };
   __property UnicodeString TlsCertificateFile = { read=FTlsCertificateFile, write=SetTlsCertificateFile };
@@ -798,6 +811,7 @@ public:
   bool GetIgnoreLsWarnings() const { return FIgnoreLsWarnings; }
   bool GetTcpNoDelay() const { return FTcpNoDelay; }
   intptr_t GetSendBuf() const { return FSendBuf; }
+  intptr_t GetReadBuf() const { return FReadBuf; }
   bool GetSshSimple() const { return FSshSimple; }
   TProxyMethod GetProxyMethod() const { return FProxyMethod; }
   TProxyMethod GetActualProxyMethod() const;
@@ -816,12 +830,15 @@ public:
   intptr_t GetSFTPDownloadQueue() const { return FSFTPDownloadQueue; }
   intptr_t GetSFTPUploadQueue() const { return FSFTPUploadQueue; }
   intptr_t GetSFTPListingQueue() const { return FSFTPListingQueue; }
+  bool GetSFTPDeltaUpload() const { return FSFTPDeltaUpload; }
+  intptr_t GetSFTPDeltaBlockSize() const { return FSFTPDeltaBlockSize; }
   intptr_t GetSFTPMaxVersion() const { return FSFTPMaxVersion; }
   intptr_t GetSFTPMinPacketSize() const { return FSFTPMinPacketSize; }
   intptr_t GetSFTPMaxPacketSize() const { return FSFTPMaxPacketSize; }
   TAutoSwitch GetSCPLsFullTime() const { return FSCPLsFullTime; }
   TAutoSwitch GetFtpListAll() const { return FFtpListAll; }
   TAutoSwitch GetFtpHost() const { return FFtpHost; }
+  TAutoSwitch GetFtpPipelining() const { return FFtpPipelining; }
   bool GetFtpDupFF() const { return FFtpDupFF; }
   bool GetFtpUndupFF() const { return FFtpUndupFF; }
   TAutoSwitch GetFtpDeleteFromCwd() const { return FFtpDeleteFromCwd; }
@@ -890,6 +907,38 @@ private:
   void AdjustHostName(UnicodeString &HostName, UnicodeString Prefix) const;
 };
 
+class TStoredSessionList;
+
+// Folder tree of stored sessions, so that listing a folder
+// does not need to go through all sessions
+class NB_CORE_EXPORT TSessionFolderIndex : public TObject
+{
+  NB_DISABLE_COPY(TSessionFolderIndex)
+public:
+  TSessionFolderIndex();
+  virtual ~TSessionFolderIndex();
+
+  void Build(const TStoredSessionList *Sessions);
+  void Clear();
+  // Folder is slash-separated path, empty for the root
+  void GetChildren(UnicodeString Folder, TStrings *Folders, TList *Sessions) const;
+
+private:
+  class TNode : public TObject
+  {
+  public:
+    TNode();
+    virtual ~TNode();
+    TNode *GetFolder(UnicodeString Name, bool CanCreate);
+
+    // Sorted, case-insensitive, objects are subfolder nodes
+    TStringList *Folders;
+    TList *Sessions;
+  };
+
+  TNode *FRoot;
+};
+
 class NB_CORE_EXPORT TStoredSessionList : public TNamedObjectList
 {
   NB_DISABLE_COPY(TStoredSessionList)
@@ -899,6 +948,9 @@ public:
 public:
   explicit TStoredSessionList(bool AReadOnly = false);
   void Load();
+  // Loads the sessions only when the storage has changed since the last load
+  bool Reload();
+  const TSessionFolderIndex *GetFolderIndex();
   void Save(bool All, bool Explicit);
   void Saved();
   void ImportFromFilezilla(const UnicodeString FileName, const UnicodeString ConfigurationFileName);
@@ -949,6 +1001,11 @@ public:
 private:
   TSessionData *FDefaultSettings;
   bool FReadOnly;
+  HANDLE FChangeEvent;
+  HKEY FWatchedKey;
+  TSessionFolderIndex *FFolderIndex;
+  intptr_t FFolderIndexVersion;
+  void StopWatching();
   void DoSave(THierarchicalStorage *Storage, bool All,
     bool RecryptPasswordOnly, TStrings *RecryptPasswordErrors);
   void DoSave(bool All, bool Explicit, bool RecryptPasswordOnly,
@@ -618,7 +618,8 @@ TCwdSessionAction::TCwdSessionAction(TActionLog *Log, UnicodeString Path) :
 }
 
 TSessionInfo::TSessionInfo() :
-  LoginTime(Now())
+  LoginTime(Now()),
+  Statistics(nullptr)
 {
 }
 
@@ -645,6 +646,38 @@ static FILE *LocalOpenLogFile(UnicodeString LogFileName, TDateTime Started, TSes
 }
 
 const wchar_t *LogLineMarks = L"<>!.*";
+// How often the writer thread flushes pending lines
+static const DWORD LogWriterInterval = 100;
+// Number of pending lines that wakes up the writer before the interval elapses
+static const USHORT LogWriterBatch = 256;
+
+struct TSessionLogRecord
+{
+  CUSTOM_MEM_ALLOCATION_IMPL
+  // has to be the first member
+  SLIST_ENTRY Entry;
+  TLogLineType Type;
+  // Raw UTC time, converted and formatted only when written
+  FILETIME Time;
+  UnicodeString Prefix;
+  UnicodeString Line;
+  // When set, the line is formatted by the writer from the arguments below
+  const wchar_t *Format;
+  const wchar_t *Str;
+  intptr_t Arg1;
+  intptr_t Arg2;
+};
+
+static UnicodeString FormatLogTimestamp(const FILETIME &Time)
+{
+  FILETIME LocalTime;
+  SYSTEMTIME SystemTime;
+  ::FileTimeToLocalFileTime(&Time, &LocalTime);
+  ::FileTimeToSystemTime(&LocalTime, &SystemTime);
+  return FORMAT(L" %04d-%02d-%02d %02d:%02d:%02d.%03d ",
+    SystemTime.wYear, SystemTime.wMonth, SystemTime.wDay,
+    SystemTime.wHour, SystemTime.wMinute, SystemTime.wSecond, SystemTime.wMilliseconds);
+}
 
 TSessionLog::TSessionLog(TSessionUI *UI, TDateTime Started, TSessionData *SessionData,
   TConfiguration *Configuration) :
@@ -656,15 +689,26 @@ TSessionLog::TSessionLog(TSessionUI *UI, TDateTime Started, TSessionData *Sessio
   FUI(UI),
   FSessionData(SessionData),
   FStarted(Started),
-  FClosed(false)
+  FClosed(false),
+  FWriterEvent(nullptr),
+  FWriterThread(nullptr),
+  FWriterThreadId(0),
+  FWriterTerminated(FALSE),
+  FOwnerThreadId(::GetCurrentThreadId()),
+  FWriterFailed(FALSE),
+  FTrace(nullptr)
 {
+  ::InitializeSListHead(&FPending);
 }
 
 TSessionLog::~TSessionLog()
 {
+  StopWriter();
   FClosed = true;
   ReflectSettings();
   DebugAssert(FLogger == nullptr);
+  DebugAssert(FTrace == nullptr);
+  DebugAssert(::QueryDepthSList(&FPending) == 0);
 }
 
 void TSessionLog::SetParent(TSessionLog *AParent, UnicodeString AName)
@@ -673,47 +717,186 @@ void TSessionLog::SetParent(TSessionLog *AParent, UnicodeString AName)
   FName = AName;
 }
 
-void TSessionLog::DoAddToParent(TLogLineType Type, UnicodeString ALine)
+void TSessionLog::DoAddToSelf(TLogLineType Type, UnicodeString ALine)
 {
-  DebugAssert(FParent != nullptr);
-  FParent->Add(Type, ALine);
+  Enqueue(Type, ALine, UnicodeString(), nullptr, nullptr, 0, 0);
 }
 
-void TSessionLog::DoAddToSelf(TLogLineType Type, UnicodeString ALine)
+void TSessionLog::Enqueue(TLogLineType AType, UnicodeString ALine, UnicodeString APrefix,
+  const wchar_t *Format, const wchar_t *Str, intptr_t Arg1, intptr_t Arg2)
 {
-  if (LogToFile()) { try
+  // the lines of the background terminals are added to the root log
+  // on their threads, these leave the error to the owner
+  if (FWriterFailed && (::GetCurrentThreadId() == FOwnerThreadId))
   {
-    if (FLogger == nullptr)
+    ReportWriterError();
+  }
+
+  if (LogToFile())
+  {
+    if ((FLogger == nullptr) || (FWriterThread == nullptr))
     {
-      OpenLogFile();
+      // Open the file on the calling thread,
+      // so that failures are reported the same way as before
+      TGuard Guard(FCriticalSection);
+      if (FLogger == nullptr)
+      {
+        OpenLogFile();
+      }
+      if ((FLogger != nullptr) && (FWriterThread == nullptr))
+      {
+        StartWriter();
+      }
     }
 
+    TSessionLogRecord *Record = new TSessionLogRecord();
+    DebugAssert((reinterpret_cast<uintptr_t>(&Record->Entry) % MEMORY_ALLOCATION_ALIGNMENT) == 0);
+    Record->Type = AType;
+    ::GetSystemTimeAsFileTime(&Record->Time);
+    Record->Prefix = APrefix;
+    Record->Line = ALine;
+    Record->Format = Format;
+    Record->Str = Str;
+    Record->Arg1 = Arg1;
+    Record->Arg2 = Arg2;
+    ::InterlockedPushEntrySList(&FPending, &Record->Entry);
+
+    if ((FWriterEvent != nullptr) && (::QueryDepthSList(&FPending) >= LogWriterBatch))
+    {
+      ::SetEvent(FWriterEvent);
+    }
+  }
+}
+
+void TSessionLog::Flush()
+{
+  TGuard Guard(FCriticalSection);
+
+  // The list is LIFO, reverse it to get the lines in order they were added
+  TSessionLogRecord *Records = nullptr;
+  PSLIST_ENTRY Entry = ::InterlockedFlushSList(&FPending);
+  while (Entry != nullptr)
+  {
+    PSLIST_ENTRY Next = Entry->Next;
+    Entry->Next = (Records != nullptr) ? &Records->Entry : nullptr;
+    Records = CONTAINING_RECORD(Entry, TSessionLogRecord, Entry);
+    Entry = Next;
+  }
+
+  UnicodeString Batch;
+  while (Records != nullptr)
+  {
+    TSessionLogRecord *Record = Records;
+    Records = (Record->Entry.Next != nullptr) ?
+      CONTAINING_RECORD(Record->Entry.Next, TSessionLogRecord, Entry) : nullptr;
+
     if (FLogger != nullptr)
     {
-      UnicodeString Timestamp = FormatDateTime(L" yyyy-mm-dd hh:nn:ss.zzz ", Now());
-      UTF8String UtfLine = UTF8String(UnicodeString(LogLineMarks[Type]) + Timestamp + TrimRight(ALine)) + "\r\n";
-#if 0
-      for (intptr_t Index = 1; Index <= UtfLine.Length(); Index++)
+      UnicodeString Head = UnicodeString(LogLineMarks[Record->Type]) + FormatLogTimestamp(Record->Time) + Record->Prefix;
+      UnicodeString Line =
+        (Record->Format != nullptr) ?
+          FORMAT(Record->Format, Record->Str, ToInt(Record->Arg1), ToInt(Record->Arg2)) :
+          Record->Line;
+      while (!Line.IsEmpty())
       {
-        if ((UtfLine[Index] == '\n') &&
-            (UtfLine[Index - 1] != '\r'))
-        {
-          UtfLine.Insert(L'\r', Index);
-        }
+        Batch += Head + TrimRight(CutToChar(Line, L'\n', false)) + L"\r\n";
       }
-#endif // #if 0
-      intptr_t ToWrite = UtfLine.Length();
+    }
+    delete Record;
+  }
+
+  if (!Batch.IsEmpty() && (FLogger != nullptr))
+  {
+    try
+    {
+      UTF8String UtfBatch(Batch);
+      intptr_t ToWrite = UtfBatch.Length();
       CheckSize(ToWrite);
-      FCurrentFileSize += FLogger->Write(UtfLine.c_str(), ToWrite);
-    }}
-    catch (...)
+      if (FLogger != nullptr)
+      {
+        FCurrentFileSize += FLogger->Write(UtfBatch.c_str(), ToWrite);
+      }
+    }
+    catch (Exception &E)
     {
-      // TODO: log error
-      DEBUG_PRINTF("TSessionLog::DoAddToSelf: error");
+      DeferWriterError(&E);
     }
   }
 }
 
+void TSessionLog::DeferWriterError(Exception *E)
+{
+  TGuard Guard(FCriticalSection);
+  // keep the first error only, the log file is closed after it anyway
+  if (!FWriterFailed)
+  {
+    FWriterError = E->Message;
+    ::InterlockedExchange(&FWriterFailed, TRUE);
+  }
+}
+
+void TSessionLog::ReportWriterError()
+{
+  UnicodeString Message;
+  {
+    TGuard Guard(FCriticalSection);
+    Message = FWriterError;
+    FWriterError.Clear();
+    ::InterlockedExchange(&FWriterFailed, FALSE);
+  }
+
+  // Same as when OpenLogFile fails, but on the thread that owns the UI,
+  // as the writer thread must not call it
+  FConfiguration->SetLogFileName(UnicodeString());
+  Exception E(Message);
+  ExtException E2(&E, LoadStr(LOG_GEN_ERROR));
+  AddException(&E2);
+  FUI->HandleExtendedException(&E2);
+}
+
+DWORD WINAPI TSessionLog::WriterThreadProc(void *Parameter)
+{
+  TSessionLog *Log = static_cast<TSessionLog *>(Parameter);
+  while (!Log->FWriterTerminated)
+  {
+    ::WaitForSingleObject(Log->FWriterEvent, LogWriterInterval);
+    Log->Flush();
+  }
+  return 0;
+}
+
+void TSessionLog::StartWriter()
+{
+  DebugAssert(FWriterThread == nullptr);
+  FWriterTerminated = FALSE;
+  FWriterEvent = ::CreateEvent(nullptr, false, false, nullptr);
+  FWriterThread = ::CreateThread(nullptr, 0, &TSessionLog::WriterThreadProc, this, 0, &FWriterThreadId);
+  if (FWriterThread == nullptr)
+  {
+    FWriterThreadId = 0;
+    // Without the writer, lines are still written on flush
+    ::CloseHandle(FWriterEvent);
+    FWriterEvent = nullptr;
+  }
+}
+
+void TSessionLog::StopWriter()
+{
+  // Must not be called with FCriticalSection locked,
+  // as the writer needs it to finish
+  if (FWriterThread != nullptr)
+  {
+    ::InterlockedExchange(&FWriterTerminated, TRUE);
+    ::SetEvent(FWriterEvent);
+    ::WaitForSingleObject(FWriterThread, INFINITE);
+    ::CloseHandle(FWriterThread);
+    FWriterThread = nullptr;
+    FWriterThreadId = 0;
+    ::CloseHandle(FWriterEvent);
+    FWriterEvent = nullptr;
+  }
+}
+
 UnicodeString TSessionLog::LogPartFileName(UnicodeString BaseName, intptr_t Index)
 {
   UnicodeString Result;
@@ -783,21 +966,42 @@ void TSessionLog::DoAdd(TLogLineType AType, UnicodeString Line,
 }
 
 void TSessionLog::Add(TLogLineType Type, UnicodeString ALine)
+{
+  DoAddRecord(Type, ALine, nullptr, nullptr, 0, 0);
+}
+
+void TSessionLog::AddDeferred(TLogLineType Type, const wchar_t *Format,
+  const wchar_t *Str, intptr_t Arg1, intptr_t Arg2)
+{
+  DoAddRecord(Type, UnicodeString(), Format, Str, Arg1, Arg2);
+}
+
+void TSessionLog::DoAddRecord(TLogLineType Type, UnicodeString ALine, const wchar_t *Format,
+  const wchar_t *Str, intptr_t Arg1, intptr_t Arg2)
 {
   DebugAssert(FConfiguration);
   if (GetLogging())
   {
     try
     {
-      if (FParent != nullptr)
+      // Lines are split, timestamped and encoded by the writer thread
+      TSessionLog *Root = this;
+      UnicodeString Prefix;
+      while (true)
       {
-        DoAdd(Type, ALine, nb::bind(&TSessionLog::DoAddToParent, this));
+        if (!Root->GetName().IsEmpty())
+        {
+          Prefix = L"[" + Root->GetName() + L"] " + Prefix;
+        }
+        if (Root->FParent == nullptr)
+        {
+          break;
+        }
+        Root = Root->FParent;
       }
-      else
+      if (Root->GetLogging())
       {
-        TGuard Guard(FCriticalSection);
-
-        DoAdd(Type, ALine, nb::bind(&TSessionLog::DoAddToSelf, this));
+        Root->Enqueue(Type, ALine, Prefix, Format, Str, Arg1, Arg2);
       }
     }
     catch (Exception &E)
@@ -829,6 +1033,9 @@ void TSessionLog::ReflectSettings()
 {
   TGuard Guard(FCriticalSection);
 
+  // write out lines added under the previous settings
+  Flush();
+
   FLogging =
     !FClosed &&
     ((FParent != nullptr) || FConfiguration->GetLogging());
@@ -844,6 +1051,17 @@ void TSessionLog::ReflectSettings()
   {
     CheckSize(0);
   }
+
+  if ((FTrace != nullptr) &&
+    ((FLogger == nullptr) || !FConfiguration->GetLogProtocolTrace()))
+  {
+    CloseTrace();
+  }
+  else if ((FTrace == nullptr) && (FLogger != nullptr) &&
+    FConfiguration->GetLogProtocolTrace())
+  {
+    OpenTrace();
+  }
 }
 
 bool TSessionLog::LogToFileProtected() const
@@ -888,17 +1106,25 @@ void TSessionLog::OpenLogFile()
     // We failed logging to file, turn it off and notify user.
     FCurrentLogFileName.Clear();
     FCurrentFileName.Clear();
-    FConfiguration->SetLogFileName(UnicodeString());
-    try
+    if (::GetCurrentThreadId() == FWriterThreadId)
     {
-      throw ExtException(&E, LoadStr(LOG_GEN_ERROR));
+      // reopening after rotation, reported by the next Add
+      DeferWriterError(&E);
     }
-    catch (Exception &E2)
+    else
     {
-      AddException(&E2);
-      // not to deadlock with TSessionLog::ReflectSettings invoked by FConfiguration->LogFileName setter above
-      TUnguard Unguard(FCriticalSection);
-      FUI->HandleExtendedException(&E2);
+      FConfiguration->SetLogFileName(UnicodeString());
+      try
+      {
+        throw ExtException(&E, LoadStr(LOG_GEN_ERROR));
+      }
+      catch (Exception &E2)
+      {
+        AddException(&E2);
+        // not to deadlock with TSessionLog::ReflectSettings invoked by FConfiguration->LogFileName setter above
+        TUnguard Unguard(FCriticalSection);
+        FUI->HandleExtendedException(&E2);
+      }
     }
   }
 
@@ -907,6 +1133,72 @@ void TSessionLog::OpenLogFile()
   {
     CheckSize(0);
   }
+
+  if ((FLogger != nullptr) && (FTrace == nullptr) &&
+      FConfiguration->GetLogProtocolTrace())
+  {
+    OpenTrace();
+  }
+}
+
+void TSessionLog::OpenTrace()
+{
+  // The trace survives rotations of the text log, it is rotated on its own
+  UnicodeString TraceFileName = FCurrentFileName + L".nbtrace";
+  int64_t MaxSize = FConfiguration->GetLogMaxSize();
+  try
+  {
+    TProtocolTrace *Trace = new TProtocolTrace(TraceFileName, (MaxSize > 0) ? MaxSize : 64 * 1024 * 1024);
+    TGuard Guard(FTraceSection);
+    FTrace = Trace;
+  }
+  catch (Exception &E)
+  {
+    // Text log is still usable
+    AddException(&E);
+  }
+}
+
+void TSessionLog::CloseTrace()
+{
+  TProtocolTrace *Trace;
+  {
+    // once we have the lock, no one else is recording
+    TGuard Guard(FTraceSection);
+    Trace = FTrace;
+    FTrace = nullptr;
+  }
+  delete Trace;
+}
+
+void TSessionLog::RecordTrace(TTraceProtocol Protocol, TTraceDirection Direction,
+  uintptr_t Type, uintptr_t MessageNumber, uintptr_t Length)
+{
+  TSessionLog *Root = this;
+  while (Root->FParent != nullptr)
+  {
+    Root = Root->FParent;
+  }
+  // unlocked test first, not to lock for every packet when not tracing
+  if (Root->GetLogging() && (Root->FTrace != nullptr))
+  {
+    TGuard Guard(Root->FTraceSection);
+    if (Root->FTrace != nullptr)
+    {
+      Root->FTrace->Record(Protocol, Direction, Type, MessageNumber, Length);
+    }
+  }
+}
+
+UnicodeString TSessionLog::GetTraceFileName() const
+{
+  const TSessionLog *Root = this;
+  while (Root->FParent != nullptr)
+  {
+    Root = Root->FParent;
+  }
+  TGuard Guard(Root->FTraceSection);
+  return (Root->FTrace != nullptr) ? Root->FTrace->GetFileName() : UnicodeString();
 }
 
 void TSessionLog::AddSystemInfo()
@@ -1146,6 +1438,10 @@ void TSessionLog::DoAddStartupInfo(TSessionData *Data)
     {
       ADF("Send buffer: %d", Data->GetSendBuf());
     }
+    if (Data->GetFSProtocol() == fsWebDAV)
+    {
+      ADF("Read buffer: %d", Data->GetReadBuf());
+    }
     if (Data->GetUsesSsh())
     {
       ADF("SSH protocol version: %s; Compression: %s",
@@ -1192,6 +1488,10 @@ void TSessionLog::DoAddStartupInfo(TSessionData *Data)
       }
       ADF("SFTP Bugs: %s", Bugs);
       ADF("SFTP Server: %s", Data->GetSftpServer().IsEmpty() ? UnicodeString(L"default") : Data->GetSftpServer());
+      if (Data->GetSFTPDeltaUpload())
+      {
+        ADF("Delta upload: Yes [Block size: %d]", int(Data->GetSFTPDeltaBlockSize()));
+      }
     }
     bool FtpsOn = false;
     if (Data->GetFSProtocol() == fsFTP)
@@ -1225,6 +1525,10 @@ void TSessionLog::DoAddStartupInfo(TSessionData *Data)
       {
         ADF("Transfer active immediately: %s", EnumName(Data->GetFtpTransferActiveImmediately(), AutoSwitchNames));
       }
+      if (Data->GetFtpPipelining() != asOff)
+      {
+        ADF("Pipelining: %s", EnumName(Data->GetFtpPipelining(), AutoSwitchNames));
+      }
       ADF("FTPS: %s [Client certificate: %s]",
         Ftps, LogSensitive(Data->GetTlsCertificateFile()));
       ADF("FTP: Passive: %s [Force IP: %s]; MLSD: %s [List all: %s]; HOST: %s",
@@ -4,6 +4,7 @@
 #include <tinylog/TinyLog.h>
 #include "SessionData.h"
 #include "Interface.h"
+#include "ProtocolTrace.h"
 
 enum TSessionStatus
 {
@@ -13,6 +14,8 @@ enum TSessionStatus
   ssClosing,
 };
 
+class TSessionStatistics;
+
 struct NB_CORE_EXPORT TSessionInfo
 {
   CUSTOM_MEM_ALLOCATION_IMPL
@@ -34,6 +37,9 @@ struct NB_CORE_EXPORT TSessionInfo
 
   UnicodeString CertificateFingerprint;
   UnicodeString Certificate;
+
+  // Live transfer telemetry of the terminal, may be nullptr
+  const TSessionStatistics *Statistics;
 };
 
 enum TFSCapability
@@ -274,6 +280,10 @@ public:
   void SetParent(TSessionLog *AParent, UnicodeString AName);
 
   void Add(TLogLineType Type, UnicodeString ALine);
+  // The line is formatted only by the writer thread,
+  // Format and Str must be static strings
+  void AddDeferred(TLogLineType Type, const wchar_t *Format,
+    const wchar_t *Str, intptr_t Arg1, intptr_t Arg2);
   void AddSystemInfo();
   void AddStartupInfo();
   void AddException(Exception *E);
@@ -290,6 +300,10 @@ public:
   UnicodeString GetName() const { return FName; }
   UnicodeString GetLogFileName() const { return FCurrentLogFileName; }
   bool LogToFile() const { return LogToFileProtected(); }
+  // Binary trace of protocol packets, when enabled by LogProtocolTrace
+  void RecordTrace(TTraceProtocol Protocol, TTraceDirection Direction,
+    uintptr_t Type, uintptr_t MessageNumber, uintptr_t Length);
+  UnicodeString GetTraceFileName() const;
 
 protected:
   void CloseLogFile();
@@ -309,11 +323,37 @@ private:
   TDateTime FStarted;
   UnicodeString FName;
   bool FClosed;
+  // Lines not written yet, pushed by any thread without locking,
+  // formatted and written by the writer thread
+  SLIST_HEADER FPending;
+  HANDLE FWriterEvent;
+  HANDLE FWriterThread;
+  DWORD FWriterThreadId;
+  volatile LONG FWriterTerminated;
+  // Error of the writer thread, reported by the thread that created the log,
+  // which owns FUI, when it adds the next line
+  DWORD FOwnerThreadId;
+  volatile LONG FWriterFailed;
+  UnicodeString FWriterError;
+  // Guards FTrace against being closed while a packet is being recorded
+  TCriticalSection FTraceSection;
+  TProtocolTrace *FTrace;
 
   void OpenLogFile();
+  void OpenTrace();
+  void CloseTrace();
+  void DoAddRecord(TLogLineType Type, UnicodeString ALine, const wchar_t *Format,
+    const wchar_t *Str, intptr_t Arg1, intptr_t Arg2);
+  void Enqueue(TLogLineType AType, UnicodeString ALine, UnicodeString APrefix,
+    const wchar_t *Format, const wchar_t *Str, intptr_t Arg1, intptr_t Arg2);
+  void Flush();
+  void DeferWriterError(Exception *E);
+  void ReportWriterError();
+  void StartWriter();
+  void StopWriter();
+  static DWORD WINAPI WriterThreadProc(void *Parameter);
   void DoAdd(TLogLineType AType, UnicodeString ALine,
     TDoAddLogEvent Event);
-  void DoAddToParent(TLogLineType AType, UnicodeString ALine);
   void DoAddToSelf(TLogLineType AType, UnicodeString ALine);
   void AddStartupInfo(bool System);
   void DoAddStartupInfo(TSessionData *Data);
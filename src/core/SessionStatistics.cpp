@@ -0,0 +1,243 @@
+#include <vcl.h>
+#pragma hdrstop
+
+#include <Common.h>
+
+#include "SessionStatistics.h"
+#include "SftpFileSystem.h"
+
+TLatencyHistogram::TLatencyHistogram()
+{
+  Reset();
+}
+
+void TLatencyHistogram::Reset()
+{
+  for (intptr_t Index = 0; Index < BucketCount; Index++)
+  {
+    ::InterlockedExchange(&FCounts[Index], 0);
+  }
+  ::InterlockedExchange(&FCount, 0);
+  ::InterlockedExchange(&FMax, 0);
+}
+
+intptr_t TLatencyHistogram::BucketIndex(uint32_t Value)
+{
+  intptr_t Result;
+  if (Value < SubBuckets)
+  {
+    Result = static_cast<intptr_t>(Value);
+  }
+  else
+  {
+    intptr_t Magnitude = 0;
+    while ((Value >> (Magnitude + 1)) != 0)
+    {
+      Magnitude++;
+    }
+    intptr_t SubBucket = static_cast<intptr_t>((Value >> (Magnitude - SubBucketBits)) & (SubBuckets - 1));
+    Result = ((Magnitude - SubBucketBits + 1) * SubBuckets) + SubBucket;
+  }
+  return Result;
+}
+
+uint32_t TLatencyHistogram::BucketUpperBound(intptr_t Index)
+{
+  uint32_t Result;
+  if (Index < SubBuckets)
+  {
+    Result = static_cast<uint32_t>(Index);
+  }
+  else
+  {
+    intptr_t Shift = (Index / SubBuckets) - 1;
+    uint32_t Lower = static_cast<uint32_t>(SubBuckets + (Index % SubBuckets)) << Shift;
+    Result = Lower + ((1u << Shift) - 1);
+  }
+  return Result;
+}
+
+void TLatencyHistogram::Record(uint32_t Microseconds)
+{
+  ::InterlockedIncrement(&FCounts[BucketIndex(Microseconds)]);
+  ::InterlockedIncrement(&FCount);
+  LONG Max = FMax;
+  while ((static_cast<uint32_t>(Max) < Microseconds) &&
+         (::InterlockedCompareExchange(&FMax, static_cast<LONG>(Microseconds), Max) != Max))
+  {
+    Max = FMax;
+  }
+}
+
+uint32_t TLatencyHistogram::GetPercentile(intptr_t Percent) const
+{
+  uint32_t Result = 0;
+  uint32_t Count = GetCount();
+  if (Count > 0)
+  {
+    uint32_t Threshold = static_cast<uint32_t>((static_cast<uint64_t>(Count) * Percent + 99) / 100);
+    uint32_t Sum = 0;
+    for (intptr_t Index = 0; Index < BucketCount; Index++)
+    {
+      Sum += static_cast<uint32_t>(FCounts[Index]);
+      if (Sum >= Threshold)
+      {
+        Result = std::min(BucketUpperBound(Index), GetMax());
+        break;
+      }
+    }
+  }
+  return Result;
+}
+
+static UnicodeString FormatMicroseconds(int64_t Microseconds)
+{
+  return FORMAT(L"%d.%03d ms", ToInt(Microseconds / 1000), ToInt(Microseconds % 1000));
+}
+
+TSessionStatistics::TSessionStatistics() :
+  FFrequency(1)
+{
+  LARGE_INTEGER Frequency;
+  if (::QueryPerformanceFrequency(&Frequency) && (Frequency.QuadPart > 0))
+  {
+    FFrequency = Frequency.QuadPart;
+  }
+  for (intptr_t Index = 0; Index < TypeCount; Index++)
+  {
+    FHistograms[Index] = nullptr;
+  }
+  Reset();
+}
+
+TSessionStatistics::~TSessionStatistics()
+{
+  for (intptr_t Index = 0; Index < TypeCount; Index++)
+  {
+    delete FHistograms[Index];
+  }
+}
+
+void TSessionStatistics::Reset()
+{
+  for (intptr_t Index = 0; Index < TypeCount; Index++)
+  {
+    if (FHistograms[Index] != nullptr)
+    {
+      FHistograms[Index]->Reset();
+    }
+  }
+  memset(FPending, 0, sizeof(FPending));
+  for (intptr_t Index = 0; Index < scCount; Index++)
+  {
+    FTimes[Index] = 0;
+  }
+  ::InterlockedExchange(&FBytesInFlight, 0);
+  ::InterlockedExchange(&FMaxBytesInFlight, 0);
+  FBytesSent = 0;
+  FBytesReceived = 0;
+}
+
+int64_t TSessionStatistics::GetTicks()
+{
+  LARGE_INTEGER Ticks;
+  ::QueryPerformanceCounter(&Ticks);
+  return Ticks.QuadPart;
+}
+
+int64_t TSessionStatistics::TicksToMicroseconds(int64_t Ticks) const
+{
+  return ((Ticks / FFrequency) * 1000000) + (((Ticks % FFrequency) * 1000000) / FFrequency);
+}
+
+void TSessionStatistics::RequestSent(uintptr_t Type, uintptr_t MessageNumber, uintptr_t Length)
+{
+  TPendingRequest &Pending = FPending[MessageNumber % PendingSlots];
+  if (Pending.Key != 0)
+  {
+    // Response to the request occupying the slot was never seen
+    ::InterlockedExchangeAdd(&FBytesInFlight, -static_cast<LONG>(Pending.Length));
+  }
+  // Key is offset by one, so that zeroed slot never matches
+  Pending.Key = static_cast<uint32_t>(MessageNumber) + 1;
+  Pending.Type = static_cast<uint8_t>(Type);
+  Pending.Length = static_cast<uint32_t>(Length);
+  Pending.Ticks = GetTicks();
+
+  LONG InFlight = ::InterlockedExchangeAdd(&FBytesInFlight, static_cast<LONG>(Length)) + static_cast<LONG>(Length);
+  if (InFlight > FMaxBytesInFlight)
+  {
+    ::InterlockedExchange(&FMaxBytesInFlight, InFlight);
+  }
+  FBytesSent += Length;
+}
+
+void TSessionStatistics::ResponseReceived(uintptr_t MessageNumber, uintptr_t Length)
+{
+  FBytesReceived += Length;
+  TPendingRequest &Pending = FPending[MessageNumber % PendingSlots];
+  if (Pending.Key == static_cast<uint32_t>(MessageNumber) + 1)
+  {
+    int64_t Microseconds = TicksToMicroseconds(GetTicks() - Pending.Ticks);
+    TLatencyHistogram *Histogram = FHistograms[Pending.Type];
+    if (Histogram == nullptr)
+    {
+      Histogram = new TLatencyHistogram();
+      // publish only fully constructed histogram
+      ::InterlockedExchangePointer(reinterpret_cast<void *volatile *>(&FHistograms[Pending.Type]), Histogram);
+    }
+    Histogram->Record(static_cast<uint32_t>(std::min(Microseconds, static_cast<int64_t>(0x7FFFFFFF))));
+    ::InterlockedExchangeAdd(&FBytesInFlight, -static_cast<LONG>(Pending.Length));
+    Pending.Key = 0;
+  }
+}
+
+void TSessionStatistics::AddTime(TStatisticsCounter Counter, int64_t Ticks)
+{
+  FTimes[Counter] += Ticks;
+}
+
+const TLatencyHistogram *TSessionStatistics::GetHistogram(uintptr_t Type) const
+{
+  return (Type < TypeCount) ? FHistograms[Type] : nullptr;
+}
+
+int64_t TSessionStatistics::GetTime(TStatisticsCounter Counter) const
+{
+  return TicksToMicroseconds(FTimes[Counter]);
+}
+
+bool TSessionStatistics::GetEmpty() const
+{
+  return (FBytesSent == 0) && (FBytesReceived == 0);
+}
+
+void TSessionStatistics::Report(TStrings *Lines) const
+{
+  for (intptr_t Type = 0; Type < TypeCount; Type++)
+  {
+    const TLatencyHistogram *Histogram = FHistograms[Type];
+    if ((Histogram != nullptr) && (Histogram->GetCount() > 0))
+    {
+      Lines->Add(FORMAT(L"%s: %d requests, RTT p50 %s, p90 %s, p99 %s, max %s",
+        SFTPPacketTypeName(static_cast<SSH_FXP_TYPES>(Type)), ToInt(Histogram->GetCount()),
+        FormatMicroseconds(Histogram->GetPercentile(50)), FormatMicroseconds(Histogram->GetPercentile(90)),
+        FormatMicroseconds(Histogram->GetPercentile(99)), FormatMicroseconds(Histogram->GetMax())));
+    }
+  }
+  Lines->Add(FORMAT(L"Sent: %s, received: %s",
+    FormatSize(GetBytesSent()), FormatSize(GetBytesReceived())));
+  Lines->Add(FORMAT(L"Bytes in flight: %s, peak %s",
+    FormatSize(GetBytesInFlight()), FormatSize(GetMaxBytesInFlight())));
+  Lines->Add(FORMAT(L"Waiting for server: %s", FormatMicroseconds(GetTime(scStallTime))));
+  Lines->Add(FORMAT(L"Local disk read: %s, write: %s",
+    FormatMicroseconds(GetTime(scDiskReadTime)), FormatMicroseconds(GetTime(scDiskWriteTime))));
+  Lines->Add(FORMAT(L"SSH layer (ciphers, MAC, compression, socket): %s", FormatMicroseconds(GetTime(scSshLayerTime))));
+}
+
+UnicodeString TSessionStatistics::GetReport() const
+{
+  std::unique_ptr<TStrings> Lines(new TStringList());
+  Report(Lines.get());
+  return Lines->GetText();
+}
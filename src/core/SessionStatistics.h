@@ -0,0 +1,127 @@
+#pragma once
+
+#include <Classes.hpp>
+
+// Histogram of latencies in microseconds. Each power of two is split
+// into four linear sub-buckets, so any value is known within 25%.
+// Counters are updated with interlocked operations and can be read
+// from other threads while being recorded.
+class NB_CORE_EXPORT TLatencyHistogram
+{
+  CUSTOM_MEM_ALLOCATION_IMPL
+  NB_DISABLE_COPY(TLatencyHistogram)
+public:
+  TLatencyHistogram();
+
+  void Record(uint32_t Microseconds);
+  void Reset();
+
+  uint32_t GetCount() const { return FCount; }
+  uint32_t GetMax() const { return FMax; }
+  // Upper bound of the bucket containing given percentile
+  uint32_t GetPercentile(intptr_t Percent) const;
+
+private:
+  static const intptr_t SubBucketBits = 2;
+  static const intptr_t SubBuckets = 1 << SubBucketBits;
+  static const intptr_t BucketCount = 32 * SubBuckets;
+
+  volatile LONG FCounts[BucketCount];
+  volatile LONG FCount;
+  volatile LONG FMax;
+
+  static intptr_t BucketIndex(uint32_t Value);
+  static uint32_t BucketUpperBound(intptr_t Index);
+};
+
+enum TStatisticsCounter
+{
+  // Waiting for the server to respond
+  scStallTime,
+  // Reading source files on upload
+  scDiskReadTime,
+  // Writing target files on download
+  scDiskWriteTime,
+  // Time inside the SSH backend: packet encryption and MAC, compression,
+  // channel and window handling, and the socket sends and reads themselves
+  scSshLayerTime,
+  scCount,
+};
+
+// Transfer telemetry of one terminal. Written by the terminal thread only,
+// so 64-bit totals may be seen torn when read from other threads
+// on 32-bit builds, which is acceptable for reporting.
+class NB_CORE_EXPORT TSessionStatistics : public TObject
+{
+  NB_DISABLE_COPY(TSessionStatistics)
+public:
+  TSessionStatistics();
+  virtual ~TSessionStatistics();
+
+  void Reset();
+
+  void RequestSent(uintptr_t Type, uintptr_t MessageNumber, uintptr_t Length);
+  void ResponseReceived(uintptr_t MessageNumber, uintptr_t Length);
+  void AddTime(TStatisticsCounter Counter, int64_t Ticks);
+
+  const TLatencyHistogram *GetHistogram(uintptr_t Type) const;
+  int64_t GetTime(TStatisticsCounter Counter) const;
+  intptr_t GetBytesInFlight() const { return FBytesInFlight; }
+  intptr_t GetMaxBytesInFlight() const { return FMaxBytesInFlight; }
+  int64_t GetBytesSent() const { return FBytesSent; }
+  int64_t GetBytesReceived() const { return FBytesReceived; }
+  bool GetEmpty() const;
+
+  // One line per metric, human readable
+  void Report(TStrings *Lines) const;
+  UnicodeString GetReport() const;
+
+  static int64_t GetTicks();
+
+private:
+  static const intptr_t TypeCount = 256;
+  static const intptr_t PendingSlots = 256;
+  struct TPendingRequest
+  {
+    uint32_t Key;
+    uint8_t Type;
+    uint32_t Length;
+    int64_t Ticks;
+  };
+
+  TLatencyHistogram *volatile FHistograms[TypeCount];
+  TPendingRequest FPending[PendingSlots];
+  int64_t FTimes[scCount];
+  int64_t FFrequency;
+  volatile LONG FBytesInFlight;
+  volatile LONG FMaxBytesInFlight;
+  int64_t FBytesSent;
+  int64_t FBytesReceived;
+
+  int64_t TicksToMicroseconds(int64_t Ticks) const;
+};
+
+// Adds time spent in its scope to a statistics counter
+class NB_CORE_EXPORT TStatisticsTimer
+{
+  NB_DISABLE_COPY(TStatisticsTimer)
+public:
+  explicit TStatisticsTimer(TSessionStatistics *Statistics, TStatisticsCounter Counter) :
+    FStatistics(Statistics),
+    FCounter(Counter),
+    FStart((Statistics != nullptr) ? TSessionStatistics::GetTicks() : 0)
+  {
+  }
+  ~TStatisticsTimer()
+  {
+    if (FStatistics != nullptr)
+    {
+      FStatistics->AddTime(FCounter, TSessionStatistics::GetTicks() - FStart);
+    }
+  }
+
+private:
+  TSessionStatistics *FStatistics;
+  TStatisticsCounter FCounter;
+  int64_t FStart;
+};
@@ -8,6 +8,10 @@
 #include <memory>
 
 #include "SftpFileSystem.h"
+#include "ProtocolTrace.h"
+#include "FileHasher.h"
+#include "LocalTreeWalker.h"
+#include <AsyncFileStream.h>
 #include "Interface.h"
 #include "Terminal.h"
 #include "TextsCore.h"
@@ -244,6 +248,55 @@ public:
   bool Loaded;
 };
 
+static const wchar_t *SFTPPacketTypeStaticName(SSH_FXP_TYPES Type)
+{
+#define TYPE_CASE(TYPE) case TYPE: return TEXT(#TYPE)
+  switch (Type)
+  {
+    TYPE_CASE(SSH_FXP_INIT);
+    TYPE_CASE(SSH_FXP_VERSION);
+    TYPE_CASE(SSH_FXP_OPEN);
+    TYPE_CASE(SSH_FXP_CLOSE);
+    TYPE_CASE(SSH_FXP_READ);
+    TYPE_CASE(SSH_FXP_WRITE);
+    TYPE_CASE(SSH_FXP_LSTAT);
+    TYPE_CASE(SSH_FXP_FSTAT);
+    TYPE_CASE(SSH_FXP_SETSTAT);
+    TYPE_CASE(SSH_FXP_FSETSTAT);
+    TYPE_CASE(SSH_FXP_OPENDIR);
+    TYPE_CASE(SSH_FXP_READDIR);
+    TYPE_CASE(SSH_FXP_REMOVE);
+    TYPE_CASE(SSH_FXP_MKDIR);
+    TYPE_CASE(SSH_FXP_RMDIR);
+    TYPE_CASE(SSH_FXP_REALPATH);
+    TYPE_CASE(SSH_FXP_STAT);
+    TYPE_CASE(SSH_FXP_RENAME);
+    TYPE_CASE(SSH_FXP_READLINK);
+    TYPE_CASE(SSH_FXP_SYMLINK);
+    TYPE_CASE(SSH_FXP_LINK);
+    TYPE_CASE(SSH_FXP_STATUS);
+    TYPE_CASE(SSH_FXP_HANDLE);
+    TYPE_CASE(SSH_FXP_DATA);
+    TYPE_CASE(SSH_FXP_NAME);
+    TYPE_CASE(SSH_FXP_ATTRS);
+    TYPE_CASE(SSH_FXP_EXTENDED);
+    TYPE_CASE(SSH_FXP_EXTENDED_REPLY);
+  default:
+    return nullptr;
+  }
+#undef TYPE_CASE
+}
+
+UnicodeString SFTPPacketTypeName(SSH_FXP_TYPES Type)
+{
+  const wchar_t *Name = SFTPPacketTypeStaticName(Type);
+  if (Name != nullptr)
+  {
+    return Name;
+  }
+  return FORMAT("Unknown message (%d)", ToInt(Type));
+}
+
 class TSFTPPacket : public TObject
 {
 public:
@@ -1081,7 +1134,8 @@ public:
       FCapacity = ACapacity;
       if (FCapacity > 0)
       {
-        uint8_t *NData = nb::calloc<uint8_t *>(1, FCapacity + FSendPrefixLen);
+        // contents are copied or received before read, no need to clear
+        uint8_t *NData = static_cast<uint8_t *>(nb_malloc_uninit(FCapacity + FSendPrefixLen));
         NData += FSendPrefixLen;
         if (FData)
         {
@@ -1108,39 +1162,22 @@ public:
 
   UnicodeString GetTypeName() const
   {
-#define TYPE_CASE(TYPE) case TYPE: return MB_TEXT(#TYPE)
-    switch (GetType())
-    {
-      TYPE_CASE(SSH_FXP_INIT);
-      TYPE_CASE(SSH_FXP_VERSION);
-      TYPE_CASE(SSH_FXP_OPEN);
-      TYPE_CASE(SSH_FXP_CLOSE);
-      TYPE_CASE(SSH_FXP_READ);
-      TYPE_CASE(SSH_FXP_WRITE);
-      TYPE_CASE(SSH_FXP_LSTAT);
-      TYPE_CASE(SSH_FXP_FSTAT);
-      TYPE_CASE(SSH_FXP_SETSTAT);
-      TYPE_CASE(SSH_FXP_FSETSTAT);
-      TYPE_CASE(SSH_FXP_OPENDIR);
-      TYPE_CASE(SSH_FXP_READDIR);
-      TYPE_CASE(SSH_FXP_REMOVE);
-      TYPE_CASE(SSH_FXP_MKDIR);
-      TYPE_CASE(SSH_FXP_RMDIR);
-      TYPE_CASE(SSH_FXP_REALPATH);
-      TYPE_CASE(SSH_FXP_STAT);
-      TYPE_CASE(SSH_FXP_RENAME);
-      TYPE_CASE(SSH_FXP_READLINK);
-      TYPE_CASE(SSH_FXP_SYMLINK);
-      TYPE_CASE(SSH_FXP_LINK);
-      TYPE_CASE(SSH_FXP_STATUS);
-      TYPE_CASE(SSH_FXP_HANDLE);
-      TYPE_CASE(SSH_FXP_DATA);
-      TYPE_CASE(SSH_FXP_NAME);
-      TYPE_CASE(SSH_FXP_ATTRS);
-      TYPE_CASE(SSH_FXP_EXTENDED);
-      TYPE_CASE(SSH_FXP_EXTENDED_REPLY);
-    default:
-      return FORMAT("Unknown message (%d)", ToInt(GetType()));
+    return SFTPPacketTypeName(GetType());
+  }
+
+  void Log(TSessionLog *Log, TLogLineType Type) const
+  {
+    const wchar_t *Name = SFTPPacketTypeStaticName(GetType());
+    if (Name != nullptr)
+    {
+      // formatted by the log writer thread, not for every packet here
+      Log->AddDeferred(Type, L"Type: %s, Size: %d, Number: %d",
+        Name, ToInt(GetLength()), ToInt(GetMessageNumber()));
+    }
+    else
+    {
+      Log->Add(Type, FORMAT("Type: %s, Size: %d, Number: %d",
+        GetTypeName(), ToInt(GetLength()), ToInt(GetMessageNumber())));
     }
   }
 
@@ -1605,6 +1642,14 @@ private:
   RawByteString FHandle;
 };
 
+// Part of a file to write, when uploading only changed blocks
+struct TSFTPUploadRange
+{
+  int64_t Offset;
+  int64_t Length;
+};
+typedef rde::vector<TSFTPUploadRange> TSFTPUploadRanges;
+
 class TSFTPUploadQueue : public TSFTPAsynchronousQueue
 {
   NB_DISABLE_COPY(TSFTPUploadQueue)
@@ -1618,7 +1663,9 @@ public:
     FEnd(false),
     FTransferred(0),
     FConvertToken(false),
-    FConvertParams(0)
+    FConvertParams(0),
+    FRangeIndex(0),
+    FRangeRemaining(0)
   {
   }
 
@@ -1630,14 +1677,21 @@ public:
   bool Init(UnicodeString AFileName,
     HANDLE AFile, TFileOperationProgressType *AOperationProgress,
     RawByteString AHandle, int64_t ATransferred,
-    intptr_t ConvertParams)
+    intptr_t ConvertParams, const TSFTPUploadRanges *Ranges = nullptr)
   {
     FFileName = AFileName;
-    FStream = new TSafeHandleStream(AFile);
+    // disk reads happen ahead on a worker thread
+    FStream = new TReadAheadStream(AFile);
     OperationProgress = AOperationProgress;
     FHandle = AHandle;
     FTransferred = ATransferred;
     FConvertParams = ConvertParams;
+    // only the ranges are written, in the order given
+    if (Ranges != nullptr)
+    {
+      FRanges = *Ranges;
+      DebugAssert(!FRanges.empty());
+    }
 
     return TSFTPAsynchronousQueue::Init();
   }
@@ -1655,6 +1709,29 @@ protected:
     TFileBuffer BlockBuf;
 
     intptr_t BlockSize = GetBlockSize();
+    if (!FRanges.empty() && (BlockSize > 0))
+    {
+      if (FRangeRemaining == 0)
+      {
+        if (FRangeIndex < static_cast<intptr_t>(FRanges.size()))
+        {
+          const TSFTPUploadRange &Range = FRanges[FRangeIndex];
+          ++FRangeIndex;
+          FTransferred = Range.Offset;
+          FRangeRemaining = Range.Length;
+          FStream->Seek(Range.Offset, soFromBeginning);
+        }
+        else
+        {
+          FEnd = true;
+          BlockSize = 0;
+        }
+      }
+      if (BlockSize > FRangeRemaining)
+      {
+        BlockSize = static_cast<intptr_t>(FRangeRemaining);
+      }
+    }
     bool Result = (BlockSize > 0);
 
     if (Result)
@@ -1662,6 +1739,7 @@ protected:
       FileOperationLoopCustom(FTerminal, OperationProgress, True, FMTLOAD(READ_ERROR, FFileName), "",
       [&]()
       {
+        TStatisticsTimer Timer(FTerminal->GetStatistics(), scDiskReadTime);
         BlockBuf.LoadStream(FStream, BlockSize, false);
       });
 
@@ -1669,6 +1747,10 @@ protected:
       Result = !FEnd;
       if (Result)
       {
+        if (!FRanges.empty())
+        {
+          FRangeRemaining -= BlockBuf.GetSize();
+        }
         OperationProgress->AddLocallyUsed(BlockBuf.GetSize());
 
         // We do ASCII transfer: convert EOL of current block
@@ -1763,6 +1845,9 @@ private:
   RawByteString FHandle;
   bool FConvertToken;
   intptr_t FConvertParams;
+  TSFTPUploadRanges FRanges;
+  intptr_t FRangeIndex;
+  int64_t FRangeRemaining;
 };
 
 class TSFTPLoadFilesPropertiesQueue : public TSFTPFixedLenQueue
@@ -1947,6 +2032,88 @@ private:
   intptr_t FIndex;
 };
 
+// Requests checksums of consecutive blocks of one file,
+// a run of blocks per request, so that the replies fit a packet
+class TSFTPCheckFileBlocksQueue : public TSFTPFixedLenQueue
+{
+  NB_DISABLE_COPY(TSFTPCheckFileBlocksQueue)
+public:
+  explicit TSFTPCheckFileBlocksQueue(TSFTPFileSystem *AFileSystem, uintptr_t CodePage) :
+    TSFTPFixedLenQueue(AFileSystem, CodePage),
+    FSize(0),
+    FBlockSize(0),
+    FRequestSize(0),
+    FOffset(0)
+  {
+  }
+
+  virtual ~TSFTPCheckFileBlocksQueue()
+  {
+  }
+
+  bool Init(intptr_t QueueLen, UnicodeString AFileName, UnicodeString Algs,
+    int64_t Size, int64_t BlockSize)
+  {
+    FFileName = AFileName;
+    FAlgs = Algs;
+    FSize = Size;
+    FBlockSize = BlockSize;
+    FRequestSize = BlockSize * BlocksPerRequest;
+    FOffset = 0;
+
+    return TSFTPFixedLenQueue::Init(QueueLen);
+  }
+
+  // Blocks covered by the reply are those following the previous reply
+  bool ReceivePacket(TSFTPPacket *Packet)
+  {
+    return TSFTPFixedLenQueue::ReceivePacket(Packet, SSH_FXP_EXTENDED_REPLY);
+  }
+
+  // with the longest (SHA-512) hashes, a reply takes 256 KB
+  static const intptr_t BlocksPerRequest = 4096;
+
+protected:
+  virtual bool InitRequest(TSFTPQueuePacket *Request) override
+  {
+    bool Result = (FOffset < FSize);
+    if (Result)
+    {
+      int64_t Length = ((FSize - FOffset) < FRequestSize) ? (FSize - FOffset) : FRequestSize;
+      Request->ChangeType(SSH_FXP_EXTENDED);
+      Request->AddString(SFTP_EXT_CHECK_FILE_NAME);
+      Request->AddPathString(FFileName, FFileSystem->FUtfStrings);
+      Request->AddString(FAlgs);
+      Request->AddInt64(FOffset);
+      Request->AddInt64(Length);
+      Request->AddCardinal(static_cast<uint32_t>(FBlockSize));
+      FOffset += Length;
+    }
+    return Result;
+  }
+
+  virtual bool SendRequest() override
+  {
+    bool Result =
+      (FOffset < FSize) &&
+      TSFTPFixedLenQueue::SendRequest();
+    return Result;
+  }
+
+  virtual bool End(TSFTPPacket * /*Response*/) override
+  {
+    return (FRequests->GetCount() == 0);
+  }
+
+private:
+  UnicodeString FFileName;
+  UnicodeString FAlgs;
+  int64_t FSize;
+  int64_t FBlockSize;
+  int64_t FRequestSize;
+  int64_t FOffset;
+};
+
 class TSFTPBusy : public TObject
 {
   NB_DISABLE_COPY(TSFTPBusy)
@@ -2017,7 +2184,8 @@ TSFTPFileSystem::TSFTPFileSystem(TTerminal *ATerminal) :
   FFixedPaths(nullptr),
   FMaxPacketSize(0),
   FSupportsStatVfsV2(false),
-  FSupportsHardlink(false)
+  FSupportsHardlink(false),
+  FLocalWalker(nullptr)
 {
   FCodePage = GetSessionData()->GetCodePageAsNumber();
 }
@@ -2481,10 +2649,7 @@ void TSFTPFileSystem::SendPacket(const TSFTPPacket *Packet)
               FNotLoggedPackets));
           FNotLoggedPackets = 0;
         }
-        FTerminal->GetLog()->Add(llInput, FORMAT("Type: %s, Size: %d, Number: %d",
-            Packet->GetTypeName(),
-            ToInt(Packet->GetLength()),
-            ToInt(Packet->GetMessageNumber())));
+        Packet->Log(FTerminal->GetLog(), llInput);
 #if 0
         if (FTerminal->GetConfiguration()->GetActualLogProtocol() >= 2)
         {
@@ -2498,6 +2663,8 @@ void TSFTPFileSystem::SendPacket(const TSFTPPacket *Packet)
         FNotLoggedPackets++;
       }
     }
+    FTerminal->GetLog()->RecordTrace(tpSFTP, tdSend, Packet->GetType(), Packet->GetMessageNumber(), Packet->GetLength());
+    FTerminal->GetStatistics()->RequestSent(Packet->GetType(), Packet->GetMessageNumber(), Packet->GetLength());
     FSecureShell->Send(Packet->GetSendData(), Packet->GetSendLength());
   }
   __finally
@@ -2715,7 +2882,10 @@ SSH_FX_TYPES TSFTPFileSystem::ReceivePacket(TSFTPPacket *Packet,
       else
       {
         uint8_t LenBuf[4];
-        FSecureShell->Receive(LenBuf, sizeof(LenBuf));
+        {
+          TStatisticsTimer Timer(FTerminal->GetStatistics(), scStallTime);
+          FSecureShell->Receive(LenBuf, sizeof(LenBuf));
+        }
         intptr_t Length = PacketLength(LenBuf, ExpectedType);
         Packet->SetCapacity(Length);
         FSecureShell->Receive(Packet->GetData(), Length);
@@ -2734,10 +2904,7 @@ SSH_FX_TYPES TSFTPFileSystem::ReceivePacket(TSFTPPacket *Packet,
                   FNotLoggedPackets));
               FNotLoggedPackets = 0;
             }
-            FTerminal->GetLog()->Add(llOutput, FORMAT("Type: %s, Size: %d, Number: %d",
-                Packet->GetTypeName(),
-                ToInt(Packet->GetLength()),
-                ToInt(Packet->GetMessageNumber())));
+            Packet->Log(FTerminal->GetLog(), llOutput);
 #if 0
             if (FTerminal->GetConfiguration()->GetActualLogProtocol() >= 2)
             {
@@ -2750,6 +2917,8 @@ SSH_FX_TYPES TSFTPFileSystem::ReceivePacket(TSFTPPacket *Packet,
             FNotLoggedPackets++;
           }
         }
+        FTerminal->GetLog()->RecordTrace(tpSFTP, tdReceive, Packet->GetType(), Packet->GetMessageNumber(), Packet->GetLength());
+        FTerminal->GetStatistics()->ResponseReceived(Packet->GetMessageNumber(), Packet->GetLength());
 
         if ((Reservation < 0) ||
           Packet->GetMessageNumber() != FPacketNumbers[Reservation])
@@ -3774,6 +3943,189 @@ void TSFTPFileSystem::ReadDirectory(TRemoteFileList *FileList)
   };
 }
 
+void TSFTPFileSystem::ReadDirectories(TList *FileLists)
+{
+  // Unlike ReadDirectory, the directories are opened and read at once,
+  // so the round trips of all of them overlap. A listing that cannot be read
+  // here is left empty, the caller reads it with ReadDirectory then,
+  // which reports the error.
+  struct TPipelinedListing
+  {
+    TRemoteFileList *FileList;
+    RawByteString Handle;
+    std::unique_ptr<TSFTPPacket> Request;
+    std::unique_ptr<TSFTPPacket> Response;
+    intptr_t Total;
+    bool HasParentDirectory;
+    bool Done;
+  };
+
+  TSFTPBusy Busy(this);
+  TFileOperationProgressType *OperationProgress = FTerminal->GetOperationProgress();
+  intptr_t Start = 0;
+  intptr_t Total = 0;
+  bool Cancel = false;
+  while ((Start < FileLists->GetCount()) && !Cancel)
+  {
+    intptr_t Count = std::min(FileLists->GetCount() - Start, MaxPipelinedListings);
+    rde::vector<TPipelinedListing *> Listings;
+    {
+      SCOPE_EXIT
+      {
+        for (size_t Index = 0; Index < Listings.size(); Index++)
+        {
+          TPipelinedListing *Listing = Listings[Index];
+          // only when reading failed halfway
+          if (!Listing->Done && !Listing->Handle.IsEmpty() && FTerminal->GetActive())
+          {
+            TSFTPPacket Packet(SSH_FXP_CLOSE, FCodePage);
+            Packet.AddString(Listing->Handle);
+            SendPacket(&Packet);
+            ReserveResponse(&Packet, nullptr);
+          }
+          // destroying the packets releases their outstanding reservations
+          delete Listing;
+        }
+      };
+
+      for (intptr_t Index = 0; Index < Count; ++Index)
+      {
+        TPipelinedListing *Listing = new TPipelinedListing();
+        Listings.push_back(Listing);
+        Listing->FileList = FileLists->GetAs<TRemoteFileList>(Start + Index);
+        Listing->Request.reset(new TSFTPPacket(SSH_FXP_OPENDIR, FCodePage));
+        Listing->Response.reset(new TSFTPPacket(FCodePage));
+        Listing->Total = 0;
+        Listing->HasParentDirectory = false;
+        Listing->Done = false;
+
+        UnicodeString Directory =
+          base::UnixExcludeTrailingBackslash(LocalCanonify(Listing->FileList->GetDirectory()));
+        FTerminal->LogEvent(FORMAT("Listing directory \"%s\".", Directory));
+        Listing->FileList->Reset();
+        Listing->Request->AddPathString(Directory, FUtfStrings);
+        SendPacket(Listing->Request.get());
+        ReserveResponse(Listing->Request.get(), Listing->Response.get());
+      }
+
+      for (size_t Index = 0; Index < Listings.size(); Index++)
+      {
+        TPipelinedListing *Listing = Listings[Index];
+        ReceiveResponse(Listing->Request.get(), Listing->Response.get(), SSH_FXP_HANDLE, asAll);
+        if (Listing->Response->GetType() != SSH_FXP_HANDLE)
+        {
+          Listing->Done = true;
+        }
+        else
+        {
+          Listing->Handle = Listing->Response->GetFileHandle();
+          Listing->Request->ChangeType(SSH_FXP_READDIR);
+          Listing->Request->AddString(Listing->Handle);
+          SendPacket(Listing->Request.get());
+          ReserveResponse(Listing->Request.get(), Listing->Response.get());
+        }
+      }
+
+      bool AnyPending;
+      do
+      {
+        AnyPending = false;
+        for (size_t Index = 0; Index < Listings.size(); Index++)
+        {
+          TPipelinedListing *Listing = Listings[Index];
+          if (Listing->Done)
+          {
+            continue;
+          }
+
+          bool isEOF = false;
+          bool Failed = false;
+          ReceiveResponse(Listing->Request.get(), Listing->Response.get());
+          if (Listing->Response->GetType() == SSH_FXP_NAME)
+          {
+            TSFTPPacket ListingPacket(*Listing->Response, FCodePage);
+            uint32_t FileCount = ListingPacket.GetCardinal();
+            for (uint32_t FileIndex = 0; FileIndex < FileCount; ++FileIndex)
+            {
+              TRemoteFile *File = LoadFile(&ListingPacket, nullptr, L"", Listing->FileList);
+              if (FTerminal->GetConfiguration()->GetActualLogProtocol() >= 1)
+              {
+                FTerminal->LogEvent(FORMAT("Read file '%s' from listing", File->GetFileName()));
+              }
+              if (File->GetIsParentDirectory())
+              {
+                Listing->HasParentDirectory = true;
+              }
+              Listing->FileList->AddFile(File);
+              Listing->Total++;
+              Total++;
+            }
+
+            if ((FVersion >= 6) &&
+              (FSecureShell->GetSshImplementation() != sshiCerberus) &&
+              ListingPacket.CanGetBool())
+            {
+              isEOF = ListingPacket.GetBool();
+            }
+
+            if (FileCount == 0)
+            {
+              isEOF = true;
+            }
+          }
+          else if (Listing->Response->GetType() == SSH_FXP_STATUS)
+          {
+            isEOF = (GotStatusPacket(Listing->Response.get(), asAll) == SSH_FX_EOF);
+            Failed = !isEOF;
+          }
+          else
+          {
+            FTerminal->FatalError(nullptr, FMTLOAD(SFTP_INVALID_TYPE, ToInt(Listing->Response->GetType())));
+          }
+
+          if (!isEOF && !Failed)
+          {
+            Listing->Request->ChangeType(SSH_FXP_READDIR);
+            Listing->Request->AddString(Listing->Handle);
+            SendPacket(Listing->Request.get());
+            ReserveResponse(Listing->Request.get(), Listing->Response.get());
+            AnyPending = true;
+          }
+          else
+          {
+            Listing->Done = true;
+            // empty listing is probably "permission denied",
+            // left to ReadDirectory to resolve
+            if (Failed || (Listing->Total == 0))
+            {
+              Listing->FileList->Reset();
+            }
+            else if (!Listing->HasParentDirectory)
+            {
+              Listing->FileList->AddFile(new TRemoteParentDirectory(FTerminal));
+            }
+
+            Listing->Request->ChangeType(SSH_FXP_CLOSE);
+            Listing->Request->AddString(Listing->Handle);
+            SendPacket(Listing->Request.get());
+            // we are not interested in the response, do not wait for it
+            ReserveResponse(Listing->Request.get(), nullptr);
+          }
+        }
+      }
+      while (AnyPending);
+    }
+    Start += Count;
+
+    // the remaining listings are left empty, when the user cancels
+    FTerminal->DoReadDirectoryProgress(Total, 0, Cancel);
+    if ((OperationProgress != nullptr) && (OperationProgress->GetCancel() != csContinue))
+    {
+      Cancel = true;
+    }
+  }
+}
+
 void TSFTPFileSystem::ReadSymlink(TRemoteFile *SymlinkFile,
   TRemoteFile *&AFile)
 {
@@ -4841,6 +5193,255 @@ void TSFTPFileSystem::SFTPSourceRobust(UnicodeString AFileName,
   while (RobustLoop.Retry());
 }
 
+static const int64_t MinDeltaUploadBlockSize = 64 * 1024;
+static const int64_t MaxDeltaUploadBlockSize = 4 * 1024 * 1024;
+// smaller files are cheaper to upload than to compare
+static const int64_t MinDeltaUploadFileSize = 1024 * 1024;
+
+int64_t TSFTPFileSystem::DeltaUploadBlockSize(int64_t Size) const
+{
+  int64_t Result = GetSessionData()->GetSFTPDeltaBlockSize();
+  if (Result <= 0)
+  {
+    // about 8192 blocks, in powers of two
+    Result = MinDeltaUploadBlockSize;
+    while ((Result < MaxDeltaUploadBlockSize) && (Size / Result > 8192))
+    {
+      Result *= 2;
+    }
+  }
+  else if (Result < 4096)
+  {
+    // the extension requires at least 256 bytes,
+    // anything that small makes the hashes outweigh the data
+    Result = 4096;
+  }
+  return Result;
+}
+
+// Writes only the blocks of an existing remote file that differ from
+// the local file, found by comparing remote "check-file" block hashes
+// with hashes calculated locally, then verifies the whole file.
+// Returns false, when the server cannot provide the hashes or the result
+// does not verify, so the file is to be uploaded whole.
+// The remote file is updated in place, so an interrupted delta upload
+// leaves it partially updated, until uploaded again.
+bool TSFTPFileSystem::SFTPDeltaUpload(UnicodeString AFileName, HANDLE LocalFileHandle,
+  UnicodeString DestFullName, int64_t DestFileSize,
+  TFileOperationProgressType *OperationProgress)
+{
+  int64_t Size = OperationProgress->GetLocalSize();
+  int64_t BlockSize = DeltaUploadBlockSize(Size);
+  int64_t CompareSize = (Size < DestFileSize) ? Size : DestFileSize;
+
+  // algorithms we can calculate locally, the fastest first,
+  // the server picks the first one it supports
+  UnicodeString SftpAlgs;
+  const UnicodeString *Algs[] = { &Md5ChecksumAlg, &Sha1ChecksumAlg, &Sha256ChecksumAlg, &Sha512ChecksumAlg };
+  for (intptr_t Index = 0; Index < static_cast<intptr_t>(_countof(Algs)); ++Index)
+  {
+    intptr_t AlgIndex = FChecksumAlgs->IndexOf(*Algs[Index]);
+    if ((AlgIndex >= 0) && IsLocalChecksumAlgSupported(*Algs[Index]))
+    {
+      AddToList(SftpAlgs, FChecksumSftpAlgs->GetString(AlgIndex), L",");
+    }
+  }
+
+  FTerminal->LogEvent(FORMAT("Comparing blocks of %s bytes with existing file.", ::Int64ToStr(BlockSize)));
+
+  UnicodeString Alg;
+  UnicodeString SftpAlg;
+  rde::vector<UnicodeString> RemoteChecksums;
+  TLocalBlockHasher Hasher;
+  {
+    TSFTPCheckFileBlocksQueue Queue(this, FCodePage);
+    SCOPE_EXIT
+    {
+      Queue.DisposeSafe();
+    };
+    try
+    {
+      static int CheckFileBlocksQueueLen = 4;
+      if (Queue.Init(CheckFileBlocksQueueLen, LocalCanonify(DestFullName), SftpAlgs, CompareSize, BlockSize))
+      {
+        TSFTPPacket Packet(FCodePage);
+        int64_t Offset = 0;
+        bool Next;
+        do
+        {
+          Next = Queue.ReceivePacket(&Packet);
+          UnicodeString ReplyAlg = Packet.GetAnsiString();
+          if (Alg.IsEmpty())
+          {
+            intptr_t AlgIndex = FChecksumSftpAlgs->IndexOf(ReplyAlg);
+            if (AlgIndex < 0)
+            {
+              FTerminal->LogEvent(FORMAT("Server used unexpected checksum algorithm \"%s\".", ReplyAlg));
+              return false;
+            }
+            SftpAlg = ReplyAlg;
+            Alg = FChecksumAlgs->GetString(AlgIndex);
+            // hash the local file while the server hashes the remote one
+            Hasher.Start(Alg, AFileName, Size, BlockSize);
+          }
+
+          int64_t Length = ((CompareSize - Offset) < BlockSize * TSFTPCheckFileBlocksQueue::BlocksPerRequest) ?
+            (CompareSize - Offset) : (BlockSize * TSFTPCheckFileBlocksQueue::BlocksPerRequest);
+          intptr_t Count = static_cast<intptr_t>((Length + BlockSize - 1) / BlockSize);
+          uintptr_t Remaining = Packet.GetRemainingLength();
+          if ((Count == 0) || (Remaining == 0) || ((Remaining % Count) != 0))
+          {
+            FTerminal->LogEvent(FORMAT("Unexpected length of block checksums (%d for %d blocks).", int(Remaining), int(Count)));
+            return false;
+          }
+          uintptr_t HashLength = Remaining / Count;
+          const uint8_t *Data = Packet.GetNextData(Remaining);
+          for (intptr_t Index = 0; Index < Count; ++Index)
+          {
+            RemoteChecksums.push_back(BytesToHex(Data + Index * HashLength, HashLength, false));
+          }
+          Offset += Length;
+
+          if (OperationProgress->GetCancel() != csContinue)
+          {
+            Abort();
+          }
+        }
+        while (Next);
+      }
+    }
+    catch (EAbort &)
+    {
+      throw;
+    }
+    catch (Exception &E)
+    {
+      if (!FTerminal->GetActive())
+      {
+        throw;
+      }
+      FTerminal->LogEvent("Server cannot calculate block checksums.");
+      FTerminal->GetLog()->AddException(&E);
+      return false;
+    }
+  }
+
+  DebugAssert(!Alg.IsEmpty());
+  Hasher.Wait();
+
+  // coalesce changed blocks to ranges
+  TSFTPUploadRanges Ranges;
+  int64_t Unchanged = 0;
+  for (intptr_t Block = 0; Block < Hasher.GetBlockCount(); ++Block)
+  {
+    int64_t Offset = Block * BlockSize;
+    int64_t Length = ((Offset + BlockSize) < Size) ? BlockSize : (Size - Offset);
+    bool Changed =
+      (Block >= static_cast<intptr_t>(RemoteChecksums.size())) ||
+      (Hasher.GetBlockChecksum(Block) != RemoteChecksums[Block]);
+    if (!Changed)
+    {
+      Unchanged += Length;
+    }
+    else if (!Ranges.empty() && (Ranges.back().Offset + Ranges.back().Length == Offset))
+    {
+      Ranges.back().Length += Length;
+    }
+    else
+    {
+      TSFTPUploadRange Range;
+      Range.Offset = Offset;
+      Range.Length = Length;
+      Ranges.push_back(Range);
+    }
+  }
+  FTerminal->LogEvent(FORMAT("%s of %s bytes changed in %d ranges.",
+    ::Int64ToStr(Size - Unchanged), ::Int64ToStr(Size), int(Ranges.size())));
+  OperationProgress->AddResumed(Unchanged);
+
+  RawByteString Handle = SFTPOpenRemoteFile(DestFullName, SSH_FXF_WRITE);
+  TSFTPPacket CloseRequest(FCodePage);
+  bool Finished = false;
+  {
+    SCOPE_EXIT
+    {
+      if (FTerminal->GetActive())
+      {
+        if (!Handle.IsEmpty())
+        {
+          SFTPCloseRemote(Handle, DestFullName, OperationProgress, Finished, true, &CloseRequest);
+        }
+        SFTPCloseRemote(Handle, DestFullName, OperationProgress, Finished, false, &CloseRequest);
+      }
+    };
+
+    if (!Ranges.empty())
+    {
+      TSFTPUploadQueue Queue(this, FCodePage);
+      SCOPE_EXIT
+      {
+        Queue.DisposeSafe();
+      };
+      Queue.Init(AFileName, LocalFileHandle, OperationProgress, Handle, 0, 0, &Ranges);
+      while (Queue.Continue())
+      {
+        if (OperationProgress->GetCancel())
+        {
+          if (OperationProgress->ClearCancelFile())
+          {
+            ThrowSkipFileNull();
+          }
+          else
+          {
+            Abort();
+          }
+        }
+      }
+      Queue.DisposeSafeWithErrorHandling();
+    }
+
+    if (Size < DestFileSize)
+    {
+      FTerminal->LogEvent(FORMAT("Truncating file to %s bytes.", ::Int64ToStr(Size)));
+      TSFTPPacket TruncateRequest(SSH_FXP_FSETSTAT, FCodePage);
+      TruncateRequest.AddString(Handle);
+      int64_t NewSize = Size;
+      TruncateRequest.AddProperties(nullptr, nullptr, nullptr, nullptr, nullptr,
+        &NewSize, false, FVersion, FUtfStrings);
+      SendPacketAndReceiveResponse(&TruncateRequest, &TruncateRequest, SSH_FXP_STATUS);
+    }
+
+    SFTPCloseRemote(Handle, DestFullName, OperationProgress, false, true, &CloseRequest);
+    Handle.Clear();
+    Finished = true;
+  }
+
+  TSFTPPacket VerifyPacket(SSH_FXP_EXTENDED, FCodePage);
+  VerifyPacket.AddString(SFTP_EXT_CHECK_FILE_NAME);
+  VerifyPacket.AddPathString(LocalCanonify(DestFullName), FUtfStrings);
+  VerifyPacket.AddString(SftpAlg);
+  VerifyPacket.AddInt64(0);
+  VerifyPacket.AddInt64(0);
+  VerifyPacket.AddCardinal(0);
+  SendPacketAndReceiveResponse(&VerifyPacket, &VerifyPacket, SSH_FXP_EXTENDED_REPLY);
+  UnicodeString VerifyAlg = VerifyPacket.GetAnsiString();
+  UnicodeString Checksum =
+    BytesToHex(VerifyPacket.GetNextData(VerifyPacket.GetRemainingLength()), VerifyPacket.GetRemainingLength(), false);
+  bool Result = (VerifyAlg == SftpAlg) && (Checksum == Hasher.GetFileChecksum());
+  if (Result)
+  {
+    FTerminal->LogEvent(FORMAT("Updated file verified, %s checksum %s.", VerifyAlg, Checksum));
+  }
+  else
+  {
+    FTerminal->LogEvent(FORMAT("Updated file does not match, %s checksum %s, uploading whole file.", VerifyAlg, Checksum));
+    OperationProgress->RollbackTransfer();
+    OperationProgress->SetTransferSize(OperationProgress->GetLocalSize());
+    ::FileSeek(LocalFileHandle, 0, 0);
+  }
+  return Result;
+}
+
 void TSFTPFileSystem::SFTPSource(UnicodeString AFileName,
   const TRemoteFile *AFile,
   UnicodeString TargetDir, const TCopyParamType *CopyParam, intptr_t Params,
@@ -4933,12 +5534,21 @@ void TSFTPFileSystem::SFTPSource(UnicodeString AFileName,
       bool ResumeAllowed = !OperationProgress->GetAsciiTransfer() &&
         CopyParam->AllowResume(OperationProgress->GetLocalSize()) &&
         IsCapable(fcRename);
+      // may we update only the changed blocks of an existing file?
+      // (not when the overwritten file is to be kept in the recycle bin)
+      bool DeltaAllowed = GetSessionData()->GetSFTPDeltaUpload() &&
+        !OperationProgress->GetAsciiTransfer() &&
+        (OperationProgress->GetLocalSize() >= MinDeltaUploadFileSize) &&
+        !GetSessionData()->GetOverwrittenToRecycleBin() &&
+        IsCapable(fcCalculatingChecksum);
+      // overwrite of existing file was confirmed already
+      bool DestConfirmed = false;
 
       // TOverwriteFileParams FileParams;
       FileParams.SourceSize = OperationProgress->GetLocalSize();
       FileParams.SourceTimestamp = Modification;
 
-      if (ResumeAllowed)
+      if (ResumeAllowed || DeltaAllowed)
       {
         DestPartialFullName = DestFullName + FTerminal->GetConfiguration()->GetPartialExt();
 
@@ -4990,10 +5600,12 @@ void TSFTPFileSystem::SFTPSource(UnicodeString AFileName,
             SAFE_DESTROY(File);
           }
 
+          bool PartialExists = false;
           if (ResumeAllowed)
           {
             FTerminal->LogEvent("Checking existence of partially transfered file.");
-            if (RemoteFileExists(DestPartialFullName, &File))
+            PartialExists = RemoteFileExists(DestPartialFullName, &File);
+            if (PartialExists)
             {
               ResumeOffset = File->GetSize();
               SAFE_DESTROY(File);
@@ -5021,31 +5633,41 @@ void TSFTPFileSystem::SFTPSource(UnicodeString AFileName,
                 FTerminal->LogEvent("Resuming file transfer.");
               }
             }
-            else
+          }
+
+          // partial upload file does not exists, check for full file
+          if ((ResumeAllowed || DeltaAllowed) && !PartialExists && DestFileExists)
+          {
+            UnicodeString PrevDestFileName = DestFileName;
+            SFTPConfirmOverwrite(AFileName, DestFileName,
+              CopyParam, Params, OperationProgress, &FileParams,
+              OpenParams.OverwriteMode);
+            DestConfirmed = true;
+            if (PrevDestFileName != DestFileName)
             {
-              // partial upload file does not exists, check for full file
-              if (DestFileExists)
-              {
-                UnicodeString PrevDestFileName = DestFileName;
-                SFTPConfirmOverwrite(AFileName, DestFileName,
-                  CopyParam, Params, OperationProgress, &FileParams,
-                  OpenParams.OverwriteMode);
-                if (PrevDestFileName != DestFileName)
-                {
-                  // update paths in case user changes the file name
-                  DestFullName = LocalCanonify(TargetDir + DestFileName);
-                  DestPartialFullName = DestFullName + FTerminal->GetConfiguration()->GetPartialExt();
-                  FTerminal->LogEvent("Checking existence of new file.");
-                  DestFileExists = RemoteFileExists(DestFullName, nullptr);
-                }
-              }
+              // update paths in case user changes the file name
+              DestFullName = LocalCanonify(TargetDir + DestFileName);
+              DestPartialFullName = DestFullName + FTerminal->GetConfiguration()->GetPartialExt();
+              FTerminal->LogEvent("Checking existence of new file.");
+              DestFileExists = RemoteFileExists(DestFullName, nullptr);
+              // size of the new file is not known
+              DeltaAllowed = false;
             }
           }
         }
       }
 
+      bool DeltaDone = false;
+      if (DeltaAllowed && DestConfirmed &&
+          (OpenParams.OverwriteMode == omOverwrite) &&
+          (OpenParams.DestFileSize >= MinDeltaUploadFileSize))
+      {
+        DeltaDone = SFTPDeltaUpload(AFileName, LocalFileHandle, DestFullName,
+          OpenParams.DestFileSize, OperationProgress);
+      }
+
       // will the transfer be resumable?
-      bool DoResume = (ResumeAllowed && (OpenParams.OverwriteMode == omOverwrite));
+      bool DoResume = !DeltaDone && (ResumeAllowed && (OpenParams.OverwriteMode == omOverwrite));
 
       UnicodeString RemoteFileName = DoResume ? DestPartialFullName : DestFullName;
       OpenParams.FileName = AFileName;
@@ -5056,22 +5678,25 @@ void TSFTPFileSystem::SFTPSource(UnicodeString AFileName,
       OpenParams.CopyParam = CopyParam;
       OpenParams.Params = Params;
       OpenParams.FileParams = &FileParams;
-      OpenParams.Confirmed = false;
+      OpenParams.Confirmed = DestConfirmed && !ResumeAllowed;
 
-      FTerminal->LogEvent("Opening remote file.");
-      FTerminal->FileOperationLoop(nb::bind(&TSFTPFileSystem::SFTPOpenRemote, this), OperationProgress, true,
-        FMTLOAD(SFTP_CREATE_FILE_ERROR, OpenParams.RemoteFileName),
-        &OpenParams);
-      OperationProgress->Progress();
-
-      if (OpenParams.RemoteFileName != RemoteFileName)
+      if (!DeltaDone)
       {
-        DebugAssert(!DoResume);
-        DebugAssert(base::UnixExtractFilePath(OpenParams.RemoteFileName) == base::UnixExtractFilePath(RemoteFileName));
-        DestFullName = OpenParams.RemoteFileName;
-        UnicodeString NewFileName = base::UnixExtractFileName(DestFullName);
-        DebugAssert(DestFileName != NewFileName);
-        DestFileName = NewFileName;
+        FTerminal->LogEvent("Opening remote file.");
+        FTerminal->FileOperationLoop(nb::bind(&TSFTPFileSystem::SFTPOpenRemote, this), OperationProgress, true,
+          FMTLOAD(SFTP_CREATE_FILE_ERROR, OpenParams.RemoteFileName),
+          &OpenParams);
+        OperationProgress->Progress();
+
+        if (OpenParams.RemoteFileName != RemoteFileName)
+        {
+          DebugAssert(!DoResume);
+          DebugAssert(base::UnixExtractFilePath(OpenParams.RemoteFileName) == base::UnixExtractFilePath(RemoteFileName));
+          DestFullName = OpenParams.RemoteFileName;
+          UnicodeString NewFileName = base::UnixExtractFileName(DestFullName);
+          DebugAssert(DestFileName != NewFileName);
+          DestFileName = NewFileName;
+        }
       }
 
       Action.Destination(DestFullName);
@@ -5080,7 +5705,6 @@ void TSFTPFileSystem::SFTPSource(UnicodeString AFileName,
       bool TransferFinished = false;
       int64_t DestWriteOffset = 0;
 #endif // #if 0
-      TSFTPPacket CloseRequest(FCodePage);
       bool SetRights = ((DoResume && DestFileExists) || CopyParam->GetPreserveRights());
       bool SetProperties = (CopyParam->GetPreserveTime() || SetRights);
       TSFTPPacket PropertiesRequest(SSH_FXP_SETSTAT, FCodePage);
@@ -5109,134 +5733,22 @@ void TSFTPFileSystem::SFTPSource(UnicodeString AFileName,
           nullptr, nullptr, false, FVersion, FUtfStrings);
       }
 
-      bool TransferFinished = false;
-      try__finally
+      if (DeltaDone)
       {
-        SCOPE_EXIT
-        {
-          if (FTerminal->GetActive())
-          {
-            // if file transfer was finished, the close request was already sent
-            if (!OpenParams.RemoteFileHandle.IsEmpty())
-            {
-              SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
-                OperationProgress, TransferFinished, true, &CloseRequest);
-            }
-            // wait for the response
-            SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
-              OperationProgress, TransferFinished, false, &CloseRequest);
-
-            // delete file if transfer was not completed, resuming was not allowed and
-            // we were not appending (incl. alternate resume),
-            // shortly after plain transfer completes (eq. !ResumeAllowed)
-            if (!TransferFinished && !DoResume && (OpenParams.OverwriteMode == omOverwrite))
-            {
-              DoDeleteFile(OpenParams.RemoteFileName, SSH_FXP_REMOVE);
-            }
-          }
-        };
-
-        int64_t DestWriteOffset = 0;
-        if (OpenParams.OverwriteMode == omAppend)
+        // the remote file was updated in place, only its properties are left
+        if (SetProperties)
         {
-          FTerminal->LogEvent("Appending file.");
-          DestWriteOffset = OpenParams.DestFileSize;
-        }
-        else if (ResumeTransfer || (OpenParams.OverwriteMode == omResume))
-        {
-          if (OpenParams.OverwriteMode == omResume)
-          {
-            FTerminal->LogEvent("Resuming file transfer (append style).");
-            ResumeOffset = OpenParams.DestFileSize;
-          }
-          ::FileSeek(LocalFileHandle, ResumeOffset, 0);
-          OperationProgress->AddResumed(ResumeOffset);
-        }
-
-        TSFTPUploadQueue Queue(this, FCodePage);
-        try__finally
-        {
-          SCOPE_EXIT
-          {
-            // Either queue is empty now (noop call then),
-            // or some error occurred (in that case, process remaining responses, ignoring other errors)
-            Queue.DisposeSafe();
-          };
-          intptr_t ConvertParams =
-            FLAGMASK(CopyParam->GetRemoveCtrlZ(), cpRemoveCtrlZ) |
-            FLAGMASK(CopyParam->GetRemoveBOM(), cpRemoveBOM);
-          Queue.Init(AFileName, LocalFileHandle, OperationProgress,
-            OpenParams.RemoteFileHandle,
-            DestWriteOffset + OperationProgress->GetTransferredSize(),
-            ConvertParams);
-
-          while (Queue.Continue())
-          {
-            if (OperationProgress->GetCancel())
-            {
-              if (OperationProgress->ClearCancelFile())
-              {
-                ThrowSkipFileNull();
-              }
-              else
-              {
-                Abort();
-              }
-            }
-          }
-
-          // send close request before waiting for pending read responses
-          SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
-            OperationProgress, false, true, &CloseRequest);
-          OpenParams.RemoteFileHandle.Clear();
-
-          // when resuming is disabled, we can send "set properties"
-          // request before waiting for pending read/close responses
-          if (SetProperties && !DoResume)
-          {
-            SendPacket(&PropertiesRequest);
-            ReserveResponse(&PropertiesRequest, &PropertiesResponse);
-          }
-          // No error so far, processes pending responses and throw on first error
-          Queue.DisposeSafeWithErrorHandling();
+          SendPacket(&PropertiesRequest);
+          ReserveResponse(&PropertiesRequest, &PropertiesResponse);
         }
-        __finally
-        {
-#if 0
-          // Either queue is empty now (noop call then),
-          // or some error occured (in that case, process remaining responses, ignoring other errors)
-          Queue.DisposeSafe();
-#endif // #if 0
-        };
-
-        TransferFinished = true;
-        // queue is discarded here
       }
-      __finally
+      else
       {
-#if 0
-        if (FTerminal->Active)
-        {
-          // if file transfer was finished, the close request was already sent
-          if (!OpenParams.RemoteFileHandle.IsEmpty())
-          {
-            SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
-              OperationProgress, TransferFinished, true, &CloseRequest);
-          }
-          // wait for the response
-          SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
-            OperationProgress, TransferFinished, false, &CloseRequest);
-
-          // delete file if transfer was not completed, resuming was not allowed and
-          // we were not appending (incl. alternate resume),
-          // shortly after plain transfer completes (eq. !ResumeAllowed)
-          if (!TransferFinished && !DoResume && (OpenParams.OverwriteMode == omOverwrite))
-          {
-            DoDeleteFile(OpenParams.RemoteFileName, SSH_FXP_REMOVE);
-          }
-        }
-#endif // #if 0
-      };
+        SFTPUploadFile(AFileName, LocalFileHandle, OpenParams, DestFileName,
+          DoResume, ResumeTransfer, ResumeOffset,
+          (SetProperties && !DoResume) ? &PropertiesRequest : nullptr, &PropertiesResponse,
+          OperationProgress, CopyParam);
+      }
 
       OperationProgress->Progress();
 
@@ -5385,6 +5897,144 @@ void TSFTPFileSystem::SFTPSource(UnicodeString AFileName,
   }
 }
 
+void TSFTPFileSystem::SFTPUploadFile(UnicodeString AFileName, HANDLE LocalFileHandle,
+  TOpenRemoteFileParams &OpenParams, UnicodeString DestFileName,
+  bool DoResume, bool ResumeTransfer, int64_t ResumeOffset,
+  TSFTPPacket *PropertiesRequest, TSFTPPacket *PropertiesResponse,
+  TFileOperationProgressType *OperationProgress, const TCopyParamType *CopyParam)
+{
+  TSFTPPacket CloseRequest(FCodePage);
+  bool TransferFinished = false;
+  try__finally
+  {
+    SCOPE_EXIT
+    {
+      if (FTerminal->GetActive())
+      {
+        // if file transfer was finished, the close request was already sent
+        if (!OpenParams.RemoteFileHandle.IsEmpty())
+        {
+          SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
+            OperationProgress, TransferFinished, true, &CloseRequest);
+        }
+        // wait for the response
+        SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
+          OperationProgress, TransferFinished, false, &CloseRequest);
+
+        // delete file if transfer was not completed, resuming was not allowed and
+        // we were not appending (incl. alternate resume),
+        // shortly after plain transfer completes (eq. !ResumeAllowed)
+        if (!TransferFinished && !DoResume && (OpenParams.OverwriteMode == omOverwrite))
+        {
+          DoDeleteFile(OpenParams.RemoteFileName, SSH_FXP_REMOVE);
+        }
+      }
+    };
+
+    int64_t DestWriteOffset = 0;
+    if (OpenParams.OverwriteMode == omAppend)
+    {
+      FTerminal->LogEvent("Appending file.");
+      DestWriteOffset = OpenParams.DestFileSize;
+    }
+    else if (ResumeTransfer || (OpenParams.OverwriteMode == omResume))
+    {
+      if (OpenParams.OverwriteMode == omResume)
+      {
+        FTerminal->LogEvent("Resuming file transfer (append style).");
+        ResumeOffset = OpenParams.DestFileSize;
+      }
+      ::FileSeek(LocalFileHandle, ResumeOffset, 0);
+      OperationProgress->AddResumed(ResumeOffset);
+    }
+
+    TSFTPUploadQueue Queue(this, FCodePage);
+    try__finally
+    {
+      SCOPE_EXIT
+      {
+        // Either queue is empty now (noop call then),
+        // or some error occurred (in that case, process remaining responses, ignoring other errors)
+        Queue.DisposeSafe();
+      };
+      intptr_t ConvertParams =
+        FLAGMASK(CopyParam->GetRemoveCtrlZ(), cpRemoveCtrlZ) |
+        FLAGMASK(CopyParam->GetRemoveBOM(), cpRemoveBOM);
+      Queue.Init(AFileName, LocalFileHandle, OperationProgress,
+        OpenParams.RemoteFileHandle,
+        DestWriteOffset + OperationProgress->GetTransferredSize(),
+        ConvertParams);
+
+      while (Queue.Continue())
+      {
+        if (OperationProgress->GetCancel())
+        {
+          if (OperationProgress->ClearCancelFile())
+          {
+            ThrowSkipFileNull();
+          }
+          else
+          {
+            Abort();
+          }
+        }
+      }
+
+      // send close request before waiting for pending read responses
+      SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
+        OperationProgress, false, true, &CloseRequest);
+      OpenParams.RemoteFileHandle.Clear();
+
+      // when resuming is disabled, we can send "set properties"
+      // request before waiting for pending read/close responses
+      if (PropertiesRequest != nullptr)
+      {
+        DebugAssert(!DoResume);
+        SendPacket(PropertiesRequest);
+        ReserveResponse(PropertiesRequest, PropertiesResponse);
+      }
+      // No error so far, processes pending responses and throw on first error
+      Queue.DisposeSafeWithErrorHandling();
+    }
+    __finally
+    {
+#if 0
+      // Either queue is empty now (noop call then),
+      // or some error occured (in that case, process remaining responses, ignoring other errors)
+      Queue.DisposeSafe();
+#endif // #if 0
+    };
+
+    TransferFinished = true;
+    // queue is discarded here
+  }
+  __finally
+  {
+#if 0
+    if (FTerminal->Active)
+    {
+      // if file transfer was finished, the close request was already sent
+      if (!OpenParams.RemoteFileHandle.IsEmpty())
+      {
+        SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
+          OperationProgress, TransferFinished, true, &CloseRequest);
+      }
+      // wait for the response
+      SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
+        OperationProgress, TransferFinished, false, &CloseRequest);
+
+      // delete file if transfer was not completed, resuming was not allowed and
+      // we were not appending (incl. alternate resume),
+      // shortly after plain transfer completes (eq. !ResumeAllowed)
+      if (!TransferFinished && !DoResume && (OpenParams.OverwriteMode == omOverwrite))
+      {
+        DoDeleteFile(OpenParams.RemoteFileName, SSH_FXP_REMOVE);
+      }
+    }
+#endif // #if 0
+  };
+}
+
 RawByteString TSFTPFileSystem::SFTPOpenRemoteFile(
   UnicodeString AFileName, SSH_FXF_TYPES OpenType, int64_t Size)
 {
@@ -5690,33 +6340,47 @@ void TSFTPFileSystem::SFTPDirectorySource(UnicodeString DirectoryName,
 
   if (FLAGCLEAR(Params, cpNoRecurse))
   {
-    DWORD FindAttrs = faReadOnly | faHidden | faSysFile | faDirectory | faArchive;
-    TSearchRecChecked SearchRec;
-    bool FindOK = false;
-
-    FileOperationLoopCustom(FTerminal, OperationProgress, True, FMTLOAD(LIST_DIR_ERROR, DirectoryName), "",
-    [&]()
+    // The walker of the top-level directory lists the included subdirectories on background
+    // threads, while the files are being uploaded. The excluded entries are kept, as the masks
+    // are still matched by SFTPSource (AllowLocalFileTransfer), so that they are logged as before.
+    std::unique_ptr<TLocalTreeWalker> Walker;
+    if (FLocalWalker == nullptr)
     {
-      FindOK =
-        ::FindFirstChecked(DirectoryName + L"*.*", FindAttrs, SearchRec) == 0;
-    });
+      Walker.reset(new TLocalTreeWalker(FTerminal, CopyParam, TLocalTreeWalker::lwKeepExcluded));
+      FLocalWalker = Walker.get();
+    }
+    std::unique_ptr<TLocalDirectoryListing> Listing;
 
     try__finally
     {
       SCOPE_EXIT
       {
-        base::FindClose(SearchRec);
+        if (Walker.get() != nullptr)
+        {
+          FLocalWalker = nullptr;
+        }
       };
-      while (FindOK && !OperationProgress->GetCancel())
+      FileOperationLoopCustom(FTerminal, OperationProgress, True, FMTLOAD(LIST_DIR_ERROR, DirectoryName), "",
+      [&]()
+      {
+        Listing.reset(FLocalWalker->GetListing(DirectoryName));
+      });
+      for (intptr_t Index = static_cast<intptr_t>(Listing->Entries.size()) - 1; Index >= 0; Index--)
+      {
+        const TLocalTreeEntry &Entry = Listing->Entries[Index];
+        if (Entry.GetIsDirectory() && Entry.Included)
+        {
+          FLocalWalker->Add(DirectoryName + Entry.FileName);
+        }
+      }
+
+      for (size_t Index = 0; (Index < Listing->Entries.size()) && !OperationProgress->GetCancel(); ++Index)
       {
-        UnicodeString FileName = DirectoryName + SearchRec.Name;
+        UnicodeString FileName = DirectoryName + Listing->Entries[Index].FileName;
         try
         {
-          if ((SearchRec.Name != THISDIRECTORY) && (SearchRec.Name != PARENTDIRECTORY))
-          {
-            SFTPSourceRobust(FileName, nullptr, DestFullName, CopyParam, Params, OperationProgress,
-              Flags & ~tfFirstLevel);
-          }
+          SFTPSourceRobust(FileName, nullptr, DestFullName, CopyParam, Params, OperationProgress,
+            Flags & ~tfFirstLevel);
         }
         catch (ESkipFile &E)
         {
@@ -5730,12 +6394,6 @@ void TSFTPFileSystem::SFTPDirectorySource(UnicodeString DirectoryName,
             throw;
           }
         }
-
-        FileOperationLoopCustom(FTerminal, OperationProgress, True, FMTLOAD(LIST_DIR_ERROR, DirectoryName), "",
-        [&]()
-        {
-          FindOK = (::FindNextChecked(SearchRec) == 0);
-        });
       }
     }
     __finally
@@ -6033,6 +6691,10 @@ void TSFTPFileSystem::SFTPSink(UnicodeString AFileName,
 
     HANDLE LocalFileHandle = INVALID_HANDLE_VALUE;
     TStream *FileStream = nullptr;
+    TWriteBehindStream *WriteBehindStream = nullptr;
+    std::unique_ptr<TLocalHash> DownloadHash;
+    std::unique_ptr<THashingStream> HashingStream;
+    TStream *DestStream = nullptr;
     bool DeleteLocalFile = false;
     RawByteString RemoteHandle;
     UnicodeString LocalFileName = DestFullName;
@@ -6043,11 +6705,12 @@ void TSFTPFileSystem::SFTPSink(UnicodeString AFileName,
     {
       SCOPE_EXIT
       {
-        SAFE_CLOSE_HANDLE(LocalFileHandle);
+        // stops the writer before the handle is closed
         if (FileStream)
         {
           SAFE_DESTROY(FileStream);
         }
+        SAFE_CLOSE_HANDLE(LocalFileHandle);
         if (DeleteLocalFile && (!ResumeAllowed || OperationProgress->GetLocallyUsed() == 0) &&
           (OverwriteMode == omOverwrite))
         {
@@ -6265,7 +6928,22 @@ void TSFTPFileSystem::SFTPSink(UnicodeString AFileName,
 
       DeleteLocalFile = true;
 
-      FileStream = new TSafeHandleStream(LocalFileHandle);
+      // disk writes happen on a worker thread, so that a slow disk
+      // does not hold up the reading of the responses
+      WriteBehindStream = new TWriteBehindStream(LocalFileHandle);
+      FileStream = WriteBehindStream;
+      DestStream = FileStream;
+      // hash only files written from the start
+      if (!FTerminal->GetDownloadChecksumAlg().IsEmpty() &&
+          (OverwriteMode == omOverwrite) && !ResumeTransfer)
+      {
+        DownloadHash.reset(CreateLocalHash(FTerminal->GetDownloadChecksumAlg()));
+        if (DownloadHash.get() != nullptr)
+        {
+          HashingStream.reset(new THashingStream(FileStream, DownloadHash.get()));
+          DestStream = HashingStream.get();
+        }
+      }
 
       // at end of this block queue is discarded
       {
@@ -6397,7 +7075,8 @@ void TSFTPFileSystem::SFTPSink(UnicodeString AFileName,
               FileOperationLoopCustom(FTerminal, OperationProgress, True, FMTLOAD(WRITE_ERROR, LocalFileName), "",
               [&]()
               {
-                BlockBuf.WriteToStream(FileStream, BlockBuf.GetSize());
+                TStatisticsTimer Timer(FTerminal->GetStatistics(), scDiskWriteTime);
+                BlockBuf.WriteToStream(DestStream, BlockBuf.GetSize());
               });
 
               OperationProgress->AddLocallyUsed(BlockBuf.GetSize());
@@ -6432,6 +7111,26 @@ void TSFTPFileSystem::SFTPSink(UnicodeString AFileName,
         // queue is discarded here
       }
 
+      FileOperationLoopCustom(FTerminal, OperationProgress, True, FMTLOAD(WRITE_ERROR, LocalFileName), "",
+      [&]()
+      {
+        TStatisticsTimer Timer(FTerminal->GetStatistics(), scDiskWriteTime);
+        WriteBehindStream->Flush();
+      });
+
+      if ((HashingStream.get() != nullptr) && HashingStream->GetValid())
+      {
+        UnicodeString Alg = FTerminal->GetDownloadChecksumAlg();
+        UnicodeString Checksum = DownloadHash->Final();
+        FTerminal->LogEvent(FORMAT("%s checksum of downloaded data: %s", Alg, Checksum));
+      }
+
+      // the writer thread must be gone before the handle is closed
+      DestStream = nullptr;
+      HashingStream.reset();
+      WriteBehindStream = nullptr;
+      SAFE_DESTROY(FileStream);
+
       if (CopyParam->GetPreserveTime())
       {
         FTerminal->LogEvent(FORMAT("Preserving timestamp [%s]",
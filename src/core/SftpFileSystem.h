@@ -14,6 +14,7 @@ class TSFTPPacket;
 struct TOverwriteFileParams;
 struct TSFTPSupport;
 class TSecureShell;
+class TLocalTreeWalker;
 
 #if 0
 enum TSFTPOverwriteMode { omOverwrite, omAppend, omResume };
@@ -29,6 +30,7 @@ class TSFTPFileSystem : public TCustomFileSystem
   friend class TSFTPDownloadQueue;
   friend class TSFTPLoadFilesPropertiesQueue;
   friend class TSFTPCalculateFilesChecksumQueue;
+  friend class TSFTPCheckFileBlocksQueue;
   friend class TSFTPBusy;
 public:
   static inline bool classof(const TObject *Obj) { return Obj->is(OBJECT_CLASS_TSFTPFileSystem); }
@@ -79,6 +81,7 @@ public:
   virtual void LookupUsersGroups() override;
   virtual void ReadCurrentDirectory() override;
   virtual void ReadDirectory(TRemoteFileList *FileList) override;
+  virtual void ReadDirectories(TList *FileLists) override;
   virtual void ReadFile(UnicodeString AFileName,
     TRemoteFile *&AFile) override;
   virtual void ReadSymlink(TRemoteFile *SymlinkFile,
@@ -126,6 +129,8 @@ protected:
   bool FSupportsStatVfsV2;
   uintptr_t FCodePage;
   bool FSupportsHardlink;
+  // lists the subdirectories of an uploaded directory ahead of the transfer
+  TLocalTreeWalker *FLocalWalker;
   std::unique_ptr<TStringList> FChecksumAlgs;
   std::unique_ptr<TStringList> FChecksumSftpAlgs;
 
@@ -181,6 +186,15 @@ protected:
     TOverwriteFileParams &FileParams,
     TFileOperationProgressType *OperationProgress, uintptr_t Flags,
     TUploadSessionAction &Action, bool &ChildError);
+  void SFTPUploadFile(UnicodeString AFileName, HANDLE LocalFileHandle,
+    TOpenRemoteFileParams &OpenParams, UnicodeString DestFileName,
+    bool DoResume, bool ResumeTransfer, int64_t ResumeOffset,
+    TSFTPPacket *PropertiesRequest, TSFTPPacket *PropertiesResponse,
+    TFileOperationProgressType *OperationProgress, const TCopyParamType *CopyParam);
+  bool SFTPDeltaUpload(UnicodeString AFileName, HANDLE LocalFileHandle,
+    UnicodeString DestFullName, int64_t DestFileSize,
+    TFileOperationProgressType *OperationProgress);
+  int64_t DeltaUploadBlockSize(int64_t Size) const;
   RawByteString SFTPOpenRemoteFile(UnicodeString AFileName,
     SSH_FXF_TYPES OpenType, int64_t Size = -1);
   intptr_t SFTPOpenRemote(void *AOpenParams, void *Param2);
@@ -225,3 +239,4 @@ private:
   const TSessionData *GetSessionData() const;
 };
 
+UnicodeString SFTPPacketTypeName(SSH_FXP_TYPES Type);
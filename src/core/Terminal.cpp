@@ -21,6 +21,8 @@
 #include "HelpCore.h"
 #include "CoreMain.h"
 #include "Queue.h"
+#include "FileHasher.h"
+#include "LocalTreeWalker.h"
 #include <openssl/pkcs12.h>
 #include <openssl/err.h>
 
@@ -286,6 +288,13 @@ const TChecklistItem *TSynchronizeChecklist::GetItem(intptr_t Index) const
   return FList.GetAs<TChecklistItem>(Index);
 }
 
+void TSynchronizeChecklist::Delete(intptr_t Index)
+{
+  TChecklistItem *Item = FList.GetAs<TChecklistItem>(Index);
+  FList.Delete(Index);
+  SAFE_DESTROY(Item);
+}
+
 void TSynchronizeChecklist::Update(const TChecklistItem *Item, bool Check, TChecklistAction Action)
 {
   // TSynchronizeChecklist owns non-const items so it can manipulate them freely,
@@ -1112,6 +1121,7 @@ TTerminal::TTerminal(TObjectClassId Kind) :
   FSessionData(new TSessionData(L"")),
   FLog(nullptr),
   FActionLog(nullptr),
+  FStatistics(nullptr),
   FConfiguration(nullptr),
   FExceptionOnFail(0),
   FFiles(nullptr),
@@ -1172,6 +1182,7 @@ void TTerminal::Init(TSessionData *SessionData,
   TDateTime Started = Now(); // use the same time for session and XML log
   FLog = new TSessionLog(this, Started, FSessionData, FConfiguration);
   FActionLog = new TActionLog(this, Started, FSessionData, FConfiguration);
+  FStatistics = new TSessionStatistics();
   FFiles = new TRemoteDirectory(this);
   FExceptionOnFail = 0;
   FInTransaction = 0;
@@ -1251,6 +1262,7 @@ TTerminal::~TTerminal()
   SAFE_DESTROY_EX(TCustomFileSystem, FFileSystem);
   SAFE_DESTROY_EX(TSessionLog, FLog);
   SAFE_DESTROY_EX(TActionLog, FActionLog);
+  SAFE_DESTROY(FStatistics);
   SAFE_DESTROY(FFiles);
   SAFE_DESTROY_EX(TRemoteDirectoryCache, FDirectoryCache);
   SAFE_DESTROY_EX(TRemoteDirectoryChangesCache, FDirectoryChangesCache);
@@ -1448,6 +1460,9 @@ void TTerminal::InternalTryOpen()
   try
   {
     ResetConnection();
+    // statistics of a previous connection would mix with this one,
+    // and its outstanding requests would match new message numbers
+    FStatistics->Reset();
     FStatus = ssOpening;
 
     try__finally
@@ -1603,6 +1618,7 @@ void TTerminal::InitFileSystem()
         SAFE_DESTROY(FSecureShell);
       };
       FSecureShell = new TSecureShell(this, FSessionData, GetLog(), FConfiguration);
+      FSecureShell->SetStatistics(FStatistics);
       try
       {
         // there will be only one channel in this session
@@ -3351,6 +3367,11 @@ void TTerminal::DirectoryLoaded(TRemoteFileList *FileList)
   AddCachedFileList(FileList);
 }
 
+intptr_t TTerminal::GetBandwidthWeight() const
+{
+  return ForegroundBandwidthWeight;
+}
+
 void TTerminal::ReloadDirectory()
 {
   if (GetSessionData()->GetCacheDirectories())
@@ -4750,6 +4771,12 @@ void TTerminal::CalculateFilesChecksum(UnicodeString Alg,
   FFileSystem->CalculateFilesChecksum(Alg, AFileList, Checksums, OnCalculatedChecksum);
 }
 
+UnicodeString TTerminal::GetDownloadChecksumAlg() const
+{
+  // the checksum goes to the log only, do not hash when nobody can see it
+  return GetLog()->GetLogging() ? FConfiguration->GetDownloadChecksumAlg() : UnicodeString();
+}
+
 void TTerminal::TerminalRenameFile(UnicodeString AFileName,
   UnicodeString ANewName)
 {
@@ -5719,7 +5746,14 @@ void TTerminal::CalculateLocalFileSize(UnicodeString AFileName,
         {
           try
           {
-            ProcessLocalDirectory(AFileName, nb::bind(&TTerminal::CalculateLocalFileSize, this), AParams);
+            if (Params->LocalWalker != nullptr)
+            {
+              CalculateLocalDirectorySize(AFileName, Params);
+            }
+            else
+            {
+              ProcessLocalDirectory(AFileName, nb::bind(&TTerminal::CalculateLocalFileSize, this), AParams);
+            }
           }
           catch (...)
           {
@@ -5739,6 +5773,58 @@ void TTerminal::CalculateLocalFileSize(UnicodeString AFileName,
   }
 }
 
+void TTerminal::CalculateLocalDirectorySize(UnicodeString ADirectory,
+  TCalculateSizeParams *Params)
+{
+  std::unique_ptr<TLocalDirectoryListing> Listing(Params->LocalWalker->GetListing(ADirectory));
+  // the include mask was matched by the walker already,
+  // so all the subdirectories are visited, list them ahead
+  for (intptr_t Index = static_cast<intptr_t>(Listing->Entries.size()) - 1; Index >= 0; Index--)
+  {
+    if (Listing->Entries[Index].GetIsDirectory())
+    {
+      Params->LocalWalker->Add(Listing->Directory + Listing->Entries[Index].FileName);
+    }
+  }
+  for (size_t Index = 0; Params->Result && (Index < Listing->Entries.size()); ++Index)
+  {
+    const TLocalTreeEntry &Entry = Listing->Entries[Index];
+    UnicodeString FileName = Listing->Directory + Entry.FileName;
+    if (!TryStartOperationWithFile(FileName, foCalculateSize))
+    {
+      Params->Result = false;
+    }
+    else
+    {
+      bool Dir = Entry.GetIsDirectory();
+      intptr_t CollectionIndex = -1;
+      if (Params->Files != nullptr)
+      {
+        CollectionIndex = Params->Files->Add(::ExpandUNCFileName(FileName), nullptr, Dir);
+      }
+
+      if (!Dir)
+      {
+        Params->Size += Entry.Size;
+      }
+      else
+      {
+        try
+        {
+          CalculateLocalDirectorySize(FileName, Params);
+        }
+        catch (...)
+        {
+          if (CollectionIndex >= 0)
+          {
+            Params->Files->DidNotRecurse(CollectionIndex);
+          }
+        }
+      }
+    }
+  }
+}
+
 bool TTerminal::CalculateLocalFilesSize(const TStrings *AFileList,
   const TCopyParamType *CopyParam, bool AllowDirs, TStrings *Files,
   int64_t &Size)
@@ -5760,6 +5846,8 @@ bool TTerminal::CalculateLocalFilesSize(const TStrings *AFileList,
     Params.CopyParam = CopyParam;
     Params.Files = nullptr;
     Params.Result = true;
+    TLocalTreeWalker LocalWalker(this, CopyParam, 0);
+    Params.LocalWalker = &LocalWalker;
 
     DebugAssert(!FOperationProgress);
     FOperationProgress = &OperationProgress; //-V506
@@ -5829,6 +5917,7 @@ public:
     MatchingRemoteFileImageIndex(0)
   {
     ClearStruct(LocalLastWriteTime);
+    ClearStruct(LocalCreationTime);
   }
 
   bool Modified;
@@ -5839,16 +5928,61 @@ public:
   TRemoteFile *MatchingRemoteFileFile;
   intptr_t MatchingRemoteFileImageIndex;
   FILETIME LocalLastWriteTime;
+  FILETIME LocalCreationTime;
 };
 
 const intptr_t sfFirstLevel = 0x01;
 
+// Files of the same size on both sides for spByChecksum. The local files
+// are hashed in the background while the remote directories are read,
+// the remote checksums are calculated in one batch at the end.
+struct TSynchronizeChecksumData
+{
+  NB_DISABLE_COPY(TSynchronizeChecksumData)
+public:
+  struct TPending
+  {
+    TChecklistItem *Item;
+    UnicodeString LocalFileName;
+    FILETIME LocalCreationTime;
+    // NPOS, when the checksum was found in the cache
+    intptr_t LocalJob;
+    UnicodeString LocalChecksum;
+  };
+
+  TSynchronizeChecksumData(UnicodeString AAlg, TLocalHashCache *ACache) :
+    Alg(AAlg),
+    Cache(ACache),
+    Hasher(new TBackgroundFileHasher(AAlg))
+  {
+  }
+
+  ~TSynchronizeChecksumData()
+  {
+    for (size_t Index = 0; Index < Pending.size(); Index++)
+    {
+      SAFE_DESTROY(Pending[Index].Item);
+    }
+  }
+
+  UnicodeString Alg;
+  TLocalHashCache *Cache;
+  std::unique_ptr<TBackgroundFileHasher> Hasher;
+  rde::vector<TPending> Pending;
+};
+
 struct TSynchronizeData : public TObject
 {
 public:
   static inline bool classof(const TObject *Obj) { return Obj->is(OBJECT_CLASS_TSynchronizeData); }
   virtual bool is(TObjectClassId Kind) const override { return (Kind == OBJECT_CLASS_TSynchronizeData) || TObject::is(Kind); }
 public:
+  struct TSubdirectory
+  {
+    UnicodeString LocalDirectory;
+    UnicodeString RemoteDirectory;
+  };
+
   TSynchronizeData() : TObject(OBJECT_CLASS_TSynchronizeData)
   {
   }
@@ -5863,6 +5997,11 @@ public:
   TStringList *LocalFileList;
   const TCopyParamType *CopyParam;
   TSynchronizeChecklist *Checklist;
+  TSynchronizeChecksumData *ChecksumData;
+  TLocalTreeWalker *Walker;
+  TSynchronizeCollectedEvent OnSynchronizeCollected;
+  // matching subdirectories, recursed into once the directory is compared
+  rde::vector<TSubdirectory> Subdirectories;
 
   void DeleteLocalFileList()
   {
@@ -5882,17 +6021,45 @@ TSynchronizeChecklist *TTerminal::SynchronizeCollect(UnicodeString LocalDirector
   UnicodeString RemoteDirectory, TSynchronizeMode Mode,
   const TCopyParamType *CopyParam, intptr_t Params,
   TSynchronizeDirectoryEvent OnSynchronizeDirectory,
-  TSynchronizeOptions *Options)
+  TSynchronizeOptions *Options, TSynchronizeCollectedEvent OnSynchronizeCollected)
 {
   TValueRestorer<bool> UseBusyCursorRestorer(FUseBusyCursor);
   FUseBusyCursor = false;
 
   std::unique_ptr<TSynchronizeChecklist> Checklist(new TSynchronizeChecklist());
+  std::unique_ptr<TSynchronizeChecksumData> ChecksumData;
+  if (FLAGSET(Params, spByChecksum))
+  {
+    UnicodeString Alg = SynchronizeChecksumAlg();
+    if ((Mode == smBoth) || FLAGSET(Params, spTimestamp) || Alg.IsEmpty())
+    {
+      LogEvent("Cannot compare files by checksum, comparing by time and size.");
+      Params &= ~spByChecksum;
+    }
+    else
+    {
+      LogEvent(FORMAT("Comparing files of the same size by %s checksum.", Alg));
+      ChecksumData.reset(new TSynchronizeChecksumData(Alg, GetConfiguration()->GetLocalHashCache()));
+    }
+  }
+  // lists the local subdirectories ahead, while the remote ones are being read
+  TLocalTreeWalker Walker(this, CopyParam,
+    FLAGMASK(GetConfiguration()->GetActualLogProtocol() >= 1, TLocalTreeWalker::lwKeepExcluded));
+  Walker.Add(LocalDirectory);
   try__catch
   {
     DoSynchronizeCollectDirectory(LocalDirectory, RemoteDirectory, Mode,
       CopyParam, Params, OnSynchronizeDirectory, Options, sfFirstLevel,
-      Checklist.get());
+      Checklist.get(), ChecksumData.get(), &Walker, OnSynchronizeCollected, nullptr);
+    if (ChecksumData.get() != nullptr)
+    {
+      intptr_t Index = Checklist->GetCount();
+      SynchronizeCompareChecksums(ChecksumData.get(), Checklist.get());
+      if (OnSynchronizeCollected && (Checklist->GetCount() > Index))
+      {
+        OnSynchronizeCollected(Checklist.get(), Index, Checklist->GetCount() - Index);
+      }
+    }
     Checklist->Sort();
   }
 #if 0
@@ -5951,6 +6118,7 @@ UnicodeString TTerminal::SynchronizeParamsStr(intptr_t Params)
   AddFlagName(ParamsStr, Params, spBySize, L"BySize");
   AddFlagName(ParamsStr, Params, spSelectedOnly, L"*SelectedOnly"); // GUI only
   AddFlagName(ParamsStr, Params, spMirror, L"Mirror");
+  AddFlagName(ParamsStr, Params, spByChecksum, L"ByChecksum");
   if (Params > 0)
   {
     AddToList(ParamsStr, FORMAT("0x%x", ToInt(Params)), L", ");
@@ -5962,7 +6130,9 @@ void TTerminal::DoSynchronizeCollectDirectory(UnicodeString ALocalDirectory,
   UnicodeString ARemoteDirectory, TSynchronizeMode Mode,
   const TCopyParamType *CopyParam, intptr_t Params,
   TSynchronizeDirectoryEvent OnSynchronizeDirectory, TSynchronizeOptions *Options,
-  intptr_t Level, TSynchronizeChecklist *Checklist)
+  intptr_t Level, TSynchronizeChecklist *Checklist, TSynchronizeChecksumData *ChecksumData,
+  TLocalTreeWalker *Walker, TSynchronizeCollectedEvent OnSynchronizeCollected,
+  TRemoteFileList *RemoteFileList)
 {
   TFileOperationProgressType *OperationProgress = GetOperationProgress();
   TSynchronizeData Data;
@@ -5977,6 +6147,10 @@ void TTerminal::DoSynchronizeCollectDirectory(UnicodeString ALocalDirectory,
   Data.Options = Options;
   Data.Flags = Level;
   Data.Checklist = Checklist;
+  Data.ChecksumData = ChecksumData;
+  Data.Walker = Walker;
+  Data.OnSynchronizeCollected = OnSynchronizeCollected;
+  intptr_t FirstIndex = Checklist->GetCount();
 
   LogEvent(FORMAT("Collecting synchronization list for local directory '%s' and remote directory '%s', "
       "mode = %s, params = 0x%x (%s), file mask = '%s'", ALocalDirectory, ARemoteDirectory,
@@ -5994,99 +6168,92 @@ void TTerminal::DoSynchronizeCollectDirectory(UnicodeString ALocalDirectory,
     {
       Data.DeleteLocalFileList();
     };
-    bool Found = false;
-    TSearchRecChecked SearchRec;
+    std::unique_ptr<TLocalDirectoryListing> Listing;
     Data.LocalFileList = CreateSortedStringList();
 
     FileOperationLoopCustom(this, OperationProgress, True, FMTLOAD(LIST_DIR_ERROR, ALocalDirectory), "",
     [&]()
     {
-      DWORD FindAttrs = faReadOnly | faHidden | faSysFile | faDirectory | faArchive;
-      Found = ::FindFirstChecked(Data.LocalDirectory + L"*.*", FindAttrs, SearchRec) == 0;
+      Listing.reset(Walker->GetListing(Data.LocalDirectory));
     });
 
+    bool Found = (Listing->Error == ERROR_SUCCESS);
     if (Found)
     {
-      try__finally
-      {
-        SCOPE_EXIT
+      // logging every file slows down the collection of large trees
+      bool LogFiles = (GetConfiguration()->GetActualLogProtocol() >= 1);
+      for (size_t Index = 0; Index < Listing->Entries.size(); ++Index)
+      {
+        const TLocalTreeEntry &Entry = Listing->Entries[Index];
+        // add dirs for recursive mode or when we are interested in newly
+        // added subdirs
+        // the include mask was matched by the walker
+        if (Entry.Included &&
+          !FFileSystem->TemporaryTransferFile(Entry.FileName) &&
+          (FLAGCLEAR(Level, sfFirstLevel) ||
+            (Options == nullptr) ||
+            Options->MatchesFilter(Entry.FileName) ||
+            Options->MatchesFilter(ChangeFileName(CopyParam, Entry.FileName, osLocal, false))))
         {
-          base::FindClose(SearchRec);
-        };
-        while (Found)
-        {
-          UnicodeString FileName = SearchRec.Name;
-          // add dirs for recursive mode or when we are interested in newly
-          // added subdirs
-          // SearchRec.Size in C++B2010 is int64_t,
-          // so we should be able to use it instead of FindData.nFileSize*
-          int64_t Size =
-            (static_cast<int64_t>(SearchRec.FindData.nFileSizeHigh) << 32) +
-            SearchRec.FindData.nFileSizeLow;
-          TDateTime Modification = ::FileTimeToDateTime(SearchRec.FindData.ftLastWriteTime);
-          TFileMasks::TParams MaskParams;
-          MaskParams.Size = Size;
-          MaskParams.Modification = Modification;
-          UnicodeString RemoteFileName =
-            ChangeFileName(CopyParam, FileName, osLocal, false);
-          UnicodeString FullLocalFileName = Data.LocalDirectory + FileName;
-          UnicodeString BaseFileName = GetBaseFileName(FullLocalFileName);
-          if ((FileName != THISDIRECTORY) && (FileName != PARENTDIRECTORY) &&
-            CopyParam->AllowTransfer(BaseFileName, osLocal,
-              FLAGSET(SearchRec.Attr, faDirectory), MaskParams) &&
-            !FFileSystem->TemporaryTransferFile(FileName) &&
-            (FLAGCLEAR(Level, sfFirstLevel) ||
-              (Options == nullptr) ||
-              Options->MatchesFilter(FileName) ||
-              Options->MatchesFilter(RemoteFileName)))
+          TSynchronizeFileData *FileData = new TSynchronizeFileData();
+
+          FileData->IsDirectory = Entry.GetIsDirectory();
+          FileData->Info.FileName = Entry.FileName;
+          FileData->Info.Directory = Data.LocalDirectory;
+          FileData->Info.Modification = Entry.Modification;
+          FileData->Info.ModificationFmt = mfFull;
+          FileData->Info.Size = Entry.Size;
+          FileData->LocalLastWriteTime = Entry.LastWriteTime;
+          FileData->LocalCreationTime = Entry.CreationTime;
+          FileData->New = true;
+          FileData->Modified = false;
+          Data.LocalFileList->AddObject(Entry.FileName, FileData);
+          if (LogFiles)
           {
-            TSynchronizeFileData *FileData = new TSynchronizeFileData();
-
-            FileData->IsDirectory = FLAGSET(SearchRec.Attr, faDirectory);
-            FileData->Info.FileName = FileName;
-            FileData->Info.Directory = Data.LocalDirectory;
-            FileData->Info.Modification = Modification;
-            FileData->Info.ModificationFmt = mfFull;
-            FileData->Info.Size = Size;
-            FileData->LocalLastWriteTime = SearchRec.FindData.ftLastWriteTime;
-            FileData->New = true;
-            FileData->Modified = false;
-            Data.LocalFileList->AddObject(FileName, FileData);
             LogEvent(FORMAT("Local file %s included to synchronization",
-                FormatFileDetailsForLog(FullLocalFileName, Modification, Size)));
-          }
-          else
-          {
-            LogEvent(FORMAT("Local file %s excluded from synchronization",
-                FormatFileDetailsForLog(FullLocalFileName, Modification, Size)));
+                FormatFileDetailsForLog(Data.LocalDirectory + Entry.FileName, Entry.Modification, Entry.Size)));
           }
-
-          FileOperationLoopCustom(this, OperationProgress, True, FMTLOAD(LIST_DIR_ERROR, ALocalDirectory), "",
-          [&]()
-          {
-            Found = (::FindNextChecked(SearchRec) == 0);
-          });
+        }
+        else if (LogFiles)
+        {
+          LogEvent(FORMAT("Local file %s excluded from synchronization",
+              FormatFileDetailsForLog(Data.LocalDirectory + Entry.FileName, Entry.Modification, Entry.Size)));
         }
       }
-      __finally
-      {
-#if 0
-        FindClose(SearchRec);
-#endif // #if 0
-      };
 
       // can we expect that ProcessDirectory would take so little time
       // that we can postpone showing progress window until anything actually happens?
-      bool Cached = FLAGSET(Params, spUseCache) && GetSessionData()->GetCacheDirectories() &&
-        FDirectoryCache->HasFileList(ARemoteDirectory);
+      // (the listing may have been read ahead by SynchronizeCollectSubdirectories)
+      bool Prefetched = (RemoteFileList != nullptr) && (RemoteFileList->GetCount() > 0);
+      bool Cached = Prefetched ||
+        (FLAGSET(Params, spUseCache) && GetSessionData()->GetCacheDirectories() &&
+          FDirectoryCache->HasFileList(ARemoteDirectory));
 
       if (!Cached && FLAGSET(Params, spDelayProgress))
       {
         DoSynchronizeProgress(Data, true);
       }
 
-      ProcessDirectory(ARemoteDirectory, nb::bind(&TTerminal::SynchronizeCollectFile, this), &Data,
-        FLAGSET(Params, spUseCache));
+      if (Prefetched)
+      {
+        for (intptr_t Index = 0; Index < RemoteFileList->GetCount(); ++Index)
+        {
+          TRemoteFile *File = RemoteFileList->GetFile(Index);
+          if (GetLog()->GetLogging())
+          {
+            LogRemoteFile(File);
+          }
+          if (!File->GetIsParentDirectory() && !File->GetIsThisDirectory())
+          {
+            SynchronizeCollectFile(Data.RemoteDirectory + File->GetFileName(), File, &Data);
+          }
+        }
+      }
+      else
+      {
+        ProcessDirectory(ARemoteDirectory, nb::bind(&TTerminal::SynchronizeCollectFile, this), &Data,
+          FLAGSET(Params, spUseCache));
+      }
 
       TSynchronizeFileData *FileData;
       for (intptr_t Index = 0; Index < Data.LocalFileList->GetCount(); ++Index)
@@ -6168,6 +6335,16 @@ void TTerminal::DoSynchronizeCollectDirectory(UnicodeString ALocalDirectory,
           }
         }
       }
+
+      // the items of this directory are complete now
+      // (except for those still to be compared by checksum)
+      if (OnSynchronizeCollected && (Checklist->GetCount() > FirstIndex))
+      {
+        OnSynchronizeCollected(Checklist, FirstIndex, Checklist->GetCount() - FirstIndex);
+      }
+
+      Data.DeleteLocalFileList();
+      SynchronizeCollectSubdirectories(&Data);
     }
   }
   __finally
@@ -6187,6 +6364,105 @@ void TTerminal::DoSynchronizeCollectDirectory(UnicodeString ALocalDirectory,
   };
 }
 
+void TTerminal::SynchronizeCollectSubdirectories(TSynchronizeData *Data)
+{
+  // The remote subdirectories are read in windows of the listings that the protocol
+  // can read at once, where it allows it, while the walker lists the local ones.
+  // The window is recursed into before the next one is read, so that the listings
+  // of a wide directory are not held all at once.
+  size_t Start = 0;
+  while (Start < Data->Subdirectories.size())
+  {
+    size_t Count = std::min(Data->Subdirectories.size() - Start,
+      static_cast<size_t>(TCustomFileSystem::MaxPipelinedListings));
+    rde::vector<TRemoteFileList *> FileLists;
+    SCOPE_EXIT
+    {
+      for (size_t Index = 0; Index < FileLists.size(); Index++)
+      {
+        SAFE_DESTROY(FileLists[Index]);
+      }
+    };
+    // only the subdirectories existing on both sides are recursed into
+    for (size_t Index = Start + Count; Index > Start; Index--)
+    {
+      Data->Walker->Add(Data->Subdirectories[Index - 1].LocalDirectory);
+    }
+    bool Cache = FLAGSET(Data->Params, spUseCache) && GetSessionData()->GetCacheDirectories();
+    std::unique_ptr<TList> Pending(new TList());
+    for (size_t Index = Start; Index < Start + Count; Index++)
+    {
+      UnicodeString RemoteDirectory = Data->Subdirectories[Index].RemoteDirectory;
+      TRemoteFileList *FileList = nullptr;
+      if (!Cache || !FDirectoryCache->HasFileList(RemoteDirectory))
+      {
+        FileList = new TRemoteFileList();
+        FileList->SetDirectory(RemoteDirectory);
+        Pending->Add(FileList);
+      }
+      FileLists.push_back(FileList);
+    }
+
+    if (Pending->GetCount() > 1)
+    {
+      try
+      {
+        FFileSystem->ReadDirectories(Pending.get());
+        if (Cache)
+        {
+          for (intptr_t Index = 0; Index < Pending->GetCount(); ++Index)
+          {
+            TRemoteFileList *FileList = Pending->GetAs<TRemoteFileList>(Index);
+            if (FileList->GetCount() > 0)
+            {
+              AddCachedFileList(FileList);
+            }
+          }
+        }
+      }
+      catch (Exception &E)
+      {
+        if (!GetActive())
+        {
+          throw;
+        }
+        // the directories are read one by one then, reporting the error properly
+        LogEvent("Reading directories ahead failed.");
+        GetLog()->AddException(&E);
+        for (intptr_t Index = 0; Index < Pending->GetCount(); ++Index)
+        {
+          Pending->GetAs<TRemoteFileList>(Index)->Reset();
+        }
+      }
+    }
+
+    for (size_t Index = 0; Index < Count; Index++)
+    {
+      try
+      {
+        DoSynchronizeCollectDirectory(
+          Data->Subdirectories[Start + Index].LocalDirectory,
+          Data->Subdirectories[Start + Index].RemoteDirectory,
+          Data->Mode, Data->CopyParam, Data->Params, Data->OnSynchronizeDirectory,
+          Data->Options, (Data->Flags & ~sfFirstLevel),
+          Data->Checklist, Data->ChecksumData, Data->Walker,
+          Data->OnSynchronizeCollected, FileLists[Index]);
+      }
+      catch (ESkipFile &E)
+      {
+        TSuspendFileOperationProgress Suspend(GetOperationProgress());
+        if (!HandleException(&E))
+        {
+          throw;
+        }
+      }
+      // the listing is not needed anymore
+      SAFE_DESTROY(FileLists[Index]);
+    }
+    Start += Count;
+  }
+}
+
 void TTerminal::SynchronizeCollectFile(UnicodeString AFileName,
   const TRemoteFile *AFile, /*TSynchronizeData*/ void *Param)
 {
@@ -6272,7 +6548,28 @@ void TTerminal::DoSynchronizeCollectFile(UnicodeString /*AFileName*/,
             // for spTimestamp+spBySize require that the file sizes are the same
             // before comparing file time
             intptr_t TimeCompare;
-            if (FLAGCLEAR(Data->Params, spNotByTime) &&
+            if (Data->ChecksumData != nullptr)
+            {
+              // files of different size are known to differ right away,
+              // the rest are compared by checksum once all directories are collected
+              TimeCompare = 0;
+              if (ChecklistItem->Local.Size != ChecklistItem->Remote.Size)
+              {
+                if (Data->Mode == smLocal)
+                {
+                  Modified = true;
+                }
+                else
+                {
+                  LocalModified = true;
+                }
+              }
+              else if (ChecklistItem->Local.Size > 0)
+              {
+                SynchronizeChecksumPending(Data, LocalData, AFile, ChecklistItem.release());
+              }
+            }
+            else if (FLAGCLEAR(Data->Params, spNotByTime) &&
               (FLAGCLEAR(Data->Params, spTimestamp) ||
                 FLAGCLEAR(Data->Params, spBySize) ||
                 (ChecklistItem->Local.Size == ChecklistItem->Remote.Size)))
@@ -6308,7 +6605,8 @@ void TTerminal::DoSynchronizeCollectFile(UnicodeString /*AFileName*/,
                 Modified = true;
               }
             }
-            else if (FLAGSET(Data->Params, spBySize) &&
+            else if ((Data->ChecksumData == nullptr) &&
+              FLAGSET(Data->Params, spBySize) &&
               (ChecklistItem->Local.Size != ChecklistItem->Remote.Size) &&
               FLAGCLEAR(Data->Params, spTimestamp))
             {
@@ -6343,12 +6641,10 @@ void TTerminal::DoSynchronizeCollectFile(UnicodeString /*AFileName*/,
           }
           else if (FLAGCLEAR(Data->Params, spNoRecurse))
           {
-            DoSynchronizeCollectDirectory(
-              Data->LocalDirectory + LocalData->Info.FileName,
-              Data->RemoteDirectory + AFile->GetFileName(),
-              Data->Mode, Data->CopyParam, Data->Params, Data->OnSynchronizeDirectory,
-              Data->Options, (Data->Flags & ~sfFirstLevel),
-              Data->Checklist);
+            TSynchronizeData::TSubdirectory Subdirectory;
+            Subdirectory.LocalDirectory = Data->LocalDirectory + LocalData->Info.FileName;
+            Subdirectory.RemoteDirectory = Data->RemoteDirectory + AFile->GetFileName();
+            Data->Subdirectories.push_back(Subdirectory);
           }
         }
         else
@@ -6410,6 +6706,135 @@ void TTerminal::DoSynchronizeCollectFile(UnicodeString /*AFileName*/,
   }
 }
 
+UnicodeString TTerminal::SynchronizeChecksumAlg()
+{
+  UnicodeString Result;
+  if (GetIsCapable(fcCalculatingChecksum))
+  {
+    std::unique_ptr<TStrings> Algs(new TStringList());
+    GetSupportedChecksumAlgs(Algs.get());
+    // algorithms we can calculate locally, the fastest first
+    const UnicodeString *PreferredAlgs[] = { &Md5ChecksumAlg, &Sha1ChecksumAlg, &Sha256ChecksumAlg, &Sha512ChecksumAlg };
+    for (intptr_t Index = 0; Result.IsEmpty() && (Index < static_cast<intptr_t>(_countof(PreferredAlgs))); ++Index)
+    {
+      if ((Algs->IndexOf(*PreferredAlgs[Index]) >= 0) && IsLocalChecksumAlgSupported(*PreferredAlgs[Index]))
+      {
+        Result = *PreferredAlgs[Index];
+      }
+    }
+  }
+  return Result;
+}
+
+void TTerminal::SynchronizeChecksumPending(TSynchronizeData *Data,
+  const TSynchronizeFileData *LocalData, const TRemoteFile *AFile, TChecklistItem *ChecklistItem)
+{
+  std::unique_ptr<TChecklistItem> Item(ChecklistItem);
+  TSynchronizeChecksumData *ChecksumData = Data->ChecksumData;
+
+  // the item is complete, in case the checksums differ
+  Item->FLocalLastWriteTime = LocalData->LocalLastWriteTime;
+  Item->RemoteFile = AFile->Duplicate();
+  Item->Action = (Data->Mode == smLocal) ? saDownloadUpdate : saUploadUpdate;
+  Item->Checked = true;
+
+  TSynchronizeChecksumData::TPending Pending;
+  Pending.Item = nullptr;
+  Pending.LocalFileName = UnicodeString(LocalData->Info.Directory) + UnicodeString(LocalData->Info.FileName);
+  Pending.LocalCreationTime = LocalData->LocalCreationTime;
+  Pending.LocalJob = NPOS;
+  if (!ChecksumData->Cache->Find(ChecksumData->Alg, Pending.LocalFileName, LocalData->Info.Size,
+        LocalData->LocalLastWriteTime, LocalData->LocalCreationTime, Pending.LocalChecksum))
+  {
+    Pending.LocalJob = ChecksumData->Hasher->Add(Pending.LocalFileName);
+  }
+  ChecksumData->Pending.push_back(Pending);
+  ChecksumData->Pending.back().Item = Item.release();
+}
+
+void TTerminal::SynchronizeCompareChecksums(TSynchronizeChecksumData *ChecksumData,
+  TSynchronizeChecklist *Checklist)
+{
+  intptr_t Count = static_cast<intptr_t>(ChecksumData->Pending.size());
+  if (Count > 0)
+  {
+    LogEvent(FORMAT("Comparing %s checksums of %d files of the same size.", ChecksumData->Alg, Count));
+
+    // the local files keep being hashed meanwhile
+    std::unique_ptr<TStrings> Checksums(new TStringList());
+    while (Checksums->GetCount() < Count)
+    {
+      intptr_t Start = Checksums->GetCount();
+      std::unique_ptr<TStrings> FileList(new TStringList());
+      for (intptr_t Index = Start; Index < Count; ++Index)
+      {
+        TRemoteFile *File = ChecksumData->Pending[Index].Item->RemoteFile;
+        FileList->AddObject(File->GetFullFileName(), File);
+      }
+      // the checksums stop at the first failure, which is only logged,
+      // and the file is transferred then; continue with the next one
+      SetExceptionOnFail(true);
+      try
+      {
+        SCOPE_EXIT
+        {
+          SetExceptionOnFail(false);
+        };
+        FFileSystem->CalculateFilesChecksum(ChecksumData->Alg, FileList.get(), Checksums.get(), nullptr);
+        // no checksums for the rest, if the file system stopped silently
+        while (Checksums->GetCount() < Count)
+        {
+          Checksums->Add(UnicodeString());
+        }
+      }
+      catch (ECommand &E)
+      {
+        if (Checksums->GetCount() < Count)
+        {
+          LogEvent(FORMAT("Cannot calculate checksum of remote file \"%s\": %s",
+            FileList->GetString(Checksums->GetCount() - Start), E.Message));
+          Checksums->Add(UnicodeString());
+        }
+      }
+    }
+    ChecksumData->Hasher->Wait();
+
+    for (intptr_t Index = 0; Index < Count; ++Index)
+    {
+      TSynchronizeChecksumData::TPending &Pending = ChecksumData->Pending[Index];
+      std::unique_ptr<TChecklistItem> Item(Pending.Item);
+      Pending.Item = nullptr;
+
+      if (Pending.LocalJob != NPOS)
+      {
+        Pending.LocalChecksum = ChecksumData->Hasher->GetChecksum(Pending.LocalJob);
+        if (!Pending.LocalChecksum.IsEmpty())
+        {
+          ChecksumData->Cache->Store(ChecksumData->Alg, Pending.LocalFileName, Item->Local.Size,
+            Item->FLocalLastWriteTime, Pending.LocalCreationTime, Pending.LocalChecksum);
+        }
+        else
+        {
+          LogEvent(FORMAT("Cannot calculate checksum of local file \"%s\": %s",
+            Pending.LocalFileName, ChecksumData->Hasher->GetError(Pending.LocalJob)));
+        }
+      }
+
+      // files that could not be compared are transferred
+      UnicodeString RemoteChecksum = Checksums->GetString(Index);
+      if (Pending.LocalChecksum.IsEmpty() || RemoteChecksum.IsEmpty() ||
+          !SameText(Pending.LocalChecksum, RemoteChecksum))
+      {
+        LogEvent(FORMAT("Local file \"%s\" and remote file \"%s\" differ by checksum (%s, %s)",
+          Pending.LocalFileName, Item->RemoteFile->GetFullFileName(), Pending.LocalChecksum, RemoteChecksum));
+        Checklist->Add(Item.release());
+      }
+    }
+
+    ChecksumData->Cache->Save();
+  }
+}
+
 void TTerminal::SynchronizeApply(TSynchronizeChecklist *Checklist,
   UnicodeString /*LocalDirectory*/, UnicodeString /*RemoteDirectory*/,
   const TCopyParamType *CopyParam, intptr_t Params,
@@ -6876,9 +7301,11 @@ void TTerminal::UnlockFiles(TStrings *AFileList)
   };
 }
 
-const TSessionInfo &TTerminal::GetSessionInfo() const
+TSessionInfo TTerminal::GetSessionInfo() const
 {
-  return FFileSystem->GetSessionInfo();
+  TSessionInfo Result = FFileSystem->GetSessionInfo();
+  Result.Statistics = FStatistics;
+  return Result;
 }
 
 const TFileSystemInfo &TTerminal::GetFileSystemInfo(bool Retrieve)
@@ -7082,6 +7509,15 @@ void TTerminal::LogTotalTransferDetails(
 void TTerminal::LogTotalTransferDone(TFileOperationProgressType *OperationProgress)
 {
   LogEvent(L"Copying finished: " + OperationProgress->GetLogStr(true));
+  if (FLog->GetLogging() && !FStatistics->GetEmpty())
+  {
+    std::unique_ptr<TStrings> Lines(new TStringList());
+    FStatistics->Report(Lines.get());
+    for (intptr_t Index = 0; Index < Lines->GetCount(); ++Index)
+    {
+      LogEvent(L"Statistics: " + Lines->GetString(Index));
+    }
+  }
 }
 
 bool TTerminal::CopyToRemote(const TStrings *AFilesToCopy,
@@ -7115,6 +7551,7 @@ bool TTerminal::CopyToRemote(const TStrings *AFilesToCopy,
     FLastProgressLogged = GetTickCount();
     OperationProgress.Start((Params & cpDelete) ? foMove : foCopy, osLocal,
       AFilesToCopy->GetCount(), (Params & cpTemporary) > 0, TargetDir, CopyParam->GetCPSLimit());
+    OperationProgress.SetBandwidthWeight(GetBandwidthWeight());
 
     FOperationProgress = &OperationProgress; //-V506
 #if 0
@@ -7290,6 +7727,7 @@ bool TTerminal::CopyToLocal(const TStrings *AFilesToCopy,
 
     OperationProgress.Start(((Params & cpDelete) != 0 ? foMove : foCopy), osRemote,
       AFilesToCopy ? AFilesToCopy->GetCount() : 0, (Params & cpTemporary) != 0, TargetDir, CopyParam->GetCPSLimit());
+    OperationProgress.SetBandwidthWeight(GetBandwidthWeight());
 
     FOperationProgress = &OperationProgress; //-V506
     //bool CollectingUsage = false;
@@ -9,6 +9,7 @@
 #include <Exceptions.h>
 
 #include "SessionInfo.h"
+#include "SessionStatistics.h"
 #include "Interface.h"
 #include "FileOperationProgress.h"
 #include "FileMasks.h"
@@ -23,8 +24,11 @@ class TSecureShell;
 struct TCalculateSizeParams;
 struct TOverwriteFileParams;
 struct TSynchronizeData;
+struct TSynchronizeChecksumData;
+struct TSynchronizeFileData;
 struct TSynchronizeOptions;
 class TSynchronizeChecklist;
+class TChecklistItem;
 struct TCalculateSizeStats;
 struct TFileSystemInfo;
 struct TSpaceAvailable;
@@ -33,6 +37,7 @@ class TTunnelUI;
 class TCallbackGuard;
 class TParallelOperation;
 class TCollectedFileList;
+class TLocalTreeWalker;
 
 #if 0
 typedef void (__closure *TQueryUserEvent)
@@ -105,6 +110,13 @@ typedef nb::FastDelegate4<void,
   UnicodeString /*LocalDirectory*/, UnicodeString /*RemoteDirectory*/,
   bool & /*Continue*/, bool /*Collect*/> TSynchronizeDirectoryEvent;
 #if 0
+typedef void (__closure *TSynchronizeCollectedEvent)
+  (TSynchronizeChecklist * Checklist, int Index, int Count);
+#endif
+typedef nb::FastDelegate3<void,
+  TSynchronizeChecklist * /*Checklist*/, intptr_t /*Index*/,
+  intptr_t /*Count*/> TSynchronizeCollectedEvent;
+#if 0
 typedef void (__closure *TDeleteLocalFileEvent)(
   const UnicodeString FileName, bool Alternative);
 #endif
@@ -261,6 +273,7 @@ public:
   static const int spBySize = 0x400; // cannot be combined with smBoth, has opposite meaning for spTimestamp
   static const int spSelectedOnly = 0x800; // not used by core
   static const int spMirror = 0x1000;
+  static const int spByChecksum = 0x2000; // cannot be combined with smBoth and spTimestamp
   static const int spDefault = TTerminal::spNoConfirmation | TTerminal::spPreviewChanges;
 
 // for TranslateLockedPath()
@@ -279,6 +292,7 @@ private:
   TSessionData *FSessionData;
   TSessionLog *FLog;
   TActionLog *FActionLog;
+  TSessionStatistics *FStatistics;
   TConfiguration *FConfiguration;
   UnicodeString FCurrentDirectory;
   UnicodeString FLockDirectory;
@@ -443,6 +457,7 @@ protected:
     const TRemoteFile *AFile, TCalculateSizeParams *Params);
   void CalculateLocalFileSize(UnicodeString AFileName,
     const TSearchRec &Rec, /*int64_t*/ void *Size);
+  void CalculateLocalDirectorySize(UnicodeString ADirectory, TCalculateSizeParams *Params);
   bool CalculateLocalFilesSize(const TStrings *AFileList,
     const TCopyParamType *CopyParam, bool AllowDirs, TStrings *Files,
     int64_t &Size);
@@ -461,11 +476,19 @@ protected:
     UnicodeString ARemoteDirectory, TSynchronizeMode Mode,
     const TCopyParamType *CopyParam, intptr_t Params,
     TSynchronizeDirectoryEvent OnSynchronizeDirectory,
-    TSynchronizeOptions *Options, intptr_t Level, TSynchronizeChecklist *Checklist);
+    TSynchronizeOptions *Options, intptr_t Level, TSynchronizeChecklist *Checklist,
+    TSynchronizeChecksumData *ChecksumData, TLocalTreeWalker *Walker,
+    TSynchronizeCollectedEvent OnSynchronizeCollected, TRemoteFileList *RemoteFileList);
+  void SynchronizeCollectSubdirectories(TSynchronizeData *Data);
   void DoSynchronizeCollectFile(UnicodeString AFileName,
     const TRemoteFile *AFile, /*TSynchronizeData*/ void *Param);
   void SynchronizeCollectFile(UnicodeString AFileName,
     const TRemoteFile *AFile, /*TSynchronizeData*/ void *Param);
+  UnicodeString SynchronizeChecksumAlg();
+  void SynchronizeChecksumPending(TSynchronizeData *Data,
+    const TSynchronizeFileData *LocalData, const TRemoteFile *AFile, TChecklistItem *ChecklistItem);
+  void SynchronizeCompareChecksums(TSynchronizeChecksumData *ChecksumData,
+    TSynchronizeChecklist *Checklist);
   void SynchronizeRemoteTimestamp(UnicodeString AFileName,
     const TRemoteFile *AFile, void *Param);
   void SynchronizeLocalTimestamp(UnicodeString AFileName,
@@ -571,6 +594,8 @@ public:
   void Reopen(intptr_t Params);
   virtual void DirectoryModified(UnicodeString APath, bool SubDirs);
   virtual void DirectoryLoaded(TRemoteFileList *FileList);
+  // share of the global bandwidth caps for transfers of this terminal
+  virtual intptr_t GetBandwidthWeight() const;
   void ShowExtendedException(Exception *E);
   void Idle();
   void RecryptPasswords();
@@ -638,7 +663,8 @@ public:
   TSynchronizeChecklist *SynchronizeCollect(UnicodeString LocalDirectory,
     UnicodeString RemoteDirectory, TSynchronizeMode Mode,
     const TCopyParamType *CopyParam, intptr_t Params,
-    TSynchronizeDirectoryEvent OnSynchronizeDirectory, TSynchronizeOptions *Options);
+    TSynchronizeDirectoryEvent OnSynchronizeDirectory, TSynchronizeOptions *Options,
+    TSynchronizeCollectedEvent OnSynchronizeCollected);
   void SynchronizeApply(TSynchronizeChecklist *Checklist,
     UnicodeString LocalDirectory, UnicodeString RemoteDirectory,
     const TCopyParamType *CopyParam, intptr_t Params,
@@ -666,7 +692,7 @@ public:
   TTerminal *CreateSecondarySession(UnicodeString Name, TSessionData *SessionData);
   void FillSessionDataForCode(TSessionData *SessionData) const;
 
-  const TSessionInfo &GetSessionInfo() const;
+  TSessionInfo GetSessionInfo() const;
   const TFileSystemInfo &GetFileSystemInfo(bool Retrieve = false);
   void LogEvent(UnicodeString Str);
   void GetSupportedChecksumAlgs(TStrings *Algs) const;
@@ -739,6 +765,7 @@ public:
   TSessionLog *GetLog() const { return FLog; }
   TSessionLog *GetLog() { return FLog; }
   TActionLog *GetActionLog() const { return FActionLog; }
+  TSessionStatistics *GetStatistics() const { return FStatistics; }
   const TConfiguration *GetConfiguration() const { return FConfiguration; }
   TConfiguration *GetConfiguration() { return FConfiguration; }
   TSessionStatus GetStatus() const { return FStatus; }
@@ -771,6 +798,9 @@ public:
   void SetOnProgress(TFileOperationProgressEvent Value) { FOnProgress = Value; }
   TFileOperationFinishedEvent GetOnFinished() const { return FOnFinished; }
   void SetOnFinished(TFileOperationFinishedEvent Value) { FOnFinished = Value; }
+  // When set, downloaded files are hashed while being written
+  // and the checksum is logged
+  UnicodeString GetDownloadChecksumAlg() const;
   TCurrentFSProtocol GetFSProtocol() const { return FFSProtocol; }
   bool GetUseBusyCursor() const { return FUseBusyCursor; }
   void SetUseBusyCursor(bool Value) { FUseBusyCursor = Value; }
@@ -894,12 +924,14 @@ public:
   static inline bool classof(const TObject *Obj) { return Obj->is(OBJECT_CLASS_TCalculateSizeParams); }
   virtual bool is(TObjectClassId Kind) const override { return (Kind == OBJECT_CLASS_TCalculateSizeParams) || TObject::is(Kind); }
 public:
-  TCalculateSizeParams() : TObject(OBJECT_CLASS_TCalculateSizeParams), Size(0), Params(0), CopyParam(nullptr), Stats(nullptr), Files(nullptr), AllowDirs(false), Result(false) {}
+  TCalculateSizeParams() : TObject(OBJECT_CLASS_TCalculateSizeParams), Size(0), Params(0), CopyParam(nullptr), Stats(nullptr), Files(nullptr), LocalWalker(nullptr), AllowDirs(false), Result(false) {}
   int64_t Size;
   intptr_t Params;
   const TCopyParamType *CopyParam;
   TCalculateSizeStats *Stats;
   TCollectedFileList *Files;
+  // lists the local directories, matching CopyParam's include mask
+  TLocalTreeWalker *LocalWalker;
   UnicodeString LastDirPath;
   bool AllowDirs;
   bool Result;
@@ -1064,6 +1096,8 @@ public:
 
   intptr_t GetCount() const;
   const TChecklistItem *GetItem(intptr_t Index) const;
+  // for items already applied elsewhere, cheap for the last items
+  void Delete(intptr_t Index);
 
 private:
   TList FList;
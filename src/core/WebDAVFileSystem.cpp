@@ -421,6 +421,9 @@ void TWebDAVFileSystem::InitSession(ne_session_s *Session)
 
   ne_set_connect_timeout(FNeonSession, ToInt(Data->GetTimeout()));
 
+  // Read the socket in large blocks rather than neon's default of 4 KB
+  SetNeonReadBufferSize(Session, Data->GetReadBuf());
+
   ne_set_session_private(Session, SESSION_FS_KEY, this);
 }
 
@@ -951,6 +954,11 @@ void TWebDAVFileSystem::ReadDirectory(TRemoteFileList *AFileList)
   CheckStatus(NeonStatus);
 }
 
+void TWebDAVFileSystem::ReadDirectories(TList * /*AFileLists*/)
+{
+  // noop, neon session serves one request at a time
+}
+
 void TWebDAVFileSystem::ReadSymlink(TRemoteFile * /*SymlinkFile*/,
   TRemoteFile *& /*AFile*/)
 {
@@ -68,6 +68,7 @@ public:
   virtual void LookupUsersGroups() override;
   virtual void ReadCurrentDirectory() override;
   virtual void ReadDirectory(TRemoteFileList *AFileList) override;
+  virtual void ReadDirectories(TList *AFileLists) override;
   virtual void ReadFile(UnicodeString AFileName,
     TRemoteFile *&AFile) override;
   virtual void ReadSymlink(TRemoteFile *SymlinkFile,
@@ -20,6 +20,7 @@ CCriticalSectionWrapper CAsyncSslSocketLayer::m_sCriticalSection;
 CAsyncSslSocketLayer::t_SslLayerList* CAsyncSslSocketLayer::m_pSslLayerList = 0;
 int CAsyncSslSocketLayer::m_nSslRefCount = 0;
 rde::map<SSL_CTX *, int> CAsyncSslSocketLayer::m_contextRefCount;
+rde::map<CString, SSL_SESSION *> CAsyncSslSocketLayer::m_sessionCache;
 
 CAsyncSslSocketLayer::CAsyncSslSocketLayer()
 {
@@ -749,6 +750,7 @@ int CAsyncSslSocketLayer::InitSSLConnection(bool clientMode,
   //Init SSL connection
   m_Main = main;
   m_sessionreuse = sessionreuse;
+  m_sessionCacheId = GetSessionCacheId(minTlsVersion, maxTlsVersion);
   if ((m_Main != NULL) && m_sessionreuse)
   {
     if (m_Main->m_sessionid != NULL)
@@ -766,6 +768,22 @@ int CAsyncSslSocketLayer::InitSSLConnection(bool clientMode,
       SSL_set_session(m_ssl, NULL);
     }
   }
+  else if ((m_Main == NULL) && m_sessionreuse && !m_sessionCacheId.IsEmpty())
+  {
+    m_sCriticalSection.Lock();
+    rde::map<CString, SSL_SESSION *>::iterator iter = m_sessionCache.find(m_sessionCacheId);
+    bool cached = (iter != m_sessionCache.end());
+    // SSL_set_session takes its own reference
+    if (cached && SSL_set_session(m_ssl, iter->second))
+    {
+      LogSocketMessageRaw(FZ_LOG_INFO, L"Trying reuse TLS session ID of another connection to the server");
+    }
+    else
+    {
+      SSL_set_session(m_ssl, NULL);
+    }
+    m_sCriticalSection.Unlock();
+  }
   else
   {
     SSL_set_session(m_ssl, NULL);
@@ -1072,6 +1090,12 @@ void CAsyncSslSocketLayer::apps_ssl_info_callback(const SSL *s, int where, int r
           pLayer->LogSocketMessageRaw(FZ_LOG_INFO, L"Session ID changed");
         }
         pLayer->m_sessionid = sessionid;
+        // before the certificate is accepted, the session is cached
+        // from SetNotifyReply
+        if (pLayer->m_bSslEstablished)
+        {
+          pLayer->CacheSession(sessionid);
+        }
       }
       else
       {
@@ -1188,9 +1212,76 @@ void CAsyncSslSocketLayer::UnloadSSL()
     return;
   }
 
+  // last connection is gone, do not keep the sessions any longer
+  ClearSessionCache();
+
   m_sCriticalSection.Unlock();
 }
 
+CString CAsyncSslSocketLayer::GetSessionCacheId(int minTlsVersion, int maxTlsVersion) const
+{
+  CString Result;
+  if (!m_sessionCacheKey.IsEmpty())
+  {
+    // a session must not be resumed with a different client identity
+    // or under settings the full handshake would not have passed
+    CString ClientCert(L"-");
+    if (FCertificate != NULL)
+    {
+      unsigned char Hash[EVP_MAX_MD_SIZE];
+      unsigned int Length = 0;
+      if (X509_digest(FCertificate, EVP_sha1(), Hash, &Length))
+      {
+        ClientCert.Empty();
+        for (unsigned int i = 0; i < Length; i++)
+        {
+          CString Byte;
+          Byte.Format(L"%02x", Hash[i]);
+          ClientCert += Byte;
+        }
+      }
+    }
+    Result.Format(L"%s|%d-%d|%s|%s", (LPCTSTR)m_sessionCacheKey, minTlsVersion, maxTlsVersion,
+      (LPCTSTR)ClientCert, (LPCTSTR)m_CertStorage);
+  }
+  return Result;
+}
+
+void CAsyncSslSocketLayer::CacheSession(SSL_SESSION * sessionid)
+{
+  if ((m_Main != NULL) || m_sessionCacheId.IsEmpty())
+  {
+    return;
+  }
+
+  m_sCriticalSection.Lock();
+  rde::map<CString, SSL_SESSION *>::iterator iter = m_sessionCache.find(m_sessionCacheId);
+  if (iter != m_sessionCache.end())
+  {
+    if (iter->second != sessionid)
+    {
+      SSL_SESSION_free(iter->second);
+      iter->second = SSL_get1_session(m_ssl);
+    }
+  }
+  else
+  {
+    m_sessionCache[m_sessionCacheId] = SSL_get1_session(m_ssl);
+  }
+  m_sCriticalSection.Unlock();
+}
+
+void CAsyncSslSocketLayer::ClearSessionCache()
+{
+  rde::map<CString, SSL_SESSION *>::iterator iter = m_sessionCache.begin();
+  while (iter != m_sessionCache.end())
+  {
+    SSL_SESSION_free(iter->second);
+    ++iter;
+  }
+  m_sessionCache.clear();
+}
+
 bool AsnTimeToValidTime(ASN1_TIME * AsnTime, t_SslCertData::t_validTime & ValidTime)
 {
   int i = AsnTime->length;
@@ -1597,6 +1688,11 @@ void CAsyncSslSocketLayer::SetNotifyReply(int nID, int nCode, int result)
     return;
   }
   m_bSslEstablished = TRUE;
+  // only now, other connections may resume the session
+  if (m_sessionreuse && (m_sessionid != NULL))
+  {
+    CacheSession(m_sessionid);
+  }
   PrintSessionInfo();
   DoLayerCallback(LAYERCALLBACK_LAYERSPECIFIC, SSL_INFO, SSL_INFO_ESTABLISHED);
 
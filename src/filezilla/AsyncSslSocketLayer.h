@@ -159,6 +159,12 @@ public:
 
   void * GetContext() { return m_ssl_ctx; }
 
+  // Control connections with the same key resume each other's TLS session,
+  // so that parallel connections to one server skip the full handshake.
+  // The TLS version range, the client certificate and the trusted
+  // certificate store are added to the key when the connection starts.
+  void SetSessionCacheKey(const CString & key) { m_sessionCacheKey = key; }
+
 private:
   virtual void Close();
   virtual BOOL Connect(LPCTSTR lpszHostAddress, UINT nHostPort);
@@ -219,6 +225,14 @@ private:
   SSL_SESSION * m_sessionid;
   bool m_sessionreuse;
   CAsyncSslSocketLayer * m_Main;
+  CString m_sessionCacheKey;
+  // m_sessionCacheKey with the TLS settings of this connection
+  CString m_sessionCacheId;
+  static rde::map<CString, SSL_SESSION *> m_sessionCache;
+
+  CString GetSessionCacheId(int minTlsVersion, int maxTlsVersion) const;
+  void CacheSession(SSL_SESSION * sessionid);
+  static void ClearSessionCache();
 
   // Data channels for encrypted/unencrypted data
   BIO* m_nbio; // Network side, sends/receives encrypted data
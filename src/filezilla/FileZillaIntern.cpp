@@ -36,6 +36,11 @@ bool TFileZillaIntern::FZPostMessage(WPARAM wParam, LPARAM lParam) const
   return Result;
 }
 
+bool TFileZillaIntern::FZPostTransferStatus(int64_t TransferSize, int64_t Bytes, bool FileTransfer) const
+{
+  return FOwner->FZPostTransferStatus(TransferSize, Bytes, FileTransfer);
+}
+
 CString TFileZillaIntern::GetOption(int OptionID) const
 {
   return FOwner->Option(OptionID);
@@ -13,6 +13,7 @@ public:
   explicit TFileZillaIntern(TFileZillaIntf * AOwner);
 
   bool FZPostMessage(WPARAM wParam, LPARAM lParam) const;
+  bool FZPostTransferStatus(int64_t TransferSize, int64_t Bytes, bool FileTransfer) const;
   CString GetOption(int OptionID) const;
   int GetOptionVal(int OptionID) const;
 
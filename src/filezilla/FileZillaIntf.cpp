@@ -312,6 +312,11 @@ bool TFileZillaIntf::FZPostMessage(WPARAM wParam, LPARAM lParam)
   return DoPostMessage(Type, wParam, lParam);
 }
 
+bool TFileZillaIntf::FZPostTransferStatus(int64_t TransferSize, int64_t Bytes, bool FileTransfer)
+{
+  return DoPostTransferStatus(TransferSize, Bytes, FileTransfer);
+}
+
 void CopyContact(TFtpsCertificateData::TContact & Dest,
   const t_SslCertData::t_Contact& Source)
 {
@@ -212,6 +212,10 @@ public:
 protected:
   bool FZPostMessage(WPARAM wParam, LPARAM lParam);
   virtual bool DoPostMessage(TMessageType Type, WPARAM wParam, LPARAM lParam) = 0;
+  // Transfer status is posted by value, so that updates
+  // can be coalesced instead of queued one by one
+  bool FZPostTransferStatus(int64_t TransferSize, int64_t Bytes, bool FileTransfer);
+  virtual bool DoPostTransferStatus(int64_t TransferSize, int64_t Bytes, bool FileTransfer) = 0;
 
   virtual bool HandleStatus(const wchar_t * Status, int Type) = 0;
   virtual bool HandleAsynchRequestOverwrite(
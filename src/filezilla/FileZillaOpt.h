@@ -52,5 +52,7 @@
 #define OPTION_MPEXT_HOST 1009
 #define OPTION_MPEXT_NODELAY 1010
 #define OPTION_MPEXT_NOLIST 1011
+#define OPTION_MPEXT_PIPELINING 1012
+#define OPTION_MPEXT_BANDWIDTH_WEIGHT 1013
 
 #endif // FileZillaOptH
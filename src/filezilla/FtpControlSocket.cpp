@@ -31,6 +31,7 @@ public:
     bUseAbsolutePaths = FALSE;
     bTriedPortPasvOnce = FALSE;
     askOnResumeFail = false;
+    nPipelinedOpState = -1;
 #ifndef MPEXT_NO_ZLIB
     newZlibLevel = 0;
 #endif
@@ -64,6 +65,7 @@ public:
   int newZlibLevel;
 #endif
   bool askOnResumeFail;
+  int nPipelinedOpState; // state whose command was sent ahead, or -1
 };
 
 class CFtpControlSocket::CLogonData:public CFtpControlSocket::t_operation::COpData
@@ -153,13 +155,6 @@ public:
 /////////////////////////////////////////////////////////////////////////////
 // CFtpControlSocket
 
-rde::list<CFtpControlSocket::t_ActiveList> CFtpControlSocket::m_InstanceList[2];
-
-CTime CFtpControlSocket::m_CurrentTransferTime[2] = { CTime::GetCurrentTime(), CTime::GetCurrentTime() };
-_int64 CFtpControlSocket::m_CurrentTransferLimit[2] = {0, 0};
-
-CCriticalSection CFtpControlSocket::m_SpeedLimitSync;
-
 #define BUFSIZE 16384
 
 CFtpControlSocket::CFtpControlSocket(CMainThread *pMainThread, CFileZillaTools * pTools)
@@ -168,6 +163,9 @@ CFtpControlSocket::CFtpControlSocket(CMainThread *pMainThread, CFileZillaTools *
   m_pOwner=pMainThread;
   m_pTools=pTools;
 
+  m_BandwidthBucket[download].SetDirection(bdDownload);
+  m_BandwidthBucket[upload].SetDirection(bdUpload);
+
   m_Operation.nOpMode=0;
   m_Operation.nOpState=-1;
   m_Operation.pData=0;
@@ -204,9 +202,12 @@ CFtpControlSocket::CFtpControlSocket(CMainThread *pMainThread, CFileZillaTools *
   m_isFileZilla = false;
   m_awaitsReply = false;
   m_skipReply = false;
+  m_pipelinedReplies = 0;
+  m_skipReplies = 0;
 
   m_sendBuffer = 0;
   m_sendBufferLen = 0;
+  m_sendBufferPipelined = false;
 
   m_bProtP = false;
 
@@ -493,6 +494,13 @@ int CFtpControlSocket::InitConnectState()
   return CONNECT_INIT;
 }
 
+static CString GetSslSessionCacheKey(const t_server & server)
+{
+  CString Result;
+  Result.Format(L"%s@%s:%d", (LPCTSTR)server.user, (LPCTSTR)server.host, server.port);
+  return Result;
+}
+
 void CFtpControlSocket::Connect(t_server &server)
 {
   USES_CONVERSION;
@@ -535,6 +543,7 @@ void CFtpControlSocket::Connect(t_server &server)
       DoClose(FZ_REPLY_CRITICALERROR);
       return;
     }
+    m_pSslLayer->SetSessionCacheKey(GetSslSessionCacheKey(server));
     int res = m_pSslLayer->InitSSLConnection(true, NULL,
       GetOptionVal(OPTION_MPEXT_SSLSESSIONREUSE) != FALSE,
       GetOptionVal(OPTION_MPEXT_MIN_TLS_VERSION),
@@ -661,6 +670,7 @@ void CFtpControlSocket::LogOnToServer(BOOL bSkipReply /*=FALSE*/)
         DoClose(FZ_REPLY_CRITICALERROR);
         return;
       }
+      m_pSslLayer->SetSessionCacheKey(GetSslSessionCacheKey(m_CurrentServer));
       int res = m_pSslLayer->InitSSLConnection(true, NULL,
         GetOptionVal(OPTION_MPEXT_SSLSESSIONREUSE) != FALSE,
         GetOptionVal(OPTION_MPEXT_MIN_TLS_VERSION),
@@ -732,6 +742,7 @@ void CFtpControlSocket::LogOnToServer(BOOL bSkipReply /*=FALSE*/)
   }
   else if (m_Operation.nOpState == CONNECT_FEAT)
   {
+    m_serverCapabilities.SetCapability(feat_command, (GetReplyCode() == 2) ? yes : no);
     std::string facts;
     if (m_serverCapabilities.GetCapabilityString(mlsd_command, &facts) == yes)
     {
@@ -1378,9 +1389,17 @@ void CFtpControlSocket::ProcessReply()
 
   if (m_awaitsReply)
   {
-    if (m_sendBuffer)
-      TriggerEvent(FD_WRITE);
-    m_awaitsReply = false;
+    if (m_pipelinedReplies > 0)
+    {
+      // still waiting for the reply to the command sent ahead
+      m_pipelinedReplies--;
+    }
+    else
+    {
+      if (m_sendBuffer)
+        TriggerEvent(FD_WRITE);
+      m_awaitsReply = false;
+    }
   }
 
   CString reply = GetReply();
@@ -1395,6 +1414,14 @@ void CFtpControlSocket::ProcessReply()
     return;
   }
 
+  // Reply to a command sent ahead by an operation that has ended already
+  if (m_skipReplies > 0)
+  {
+    m_skipReplies--;
+    m_RecvBuffer.pop_front();
+    return;
+  }
+
   if (m_bKeepAliveActive)
   {
     m_bKeepAliveActive = FALSE;
@@ -1476,7 +1503,7 @@ void CFtpControlSocket::OnConnect(int nErrorCode)
   }
 }
 
-BOOL CFtpControlSocket::Send(CString str)
+BOOL CFtpControlSocket::Send(CString str, bool pipelined /*=false*/)
 {
   USES_CONVERSION;
 
@@ -1497,7 +1524,7 @@ BOOL CFtpControlSocket::Send(CString str)
     WideCharToMultiByte(CP_UTF8, 0, unicode, -1, utf8, len + 1, 0, 0);
 
     size_t sendLen = strlen(utf8);
-    if (!m_awaitsReply && !m_sendBuffer)
+    if ((!m_awaitsReply || pipelined) && !m_sendBuffer)
       res = CAsyncSocketEx::Send(utf8, (int)strlen(utf8));
     else
       res = -2;
@@ -1544,7 +1571,7 @@ BOOL CFtpControlSocket::Send(CString str)
     WideCharToMultiByte(m_nCodePage, 0, unicode, -1, utf8, len + 1, 0, 0);
 
     size_t sendLen = strlen(utf8);
-    if (!m_awaitsReply && !m_sendBuffer)
+    if ((!m_awaitsReply || pipelined) && !m_sendBuffer)
       res = CAsyncSocketEx::Send(utf8, (int)strlen(utf8));
     else
       res = -2;
@@ -1582,7 +1609,7 @@ BOOL CFtpControlSocket::Send(CString str)
     LPCSTR lpszAsciiSend = T2CA(str);
 
     size_t sendLen = strlen(lpszAsciiSend);
-    if (!m_awaitsReply && !m_sendBuffer)
+    if ((!m_awaitsReply || pipelined) && !m_sendBuffer)
       res = CAsyncSocketEx::Send(lpszAsciiSend, (int)strlen(lpszAsciiSend), 0, m_CurrentServer.iDupFF);
     else
       res = -2;
@@ -1613,6 +1640,14 @@ BOOL CFtpControlSocket::Send(CString str)
       }
     }
   }
+  if (pipelined)
+  {
+    // The reply to the previous command may take a while,
+    // do not keep the rest of this one until then
+    if (m_sendBuffer)
+      m_sendBufferPipelined = true;
+    m_pipelinedReplies++;
+  }
   if (res > 0)
   {
     m_awaitsReply = true;
@@ -1663,10 +1698,13 @@ void CFtpControlSocket::DoClose(int nError /*=0*/)
 
   m_awaitsReply = false;
   m_skipReply = false;
+  m_pipelinedReplies = 0;
+  m_skipReplies = 0;
 
   nb_free(m_sendBuffer);
   m_sendBuffer = 0;
   m_sendBufferLen = 0;
+  m_sendBufferPipelined = false;
 
   m_bProtP = false;
 
@@ -3947,6 +3985,13 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
   /////////////////
   //Send commands//
   /////////////////
+  if (pData->nPipelinedOpState == m_Operation.nOpState)
+  {
+    // the command was sent along with the previous one, just wait for its reply
+    pData->nPipelinedOpState = -1;
+    return;
+  }
+
   BOOL bError=FALSE;
   switch(m_Operation.nOpState)
   {
@@ -4195,6 +4240,16 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
 
       if (!Send(command))
         bError=TRUE;
+      // MDTM always follows SIZE, whatever the reply is
+      else if (UsePipelining() && !m_sendBuffer)
+      {
+        command = L"MDTM ";
+        command += pData->transferfile.remotepath.FormatFilename(pData->transferfile.remotefile, !pData->bUseAbsolutePaths);
+        if (!Send(command, true))
+          bError=TRUE;
+        else
+          pData->nPipelinedOpState = FILETRANSFER_NOLIST_MDTM;
+      }
     }
     break;
   case FILETRANSFER_NOLIST_MDTM:
@@ -4215,6 +4270,15 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
     else
       if (!Send(L"TYPE I"))
         bError=TRUE;
+    // Passive mode command follows TYPE, unless MODE Z needs to be changed
+    if (!bError && pData->bPasv && !NeedModeCommand() && !NeedOptsCommand() &&
+        UsePipelining() && !m_sendBuffer)
+    {
+      if (!Send((GetFamily() == AF_INET) ? L"PASV" : L"EPSV", true))
+        bError=TRUE;
+      else
+        pData->nPipelinedOpState = FILETRANSFER_PORTPASV;
+    }
     break;
   case FILETRANSFER_MODE:
 #ifdef MPEXT_NO_ZLIB
@@ -4672,6 +4736,14 @@ void CFtpControlSocket::ResetOperation(int nSuccessful /*=FALSE*/)
   if (nSuccessful & FZ_REPLY_CRITICALERROR)
     nSuccessful |= FZ_REPLY_ERROR;
 
+  // The reply to a command sent ahead is still to come
+  if (m_Operation.pData && (m_Operation.nOpMode & CSMODE_TRANSFER) &&
+      (static_cast<CFileTransferData *>(m_Operation.pData)->nPipelinedOpState != -1))
+  {
+    static_cast<CFileTransferData *>(m_Operation.pData)->nPipelinedOpState = -1;
+    m_skipReplies++;
+  }
+
   if (m_pTransferSocket)
     delete m_pTransferSocket;
   m_pTransferSocket=0;
@@ -5971,159 +6043,52 @@ _int64 CFtpControlSocket::GetSpeedLimit(enum transferDirection direction, CTime
   return ( _int64)1000000000000;
 }
 
-_int64 CFtpControlSocket::GetAbleToUDSize( bool & beenWaiting, CTime & curTime, _int64 & curLimit, rde::list<CFtpControlSocket::t_ActiveList>::iterator & iter, enum transferDirection direction, int nBufSize)
+_int64 CFtpControlSocket::GetAbleToTransferSize(enum transferDirection direction, bool &beenWaiting, int nBufSize)
 {
   beenWaiting = false;
 
-  CTime nowTime = CTime::GetCurrentTime();
-  _int64 ableToRead = BUFSIZE;
-
-  if ( nowTime == curTime)
-  {
-    ableToRead = iter->nBytesAvailable;
-
-    if (ableToRead <= 0)
-    {
-      //  we should wait till next second
-      nowTime = CTime::GetCurrentTime();
+  if (!nBufSize)
+    nBufSize = BUFSIZE;
 
-      while (nowTime == curTime && !iter->nBytesAvailable)
-      {
-        if (beenWaiting)
-        {
-          //Check if there are other commands in the command queue.
-          MSG msg;
-          if (PeekMessage(&msg, 0, m_pOwner->m_nInternalMessageID, m_pOwner->m_nInternalMessageID, PM_NOREMOVE))
-          {
-            LogMessage(FZ_LOG_INFO, L"Message waiting in queue, resuming later");
-            return 0;
-          }
-        }
-        m_SpeedLimitSync.Unlock();
-        Sleep(100);
-        m_SpeedLimitSync.Lock();
-        nowTime = CTime::GetCurrentTime();
-        beenWaiting = true;
-
-        // Since we didn't hold the critical section for some time, we have to renew the iterator
-        for (iter = m_InstanceList[direction].begin(); iter != m_InstanceList[direction].end(); iter++)
-          if (iter->pOwner == this)
-            break;
-        if (iter == m_InstanceList[direction].end())
-          return 0;
-      }
-    }
-    ableToRead = iter->nBytesAvailable;
-  }
+  TBandwidthBucket & bucket = m_BandwidthBucket[direction];
+  CTime time = CTime::GetCurrentTime();
+  _int64 limit = GetSpeedLimit(direction, time);
+  bucket.SetLimit((limit < MAXLONG) ? static_cast<intptr_t>(limit) : 0);
+  bucket.SetWeight(GetOptionVal(OPTION_MPEXT_BANDWIDTH_WEIGHT));
 
-  if (nowTime != curTime)
+  _int64 ableToRead = bucket.Available(nBufSize);
+  while (!ableToRead)
   {
-    if (ableToRead > 0)
-      ableToRead = 0;
-
-    curLimit = GetSpeedLimit(direction, curTime);
-    size_t sz = m_InstanceList[direction].size();
-    int64_t nMax = curLimit / (sz ? sz : 1);
-    _int64 nLeft = 0;
-    int nCount = 0;
-    rde::list<t_ActiveList>::iterator iter2;
-    for (iter2 = m_InstanceList[direction].begin(); iter2 != m_InstanceList[direction].end(); iter2++)
+    if (beenWaiting)
     {
-      if (iter2->nBytesAvailable>0)
+      //Check if there are other commands in the command queue.
+      MSG msg;
+      if (PeekMessage(&msg, 0, m_pOwner->m_nInternalMessageID, m_pOwner->m_nInternalMessageID, PM_NOREMOVE))
       {
-        nLeft += iter2->nBytesAvailable;
-        iter2->nBytesTransferred = 1;
-      }
-      else
-      {
-        nCount++;
-        iter2->nBytesTransferred = 0;
-      }
-      iter2->nBytesAvailable = nMax;
-    }
-    if (nLeft && nCount)
-    {
-      nMax = nLeft / nCount;
-      for (iter2 = m_InstanceList[direction].begin(); iter2 != m_InstanceList[direction].end(); iter2++)
-      {
-        if (!iter2->nBytesTransferred)
-          iter2->nBytesAvailable += nMax;
-        else
-          iter2->nBytesTransferred = 0;
+        LogMessage(FZ_LOG_INFO, L"Message waiting in queue, resuming later");
+        return 0;
       }
     }
-    ableToRead = iter->nBytesAvailable;
+    Sleep(static_cast<DWORD>(bucket.GetWaitTime()));
+    beenWaiting = true;
+    ableToRead = bucket.Available(nBufSize);
   }
 
-  curTime = nowTime;
-
-  if (!nBufSize)
-    nBufSize = BUFSIZE;
-  if (ableToRead > nBufSize)
-    ableToRead = nBufSize;
-
   return ableToRead;
 }
 
-_int64 CFtpControlSocket::GetAbleToTransferSize(enum transferDirection direction, bool &beenWaiting, int nBufSize)
-{
-  m_SpeedLimitSync.Lock();
-  rde::list<t_ActiveList>::iterator iter;
-  for (iter = m_InstanceList[direction].begin(); iter != m_InstanceList[direction].end(); iter++)
-    if (iter->pOwner == this)
-      break;
-  if (iter == m_InstanceList[direction].end())
-  {
-    t_ActiveList item;
-    CTime time = CTime::GetCurrentTime();
-    item.nBytesAvailable = GetSpeedLimit(direction, time) / (m_InstanceList[direction].size() + 1);
-    item.nBytesTransferred = 0;
-    item.pOwner = this;
-    m_InstanceList[direction].push_back(item);
-    iter = m_InstanceList[direction].end();
-    iter--;
-  }
-  _int64 limit = GetAbleToUDSize(beenWaiting, m_CurrentTransferTime[direction], m_CurrentTransferLimit[direction], iter, direction, nBufSize);
-  m_SpeedLimitSync.Unlock();
-  return limit;
-}
-
 BOOL CFtpControlSocket::RemoveActiveTransfer()
 {
-  BOOL bFound = FALSE;
-  m_SpeedLimitSync.Lock();
-  rde::list<t_ActiveList>::iterator iter;
+  // Next transfer starts with fresh buckets
   for (int i = 0; i < 2; i++)
-  {
-    for (iter = m_InstanceList[i].begin(); iter != m_InstanceList[i].end(); iter++)
-      if (iter->pOwner == this)
-      {
-        m_InstanceList[i].erase(iter);
-        bFound = TRUE;
-        break;
-      }
-  }
-  m_SpeedLimitSync.Unlock();
-  return bFound;
+    m_BandwidthBucket[i].SetLimit(0);
+  return TRUE;
 }
 
 BOOL CFtpControlSocket::SpeedLimitAddTransferredBytes(enum transferDirection direction, _int64 nBytesTransferred)
 {
-  m_SpeedLimitSync.Lock();
-  rde::list<t_ActiveList>::iterator iter;
-  for (iter = m_InstanceList[direction].begin(); iter != m_InstanceList[direction].end(); iter++)
-    if (iter->pOwner == this)
-    {
-      if (iter->nBytesAvailable > nBytesTransferred)
-        iter->nBytesAvailable -= nBytesTransferred;
-      else
-        iter->nBytesAvailable = 0;
-      iter->nBytesTransferred += nBytesTransferred;
-      m_SpeedLimitSync.Unlock();
-      return TRUE;
-    }
-  m_SpeedLimitSync.Unlock();
-  return FALSE;
+  m_BandwidthBucket[direction].Consume(static_cast<intptr_t>(nBytesTransferred));
+  return TRUE;
 }
 
 CString CFtpControlSocket::ConvertDomainName(CString domain)
@@ -6292,6 +6257,17 @@ bool CFtpControlSocket::NeedModeCommand()
 #endif
 }
 
+bool CFtpControlSocket::UsePipelining()
+{
+  // 0 = off (default), 1 = on, 2 = auto (servers that implement FEAT);
+  // FEAT support says nothing about how a server handles commands sent
+  // ahead, so auto is an opt-in for servers known to handle them
+  int pipelining = GetOptionVal(OPTION_MPEXT_PIPELINING);
+  return
+    (pipelining == 1) ||
+    ((pipelining == 2) && (m_serverCapabilities.GetCapability(feat_command) == yes));
+}
+
 bool CFtpControlSocket::NeedOptsCommand()
 {
 #ifndef MPEXT_NO_ZLIB
@@ -6381,7 +6357,7 @@ CString CFtpControlSocket::GetReply()
 
 void CFtpControlSocket::OnSend(int nErrorCode)
 {
-  if (!m_sendBufferLen || !m_sendBuffer || m_awaitsReply)
+  if (!m_sendBufferLen || !m_sendBuffer || (m_awaitsReply && !m_sendBufferPipelined))
     return;
 
   int res = CAsyncSocketEx::Send(m_sendBuffer, (int)m_sendBufferLen, 0, m_bUTF8 ? 0 : m_CurrentServer.iDupFF);
@@ -6408,6 +6384,7 @@ void CFtpControlSocket::OnSend(int nErrorCode)
     nb_free(m_sendBuffer);
     m_sendBuffer = 0;
     m_sendBufferLen = 0;
+    m_sendBufferPipelined = false;
   }
   else
   {
@@ -5,6 +5,7 @@
 #include "stdafx.h"
 #include "FileZillaApi.h"
 #include "FileZillaIntf.h"
+#include <BandwidthScheduler.h>
 
 class CTransferSocket;
 class CMainThread;
@@ -128,7 +129,8 @@ protected:
   int GetReplyCode();
   CString GetReply();
   void LogOnToServer(BOOL bSkipReply = FALSE);
-  BOOL Send(CString str);
+  BOOL Send(CString str, bool pipelined = false);
+  bool UsePipelining();
 
   BOOL ParsePwdReply(CString & rawpwd);
   BOOL ParsePwdReply(CString & rawpwd, CServerPath & realPath);
@@ -159,18 +161,9 @@ protected:
   CString ConvertDomainName(CString domain);
   bool ConnectTransferSocket(const CString & host, UINT port);
 
-  struct t_ActiveList
-  {
-  CUSTOM_MEM_ALLOCATION_IMPL
-    CFtpControlSocket * pOwner;
-    int64_t nBytesAvailable;
-    int64_t nBytesTransferred;
-  };
-  static rde::list<t_ActiveList> m_InstanceList[2];
-  static CTime m_CurrentTransferTime[2];
-  static _int64 m_CurrentTransferLimit[2];
-  static CCriticalSection m_SpeedLimitSync;
-  _int64 GetAbleToUDSize(bool & beenWaiting, CTime & curTime, _int64 & curLimit, rde::list<t_ActiveList>::iterator & iter, enum transferDirection direction, int nBufSize);
+  // Per-direction token buckets, sharing the global bandwidth cap
+  // with transfers of all other sessions
+  TBandwidthBucket m_BandwidthBucket[2];
   _int64 GetSpeedLimit(CTime & time, int valType, int valValue);
 
   void SetDirectoryListing(t_directory * pDirectory, bool bSetWorkingDir = true);
@@ -210,9 +203,15 @@ protected:
 
   bool m_awaitsReply;
   bool m_skipReply;
+  // Replies outstanding for commands sent without waiting
+  // for the reply to the previous command
+  int m_pipelinedReplies;
+  // Replies to skip, as the operation ended before consuming them
+  int m_skipReplies;
 
   char * m_sendBuffer;
   size_t m_sendBufferLen;
+  bool m_sendBufferPipelined;
 
   bool m_bProtP;
 
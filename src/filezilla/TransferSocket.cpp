@@ -159,11 +159,7 @@ void CTransferSocket::OnReceive(int nErrorCode)
 #endif
         m_pListResult->AddData(buffer, numread);
       m_transferdata.transfersize += numread;
-      t_ffam_transferstatus *status = new t_ffam_transferstatus();
-      status->bFileTransfer = FALSE;
-      status->transfersize = -1;
-      status->bytes = m_transferdata.transfersize;
-      GetIntern()->FZPostMessage(FZ_MSG_MAKEMSG(FZ_MSG_TRANSFERSTATUS, 0), (LPARAM)status);
+      GetIntern()->FZPostTransferStatus(-1, m_transferdata.transfersize, false);
     }
     else
       nb_free(buffer);
@@ -876,12 +872,9 @@ void CTransferSocket::UpdateStatusBar(bool forceUpdate)
   }
 
   //Update the statusbar
-  t_ffam_transferstatus *status=new t_ffam_transferstatus;
-  status->bFileTransfer = m_nMode & (CSMODE_DOWNLOAD | CSMODE_UPLOAD);
-  status->transfersize = m_transferdata.transfersize;
-  status->bytes=m_transferdata.transfersize-m_transferdata.transferleft;
-
-  GetIntern()->FZPostMessage(FZ_MSG_MAKEMSG(FZ_MSG_TRANSFERSTATUS, 0), (LPARAM)status);
+  GetIntern()->FZPostTransferStatus(m_transferdata.transfersize,
+    m_transferdata.transfersize-m_transferdata.transferleft,
+    (m_nMode & (CSMODE_DOWNLOAD | CSMODE_UPLOAD)) != 0);
 }
 
 BOOL CTransferSocket::Create(BOOL bUseSsl)
@@ -200,6 +200,7 @@ NB_CORE_DLL(void) nbcore_md5_hash(const uint8_t *data, size_t len, uint8_t diges
 ///////////////////////////////////////////////////////////////////////////////
 // memory functions
 
+// nbcore_alloc does not clear the memory, nbcore_calloc does
 NB_C_CORE_DLL(void *) nbcore_alloc(size_t);
 NB_C_CORE_DLL(void *) nbcore_calloc(size_t);
 NB_C_CORE_DLL(void *) nbcore_realloc(void *ptr, size_t);
@@ -11,20 +11,39 @@
 
 #include <dlmalloc/dlmalloc-2.8.6.h>
 
-#define nb_malloc(size) dlcalloc(1, size)
-#define nb_calloc(count, size) dlcalloc(count, size)
+#if defined(__cplusplus)
+extern "C" {
+#endif // if defined(__cplusplus)
+
+// Per-thread cache of small blocks in front of dlmalloc, see nbmemory.cpp.
+void *nb_cache_malloc(size_t size);
+void *nb_cache_calloc(size_t count, size_t size);
+void nb_cache_free(void *ptr);
+void nb_cache_release_thread(void);
+
+#if defined(__cplusplus)
+}
+#endif // if defined(__cplusplus)
+
+// nb_malloc clears the memory, as MFC/ATL operator new and PuTTY safemalloc,
+// which go through it, have always relied on that.
+// nb_malloc_uninit does not, use it only where every byte is written before being read.
+#define nb_malloc(size) nb_cache_calloc(1, size)
+#define nb_malloc_uninit(size) nb_cache_malloc(size)
+#define nb_calloc(count, size) nb_cache_calloc(count, size)
 #define nb_realloc(ptr, size) dlrealloc(ptr, size)
 
 #if defined(__cplusplus)
 template<typename T>
-void nb_free(const T *ptr) { dlfree(reinterpret_cast<void *>(const_cast<T *>(ptr))); }
+void nb_free(const T *ptr) { nb_cache_free(reinterpret_cast<void *>(const_cast<T *>(ptr))); }
 #else
-#define nb_free(ptr) dlfree((void *)(ptr))
+#define nb_free(ptr) nb_cache_free((void *)(ptr))
 #endif // if defined(__cplusplus)
 
 #else
 
 #define nb_malloc(size) ::malloc(size)
+#define nb_malloc_uninit(size) ::malloc(size)
 #define nb_calloc(count, size) ::calloc(count, size)
 #define nb_realloc(ptr, size) ::realloc(ptr, size)
 
@@ -2,6 +2,7 @@
 
 #include <mbstring.h>
 #include <wchar.h>
+#include <utility>
 
 #include <nbcore.h>
 
@@ -106,6 +107,7 @@ public:
   explicit CMSimpleStringT();
 
   CMSimpleStringT(const CMSimpleStringT &strSrc);
+  CMSimpleStringT(CMSimpleStringT &&strSrc);
   CMSimpleStringT(PCXSTR pszSrc);
   CMSimpleStringT(const XCHAR *pchSrc, int nLength);
   ~CMSimpleStringT();
@@ -117,6 +119,7 @@ public:
   }
 
   CMSimpleStringT &operator=(const CMSimpleStringT &strSrc);
+  CMSimpleStringT &operator=(CMSimpleStringT &&strSrc);
 
   __forceinline CMSimpleStringT &operator=(PCXSTR pszSrc)
   {
@@ -776,6 +779,8 @@ public:
 
   // Copy constructor
   CMStringT(const CMStringT &strSrc);
+  // Move constructor, takes over the buffer
+  CMStringT(CMStringT &&strSrc);
 
   CMStringT(const XCHAR *pszSrc);
   CMStringT(CMStringDataFormat, const XCHAR *pszFormat, ...);
@@ -795,6 +800,7 @@ public:
 
   // Assignment operators
   CMStringT &operator=(const CMStringT &strSrc);
+  CMStringT &operator=(CMStringT &&strSrc);
   CMStringT &operator=(PCXSTR pszSrc);
   CMStringT &operator=(PCYSTR pszSrc);
   CMStringT &operator=(const unsigned char *pszSrc);
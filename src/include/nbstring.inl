@@ -19,6 +19,25 @@ CMSimpleStringT<BaseType>::CMSimpleStringT(const CMSimpleStringT &strSrc) :
   Attach(pNewData);
 }
 
+template<typename BaseType>
+CMSimpleStringT<BaseType>::CMSimpleStringT(CMSimpleStringT &&strSrc) :
+  m_pszData(nullptr)
+{
+  CMStringData *pSrcData = strSrc.GetData();
+  if (!pSrcData->IsLocked())
+  {
+    // take over the buffer, the source is left empty
+    Attach(pSrcData);
+    strSrc.Attach(nbstr_getNil());
+  }
+  else
+  {
+    // locked buffer stays with its owner
+    Attach(nbstr_getNil());
+    SetString(strSrc.GetString(), strSrc.GetLength());
+  }
+}
+
 template<typename BaseType>
 CMSimpleStringT<BaseType>::CMSimpleStringT(PCXSTR pszSrc) :
   m_pszData(nullptr)
@@ -75,6 +94,28 @@ CMSimpleStringT<BaseType> &CMSimpleStringT<BaseType>::operator=(const CMSimpleSt
   return *this;
 }
 
+template<typename BaseType>
+CMSimpleStringT<BaseType> &CMSimpleStringT<BaseType>::operator=(CMSimpleStringT &&strSrc)
+{
+  CMStringData *pSrcData = strSrc.GetData();
+  CMStringData *pOldData = GetData();
+  if (pSrcData != pOldData)
+  {
+    if (pOldData->IsLocked() || pSrcData->IsLocked())
+    {
+      SetString(strSrc.GetString(), strSrc.GetLength());
+    }
+    else
+    {
+      // swap, the old buffer is released by the source
+      Attach(pSrcData);
+      strSrc.Attach(pOldData);
+    }
+  }
+
+  return *this;
+}
+
 template<typename BaseType>
 void CMSimpleStringT<BaseType>::Append(PCXSTR pszSrc)
 {
@@ -475,6 +516,12 @@ CMStringT<BaseType, StringTraits>::CMStringT(const CMStringT<BaseType, StringTra
 {
 }
 
+template< typename BaseType, class StringTraits >
+CMStringT<BaseType, StringTraits>::CMStringT(CMStringT<BaseType, StringTraits> &&strSrc) :
+  CThisSimpleString(std::move(strSrc))
+{
+}
+
 template< typename BaseType, class StringTraits >
 CMStringT<BaseType, StringTraits>::CMStringT(const XCHAR *pszSrc) :
   CThisSimpleString()
@@ -602,6 +649,13 @@ CMStringT<BaseType, StringTraits> &CMStringT<BaseType, StringTraits>::operator=(
   return *this;
 }
 
+template< typename BaseType, class StringTraits >
+CMStringT<BaseType, StringTraits> &CMStringT<BaseType, StringTraits>::operator=(CMStringT &&strSrc)
+{
+  CThisSimpleString::operator=(std::move(strSrc));
+  return *this;
+}
+
 template< typename BaseType, class StringTraits >
 CMStringT<BaseType, StringTraits> &CMStringT<BaseType, StringTraits>::operator=(PCXSTR pszSrc)
 {
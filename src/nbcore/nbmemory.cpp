@@ -1,5 +1,211 @@
 #include "stdafx.h"
 
+#ifdef USE_DLMALLOC
+
+/******************************************************************************/
+// Thread cache in front of dlmalloc, which serializes all calls on one lock.
+// Freed blocks are kept on per-thread lists by size class and reused
+// without locking. The class of a block is derived from its dlmalloc usable
+// size, so no header is needed and blocks can be freed by any thread.
+
+#define CACHE_SMALL_STEP    16
+#define CACHE_SMALL_CLASSES 8    // 16..128 by 16
+#define CACHE_SUB_CLASSES   4    // then 4 classes per power of two
+#define CACHE_CLASSES       52   // up to 256 KB
+#define CACHE_MAX_SIZE      (256 * 1024)
+#define CACHE_CLASS_BYTES   (128 * 1024)
+#define CACHE_BULK_FREE     32
+
+struct TCacheBlock
+{
+  TCacheBlock *Next;
+};
+
+struct TThreadCache
+{
+  TCacheBlock *Heads[CACHE_CLASSES];
+  uint32_t Counts[CACHE_CLASSES];
+};
+
+static volatile LONG CacheTlsIndex = static_cast<LONG>(TLS_OUT_OF_INDEXES);
+
+static size_t HighestBit(size_t value)
+{
+  size_t result = 0;
+  while (value >>= 1)
+    result++;
+  return result;
+}
+
+// smallest class that fits size
+static int CacheClassOf(size_t size)
+{
+  if (size <= CACHE_SMALL_STEP * CACHE_SMALL_CLASSES)
+    return (size == 0) ? 0 : static_cast<int>((size - 1) / CACHE_SMALL_STEP);
+  size_t bit = HighestBit(size - 1);
+  size_t sub = ((size - 1) >> (bit - 2)) & (CACHE_SUB_CLASSES - 1);
+  return static_cast<int>(CACHE_SMALL_CLASSES + (bit - 7) * CACHE_SUB_CLASSES + sub);
+}
+
+static size_t CacheClassSize(int cls)
+{
+  if (cls < CACHE_SMALL_CLASSES)
+    return (cls + 1) * CACHE_SMALL_STEP;
+  size_t bit = 7 + (cls - CACHE_SMALL_CLASSES) / CACHE_SUB_CLASSES;
+  size_t sub = (cls - CACHE_SMALL_CLASSES) % CACHE_SUB_CLASSES;
+  return (static_cast<size_t>(1) << bit) + (sub + 1) * (static_cast<size_t>(1) << (bit - 2));
+}
+
+static uint32_t CacheClassLimit(int cls)
+{
+  size_t limit = CACHE_CLASS_BYTES / CacheClassSize(cls);
+  return static_cast<uint32_t>(limit < 2 ? 2 : (limit > 128 ? 128 : limit));
+}
+
+static DWORD GetCacheTlsIndex()
+{
+  DWORD index = static_cast<DWORD>(CacheTlsIndex);
+  if (index == TLS_OUT_OF_INDEXES)
+  {
+    DWORD newIndex = ::TlsAlloc();
+    if (newIndex == TLS_OUT_OF_INDEXES)
+      return TLS_OUT_OF_INDEXES;
+    LONG prevIndex = InterlockedCompareExchange(&CacheTlsIndex,
+      static_cast<LONG>(newIndex), static_cast<LONG>(TLS_OUT_OF_INDEXES));
+    if (prevIndex != static_cast<LONG>(TLS_OUT_OF_INDEXES))
+    {
+      // another thread was faster
+      ::TlsFree(newIndex);
+      index = static_cast<DWORD>(prevIndex);
+    }
+    else
+      index = newIndex;
+  }
+  return index;
+}
+
+static TThreadCache *GetThreadCache(bool create)
+{
+  DWORD index = GetCacheTlsIndex();
+  if (index == TLS_OUT_OF_INDEXES)
+    return nullptr;
+  // TlsGetValue resets the last error, which callers may still need
+  DWORD lastError = ::GetLastError();
+  TThreadCache *cache = static_cast<TThreadCache *>(::TlsGetValue(index));
+  if ((cache == nullptr) && create)
+  {
+    cache = static_cast<TThreadCache *>(dlcalloc(1, sizeof(TThreadCache)));
+    if ((cache != nullptr) && !::TlsSetValue(index, cache))
+    {
+      dlfree(cache);
+      cache = nullptr;
+    }
+  }
+  ::SetLastError(lastError);
+  return cache;
+}
+
+static void FlushCacheClass(TThreadCache *cache, int cls, uint32_t keep)
+{
+  void *blocks[CACHE_BULK_FREE];
+  size_t count = 0;
+  while (cache->Counts[cls] > keep)
+  {
+    TCacheBlock *block = cache->Heads[cls];
+    cache->Heads[cls] = block->Next;
+    cache->Counts[cls]--;
+    blocks[count++] = block;
+    if (count == CACHE_BULK_FREE)
+    {
+      dlbulk_free(blocks, count);
+      count = 0;
+    }
+  }
+  if (count > 0)
+    dlbulk_free(blocks, count);
+}
+
+extern "C" void *nb_cache_malloc(size_t size)
+{
+  if (size > CACHE_MAX_SIZE)
+    return dlmalloc(size);
+
+  int cls = CacheClassOf(size);
+  TThreadCache *cache = GetThreadCache(true);
+  if ((cache != nullptr) && (cache->Heads[cls] != nullptr))
+  {
+    TCacheBlock *block = cache->Heads[cls];
+    cache->Heads[cls] = block->Next;
+    cache->Counts[cls]--;
+    return block;
+  }
+  // allocate whole class, so that the block can be reused for any size of it
+  return dlmalloc(CacheClassSize(cls));
+}
+
+extern "C" void *nb_cache_calloc(size_t count, size_t size)
+{
+  if ((size != 0) && (count > static_cast<size_t>(-1) / size))
+    return nullptr;
+  size_t total = count * size;
+  void *p = nb_cache_malloc(total);
+  if (p != nullptr)
+    memset(p, 0, total);
+  return p;
+}
+
+extern "C" void nb_cache_free(void *ptr)
+{
+  if (ptr == nullptr)
+    return;
+
+  size_t usable = dlmalloc_usable_size(ptr);
+  if ((usable < CACHE_SMALL_STEP) || (usable > CACHE_MAX_SIZE + CACHE_MAX_SIZE / 4))
+  {
+    dlfree(ptr);
+    return;
+  }
+  // largest class the block can serve
+  int cls = CacheClassOf(usable);
+  if (cls >= CACHE_CLASSES)
+    cls = CACHE_CLASSES - 1;
+  if (CacheClassSize(cls) > usable)
+    cls--;
+
+  TThreadCache *cache = GetThreadCache(true);
+  if (cache == nullptr)
+  {
+    dlfree(ptr);
+    return;
+  }
+  TCacheBlock *block = static_cast<TCacheBlock *>(ptr);
+  block->Next = cache->Heads[cls];
+  cache->Heads[cls] = block;
+  cache->Counts[cls]++;
+  uint32_t limit = CacheClassLimit(cls);
+  if (cache->Counts[cls] > limit)
+    FlushCacheClass(cache, cls, limit / 2);
+}
+
+// Called on thread detach, returns cached blocks of the thread to dlmalloc
+extern "C" void nb_cache_release_thread(void)
+{
+  TThreadCache *cache = GetThreadCache(false);
+  if (cache == nullptr)
+    return;
+  for (int cls = 0; cls < CACHE_CLASSES; cls++)
+    FlushCacheClass(cache, cls, 0);
+  ::TlsSetValue(GetCacheTlsIndex(), nullptr);
+  dlfree(cache);
+}
+
+#endif // ifdef USE_DLMALLOC
+
+/******************************************************************************/
+// Guard words around nbcore_alloc blocks, debug builds only
+
+#if defined(_DEBUG)
+
 #define BLOCK_ALLOCATED 0xABBABABA
 #define BLOCK_FREED   0xDEADBEEF
 
@@ -48,7 +254,7 @@ NB_C_CORE_DLL(void *) nbcore_alloc(size_t size)
   if (size == 0)
     return nullptr;
 
-  char *p = static_cast<char *>(nb_malloc(size + sizeof(uint32_t) * 3));
+  char *p = static_cast<char *>(nb_malloc_uninit(size + sizeof(uint32_t) * 3));
   if (p == nullptr)
   {
     OutputDebugStringA("memory overflow\n");
@@ -121,6 +327,34 @@ NB_C_CORE_DLL(void) nbcore_free(void *ptr)
   nb_free(p);
 }
 
+#else
+
+NB_C_CORE_DLL(void *) nbcore_alloc(size_t size)
+{
+  if (size == 0)
+    return nullptr;
+  return nb_malloc_uninit(size);
+}
+
+NB_C_CORE_DLL(void *) nbcore_calloc(size_t size)
+{
+  if (size == 0)
+    return nullptr;
+  return nb_calloc(1, size);
+}
+
+NB_C_CORE_DLL(void *) nbcore_realloc(void *ptr, size_t size)
+{
+  return nb_realloc(ptr, size);
+}
+
+NB_C_CORE_DLL(void) nbcore_free(void *ptr)
+{
+  nb_free(ptr);
+}
+
+#endif // if defined(_DEBUG)
+
 /******************************************************************************/
 
 NB_CORE_DLL(char *) nbcore_strdup(const char *str)
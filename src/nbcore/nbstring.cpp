@@ -39,6 +39,8 @@ NB_CORE_DLL(CMStringData *) nbstr_allocate(int nChars, int nCharSize)
   pData->nRefs = 1;
   pData->nAllocLength = nChars - 1;
   pData->nDataLength = 0;
+  // nbcore_alloc does not clear the memory
+  memset(pData->data(), 0, nCharSize);
   return pData;
 }
 
@@ -81,7 +83,9 @@ NB_CORE_DLL(void) nbstr_lock(CMStringData *pThis)
 
 NB_CORE_DLL(void) nbstr_release(CMStringData *pThis)
 {
-  if (InterlockedDecrement(&pThis->nRefs) <= 0)
+  // The only reference cannot be shared by another thread meanwhile,
+  // so no interlocked operation is needed to free it
+  if ((pThis->nRefs == 1) || (InterlockedDecrement(&pThis->nRefs) <= 0))
     nbstr_free(pThis);
 }
 
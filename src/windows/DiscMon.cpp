@@ -0,0 +1,376 @@
+#include <vcl.h>
+#pragma hdrstop
+
+#include <Common.h>
+#include <Exceptions.h>
+#include <RemoteFiles.h>
+#include "DiscMon.h"
+
+namespace Discmon {
+
+static const DWORD DiscMonitorBufferSize = 64 * 1024;
+
+TDiscMonitor::TDiscMonitor() :
+  FSubTree(false),
+  FDirectories(0),
+  FChangeDelay(500),
+  FDirectoryHandle(INVALID_HANDLE_VALUE),
+  FThread(nullptr),
+  FStopEvent(nullptr),
+  FBuffer(DiscMonitorBufferSize),
+  FPending(new TStringList()),
+  FSubdirsChanged(false)
+{
+  ClearStruct(FOverlapped);
+  FPending->SetCaseSensitive(false);
+  FPending->SetHashed(true);
+}
+
+TDiscMonitor::~TDiscMonitor()
+{
+  Close();
+  if (FThread != nullptr)
+  {
+    ::WaitForSingleObject(FThread, INFINITE);
+    SAFE_CLOSE_HANDLE(FThread);
+  }
+  else if ((FDirectoryHandle != INVALID_HANDLE_VALUE) && (FOverlapped.hEvent != nullptr))
+  {
+    // Open failed after the first request was issued,
+    // the buffer has to outlive the request
+    DWORD Bytes;
+    ::CancelIo(FDirectoryHandle);
+    ::GetOverlappedResult(FDirectoryHandle, &FOverlapped, &Bytes, TRUE);
+  }
+  if (FDirectoryHandle != INVALID_HANDLE_VALUE)
+  {
+    ::CloseHandle(FDirectoryHandle);
+  }
+  SAFE_CLOSE_HANDLE(FOverlapped.hEvent);
+  SAFE_CLOSE_HANDLE(FStopEvent);
+}
+
+void TDiscMonitor::AddDirectory(UnicodeString Directory, bool SubTree)
+{
+  DebugAssert(FDirectory.IsEmpty());
+  FDirectory = ::IncludeTrailingBackslash(Directory);
+  FSubTree = SubTree;
+  FDirectories = 1 + (FSubTree ? CountDirectories(FDirectory) : 0);
+}
+
+void TDiscMonitor::Open()
+{
+  DebugAssert(FThread == nullptr);
+  FDirectoryHandle = ::CreateFile(ApiPath(FDirectory).c_str(), FILE_LIST_DIRECTORY,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+    FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+  if (FDirectoryHandle == INVALID_HANDLE_VALUE)
+  {
+    ::RaiseLastOSError();
+  }
+  FStopEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  FOverlapped.hEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  if ((FStopEvent == nullptr) || (FOverlapped.hEvent == nullptr))
+  {
+    ::RaiseLastOSError();
+  }
+  // the first request has to be issued before returning,
+  // so that no change made after Open is missed
+  if (!ReadChanges())
+  {
+    ::RaiseLastOSError();
+  }
+  DWORD ThreadId;
+  FThread = ::CreateThread(nullptr, 0, &TDiscMonitor::MonitorThreadProc, this, 0, &ThreadId);
+  if (FThread == nullptr)
+  {
+    ::RaiseLastOSError();
+  }
+}
+
+void TDiscMonitor::Close()
+{
+  // Does not wait for the thread, as it can be called from an event
+  // that the thread waits for. The thread is waited for on destruction.
+  if (FStopEvent != nullptr)
+  {
+    ::SetEvent(FStopEvent);
+  }
+}
+
+bool TDiscMonitor::IsStopping() const
+{
+  return (::WaitForSingleObject(FStopEvent, 0) == WAIT_OBJECT_0);
+}
+
+DWORD WINAPI TDiscMonitor::MonitorThreadProc(void *Parameter)
+{
+  static_cast<TDiscMonitor *>(Parameter)->Execute();
+  return 0;
+}
+
+bool TDiscMonitor::ReadChanges()
+{
+  DWORD Filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE;
+  if (FSubTree)
+  {
+    Filter |= FILE_NOTIFY_CHANGE_DIR_NAME;
+  }
+  ::ResetEvent(FOverlapped.hEvent);
+  return
+    (::ReadDirectoryChangesW(FDirectoryHandle, &FBuffer[0], static_cast<DWORD>(FBuffer.size()),
+       FSubTree, Filter, nullptr, &FOverlapped, nullptr) != FALSE);
+}
+
+void TDiscMonitor::Execute()
+{
+  HANDLE Handles[] = { FStopEvent, FOverlapped.hEvent };
+  DWORD FirstChange = 0;
+  while (true)
+  {
+    DWORD Timeout = INFINITE;
+    if (FPending->GetCount() > 0)
+    {
+      DWORD Elapsed = ::GetTickCount() - FirstChange;
+      Timeout = (Elapsed < static_cast<DWORD>(FChangeDelay)) ? static_cast<DWORD>(FChangeDelay) - Elapsed : 0;
+    }
+
+    DWORD WaitResult = ::WaitForMultipleObjects(_countof(Handles), Handles, FALSE, Timeout);
+    if (WaitResult == WAIT_OBJECT_0)
+    {
+      break;
+    }
+    else if (WaitResult == WAIT_OBJECT_0 + 1)
+    {
+      DWORD Bytes = 0;
+      bool Reading =
+        (::GetOverlappedResult(FDirectoryHandle, &FOverlapped, &Bytes, FALSE) != FALSE) ||
+        (::GetLastError() == ERROR_NOTIFY_ENUM_DIR);
+      if (Reading)
+      {
+        if (FPending->GetCount() == 0)
+        {
+          FirstChange = ::GetTickCount();
+        }
+        CollectChanges(Bytes);
+        // issue the next request right away, changes made in the meantime
+        // are buffered by the system
+        Reading = ReadChanges();
+      }
+
+      if (!Reading)
+      {
+        // typically the watched directory was deleted
+        FInvalidError = LastSysErrorMessage();
+        Synchronize(nb::bind(&TDiscMonitor::DoInvalid, this));
+        break;
+      }
+    }
+    else if (WaitResult == WAIT_TIMEOUT)
+    {
+      ReportChanges();
+    }
+    else
+    {
+      FInvalidError = LastSysErrorMessage();
+      Synchronize(nb::bind(&TDiscMonitor::DoInvalid, this));
+      break;
+    }
+  }
+  ::CancelIo(FDirectoryHandle);
+}
+
+void TDiscMonitor::CollectChanges(DWORD Bytes)
+{
+  if (Bytes == 0)
+  {
+    // the system buffer overflowed, the changes are unknown
+    AddPendingTree(FDirectory);
+  }
+  else
+  {
+    const uint8_t *Data = &FBuffer[0];
+    while (true)
+    {
+      const FILE_NOTIFY_INFORMATION *Info = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(Data);
+      UnicodeString FileName(Info->FileName, Info->FileNameLength / sizeof(wchar_t));
+      bool Skip = false;
+      if (Info->Action == FILE_ACTION_MODIFIED)
+      {
+        // a change of a directory's contents is reported for the contents itself
+        DWORD Attrs = ::GetFileAttributes(ApiPath(FDirectory + FileName).c_str());
+        Skip = (Attrs != INVALID_FILE_ATTRIBUTES) && FLAGSET(Attrs, FILE_ATTRIBUTE_DIRECTORY);
+      }
+      if (!Skip)
+      {
+        // the change is synchronized by synchronizing the parent directory
+        AddPending(::IncludeTrailingBackslash(FDirectory + ::ExtractFilePath(FileName)));
+      }
+      if (Info->NextEntryOffset == 0)
+      {
+        break;
+      }
+      Data += Info->NextEntryOffset;
+    }
+  }
+}
+
+void TDiscMonitor::AddPending(UnicodeString Directory)
+{
+  if (FPending->IndexOf(Directory) < 0)
+  {
+    FPending->Add(Directory);
+  }
+}
+
+void TDiscMonitor::AddPendingTree(UnicodeString Directory)
+{
+  AddPending(Directory);
+  if (FSubTree)
+  {
+    TSearchRecChecked SearchRec;
+    bool Found = (::FindFirstChecked(Directory + L"*.*", faDirectory | faHidden | faSysFile | faReadOnly | faArchive, SearchRec) == 0);
+    SCOPE_EXIT
+    {
+      if (Found)
+      {
+        base::FindClose(SearchRec);
+      }
+    };
+    while (Found)
+    {
+      if (FLAGSET(SearchRec.Attr, faDirectory) &&
+          (SearchRec.Name != THISDIRECTORY) && (SearchRec.Name != PARENTDIRECTORY))
+      {
+        AddPendingTree(::IncludeTrailingBackslash(Directory + SearchRec.Name));
+      }
+      Found = (::FindNextChecked(SearchRec) == 0);
+    }
+  }
+}
+
+void TDiscMonitor::ReportChanges()
+{
+  // parents first, so that new subdirectories exist remotely,
+  // when their contents gets synchronized
+  FPending->Sort();
+  std::unique_ptr<TStringList> Pending(new TStringList());
+  Pending->Assign(FPending.get());
+  FPending->Clear();
+
+  bool SubdirsChanged = false;
+  for (intptr_t Index = 0; (Index < Pending->GetCount()) && !IsStopping(); Index++)
+  {
+    FChangedDirectory = Pending->GetString(Index);
+    FSubdirsChanged = false;
+    Synchronize(nb::bind(&TDiscMonitor::DoChange, this));
+    SubdirsChanged = SubdirsChanged || FSubdirsChanged;
+  }
+
+  if (SubdirsChanged && FSubTree && !IsStopping())
+  {
+    Synchronize(nb::bind(&TDiscMonitor::DoDirectoriesChange, this));
+  }
+}
+
+bool TDiscMonitor::AllowDirectory(UnicodeString Directory)
+{
+  // the directory is excluded if any directory on the path to it is
+  bool Result = true;
+  if (FOnFilter != nullptr)
+  {
+    UnicodeString Path = FDirectory;
+    UnicodeString Rest = Directory.SubString(FDirectory.Length() + 1, Directory.Length() - FDirectory.Length());
+    while (Result && !Rest.IsEmpty())
+    {
+      intptr_t P = Rest.Pos(L'\\');
+      UnicodeString Name = (P > 0) ? Rest.SubString(1, P - 1) : Rest;
+      Rest = (P > 0) ? Rest.SubString(P + 1, Rest.Length() - P) : UnicodeString();
+      Path += Name;
+      FOnFilter(this, Path, Result);
+      Path += L"\\";
+    }
+  }
+  return Result;
+}
+
+intptr_t TDiscMonitor::CountDirectories(UnicodeString Directory)
+{
+  intptr_t Result = 0;
+  TSearchRecChecked SearchRec;
+  bool Found = (::FindFirstChecked(Directory + L"*.*", faDirectory | faHidden | faSysFile | faReadOnly | faArchive, SearchRec) == 0);
+  SCOPE_EXIT
+  {
+    if (Found)
+    {
+      base::FindClose(SearchRec);
+    }
+  };
+  while (Found)
+  {
+    if (FLAGSET(SearchRec.Attr, faDirectory) &&
+        (SearchRec.Name != THISDIRECTORY) && (SearchRec.Name != PARENTDIRECTORY))
+    {
+      UnicodeString SubDirectory = Directory + SearchRec.Name;
+      bool Add = true;
+      if (FOnFilter != nullptr)
+      {
+        FOnFilter(this, SubDirectory, Add);
+      }
+      if (Add)
+      {
+        Result += 1 + CountDirectories(::IncludeTrailingBackslash(SubDirectory));
+      }
+    }
+    Found = (::FindNextChecked(SearchRec) == 0);
+  }
+  return Result;
+}
+
+void TDiscMonitor::Synchronize(TThreadMethod Method)
+{
+  if (FOnSynchronize != nullptr)
+  {
+    FOnSynchronize(this, Method);
+  }
+  else
+  {
+    Method();
+  }
+}
+
+void TDiscMonitor::DoChange()
+{
+  // filtered here, as OnFilter reads the options owned by the main thread
+  if (!IsStopping() && (FOnChange != nullptr) && AllowDirectory(FChangedDirectory))
+  {
+    FOnChange(this, ::ExcludeTrailingBackslash(FChangedDirectory), FSubdirsChanged);
+  }
+}
+
+void TDiscMonitor::DoInvalid()
+{
+  if (!IsStopping() && (FOnInvalid != nullptr))
+  {
+    FOnInvalid(this, ::ExcludeTrailingBackslash(FDirectory), FInvalidError);
+  }
+}
+
+void TDiscMonitor::DoDirectoriesChange()
+{
+  if (!IsStopping())
+  {
+    // counted here for the same reason as DoChange filters
+    intptr_t Directories = 1 + CountDirectories(FDirectory);
+    if (Directories != FDirectories)
+    {
+      FDirectories = Directories;
+      if (FOnDirectoriesChange != nullptr)
+      {
+        FOnDirectoriesChange(this, FDirectories);
+      }
+    }
+  }
+}
+
+} // namespace Discmon
@@ -0,0 +1,83 @@
+
+#pragma once
+
+#include <Classes.hpp>
+
+namespace Discmon {
+
+typedef nb::FastDelegate3<void,
+  TObject * /*Sender*/, UnicodeString /*Directory*/,
+  bool & /*SubdirsChanged*/> TDiscMonitorChangeEvent;
+typedef nb::FastDelegate3<void,
+  TObject * /*Sender*/, UnicodeString /*Directory*/,
+  UnicodeString /*ErrorStr*/> TDiscMonitorInvalidEvent;
+typedef nb::FastDelegate3<void,
+  TObject * /*Sender*/, UnicodeString /*DirectoryName*/,
+  bool & /*Add*/> TDiscMonitorFilterEvent;
+typedef nb::FastDelegate2<void,
+  TObject * /*Sender*/, intptr_t /*Directories*/> TDiscMonitorDirectoriesChangeEvent;
+typedef nb::FastDelegate2<void,
+  TObject * /*Sender*/, TThreadMethod /*Method*/> TDiscMonitorSynchronizeEvent;
+
+// Watches a local directory (tree) for changes on a worker thread.
+// Changes are collected for ChangeDelay milliseconds after the first one
+// and then reported once per changed directory, so that a burst of
+// changes results in a single synchronization of each affected directory.
+// The events are called via OnSynchronize, if set, to run on the main thread.
+// OnFilter is called only from within them, never on the worker thread.
+class TDiscMonitor : public TObject
+{
+  NB_DISABLE_COPY(TDiscMonitor)
+public:
+  TDiscMonitor();
+  virtual ~TDiscMonitor();
+
+  void AddDirectory(UnicodeString Directory, bool SubTree);
+  void Open();
+  void Close();
+
+  intptr_t GetDirectories() const { return FDirectories; }
+  void SetChangeDelay(intptr_t Value) { FChangeDelay = Value; }
+  void SetOnChange(TDiscMonitorChangeEvent Value) { FOnChange = Value; }
+  void SetOnInvalid(TDiscMonitorInvalidEvent Value) { FOnInvalid = Value; }
+  void SetOnFilter(TDiscMonitorFilterEvent Value) { FOnFilter = Value; }
+  void SetOnDirectoriesChange(TDiscMonitorDirectoriesChangeEvent Value) { FOnDirectoriesChange = Value; }
+  void SetOnSynchronize(TDiscMonitorSynchronizeEvent Value) { FOnSynchronize = Value; }
+
+private:
+  UnicodeString FDirectory;
+  bool FSubTree;
+  intptr_t FDirectories;
+  intptr_t FChangeDelay;
+  HANDLE FDirectoryHandle;
+  HANDLE FThread;
+  HANDLE FStopEvent;
+  OVERLAPPED FOverlapped;
+  rde::vector<uint8_t> FBuffer;
+  std::unique_ptr<TStringList> FPending;
+  UnicodeString FChangedDirectory;
+  bool FSubdirsChanged;
+  UnicodeString FInvalidError;
+  TDiscMonitorChangeEvent FOnChange;
+  TDiscMonitorInvalidEvent FOnInvalid;
+  TDiscMonitorFilterEvent FOnFilter;
+  TDiscMonitorDirectoriesChangeEvent FOnDirectoriesChange;
+  TDiscMonitorSynchronizeEvent FOnSynchronize;
+
+  static DWORD WINAPI MonitorThreadProc(void *Parameter);
+  void Execute();
+  bool ReadChanges();
+  void CollectChanges(DWORD Bytes);
+  void AddPending(UnicodeString Directory);
+  void AddPendingTree(UnicodeString Directory);
+  void ReportChanges();
+  bool IsStopping() const;
+  bool AllowDirectory(UnicodeString Directory);
+  intptr_t CountDirectories(UnicodeString Directory);
+  void Synchronize(TThreadMethod Method);
+  void DoChange();
+  void DoInvalid();
+  void DoDirectoriesChange();
+};
+
+} // namespace Discmon
@@ -4,7 +4,7 @@
 #include <Common.h>
 #include <RemoteFiles.h>
 #include <Terminal.h>
-//#include <DiscMon.hpp>
+#include "DiscMon.h"
 #include <Exceptions.h>
 #include "GUIConfiguration.h"
 #include "TextsCore.h"
@@ -35,7 +35,7 @@ TSynchronizeController::~TSynchronizeController()
 void TSynchronizeController::StartStop(TObject * /*Sender*/,
   bool Start, const TSynchronizeParamType &Params, const TCopyParamType &CopyParam,
   TSynchronizeOptions *Options,
-  TSynchronizeAbortEvent OnAbort, TSynchronizeThreadsEvent /*OnSynchronizeThreads*/,
+  TSynchronizeAbortEvent OnAbort, TSynchronizeThreadsEvent OnSynchronizeThreads,
   TSynchronizeLogEvent OnSynchronizeLog)
 {
   if (Start)
@@ -67,45 +67,32 @@ void TSynchronizeController::StartStop(TObject * /*Sender*/,
         SynchronizeLog(slScan,
           FMTLOAD(SYNCHRONIZE_SCAN, FSynchronizeParams.LocalDirectory));
       }
-      ThrowNotImplemented(256);
-      /*
-      // FIXME
-      FSynchronizeMonitor = new TDiscMonitor(dyn_cast<TComponent>(Sender));
-      FSynchronizeMonitor->SubTree = false;
-      TMonitorFilters Filters;
-      Filters << moFilename << moLastWrite;
-      if (FLAGSET(FSynchronizeParams.Options, soRecurse))
-      {
-        Filters << moDirName;
-      }
-      FSynchronizeMonitor->Filters = Filters;
-      FSynchronizeMonitor->MaxDirectories = 0;
-      FSynchronizeMonitor->ChangeDelay = GetGUIConfiguration()->GetKeepUpToDateChangeDelay();
-      FSynchronizeMonitor->OnTooManyDirectories = SynchronizeTooManyDirectories;
-      FSynchronizeMonitor->OnDirectoriesChange = SynchronizeDirectoriesChange;
-      FSynchronizeMonitor->OnFilter = SynchronizeFilter;
+      // The whole tree is watched with a single request, so there is
+      // no limit on number of directories (and no OnTooManyDirectories)
+      FSynchronizeMonitor = new Discmon::TDiscMonitor();
+      FSynchronizeMonitor->SetChangeDelay(GetGUIConfiguration()->GetKeepUpToDateChangeDelay());
+      FSynchronizeMonitor->SetOnDirectoriesChange(nb::bind(&TSynchronizeController::SynchronizeDirectoriesChange, this));
+      FSynchronizeMonitor->SetOnFilter(nb::bind(&TSynchronizeController::SynchronizeFilter, this));
       FSynchronizeMonitor->AddDirectory(FSynchronizeParams.LocalDirectory,
         FLAGSET(FSynchronizeParams.Options, soRecurse));
-      FSynchronizeMonitor->OnChange = SynchronizeChange;
-      FSynchronizeMonitor->OnInvalid = SynchronizeInvalid;
-      FSynchronizeMonitor->OnSynchronize = OnSynchronizeThreads;
+      FSynchronizeMonitor->SetOnChange(nb::bind(&TSynchronizeController::SynchronizeChange, this));
+      FSynchronizeMonitor->SetOnInvalid(nb::bind(&TSynchronizeController::SynchronizeInvalid, this));
+      FSynchronizeMonitor->SetOnSynchronize(OnSynchronizeThreads);
       // get count before open to avoid thread issues
-      int Directories = FSynchronizeMonitor->Directories->Count;
+      intptr_t Directories = FSynchronizeMonitor->GetDirectories();
       FSynchronizeMonitor->Open();
       SynchronizeLog(slStart, FMTLOAD(SYNCHRONIZE_START, Directories));
-      */
     }
     catch (...)
     {
-      // FIXME SAFE_DESTROY(FSynchronizeMonitor);
-      ThrowNotImplemented(257);
+      SAFE_DESTROY(FSynchronizeMonitor);
       throw;
     }
   }
   else
   {
     FOptions = nullptr;
-    // SAFE_DESTROY(FSynchronizeMonitor);
+    SAFE_DESTROY(FSynchronizeMonitor);
   }
 }
 
@@ -179,8 +166,7 @@ void TSynchronizeController::SynchronizeAbort(bool Close)
 {
   if (FSynchronizeMonitor != nullptr)
   {
-    // FIXME FSynchronizeMonitor->Close();
-    ThrowNotImplemented(258);
+    FSynchronizeMonitor->Close();
   }
   DebugAssert(FSynchronizeAbort);
   FSynchronizeAbort(nullptr, Close);
@@ -374,6 +374,7 @@ const int spNotByTime = 0x200;
 const int spBySize = 0x400;
 const int spSelectedOnly = 0x800;
 const int spMirror = 0x1000;
+const int spByChecksum = 0x2000;
 // forms\Synchronize.cpp
 const int soDoNotUsePresets =  0x01;
 const int soNoMinimize =       0x02;